@@ -36,6 +36,84 @@
 #define IPX_RECEIVE_BROADCAST 0x400f
 #define IPX_IMMEDIATESPXACK 0x4010
 
+/* IPXWrapper extension: priority of packets sent from the socket when send
+ * rate limiting is enabled. Defaults to IPX_PRIORITY_AUTO, which sends small
+ * packets at high priority and anything else at normal priority.
+*/
+#define IPX_PRIORITY 0x4100
+
+#define IPX_PRIORITY_AUTO   0
+#define IPX_PRIORITY_HIGH   1
+#define IPX_PRIORITY_NORMAL 2
+#define IPX_PRIORITY_BULK   3
+
+/* IPXWrapper extension: traffic counters of the socket, returned as an
+ * IPX_SOCKET_STATS_DATA structure. The counters start at zero when the socket
+ * is created and are never reset. Read only.
+*/
+#define IPX_SOCKET_STATS 0x4101
+
+/* IPXWrapper extension: traffic counters for each remote node the process has
+ * recently exchanged packets with, using any socket. Returns an array of
+ * IPX_PEER_STATS_DATA structures, most recently active first, with *optlen set
+ * to the size of the array. Fails with WSAEFAULT and sets *optlen to the size
+ * required if the buffer is too small to hold every entry; at most
+ * IPX_PEER_STATS_MAX entries are ever returned. Read only.
+ *
+ * Unless profiling is enabled, packets are only counted from the first time
+ * this option is read, so the first read returns no entries.
+*/
+#define IPX_PEER_STATS 0x4102
+
+#define IPX_PEER_STATS_MAX 256
+
+typedef struct _IPX_SOCKET_STATS_DATA {
+    /* Packets accepted by sendto(), including any held back by the send
+     * rate limits.
+    */
+    ULONGLONG send_packets;
+    ULONGLONG send_bytes;
+    
+    /* Packets which had to wait for the send rate limits. */
+    ULONGLONG send_deferred;
+    
+    /* Times sendto() found the rate limited send queue full and had to
+     * wait for space or fail with WSAEWOULDBLOCK.
+    */
+    ULONGLONG send_queue_full;
+    
+    /* Packets which sendto() failed to send or queue. */
+    ULONGLONG send_errors;
+    
+    /* Packets delivered to the socket. */
+    ULONGLONG recv_packets;
+    ULONGLONG recv_bytes;
+    
+    /* Times a packet arrived while the receive queue was full and had to
+     * wait in the underlying UDP socket's buffer instead.
+    */
+    ULONGLONG recv_queue_full;
+    
+    /* Packets addressed to the socket which were discarded. */
+    ULONGLONG recv_drops;
+} IPX_SOCKET_STATS_DATA, *PIPX_SOCKET_STATS_DATA;
+
+typedef struct _IPX_PEER_STATS_DATA {
+    UCHAR netnum[4];
+    UCHAR nodenum[6];
+    
+    ULONGLONG send_packets;
+    ULONGLONG send_bytes;
+    ULONGLONG recv_packets;
+    ULONGLONG recv_bytes;
+    
+    /* GetTickCount() when a packet was last sent to and received from the
+     * node, only meaningful when the matching packet counter is non-zero.
+    */
+    DWORD last_send;
+    DWORD last_recv;
+} IPX_PEER_STATS_DATA, *PIPX_PEER_STATS_DATA;
+
 typedef struct _IPX_ADDRESS_DATA {
     INT   adapternum;
     UCHAR netnum[4];
@@ -71,19 +71,16 @@ foreach my $line(<STUBS>)
 print CODE <<"END";
 extern _QueryPerformanceCounter\@4
 
+extern _min_log_level
 extern _find_sym
 extern _log_call
 extern _fprof_record_timed
 extern _fprof_record_untimed
 
+; Must match struct FuncStats in funcprof.h
 struc FuncStats
 	.func_name:   resd 1
-	.min_time:    resd 1
-	.max_time:    resd 1
-	.total_time:  resd 1
-	.n_calls:     resd 1
-
-	.cs:  resb 24
+	.shards:      resd 1
 endstruc
 END
 
@@ -153,12 +150,17 @@ foreach my $func(@stubs)
 		print CODE <<"END";
 			global _$func->{name}
 			_$func->{name}:
-				; Log the call
+				; Log the call, skipped unless tracing (LOG_CALL) is enabled
+				cmp dword [_min_log_level], 1
+				jg $func->{name}_nolog
+				
 				push dword $func->{target_dll_index}
 				push $func->{name}_target_func
 				push dword $dll_index
 				call _log_call
 				
+				$func->{name}_nolog:
+				
 				; Check if we have address cached
 				cmp dword [$func->{name}_addr], 0
 				jne $func->{name}_go
@@ -253,12 +255,17 @@ END
 		print CODE <<"END";
 			global _$func->{name}
 			_$func->{name}:
-				; Log the call
+				; Log the call, skipped unless tracing (LOG_CALL) is enabled
+				cmp dword [_min_log_level], 1
+				jg $func->{name}_nolog
+				
 				push dword $func->{target_dll_index}
 				push $func->{name}_target_func
 				push dword $dll_index
 				call _log_call
 				
+				$func->{name}_nolog:
+				
 				; Check if we have address cached
 				cmp dword [$func->{name}_addr], 0
 				jne $func->{name}_go
@@ -59,6 +59,9 @@ typedef struct host_table_key host_table_key_t;
 static host_table_t *host_table = NULL;
 static CRITICAL_SECTION host_table_cs;
 
+/* Lookups which found a current address and which didn't. */
+static uint64_t addr_cache_hits = 0, addr_cache_misses = 0;
+
 /* Lock the host table */
 static void host_table_lock(void)
 {
@@ -82,7 +85,7 @@ static host_table_t *host_table_find(addr32_t net, addr48_t node, uint16_t sock)
 	key.netnum  = net;
 	key.nodenum = node;
 	key.socket  = sock;
-
+	
 	host_table_t *host;
 	
 	HASH_FIND(hh, host_table, &key, sizeof(key), host);
@@ -142,14 +145,27 @@ int addr_cache_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48
 		*addrlen = host->addrlen;
 		
 		host_table_unlock();
+		
+		__atomic_add_fetch(&addr_cache_hits, 1, __ATOMIC_RELAXED);
 		return 1;
 	}
 	
 	
 	host_table_unlock();
+	
+	__atomic_add_fetch(&addr_cache_misses, 1, __ATOMIC_RELAXED);
 	return 0;
 }
 
+/* Get the number of addr_cache_get() calls which have found a cached address
+ * and which haven't.
+*/
+void addr_cache_stats(uint64_t *hits, uint64_t *misses)
+{
+	*hits   = __atomic_load_n(&addr_cache_hits,   __ATOMIC_RELAXED);
+	*misses = __atomic_load_n(&addr_cache_misses, __ATOMIC_RELAXED);
+}
+
 /* Update the address cache.
  *
  * The given address will be treated as the host's defaut (i.e router port) if
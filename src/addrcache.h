@@ -29,5 +29,6 @@ void addr_cache_cleanup(void);
 
 int addr_cache_get(SOCKADDR_STORAGE *addr, size_t *addrlen, addr32_t net, addr48_t node, uint16_t sock);
 void addr_cache_set(const struct sockaddr *addr, size_t addrlen, addr32_t net, addr48_t node, uint16_t sock);
+void addr_cache_stats(uint64_t *hits, uint64_t *misses);
 
 #endif /* !_ADDRCACHE_H */
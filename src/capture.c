@@ -0,0 +1,425 @@
+/* IPXWrapper - Packet capture
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "common.h"
+#include "ethernet.h"
+
+#define PCAPNG_SHB_TYPE 0x0A0D0D0A
+#define PCAPNG_IDB_TYPE 0x00000001
+#define PCAPNG_EPB_TYPE 0x00000006
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_EPB_FLAGS    2
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_TSRESOL   9
+
+#define LINKTYPE_ETHERNET 1
+
+/* Enhanced Packet Block header (28 bytes), epb_flags option (8 bytes),
+ * opt_endofopt (4 bytes) and trailing block length (4 bytes).
+*/
+#define EPB_HEADER_SIZE 28
+#define EPB_OVERHEAD    (EPB_HEADER_SIZE + 8 + 4 + 4)
+
+#define PAD32(x) (((x) + 3) & ~(size_t)(3))
+
+static CRITICAL_SECTION capture_lock;
+static bool capture_active = false;
+
+static HANDLE capture_file = INVALID_HANDLE_VALUE;
+
+/* Packets are appended to buffers[active_buffer] while the writer thread is
+ * writing out the other one.
+*/
+static unsigned char *buffers[2] = { NULL, NULL };
+static int active_buffer;
+static size_t buffer_used;
+
+static unsigned int dropped_packets;
+
+static HANDLE capture_wake_event = NULL;
+static HANDLE capture_thread = NULL;
+static bool capture_exit;
+
+/* Wall clock time (in microseconds since the UNIX epoch) and performance
+ * counter value when the capture was started, timestamps are calculated
+ * relative to these so that they have a better resolution than the system
+ * clock.
+*/
+static uint64_t base_time;
+static LARGE_INTEGER base_counter;
+static LARGE_INTEGER counter_freq;
+
+static void put16(unsigned char *buf, uint16_t value)
+{
+	memcpy(buf, &value, sizeof(value));
+}
+
+static void put32(unsigned char *buf, uint32_t value)
+{
+	memcpy(buf, &value, sizeof(value));
+}
+
+static uint64_t capture_timestamp(void)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	
+	uint64_t elapsed = now.QuadPart - base_counter.QuadPart;
+	
+	/* Split to avoid overflowing when multiplying large counter values. */
+	return base_time
+		+ ((elapsed / counter_freq.QuadPart) * 1000000)
+		+ (((elapsed % counter_freq.QuadPart) * 1000000) / counter_freq.QuadPart);
+}
+
+static bool capture_write(const void *data, size_t size)
+{
+	DWORD written;
+	if(!WriteFile(capture_file, data, size, &written, NULL) || written != size)
+	{
+		log_printf(LOG_ERROR, "Error writing to capture file: %s", w32_error(GetLastError()));
+		return false;
+	}
+	
+	return true;
+}
+
+/* Write the Section Header Block and Interface Description Block which must
+ * precede any packets.
+*/
+static bool capture_write_header(void)
+{
+	static const char userappl[] = "IPXWrapper";
+	
+	unsigned char shb[48];
+	memset(shb, 0, sizeof(shb));
+	
+	put32(shb +  0, PCAPNG_SHB_TYPE);
+	put32(shb +  4, sizeof(shb));
+	put32(shb +  8, PCAPNG_BYTE_ORDER_MAGIC);
+	put16(shb + 12, 1);  /* Major version */
+	put16(shb + 14, 0);  /* Minor version */
+	put32(shb + 16, 0xFFFFFFFF);  /* Section length (unspecified) */
+	put32(shb + 20, 0xFFFFFFFF);
+	put16(shb + 24, PCAPNG_OPT_SHB_USERAPPL);
+	put16(shb + 26, sizeof(userappl) - 1);
+	memcpy(shb + 28, userappl, sizeof(userappl) - 1);
+	put16(shb + 40, PCAPNG_OPT_ENDOFOPT);
+	put16(shb + 42, 0);
+	put32(shb + 44, sizeof(shb));
+	
+	unsigned char idb[32];
+	memset(idb, 0, sizeof(idb));
+	
+	put32(idb +  0, PCAPNG_IDB_TYPE);
+	put32(idb +  4, sizeof(idb));
+	put16(idb +  8, LINKTYPE_ETHERNET);
+	put16(idb + 10, 0);  /* Reserved */
+	put32(idb + 12, 0);  /* Snap length (unlimited) */
+	put16(idb + 16, PCAPNG_OPT_IF_TSRESOL);
+	put16(idb + 18, 1);
+	idb[20] = 6;         /* Microseconds */
+	put16(idb + 24, PCAPNG_OPT_ENDOFOPT);
+	put16(idb + 26, 0);
+	put32(idb + 28, sizeof(idb));
+	
+	return capture_write(shb, sizeof(shb)) && capture_write(idb, sizeof(idb));
+}
+
+static DWORD WINAPI capture_main(LPVOID lpParameter)
+{
+	bool write_ok = true;
+	
+	while(1)
+	{
+		bool exiting = __atomic_load_n(&capture_exit, __ATOMIC_RELAXED);
+		
+		/* Swap buffers, so packets can be captured while the full one
+		 * is written out.
+		*/
+		
+		EnterCriticalSection(&capture_lock);
+		
+		unsigned char *buffer = buffers[active_buffer];
+		size_t size = buffer_used;
+		
+		active_buffer = !active_buffer;
+		buffer_used = 0;
+		
+		unsigned int dropped = dropped_packets;
+		dropped_packets = 0;
+		
+		LeaveCriticalSection(&capture_lock);
+		
+		if(size > 0 && write_ok)
+		{
+			/* Stop writing after an error rather than logging one
+			 * for every batch.
+			*/
+			write_ok = capture_write(buffer, size);
+		}
+		
+		if(dropped > 0)
+		{
+			log_printf(LOG_WARNING, "Capture buffer full, %u packets were not captured", dropped);
+		}
+		
+		if(exiting)
+		{
+			break;
+		}
+		
+		WaitForSingleObject(capture_wake_event, CAPTURE_FLUSH_INTERVAL);
+	}
+	
+	return 0;
+}
+
+/* Start capturing packets to the given file, replacing it if it exists.
+ * Returns false if the capture couldn't be started.
+*/
+bool capture_init(const char *path)
+{
+	capture_file = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, NULL);
+	if(capture_file == INVALID_HANDLE_VALUE)
+	{
+		log_printf(LOG_ERROR, "Unable to open capture file %s: %s", path, w32_error(GetLastError()));
+		return false;
+	}
+	
+	if(!capture_write_header())
+	{
+		goto FAIL;
+	}
+	
+	buffers[0] = malloc(CAPTURE_BUFFER_SIZE);
+	buffers[1] = malloc(CAPTURE_BUFFER_SIZE);
+	
+	if(buffers[0] == NULL || buffers[1] == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to allocate capture buffers");
+		goto FAIL;
+	}
+	
+	active_buffer = 0;
+	buffer_used = 0;
+	dropped_packets = 0;
+	
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	
+	QueryPerformanceFrequency(&counter_freq);
+	QueryPerformanceCounter(&base_counter);
+	
+	/* FILETIME is in 100ns intervals since 1601. */
+	base_time = ((((uint64_t)(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) - 116444736000000000ULL) / 10;
+	
+	capture_wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if(capture_wake_event == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create event object: %s", w32_error(GetLastError()));
+		goto FAIL;
+	}
+	
+	InitializeCriticalSection(&capture_lock);
+	capture_exit = false;
+	
+	capture_thread = CreateThread(
+		NULL,          /* lpThreadAttributes */
+		0,             /* dwStackSize */
+		&capture_main, /* lpStartAddress */
+		NULL,          /* lpParameter */
+		0,             /* dwCreationFlags */
+		NULL);         /* lpThreadId */
+	
+	if(capture_thread == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create capture_main thread: %s", w32_error(GetLastError()));
+		
+		DeleteCriticalSection(&capture_lock);
+		goto FAIL;
+	}
+	
+	__atomic_store_n(&capture_active, true, __ATOMIC_RELEASE);
+	
+	log_printf(LOG_INFO, "Capturing packets to %s", path);
+	
+	return true;
+	
+	FAIL:
+	
+	if(capture_wake_event != NULL)
+	{
+		CloseHandle(capture_wake_event);
+		capture_wake_event = NULL;
+	}
+	
+	free(buffers[0]);
+	free(buffers[1]);
+	buffers[0] = buffers[1] = NULL;
+	
+	CloseHandle(capture_file);
+	capture_file = INVALID_HANDLE_VALUE;
+	
+	return false;
+}
+
+/* Stop capturing and write out any packets still in the buffer. */
+void capture_cleanup(void)
+{
+	if(capture_thread == NULL)
+	{
+		return;
+	}
+	
+	EnterCriticalSection(&capture_lock);
+	__atomic_store_n(&capture_active, false, __ATOMIC_RELAXED);
+	LeaveCriticalSection(&capture_lock);
+	
+	__atomic_store_n(&capture_exit, true, __ATOMIC_RELAXED);
+	SetEvent(capture_wake_event);
+	
+	/* Wait for it to exit, kill if it takes too long. */
+	
+	if(WaitForSingleObject(capture_thread, 3000) == WAIT_TIMEOUT)
+	{
+		log_printf(LOG_WARNING, "Capture thread didn't exit in 3 seconds, killing");
+		TerminateThread(capture_thread, 0);
+	}
+	
+	CloseHandle(capture_thread);
+	capture_thread = NULL;
+	
+	/* Write out anything captured since the thread's last batch. */
+	
+	if(buffer_used > 0)
+	{
+		capture_write(buffers[active_buffer], buffer_used);
+		buffer_used = 0;
+	}
+	
+	CloseHandle(capture_wake_event);
+	capture_wake_event = NULL;
+	
+	DeleteCriticalSection(&capture_lock);
+	
+	free(buffers[0]);
+	free(buffers[1]);
+	buffers[0] = buffers[1] = NULL;
+	
+	CloseHandle(capture_file);
+	capture_file = INVALID_HANDLE_VALUE;
+}
+
+/* Add a packet to the capture, if one is running. The packet is written out
+ * by the capture thread some time later.
+*/
+void capture_packet(
+	enum capture_direction direction,
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size)
+{
+	if(!__atomic_load_n(&capture_active, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+	
+	size_t frame_size = ethII_frame_size(data_size);
+	if(frame_size == 0)
+	{
+		return;
+	}
+	
+	size_t block_size = EPB_OVERHEAD + PAD32(frame_size);
+	uint64_t timestamp = capture_timestamp();
+	
+	bool wake = false;
+	
+	EnterCriticalSection(&capture_lock);
+	
+	if(!capture_active)
+	{
+		LeaveCriticalSection(&capture_lock);
+		return;
+	}
+	
+	if((buffer_used + block_size) > CAPTURE_BUFFER_SIZE)
+	{
+		++dropped_packets;
+		LeaveCriticalSection(&capture_lock);
+		
+		SetEvent(capture_wake_event);
+		return;
+	}
+	
+	unsigned char *block = buffers[active_buffer] + buffer_used;
+	
+	put32(block +  0, PCAPNG_EPB_TYPE);
+	put32(block +  4, block_size);
+	put32(block +  8, 0);  /* Interface ID */
+	put32(block + 12, (uint32_t)(timestamp >> 32));
+	put32(block + 16, (uint32_t)(timestamp));
+	put32(block + 20, frame_size);  /* Captured length */
+	put32(block + 24, frame_size);  /* Original length */
+	
+	ethII_frame_pack(block + EPB_HEADER_SIZE,
+		type,
+		src_net,  src_node,  src_socket,
+		dest_net, dest_node, dest_socket,
+		data, data_size);
+	
+	unsigned char *opts = block + EPB_HEADER_SIZE + PAD32(frame_size);
+	memset(opts - (PAD32(frame_size) - frame_size), 0, PAD32(frame_size) - frame_size);
+	
+	put16(opts +  0, PCAPNG_OPT_EPB_FLAGS);
+	put16(opts +  2, 4);
+	put32(opts +  4, direction);
+	put16(opts +  8, PCAPNG_OPT_ENDOFOPT);
+	put16(opts + 10, 0);
+	put32(opts + 12, block_size);
+	
+	/* Wake the writer early when the buffer passes the half way mark. */
+	if(buffer_used < (CAPTURE_BUFFER_SIZE / 2) && (buffer_used + block_size) >= (CAPTURE_BUFFER_SIZE / 2))
+	{
+		wake = true;
+	}
+	
+	buffer_used += block_size;
+	
+	LeaveCriticalSection(&capture_lock);
+	
+	if(wake)
+	{
+		SetEvent(capture_wake_event);
+	}
+}
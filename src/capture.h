@@ -0,0 +1,70 @@
+/* IPXWrapper - Packet capture
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_CAPTURE_H
+#define IPXWRAPPER_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "addr.h"
+
+/* Optional capture of every IPX packet sent by ipx_send_packet() and
+ * delivered to local sockets by deliver_packet(), enabled by the "capture
+ * file" option in ipxwrapper.ini.
+ *
+ * Packets are written in pcapng format as Ethernet II frames, the same way
+ * they would appear on the wire using the Ethernet II frame type, so captures
+ * can be opened directly in Wireshark regardless of which encapsulation is in
+ * use. Each packet is marked as inbound or outbound using the epb_flags
+ * option and timestamped to the microsecond using the performance counter.
+ *
+ * capture_packet() copies the packet into an in-memory buffer, which is
+ * written out to the file by a background thread every CAPTURE_FLUSH_INTERVAL
+ * milliseconds (or sooner, once it is half full). Packets which arrive while
+ * the buffer is full are dropped from the capture and counted in the log.
+ * Anything still in the buffer when the process exits without unloading the
+ * DLL (see DllMain()) is lost.
+*/
+
+#define CAPTURE_BUFFER_SIZE    (256 * 1024)
+#define CAPTURE_FLUSH_INTERVAL 100
+
+/* Values match the direction bits of the pcapng epb_flags option. */
+enum capture_direction
+{
+	CAPTURE_INBOUND  = 1,
+	CAPTURE_OUTBOUND = 2,
+};
+
+bool capture_init(const char *path);
+void capture_cleanup(void);
+
+void capture_packet(
+	enum capture_direction direction,
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size);
+
+#endif /* !IPXWRAPPER_CAPTURE_H */
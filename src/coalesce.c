@@ -26,6 +26,8 @@
 #include "ethernet.h"
 #include "interface.h"
 #include "ipxwrapper.h"
+#include "router.h"
+#include "sendrate.h"
 
 struct coalesce_table_key
 {
@@ -40,13 +42,34 @@ struct coalesce_dest
 {
 	UT_hash_handle hh;
 	
+	/* Links in coalesce_pending, or coalesce_free when unused. */
 	struct coalesce_dest *prev;
 	struct coalesce_dest *next;
 	
+	/* Links in coalesce_lru. */
+	struct coalesce_dest *lru_prev;
+	struct coalesce_dest *lru_next;
+	
 	coalesce_table_key dest;
 	bool active;
 	
-	uint64_t send_timestamps[IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT];
+	uint64_t last_send;
+	
+	send_rate_t send_rate;
+	
+	/* Address coalesced packets to this destination are sent to, either
+	 * the DOSBox server or the peer's address from the address cache.
+	*/
+	SOCKADDR_STORAGE send_addr;
+	int send_addrlen;
+	
+	/* Whether the peer at send_addr understands coalesced packets. When
+	 * using IPXWrapper UDP encapsulation this isn't known until the peer
+	 * replies to an IPX_MAGIC_COALESCE_QUERY packet, older versions will
+	 * never reply and so won't be sent coalesced packets.
+	*/
+	bool peer_capable;
+	uint64_t next_query_at;
 	
 	uint64_t payload_timestamp;
 	unsigned char payload[IPXWRAPPER_COALESCE_PACKET_MAX_SIZE];
@@ -66,37 +89,181 @@ static coalesce_dest *coalesce_table = NULL;
 */
 static coalesce_dest *coalesce_pending = NULL;
 
-coalesce_dest *get_coalesce_by_dest(addr32_t netnum, addr48_t nodenum, uint16_t socket)
+/* coalesce_dest structures are allocated from a single slab of
+ * main_config.coalesce_table_size structures, allocated the first time one is
+ * needed. Unused structures are kept in coalesce_free.
+ *
+ * coalesce_lru provides access to all coalesce_dest structures in the table
+ * ordered from least to most recently used. When the slab is exhausted, the
+ * least recently used destination which isn't coalescing or waiting to send
+ * is recycled.
+*/
+static coalesce_dest *coalesce_slab = NULL;
+static coalesce_dest *coalesce_free = NULL;
+static coalesce_dest *coalesce_lru  = NULL;
+
+/* Protects all of the above, along with the contents of every coalesce_dest.
+ * May be held while sending packets, but not while locking any sockets.
+*/
+static CRITICAL_SECTION coalesce_lock;
+
+static void _coalesce_timer_fired(ipx_timer *timer, uint64_t now);
+
+/* coalesce_timer is scheduled with the router to expire when the oldest
+ * pending payload is due to be sent. It may fire early if that payload was
+ * sent before the deadline.
+*/
+static ipx_timer coalesce_timer = IPX_TIMER_INIT(&_coalesce_timer_fired);
+
+static bool _coalesce_enabled(void)
+{
+	return (ipx_encap_type == ENCAP_TYPE_DOSBOX && main_config.dosbox_coalesce)
+		|| (ipx_encap_type == ENCAP_TYPE_IPXWRAPPER && main_config.udp_coalesce);
+}
+
+static coalesce_table_key _make_table_key(addr32_t netnum, addr48_t nodenum, uint16_t socket)
+{
+	coalesce_table_key dest;
+	
+	/* Clear any padding, the whole structure is hashed. */
+	memset(&dest, 0, sizeof(dest));
+	
+	dest.netnum  = netnum;
+	dest.nodenum = nodenum;
+	dest.socket  = socket;
+	
+	return dest;
+}
+
+static bool _sockaddr_equal(const struct sockaddr *a, int a_len, const struct sockaddr *b, int b_len)
+{
+	if(a->sa_family == AF_INET && b->sa_family == AF_INET)
+	{
+		const struct sockaddr_in *a_in = (const struct sockaddr_in*)(a);
+		const struct sockaddr_in *b_in = (const struct sockaddr_in*)(b);
+		
+		return a_in->sin_addr.s_addr == b_in->sin_addr.s_addr
+			&& a_in->sin_port == b_in->sin_port;
+	}
+	
+	return a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+/* Size of the header at the start of a coalesced packet, which is followed
+ * by the complete encapsulated packets.
+*/
+static size_t _coalesce_header_size(void)
+{
+	return ipx_encap_type == ENCAP_TYPE_DOSBOX
+		? sizeof(novell_ipx_packet)
+		: (sizeof(ipx_packet) - 1);
+}
+
+static bool _coalesce_slab_init(void)
+{
+	unsigned int size = main_config.coalesce_table_size;
+	
+	coalesce_slab = calloc(size, sizeof(coalesce_dest));
+	if(coalesce_slab == NULL)
+	{
+		log_printf(LOG_ERROR, "Cannot allocate memory for %u coalescing destinations", size);
+		return false;
+	}
+	
+	for(unsigned int i = 0; i < size; ++i)
+	{
+		LL_PREPEND(coalesce_free, &(coalesce_slab[i]));
+	}
+	
+	return true;
+}
+
+/* Remove the least recently used destination which can be safely forgotten
+ * from the table and return it, NULL if every destination is in use.
+*/
+static coalesce_dest *_coalesce_evict(uint64_t now)
+{
+	coalesce_dest *cd;
+	DL_FOREACH2(coalesce_lru, cd, lru_next)
+	{
+		/* Destinations which haven't been sent to for longer than
+		 * IPXWRAPPER_COALESCE_PACKET_STOP_THRESH would stop coalescing
+		 * on the next send anyway.
+		*/
+		
+		bool idle = !cd->active
+			|| (cd->last_send + IPXWRAPPER_COALESCE_PACKET_STOP_THRESH) < now;
+		
+		if(idle && cd->payload_used == 0)
+		{
+			HASH_DEL(coalesce_table, cd);
+			DL_DELETE2(coalesce_lru, cd, lru_prev, lru_next);
+			
+			__atomic_add_fetch(&coalesce_table_evictions, 1, __ATOMIC_RELAXED);
+			
+			return cd;
+		}
+	}
+	
+	return NULL;
+}
+
+coalesce_dest *get_coalesce_by_dest(addr32_t netnum, addr48_t nodenum, uint16_t socket, uint64_t now)
 {
 	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_get_coalesce_by_dest]));
 	
-	if(!main_config.dosbox_coalesce)
+	if(!_coalesce_enabled())
 	{
 		/* Skip coalescing if disabled. */
 		return NULL;
 	}
 	
-	coalesce_table_key dest = { netnum, nodenum, socket };
+	coalesce_table_key dest = _make_table_key(netnum, nodenum, socket);
 	
 	coalesce_dest *node;
 	HASH_FIND(hh, coalesce_table, &dest, sizeof(dest), node);
 	
-	if(node == NULL)
+	if(node != NULL)
 	{
+		__atomic_add_fetch(&coalesce_table_hits, 1, __ATOMIC_RELAXED);
+		
+		/* Move to the most recently used end of the LRU list. */
+		
+		if(node->lru_next != NULL)
+		{
+			DL_DELETE2(coalesce_lru, node, lru_prev, lru_next);
+			DL_APPEND2(coalesce_lru, node, lru_prev, lru_next);
+		}
+	}
+	else{
 		FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_get_coalesce_by_dest_new]));
 		
-		/* TODO: Limit maximum number of nodes, recycle old ones. */
+		__atomic_add_fetch(&coalesce_table_misses, 1, __ATOMIC_RELAXED);
 		
-		node = malloc(sizeof(coalesce_dest));
-		if(node == NULL)
+		if(coalesce_slab == NULL && !_coalesce_slab_init())
 		{
 			return NULL;
 		}
 		
+		if(coalesce_free != NULL)
+		{
+			node = coalesce_free;
+			LL_DELETE(coalesce_free, node);
+		}
+		else{
+			node = _coalesce_evict(now);
+			if(node == NULL)
+			{
+				/* Table is full of busy destinations. */
+				return NULL;
+			}
+		}
+		
 		memset(node, 0, sizeof(*node));
 		node->dest = dest;
 		
 		HASH_ADD(hh, coalesce_table, dest, sizeof(node->dest), node);
+		DL_APPEND2(coalesce_lru, node, lru_prev, lru_next);
 	}
 	
 	return node;
@@ -106,20 +273,7 @@ bool coalesce_register_send(coalesce_dest *node, uint64_t timestamp)
 {
 	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_coalesce_register_send]));
 	
-	memmove(node->send_timestamps, node->send_timestamps + 1, sizeof(node->send_timestamps) - sizeof(*(node->send_timestamps)));
-	node->send_timestamps[IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT - 1] = timestamp;
-	
-	if((node->send_timestamps[0] + IPXWRAPPER_COALESCE_PACKET_START_THRESH) >= timestamp)
-	{
-		return true;
-	}
-	else if(node->active && (node->send_timestamps[0] + IPXWRAPPER_COALESCE_PACKET_STOP_THRESH) < timestamp)
-	{
-		return false;
-	}
-	else{
-		return node->active;
-	}
+	return send_rate_register(&(node->send_rate), timestamp, node->active);
 }
 
 bool coalesce_add_data(coalesce_dest *cd, const void *data, int size, uint64_t now)
@@ -130,30 +284,53 @@ bool coalesce_add_data(coalesce_dest *cd, const void *data, int size, uint64_t n
 	{
 		FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_coalesce_add_data_init]));
 		
-		novell_ipx_packet header;
+		size_t header_size = _coalesce_header_size();
 		
-		header.checksum = 0xFFFF;
-		header.hops = 0;
-		header.type = IPX_MAGIC_COALESCED;
-		
-		addr32_out(header.dest_net, cd->dest.netnum);
-		addr48_out(header.dest_node, cd->dest.nodenum);
-		header.dest_socket = 0;
-		
-		addr32_out(header.src_net, dosbox_local_netnum);
-		addr48_out(header.src_node, dosbox_local_nodenum);
-		header.src_socket = 0;
-		
-		if((sizeof(header) + size) > IPXWRAPPER_COALESCE_PACKET_MAX_SIZE)
+		if((header_size + size) > IPXWRAPPER_COALESCE_PACKET_MAX_SIZE)
 		{
 			return false;
 		}
 		
+		if(ipx_encap_type == ENCAP_TYPE_DOSBOX)
+		{
+			novell_ipx_packet *header = (novell_ipx_packet*)(cd->payload);
+			
+			header->checksum = 0xFFFF;
+			header->hops = 0;
+			header->type = IPX_MAGIC_COALESCED;
+			
+			addr32_out(header->dest_net, cd->dest.netnum);
+			addr48_out(header->dest_node, cd->dest.nodenum);
+			header->dest_socket = 0;
+			
+			addr32_out(header->src_net, dosbox_local_netnum);
+			addr48_out(header->src_node, dosbox_local_nodenum);
+			header->src_socket = 0;
+		}
+		else{
+			/* Like other internal IPXWrapper traffic, the source
+			 * socket and destination address are zero so older
+			 * versions won't pass it on to applications.
+			*/
+			
+			ipx_packet *header = (ipx_packet*)(cd->payload);
+			memset(header, 0, header_size);
+			
+			header->ptype = IPX_MAGIC_COALESCED;
+		}
+		
+		cd->payload_used = header_size;
+		
 		cd->payload_timestamp = now;
 		DL_APPEND(coalesce_pending, cd);
 		
-		memcpy(cd->payload, &header, sizeof(header));
-		cd->payload_used = sizeof(header);
+		if(coalesce_pending == cd)
+		{
+			/* Nothing else was waiting, so the timer needs to be
+			 * (re)scheduled for this payload.
+			*/
+			router_timer_schedule(&coalesce_timer, (now + IPXWRAPPER_COALESCE_PACKET_MAX_DELAY));
+		}
 	}
 	
 	if((cd->payload_used + size) <= IPXWRAPPER_COALESCE_PACKET_MAX_SIZE)
@@ -174,14 +351,28 @@ void coalesce_flush(coalesce_dest *cd)
 	
 	assert(cd->payload_used > 0);
 	
-	novell_ipx_packet *header = (novell_ipx_packet*)(cd->payload);
-	header->length = htons(cd->payload_used);
+	if(ipx_encap_type == ENCAP_TYPE_DOSBOX)
+	{
+		novell_ipx_packet *header = (novell_ipx_packet*)(cd->payload);
+		header->length = htons(cd->payload_used);
+	}
+	else{
+		ipx_packet *header = (ipx_packet*)(cd->payload);
+		header->size = htons(cd->payload_used - _coalesce_header_size());
+	}
+	
+	LOG_PRINTF(LOG_DEBUG, "Sending coalesced packet (%d bytes)", cd->payload_used);
+	
+	/* Track the longest time any data waited to be sent. */
+	
+	unsigned int delay = get_uticks() - cd->payload_timestamp;
+	unsigned int max_delay = __atomic_load_n(&coalesce_max_delay, __ATOMIC_RELAXED);
 	
-	log_printf(LOG_DEBUG, "Sending coalesced packet (%d bytes)", cd->payload_used);
+	while(delay > max_delay && !__atomic_compare_exchange_n(&coalesce_max_delay, &max_delay, delay, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
 	
-	if(r_sendto(private_socket, (const void*)(cd->payload), cd->payload_used, 0, (struct sockaddr*)(&dosbox_server_addr), sizeof(dosbox_server_addr)) < 0)
+	if(r_sendto(private_socket, (const void*)(cd->payload), cd->payload_used, 0, (struct sockaddr*)(&(cd->send_addr)), cd->send_addrlen) < 0)
 	{
-		log_printf(LOG_ERROR, "Error sending DOSBox IPX packet: %s", w32_error(WSAGetLastError()));
+		log_printf(LOG_ERROR, "Error sending coalesced IPX packet: %s", w32_error(WSAGetLastError()));
 	}
 	else{
 		__atomic_add_fetch(&send_packets_udp, 1, __ATOMIC_RELAXED);
@@ -192,7 +383,40 @@ void coalesce_flush(coalesce_dest *cd)
 	DL_DELETE(coalesce_pending, cd);
 }
 
-DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr48_t dest_node, uint16_t dest_socket)
+static void _send_coalesce_magic(uint8_t ptype, const coalesce_query_t *query, const struct sockaddr *addr, int addrlen)
+{
+	unsigned char buf[sizeof(ipx_packet) - 1 + sizeof(coalesce_query_t)];
+	ipx_packet *packet = (ipx_packet*)(buf);
+	
+	memset(packet, 0, sizeof(buf));
+	
+	packet->ptype = ptype;
+	
+	packet->size = htons(sizeof(*query));
+	memcpy(packet->data, query, sizeof(*query));
+	
+	if(r_sendto(private_socket, (const void*)(buf), sizeof(buf), 0, addr, addrlen) < 0)
+	{
+		log_printf(LOG_ERROR, "Cannot send coalescing query packet: %s", w32_error(WSAGetLastError()));
+	}
+}
+
+/* Ask the peer at cd->send_addr whether it can receive coalesced packets. */
+static void _send_coalesce_query(coalesce_dest *cd)
+{
+	coalesce_query_t query;
+	memset(&query, 0, sizeof(query));
+	
+	addr32_out(query.net, cd->dest.netnum);
+	addr48_out(query.node, cd->dest.nodenum);
+	query.socket = cd->dest.socket;
+	
+	LOG_PRINTF(LOG_DEBUG, "Sending IPX_MAGIC_COALESCE_QUERY packet");
+	
+	_send_coalesce_magic(IPX_MAGIC_COALESCE_QUERY, &query, (struct sockaddr*)(&(cd->send_addr)), cd->send_addrlen);
+}
+
+DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr48_t dest_node, uint16_t dest_socket, const struct sockaddr *send_addr, int send_addrlen)
 {
 	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_coalesce_send]));
 	
@@ -204,12 +428,38 @@ DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr4
 	uint64_t now = get_uticks();
 	bool queued = false;
 	
-	coalesce_dest *cd = get_coalesce_by_dest(dest_net, dest_node, dest_socket);
+	EnterCriticalSection(&coalesce_lock);
+	
+	coalesce_dest *cd = get_coalesce_by_dest(dest_net, dest_node, dest_socket, now);
 	if(cd != NULL)
 	{
 		FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_coalesce_send_cd]));
 		
+		if(cd->send_addrlen == 0 || !_sockaddr_equal((struct sockaddr*)(&(cd->send_addr)), cd->send_addrlen, send_addr, send_addrlen))
+		{
+			/* First send to this destination, or it has moved to a
+			 * different address. Anything already waiting goes to
+			 * the old address.
+			*/
+			
+			if(cd->payload_used > 0)
+			{
+				coalesce_flush(cd);
+			}
+			
+			memcpy(&(cd->send_addr), send_addr, send_addrlen);
+			cd->send_addrlen = send_addrlen;
+			
+			/* The DOSBox server passes coalesced packets through, so we
+			 * have to assume whatever is on the other side can handle
+			 * them.
+			*/
+			cd->peer_capable  = (ipx_encap_type == ENCAP_TYPE_DOSBOX);
+			cd->next_query_at = now;
+		}
+		
 		bool should_coalesce = coalesce_register_send(cd, now);
+		cd->last_send = now;
 		
 		if(should_coalesce && !cd->active)
 		{
@@ -226,6 +476,18 @@ DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr4
 			cd->active = false;
 		}
 		
+		if(should_coalesce && !cd->peer_capable)
+		{
+			if(now >= cd->next_query_at)
+			{
+				_send_coalesce_query(cd);
+				cd->next_query_at = now + IPXWRAPPER_COALESCE_QUERY_INTERVAL;
+			}
+			
+			/* Can't coalesce until the peer says it understands. */
+			should_coalesce = false;
+		}
+		
 		if(
 			should_coalesce
 			&& (cd->payload_used + data_size) > IPXWRAPPER_COALESCE_PACKET_MAX_SIZE
@@ -245,14 +507,16 @@ DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr4
 		}
 	}
 	
+	LeaveCriticalSection(&coalesce_lock);
+	
 	if(!queued)
 	{
 		FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_coalesce_send_immediate]));
 		
-		if(r_sendto(private_socket, (const void*)(data), data_size, 0, (struct sockaddr*)(&dosbox_server_addr), sizeof(dosbox_server_addr)) < 0)
+		if(r_sendto(private_socket, (const void*)(data), data_size, 0, send_addr, send_addrlen) < 0)
 		{
 			DWORD error = WSAGetLastError();
-			log_printf(LOG_ERROR, "Error sending DOSBox IPX packet: %s", w32_error(error));
+			log_printf(LOG_ERROR, "Error sending IPX packet: %s", w32_error(error));
 			
 			return error;
 		}
@@ -265,6 +529,9 @@ DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr4
 	return ERROR_SUCCESS;
 }
 
+/* Send any payloads which have waited long enough. The caller must hold
+ * coalesce_lock.
+*/
 void coalesce_flush_waiting(void)
 {
 	uint64_t now = get_uticks();
@@ -274,20 +541,114 @@ void coalesce_flush_waiting(void)
 	{
 		coalesce_flush(coalesce_pending);
 	}
+	
+	if(coalesce_pending != NULL)
+	{
+		router_timer_schedule(&coalesce_timer, (coalesce_pending->payload_timestamp + IPXWRAPPER_COALESCE_PACKET_MAX_DELAY));
+	}
 }
 
-void coalesce_cleanup(void)
+/* Called by the router when an IPX_MAGIC_COALESCE_QUERY packet is received.
+ *
+ * Receiving coalesced packets is always supported, even if we aren't sending
+ * them, so the query is just echoed back.
+*/
+void coalesce_handle_query(const coalesce_query_t *query, const struct sockaddr *from, int fromlen)
 {
-	while(coalesce_pending != NULL)
+	_send_coalesce_magic(IPX_MAGIC_COALESCE_REPLY, query, from, fromlen);
+}
+
+/* Called by the router when a peer replies to an IPX_MAGIC_COALESCE_QUERY
+ * packet, coalescing can begin for the destination if it is still at the
+ * address which replied.
+*/
+void coalesce_handle_reply(const coalesce_query_t *reply, const struct sockaddr *from, int fromlen)
+{
+	addr32_t dest_net    = addr32_in(reply->net);
+	addr48_t dest_node   = addr48_in(reply->node);
+	uint16_t dest_socket = reply->socket;
+	
+	coalesce_table_key dest = _make_table_key(dest_net, dest_node, dest_socket);
+	
+	EnterCriticalSection(&coalesce_lock);
+	
+	coalesce_dest *cd;
+	HASH_FIND(hh, coalesce_table, &dest, sizeof(dest), cd);
+	
+	if(cd != NULL && !cd->peer_capable
+		&& cd->send_addrlen > 0 && _sockaddr_equal((struct sockaddr*)(&(cd->send_addr)), cd->send_addrlen, from, fromlen))
 	{
-		coalesce_flush(coalesce_pending);
+		IPX_STRING_ADDR(dest_addr, dest_net, dest_node, dest_socket);
+		log_printf(LOG_INFO, "%s supports packet coalescing", dest_addr);
+		
+		cd->peer_capable = true;
 	}
 	
-	while(coalesce_table != NULL)
+	LeaveCriticalSection(&coalesce_lock);
+}
+
+static void _coalesce_timer_fired(ipx_timer *timer, uint64_t now)
+{
+	EnterCriticalSection(&coalesce_lock);
+	coalesce_flush_waiting();
+	LeaveCriticalSection(&coalesce_lock);
+}
+
+/* Get the number of destinations in the table, how many of them are being
+ * coalesced and how many have data waiting to be sent.
+*/
+void coalesce_stats(unsigned int *n_dests, unsigned int *n_active, unsigned int *n_pending)
+{
+	*n_dests = 0;
+	*n_active = 0;
+	*n_pending = 0;
+	
+	EnterCriticalSection(&coalesce_lock);
+	
+	coalesce_dest *cd, *tmp;
+	HASH_ITER(hh, coalesce_table, cd, tmp)
 	{
-		coalesce_dest *cd = coalesce_table;
+		++(*n_dests);
 		
-		HASH_DEL(coalesce_table, cd);
-		free(cd);
+		if(cd->active)
+		{
+			++(*n_active);
+		}
 	}
+	
+	DL_FOREACH(coalesce_pending, cd)
+	{
+		++(*n_pending);
+	}
+	
+	LeaveCriticalSection(&coalesce_lock);
+}
+
+void coalesce_init(void)
+{
+	if(!InitializeCriticalSectionAndSpinCount(&coalesce_lock, 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		abort();
+	}
+}
+
+void coalesce_cleanup(void)
+{
+	router_timer_cancel(&coalesce_timer);
+	
+	while(coalesce_pending != NULL)
+	{
+		coalesce_flush(coalesce_pending);
+	}
+	
+	HASH_CLEAR(hh, coalesce_table);
+	
+	coalesce_free = NULL;
+	coalesce_lru  = NULL;
+	
+	free(coalesce_slab);
+	coalesce_slab = NULL;
+	
+	DeleteCriticalSection(&coalesce_lock);
 }
@@ -20,10 +20,13 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <winsock2.h>
 #include <windows.h>
 
 #include "addr.h"
 
+struct coalesce_query;
+
 /* For each destination IPX address, track the timestamp of the past n send
  * operations, we use this to determine how spammy the application is being
  * with sendto() calls.
@@ -52,8 +55,18 @@
 */
 #define IPXWRAPPER_COALESCE_PACKET_MAX_SIZE 1384
 
-DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr48_t dest_node, uint16_t dest_socket);
+/* When using IPXWrapper UDP encapsulation, ask a peer whether it can receive
+ * coalesced packets at most once every IPXWRAPPER_COALESCE_QUERY_INTERVAL
+ * microseconds while sending to it fast enough to coalesce.
+*/
+#define IPXWRAPPER_COALESCE_QUERY_INTERVAL 5000000 /* 5s */
+
+DWORD coalesce_send(const void *data, size_t data_size, addr32_t dest_net, addr48_t dest_node, uint16_t dest_socket, const struct sockaddr *send_addr, int send_addrlen);
+void coalesce_handle_query(const struct coalesce_query *query, const struct sockaddr *from, int fromlen);
+void coalesce_handle_reply(const struct coalesce_query *reply, const struct sockaddr *from, int fromlen);
 void coalesce_flush_waiting(void);
+void coalesce_stats(unsigned int *n_dests, unsigned int *n_active, unsigned int *n_pending);
+void coalesce_init(void);
 void coalesce_cleanup(void);
 
 #endif /* !IPXWRAPPER_COALESCE_H */
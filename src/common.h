@@ -31,7 +31,7 @@ extern "C" {
 #endif
 
 enum ipx_log_level {
-	LOG_CALL = 1,
+	LOG_CALL = 1,    /* Value is also used by mkstubs.pl */
 	LOG_DEBUG,
 	LOG_INFO = 4,
 	LOG_WARNING,
@@ -79,10 +79,29 @@ wchar_t *get_module_path(HMODULE module);
 wchar_t *get_module_relative_path(HMODULE module, const wchar_t *relative_path);
 
 void log_init();
+void log_start(bool drop_when_full);
 void log_open(const char *file);
 void log_close();
+void log_flush();
 void log_printf(enum ipx_log_level level, const char *fmt, ...);
 
+/* Returns true if messages of the given level will be written to the log.
+ * Check this before doing any work (e.g. formatting addresses) which is only
+ * needed for a log message.
+*/
+#define LOG_ENABLED(level) ((level) >= min_log_level)
+
+/* Calls log_printf() if the level is enabled, without evaluating any of the
+ * arguments otherwise. Used for high volume messages in hot paths.
+*/
+#define LOG_PRINTF(level, ...) \
+	do { \
+		if(LOG_ENABLED(level)) \
+		{ \
+			log_printf((level), __VA_ARGS__); \
+		} \
+	} while(0)
+
 #define RATELIMIT_COUNTS_SIZE 10
 
 struct ratelimit_data
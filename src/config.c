@@ -39,13 +39,30 @@ main_config_t get_main_config(bool ignore_ini)
 	config.log_level  = LOG_INFO;
 	config.profile    = false;
 	
+	config.log_queue_drop = false;
+	
+	config.capture_file = NULL;
+	
+	config.stats_export = false;
+	
 	config.dosbox_server_addr = NULL;
 	config.dosbox_server_port = 213;
 	config.dosbox_coalesce = false;
 	
+	config.udp_coalesce = false;
+	config.coalesce_table_size = 64;
+	
+	config.recv_queue_depth = RECV_QUEUE_DEFAULT_DEPTH;
+	
 	config.rate_limit_packets = 0;
 	config.rate_limit_bytes = 0;
 	
+	config.socket_rate_limit_packets = 0;
+	config.socket_rate_limit_bytes = 0;
+	
+	config.dest_rate_limit_packets = 0;
+	config.dest_rate_limit_bytes = 0;
+	
 	if(!ignore_ini)
 	{
 		wchar_t *ini_path = get_module_relative_path(NULL, L"ipxwrapper.ini");
@@ -99,13 +116,42 @@ main_config_t get_main_config(bool ignore_ini)
 	config.log_level  = reg_get_dword(reg, "log_level",  config.log_level);
 	config.profile    = reg_get_dword(reg, "profile",    config.profile);
 	
+	config.log_queue_drop = reg_get_dword(reg, "log_queue_drop", config.log_queue_drop);
+	
+	config.capture_file = reg_get_string(reg, "capture_file", "");
+	
+	config.stats_export = reg_get_dword(reg, "stats_export", config.stats_export);
+	
 	config.dosbox_server_addr = reg_get_string(reg, "dosbox_server_addr", "");
 	config.dosbox_server_port = reg_get_dword(reg, "dosbox_server_port", config.dosbox_server_port);
 	config.dosbox_coalesce    = reg_get_dword(reg, "dosbox_coalesce", config.dosbox_coalesce);
 	
+	config.udp_coalesce = reg_get_dword(reg, "udp_coalesce", config.udp_coalesce);
+	config.coalesce_table_size = reg_get_dword(reg, "coalesce_table_size", config.coalesce_table_size);
+	
+	if(config.coalesce_table_size < 1)
+	{
+		log_printf(LOG_WARNING, "Ignoring invalid coalesce_table_size %u", config.coalesce_table_size);
+		config.coalesce_table_size = 64;
+	}
+	
+	config.recv_queue_depth = reg_get_dword(reg, "recv_queue_depth", config.recv_queue_depth);
+	
+	if(config.recv_queue_depth < 1 || config.recv_queue_depth > RECV_QUEUE_MAX_DEPTH)
+	{
+		log_printf(LOG_WARNING, "Ignoring invalid recv_queue_depth %u", config.recv_queue_depth);
+		config.recv_queue_depth = RECV_QUEUE_DEFAULT_DEPTH;
+	}
+	
 	config.rate_limit_packets = reg_get_dword(reg, "rate_limit_packets", config.rate_limit_packets);
 	config.rate_limit_bytes = reg_get_dword(reg, "rate_limit_bytes", config.rate_limit_bytes);
 	
+	config.socket_rate_limit_packets = reg_get_dword(reg, "socket_rate_limit_packets", config.socket_rate_limit_packets);
+	config.socket_rate_limit_bytes = reg_get_dword(reg, "socket_rate_limit_bytes", config.socket_rate_limit_bytes);
+	
+	config.dest_rate_limit_packets = reg_get_dword(reg, "dest_rate_limit_packets", config.dest_rate_limit_packets);
+	config.dest_rate_limit_bytes = reg_get_dword(reg, "dest_rate_limit_bytes", config.dest_rate_limit_bytes);
+	
 	/* Check for valid frame_type */
 	
 	if(        config.frame_type != FRAME_TYPE_ETH_II
@@ -172,6 +218,44 @@ static int process_ini_directive(void *context, const char *section, const char
 			log_printf(LOG_ERROR, "Invalid \"coalesce packets\" (%s) specified in ipxwrapper.ini (expected \"yes\" or \"no\")", value);
 		}
 	}
+	else if(strcmp(name, "udp coalesce") == 0)
+	{
+		if(strcmp(value, "yes") == 0)
+		{
+			config->udp_coalesce = true;
+		}
+		else if(strcmp(value, "no") == 0)
+		{
+			config->udp_coalesce = false;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"udp coalesce\" (%s) specified in ipxwrapper.ini (expected \"yes\" or \"no\")", value);
+		}
+	}
+	else if(strcmp(name, "coalesce table size") == 0)
+	{
+		int coalesce_table_size = atoi(value);
+		
+		if(coalesce_table_size > 0)
+		{
+			config->coalesce_table_size = coalesce_table_size;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"coalesce table size\" (%s) specified in ipxwrapper.ini", value);
+		}
+	}
+	else if(strcmp(name, "receive queue depth") == 0)
+	{
+		int recv_queue_depth = atoi(value);
+		
+		if(recv_queue_depth > 0 && recv_queue_depth <= RECV_QUEUE_MAX_DEPTH)
+		{
+			config->recv_queue_depth = recv_queue_depth;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"receive queue depth\" (%s) specified in ipxwrapper.ini", value);
+		}
+	}
 	else if(strcmp(name, "firewall exception") == 0)
 	{
 		if(strcmp(value, "yes") == 0)
@@ -208,6 +292,39 @@ static int process_ini_directive(void *context, const char *section, const char
 			log_printf(LOG_ERROR, "Invalid \"logging\" (%s) specified in ipxwrapper.ini (expected \"none\", \"info\", \"debug\" or \"trace\")", value);
 		}
 	}
+	else if(strcmp(name, "log queue full") == 0)
+	{
+		if(strcmp(value, "wait") == 0)
+		{
+			config->log_queue_drop = false;
+		}
+		else if(strcmp(value, "drop") == 0)
+		{
+			config->log_queue_drop = true;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"log queue full\" (%s) specified in ipxwrapper.ini (expected \"wait\" or \"drop\")", value);
+		}
+	}
+	else if(strcmp(name, "capture file") == 0)
+	{
+		free(config->capture_file);
+		config->capture_file = strdup(value);
+	}
+	else if(strcmp(name, "stats export") == 0)
+	{
+		if(strcmp(value, "yes") == 0)
+		{
+			config->stats_export = true;
+		}
+		else if(strcmp(value, "no") == 0)
+		{
+			config->stats_export = false;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"stats export\" (%s) specified in ipxwrapper.ini (expected \"yes\" or \"no\")", value);
+		}
+	}
 	else if(strcmp(name, "send packet limit") == 0)
 	{
 		int rate_limit_packets = atoi(value);
@@ -232,6 +349,54 @@ static int process_ini_directive(void *context, const char *section, const char
 			log_printf(LOG_ERROR, "Invalid \"send byte limit\" (%s) specified in ipxwrapper.ini", value);
 		}
 	}
+	else if(strcmp(name, "socket packet limit") == 0)
+	{
+		int socket_rate_limit_packets = atoi(value);
+		
+		if(socket_rate_limit_packets > 0)
+		{
+			config->socket_rate_limit_packets = socket_rate_limit_packets;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"socket packet limit\" (%s) specified in ipxwrapper.ini", value);
+		}
+	}
+	else if(strcmp(name, "socket byte limit") == 0)
+	{
+		int socket_rate_limit_bytes = atoi(value);
+		
+		if(socket_rate_limit_bytes > 0)
+		{
+			config->socket_rate_limit_bytes = socket_rate_limit_bytes;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"socket byte limit\" (%s) specified in ipxwrapper.ini", value);
+		}
+	}
+	else if(strcmp(name, "destination packet limit") == 0)
+	{
+		int dest_rate_limit_packets = atoi(value);
+		
+		if(dest_rate_limit_packets > 0)
+		{
+			config->dest_rate_limit_packets = dest_rate_limit_packets;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"destination packet limit\" (%s) specified in ipxwrapper.ini", value);
+		}
+	}
+	else if(strcmp(name, "destination byte limit") == 0)
+	{
+		int dest_rate_limit_bytes = atoi(value);
+		
+		if(dest_rate_limit_bytes > 0)
+		{
+			config->dest_rate_limit_bytes = dest_rate_limit_bytes;
+		}
+		else{
+			log_printf(LOG_ERROR, "Invalid \"destination byte limit\" (%s) specified in ipxwrapper.ini", value);
+		}
+	}
 	else{
 		log_printf(LOG_ERROR, "Unknown directive \"%s\" in ipxwrapper.ini", name);
 	}
@@ -250,13 +415,26 @@ bool set_main_config(const main_config_t *config)
 		&& reg_set_dword(reg, "frame_type", config->frame_type)
 		&& reg_set_dword(reg, "log_level",  config->log_level)
 		&& reg_set_dword(reg, "profile",    config->profile)
+		&& reg_set_dword(reg, "log_queue_drop", config->log_queue_drop)
+		&& reg_set_string(reg, "capture_file", config->capture_file)
+		&& reg_set_dword(reg, "stats_export", config->stats_export)
 		
 		&& reg_set_string(reg, "dosbox_server_addr", config->dosbox_server_addr)
 		&& reg_set_dword(reg,  "dosbox_server_port", config->dosbox_server_port)
 		&& reg_set_dword(reg,  "dosbox_coalesce",    config->dosbox_coalesce)
 		
+		&& reg_set_dword(reg, "udp_coalesce", config->udp_coalesce)
+		&& reg_set_dword(reg, "coalesce_table_size", config->coalesce_table_size)
+		&& reg_set_dword(reg, "recv_queue_depth", config->recv_queue_depth)
+		
 		&& reg_set_dword(reg, "rate_limit_packets", config->rate_limit_packets)
-		&& reg_set_dword(reg, "rate_limit_bytes", config->rate_limit_bytes);
+		&& reg_set_dword(reg, "rate_limit_bytes", config->rate_limit_bytes)
+		
+		&& reg_set_dword(reg, "socket_rate_limit_packets", config->socket_rate_limit_packets)
+		&& reg_set_dword(reg, "socket_rate_limit_bytes", config->socket_rate_limit_bytes)
+		
+		&& reg_set_dword(reg, "dest_rate_limit_packets", config->dest_rate_limit_packets)
+		&& reg_set_dword(reg, "dest_rate_limit_bytes", config->dest_rate_limit_bytes);
 	
 	reg_close(reg);
 	
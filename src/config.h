@@ -20,6 +20,13 @@
 
 #define DEFAULT_PORT 54792
 
+/* Default and maximum number of packets which can be held in the receive
+ * queue of each IPX socket. The maximum is limited by the size of the free
+ * slot bitmap in ipx_recv_queue.
+*/
+#define RECV_QUEUE_DEFAULT_DEPTH 32
+#define RECV_QUEUE_MAX_DEPTH 1024
+
 #include "common.h"
 
 #ifdef __cplusplus
@@ -42,6 +49,7 @@ enum main_config_frame_type
 
 typedef struct main_config {
 	uint16_t udp_port;
+	bool udp_coalesce;
 	
 	bool w95_bug;
 	bool fw_except;
@@ -52,11 +60,33 @@ typedef struct main_config {
 	uint16_t dosbox_server_port;
 	bool dosbox_coalesce;
 	
+	unsigned int coalesce_table_size;
+	
+	unsigned int recv_queue_depth;
+	
 	enum ipx_log_level log_level;
 	bool profile;
 	
+	/* Drop log messages rather than waiting when the log queue is full. */
+	bool log_queue_drop;
+	
+	/* pcapng file to capture packets to, NULL or empty to disable. */
+	char *capture_file;
+	
+	/* Publish live statistics for ipxstat.exe, see statsmem.h. */
+	bool stats_export;
+	
+	/* Send rate limits shared by every socket, applied to each socket
+	 * and applied to each destination address. Zero for no limit.
+	*/
 	unsigned int rate_limit_packets;
 	unsigned int rate_limit_bytes;
+	
+	unsigned int socket_rate_limit_packets;
+	unsigned int socket_rate_limit_bytes;
+	
+	unsigned int dest_rate_limit_packets;
+	unsigned int dest_rate_limit_bytes;
 } main_config_t;
 
 struct v1_global_config {
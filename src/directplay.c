@@ -49,7 +49,7 @@ struct sp_data {
 */
 #define API_HEADER_SIZE 20
 
-#define CALL(func) log_printf(LOG_CALL, "directplay.c: " func);
+#define CALL(func) LOG_PRINTF(LOG_CALL, "directplay.c: " func);
 
 /* Lock the object mutex and return the data pointer */
 static struct sp_data *get_sp_data(IDirectPlaySP *sp) {
@@ -98,7 +98,7 @@ static void recv_packet(SOCKET *sockfd, char *buf, IDirectPlaySP *sp)
 		}
 		
 		log_printf(LOG_ERROR, "DirectPlay read error: %s", w32_error(WSAGetLastError()));
-		log_printf(LOG_DEBUG, "Closing socket %u", (unsigned int)(*sockfd));
+		LOG_PRINTF(LOG_DEBUG, "Closing socket %u", (unsigned int)(*sockfd));
 		
 		closesocket(*sockfd);
 		*sockfd = -1;
@@ -111,12 +111,15 @@ static void recv_packet(SOCKET *sockfd, char *buf, IDirectPlaySP *sp)
 	
 	/* Pass the message on to DirectPlay to be processed. */
 	
-	IPX_STRING_ADDR(str_addr, addr32_in(addr.sa_netnum), addr48_in(addr.sa_nodenum), addr.sa_socket);
-	log_printf(LOG_DEBUG, "About to HandleMessage from %s", str_addr);
+	if(LOG_ENABLED(LOG_DEBUG))
+	{
+		IPX_STRING_ADDR(str_addr, addr32_in(addr.sa_netnum), addr48_in(addr.sa_nodenum), addr.sa_socket);
+		log_printf(LOG_DEBUG, "About to HandleMessage from %s", str_addr);
+	}
 	
 	HRESULT r = IDirectPlaySP_HandleMessage(sp, buf, size, &addr);
 	
-	log_printf(LOG_DEBUG, "HandleMessage returned %x", (unsigned int)(r));
+	LOG_PRINTF(LOG_DEBUG, "HandleMessage returned %x", (unsigned int)(r));
 }
 
 static DWORD WINAPI worker_main(LPVOID sp) {
@@ -390,7 +393,7 @@ static HRESULT WINAPI IPX_Reply(LPDPSP_REPLYDATA data) {
 	
 	if(sp_data->ns_id != data->idNameServer)
 	{
-		log_printf(LOG_DEBUG, "IPX_Reply: Name server update (%u -> %u)",
+		LOG_PRINTF(LOG_DEBUG, "IPX_Reply: Name server update (%u -> %u)",
 			(unsigned int)(sp_data->ns_id), (unsigned int)(data->idNameServer));
 		
 		struct sockaddr_ipx *addr_p;
@@ -399,15 +402,15 @@ static HRESULT WINAPI IPX_Reply(LPDPSP_REPLYDATA data) {
 		HRESULT r = IDirectPlaySP_GetSPPlayerData(data->lpISP, data->idNameServer, (void**)&addr_p, &size, 0);
 		if(r != DP_OK)
 		{
-			log_printf(LOG_DEBUG, "IPX_Reply: GetSPPlayerData: %x", (unsigned int)(r));
+			LOG_PRINTF(LOG_DEBUG, "IPX_Reply: GetSPPlayerData: %x", (unsigned int)(r));
 		}
 		else if(addr_p == NULL)
 		{
-			log_printf(LOG_DEBUG, "IPX_Reply: Cannot update name server, no shared data");
+			LOG_PRINTF(LOG_DEBUG, "IPX_Reply: Cannot update name server, no shared data");
 		}
 		else if(size != sizeof(struct sockaddr_ipx))
 		{
-			log_printf(LOG_DEBUG,
+			LOG_PRINTF(LOG_DEBUG,
 				"IPX_Reply: Cannot update name server, shared data is %u bytes (expected %u)",
 				(unsigned int)(size), (unsigned int)(sizeof(struct sockaddr_ipx)));
 		}
@@ -420,7 +423,7 @@ static HRESULT WINAPI IPX_Reply(LPDPSP_REPLYDATA data) {
 				addr48_in(sp_data->ns_addr.sa_nodenum),
 				sp_data->ns_addr.sa_socket);
 			
-			log_printf(LOG_DEBUG, "IPX_Reply: New name server address is %s", str_addr);
+			LOG_PRINTF(LOG_DEBUG, "IPX_Reply: New name server address is %s", str_addr);
 		}
 	}
 	
@@ -432,7 +435,7 @@ static HRESULT WINAPI IPX_Reply(LPDPSP_REPLYDATA data) {
 	
 	if(to_addr == NULL)
 	{
-		log_printf(LOG_DEBUG, "Attempted SP_Reply with NULL lpSPMessageHeader");
+		LOG_PRINTF(LOG_DEBUG, "Attempted SP_Reply with NULL lpSPMessageHeader");
 		return DPERR_GENERIC;
 	}
 	
@@ -467,11 +470,11 @@ static HRESULT WINAPI IPX_CreatePlayer(LPDPSP_CREATEPLAYERDATA data) {
 		struct sockaddr_ipx *addr = data->lpSPMessageHeader;
 		
 		IPX_STRING_ADDR(str_addr, addr32_in(addr->sa_netnum), addr48_in(addr->sa_nodenum), addr->sa_socket);
-		log_printf(LOG_DEBUG, "IPX_CreatePlayer: idPlayer = %u, addr = %s, dwFlags = %u",
+		LOG_PRINTF(LOG_DEBUG, "IPX_CreatePlayer: idPlayer = %u, addr = %s, dwFlags = %u",
 			(unsigned int)(data->idPlayer), str_addr, (unsigned int)(data->dwFlags));
 	}
 	else{
-		log_printf(LOG_DEBUG, "IPX_CreatePlayer: idPlayer = %u, dwFlags = %u",
+		LOG_PRINTF(LOG_DEBUG, "IPX_CreatePlayer: idPlayer = %u, dwFlags = %u",
 			(unsigned int)(data->idPlayer), (unsigned int)(data->dwFlags));
 	}
 	
@@ -668,7 +671,7 @@ static HRESULT WINAPI IPX_ShutdownEx(LPDPSP_SHUTDOWNDATA data) {
 HRESULT WINAPI r_SPInit(LPSPINITDATA);
 
 HRESULT WINAPI SPInit(LPSPINITDATA data) {
-	log_printf(LOG_DEBUG, "SPInit called with provider GUID {%08lX-%04hX-%04hX-%02hhX%02hhX-%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX}",
+	LOG_PRINTF(LOG_DEBUG, "SPInit called with provider GUID {%08lX-%04hX-%04hX-%02hhX%02hhX-%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX}",
 		data->lpGuid->Data1, data->lpGuid->Data2, data->lpGuid->Data3,
 		data->lpGuid->Data4[0], data->lpGuid->Data4[1], data->lpGuid->Data4[2], data->lpGuid->Data4[3],
 		data->lpGuid->Data4[4], data->lpGuid->Data4[5], data->lpGuid->Data4[6], data->lpGuid->Data4[7]);
@@ -677,7 +680,7 @@ HRESULT WINAPI SPInit(LPSPINITDATA data) {
 		return r_SPInit(data);
 	}
 	
-	log_printf(LOG_DEBUG, "SPInit: %p (lpAddress = %p, dwAddressSize = %u)", data->lpISP, data->lpAddress, (unsigned int)(data->dwAddressSize));
+	LOG_PRINTF(LOG_DEBUG, "SPInit: %p (lpAddress = %p, dwAddressSize = %u)", data->lpISP, data->lpAddress, (unsigned int)(data->dwAddressSize));
 	
 	struct sp_data sp_data;
 	
@@ -734,7 +737,10 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
 		
 		log_init();
 		
-		min_log_level = get_main_config(false).log_level;
+		main_config_t config = get_main_config(false);
+		
+		min_log_level = config.log_level;
+		log_start(config.log_queue_drop);
 	}
 	else if(fdwReason == DLL_PROCESS_DETACH)
 	{
@@ -742,9 +748,14 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
 		 * than the DLL being unloaded dynamically and any threads will have been terminated
 		 * at unknown points, meaning any global data may be in an inconsistent state and we
 		 * cannot (safely) clean up. MSDN states we should do nothing.
+		 *
+		 * The one exception is writing out any messages left in the log queue by the
+		 * (terminated) log writer thread, which only reads the queue and appends to the
+		 * log file, so that the messages leading up to the exit aren't lost.
 		*/
 		if(lpvReserved != NULL)
 		{
+			log_flush();
 			return TRUE;
 		}
 		
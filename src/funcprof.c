@@ -16,113 +16,249 @@
 */
 
 #include <windows.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "funcprof.h"
 
+bool fprof_enabled = false;
+
+/* Performance counter ticks per microsecond, the counter frequency is fixed
+ * at boot so it is only queried once by fprof_init().
+*/
+static float fprof_ticks_per_usec = 1.0f;
+
+/* Bucket index for a duration. The first FPROF_SUB_BUCKETS buckets hold one
+ * value each, after that each power of two is split into FPROF_SUB_BUCKETS
+ * equal parts.
+*/
+static unsigned int fprof_bucket(uint64_t ticks)
+{
+	if(ticks < FPROF_SUB_BUCKETS)
+	{
+		return ticks;
+	}
+	
+	unsigned int exponent = 63 - __builtin_clzll(ticks);
+	unsigned int sub_bucket = (ticks >> (exponent - 2)) & (FPROF_SUB_BUCKETS - 1);
+	
+	unsigned int bucket = ((exponent - 1) * FPROF_SUB_BUCKETS) + sub_bucket;
+	
+	return bucket < FPROF_BUCKETS ? bucket : (FPROF_BUCKETS - 1);
+}
+
+/* Largest duration counted in a bucket. */
+static uint64_t fprof_bucket_max(unsigned int bucket)
+{
+	if(bucket < FPROF_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	
+	unsigned int exponent = (bucket / FPROF_SUB_BUCKETS) + 1;
+	unsigned int sub_bucket = bucket % FPROF_SUB_BUCKETS;
+	
+	return ((uint64_t)(FPROF_SUB_BUCKETS + sub_bucket + 1) << (exponent - 2)) - 1;
+}
+
+static struct fprof_shard *fprof_shard(struct FuncStats *fstats)
+{
+	/* Thread IDs are multiples of four. */
+	return &(fstats->shards[(GetCurrentThreadId() >> 2) % FPROF_SHARDS]);
+}
+
 void fprof_init(struct FuncStats *fstats, size_t n_fstats)
 {
+	LARGE_INTEGER freq;
+	if(QueryPerformanceFrequency(&freq))
+	{
+		fprof_ticks_per_usec = freq.QuadPart / 1000000.0;
+	}
+	
+	/* The pages are zeroed by the system and not touched until something
+	 * is recorded in them, so this costs nothing when profiling is off.
+	*/
+	struct fprof_shard *shards = VirtualAlloc(NULL, (n_fstats * (FPROF_SHARDS + 1) * sizeof(struct fprof_shard)), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if(shards == NULL && n_fstats > 0)
+	{
+		log_printf(LOG_ERROR, "Unable to allocate profiling counters: %s", w32_error(GetLastError()));
+		abort();
+	}
+	
 	for(size_t i = 0; i < n_fstats; ++i)
 	{
-		fstats[i].min_time   = 0.0;
-		fstats[i].max_time   = 0.0;
-		fstats[i].total_time = 0.0;
-		
-		fstats[i].n_calls = 0;
-		
-		InitializeCriticalSectionAndSpinCount(&(fstats[i].cs), 0x80000000);
+		fstats[i].shards = shards + (i * (FPROF_SHARDS + 1));
 	}
 }
 
 void fprof_cleanup(struct FuncStats *fstats, size_t n_fstats)
 {
-	for(size_t i = 0; i < n_fstats; ++i)
+	if(n_fstats > 0 && fstats[0].shards != NULL)
 	{
-		DeleteCriticalSection(&(fstats[i].cs));
+		VirtualFree(fstats[0].shards, 0, MEM_RELEASE);
+		
+		for(size_t i = 0; i < n_fstats; ++i)
+		{
+			fstats[i].shards = NULL;
+		}
 	}
 }
 
 __stdcall void fprof_record_timed(struct FuncStats *fstats, const LARGE_INTEGER *start, const LARGE_INTEGER *end)
 {
-	EnterCriticalSection(&(fstats->cs));
+	struct fprof_shard *shard = fprof_shard(fstats);
+	
+	uint64_t this_time = end->QuadPart - start->QuadPart;
 	
-	float this_time = end->QuadPart - start->QuadPart;
+	__atomic_add_fetch(&(shard->n_calls), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(shard->total_time), this_time, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(shard->buckets[ fprof_bucket(this_time) ]), 1, __ATOMIC_RELAXED);
+	
+	uint64_t max_time = __atomic_load_n(&(shard->max_time), __ATOMIC_RELAXED);
+	while(max_time < this_time && !__atomic_compare_exchange_n(&(shard->max_time), &max_time, this_time, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+__stdcall void fprof_record_untimed(struct FuncStats *fstats)
+{
+	struct fprof_shard *shard = fprof_shard(fstats);
+	__atomic_add_fetch(&(shard->n_calls), 1, __ATOMIC_RELAXED);
+}
+
+/* Merge the counters of a function from every shard. Calls which are being
+ * recorded while this is running may be counted in some totals and not others.
+*/
+void fprof_read(struct FuncStats *fstats, struct fprof_shard *totals)
+{
+	memset(totals, 0, sizeof(*totals));
 	
-	if(fstats->n_calls == 0)
+	for(int i = 0; i < FPROF_SHARDS; ++i)
 	{
-		fstats->min_time   = this_time;
-		fstats->max_time   = this_time;
-		fstats->total_time = this_time;
-	}
-	else{
-		if(fstats->min_time > this_time)
+		struct fprof_shard *shard = &(fstats->shards[i]);
+		
+		totals->n_calls += __atomic_load_n(&(shard->n_calls), __ATOMIC_RELAXED);
+		totals->total_time += __atomic_load_n(&(shard->total_time), __ATOMIC_RELAXED);
+		
+		uint64_t max_time = __atomic_load_n(&(shard->max_time), __ATOMIC_RELAXED);
+		if(totals->max_time < max_time)
 		{
-			fstats->min_time = this_time;
+			totals->max_time = max_time;
 		}
 		
-		if(fstats->max_time < this_time)
+		for(int b = 0; b < FPROF_BUCKETS; ++b)
 		{
-			fstats->max_time = this_time;
+			totals->buckets[b] += __atomic_load_n(&(shard->buckets[b]), __ATOMIC_RELAXED);
 		}
+	}
+}
+
+/* Summarise the calls counted in now since then, which may be NULL to
+ * summarise everything in now.
+*/
+void fprof_summarise(const struct fprof_shard *now, const struct fprof_shard *then, struct fprof_summary *summary)
+{
+	unsigned int buckets[FPROF_BUCKETS];
+	unsigned int n_timed = 0;
+	int last_bucket = -1;
+	
+	for(int b = 0; b < FPROF_BUCKETS; ++b)
+	{
+		buckets[b] = now->buckets[b] - (then != NULL ? then->buckets[b] : 0);
+		n_timed += buckets[b];
 		
-		fstats->total_time += this_time;
+		if(buckets[b] > 0)
+		{
+			last_bucket = b;
+		}
 	}
 	
-	++(fstats->n_calls);
+	summary->n_calls = now->n_calls - (then != NULL ? then->n_calls : 0);
+	summary->total_time = now->total_time - (then != NULL ? then->total_time : 0);
+	
+	/* The longest call is somewhere in the last bucket used, and no longer
+	 * than the longest call ever recorded. The last bucket has no upper
+	 * bound.
+	*/
+	summary->max_time = 0;
 	
-	LeaveCriticalSection(&(fstats->cs));
+	if(last_bucket >= 0)
+	{
+		uint64_t bucket_max = (last_bucket + 1) < FPROF_BUCKETS ? fprof_bucket_max(last_bucket) : now->max_time;
+		summary->max_time = bucket_max < now->max_time ? bucket_max : now->max_time;
+	}
+	
+	/* Walk the histogram once, picking out each percentile as the running
+	 * total reaches it.
+	*/
+	
+	static const double PERCENTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t *results[] = { &(summary->p50), &(summary->p90), &(summary->p99), &(summary->p999) };
+	
+	int next = 0;
+	unsigned int seen = 0;
+	
+	for(int b = 0; b <= last_bucket && next < 4; ++b)
+	{
+		seen += buckets[b];
+		
+		while(next < 4 && seen >= (PERCENTILES[next] * n_timed))
+		{
+			uint64_t bucket_max = (b + 1) < FPROF_BUCKETS ? fprof_bucket_max(b) : summary->max_time;
+			*(results[next++]) = bucket_max < summary->max_time ? bucket_max : summary->max_time;
+		}
+	}
+	
+	while(next < 4)
+	{
+		*(results[next++]) = 0;
+	}
 }
 
-__stdcall void fprof_record_untimed(struct FuncStats *fstats)
+/* Summarise the calls to a function since the last call to fprof_take(). */
+void fprof_take(struct FuncStats *fstats, struct fprof_summary *summary)
 {
-	EnterCriticalSection(&(fstats->cs));
+	struct fprof_shard *reported = &(fstats->shards[FPROF_SHARDS]);
 	
-	++(fstats->n_calls);
+	struct fprof_shard now;
+	fprof_read(fstats, &now);
 	
-	LeaveCriticalSection(&(fstats->cs));
+	fprof_summarise(&now, reported, summary);
+	
+	*reported = now;
 }
 
 void fprof_report(const char *dll_name, struct FuncStats *fstats, size_t n_fstats)
 {
-	LARGE_INTEGER freq; /* TODO: Cache somewhere */
-	QueryPerformanceFrequency(&freq);
-	
-	const float TICKS_PER_USEC = freq.QuadPart / 1000000.0;
+	const float TICKS_PER_USEC = fprof_ticks_per_usec;
 	
 	for(size_t i = 0; i < n_fstats; ++i)
 	{
-		EnterCriticalSection(&(fstats[i].cs));
-		
-		float min_time   = fstats[i].min_time;
-		float max_time   = fstats[i].max_time;
-		float total_time = fstats[i].total_time;
-		
-		unsigned int n_calls = fstats[i].n_calls;
-		
-		fstats[i].n_calls = 0;
-		
-		LeaveCriticalSection(&(fstats[i].cs));
+		struct fprof_summary s;
+		fprof_take(&(fstats[i]), &s);
 		
-		if(n_calls > 0)
+		if(s.n_calls > 0)
 		{
-			if(total_time > 0.0)
+			if(s.total_time > 0)
 			{
 				log_printf(LOG_INFO,
-					"%s:%s was called %u times duration total %fus min %fus max %fus avg %fus",
+					"%s:%s was called %u times duration total %fus avg %fus p50 %fus p90 %fus p99 %fus p99.9 %fus max %fus",
 					dll_name,
 					fstats[i].func_name,
-					n_calls,
-					(total_time / TICKS_PER_USEC),
-					(min_time / TICKS_PER_USEC),
-					(max_time / TICKS_PER_USEC),
-					((total_time / (float)(n_calls)) / TICKS_PER_USEC));
+					s.n_calls,
+					(s.total_time / TICKS_PER_USEC),
+					(((float)(s.total_time) / (float)(s.n_calls)) / TICKS_PER_USEC),
+					(s.p50 / TICKS_PER_USEC),
+					(s.p90 / TICKS_PER_USEC),
+					(s.p99 / TICKS_PER_USEC),
+					(s.p999 / TICKS_PER_USEC),
+					(s.max_time / TICKS_PER_USEC));
 			}
 			else{
 				log_printf(LOG_INFO,
 					"%s:%s was called %u times",
 					dll_name,
 					fstats[i].func_name,
-					n_calls);
+					s.n_calls);
 			}
 		}
 	}
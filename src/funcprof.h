@@ -19,30 +19,96 @@
 #define IPXWRAPPER_FUNCPROF_H
 
 #include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Call durations are recorded in a histogram of performance counter ticks,
+ * with FPROF_SUB_BUCKETS buckets for each power of two, so percentiles are
+ * accurate to within 25%. Durations too long for the last bucket are counted
+ * in it.
+ *
+ * Each function has FPROF_SHARDS copies of its counters, threads record into
+ * the shard picked by their thread ID using atomic operations, so threads
+ * calling the same function rarely touch the same cache lines and never wait
+ * for each other. The shards are merged by fprof_read().
+ *
+ * The counters are never reset, so they can be read by the stats export (see
+ * statsmem.h) and the periodic log report at the same time. fprof_take() keeps
+ * a copy of the merged counters from the last time it was called in an extra
+ * shard after the others and reports the difference. The bucket counters may
+ * wrap, which doesn't matter as long as fewer than 2^32 calls land in one
+ * bucket between reads.
+*/
+
+#define FPROF_SHARDS 8
+#define FPROF_SUB_BUCKETS 4
+#define FPROF_BUCKETS 128
+
+struct fprof_shard
+{
+	uint64_t n_calls;
+	uint64_t total_time;
+	uint64_t max_time;
+	
+	unsigned int buckets[FPROF_BUCKETS];
+} __attribute__((aligned(64)));
+
+/* The layout of this structure is duplicated in mkstubs.pl, which only
+ * initialises func_name.
+*/
 struct FuncStats
 {
 	const char *func_name;
-	float min_time, max_time, total_time;
+	
+	/* Array of FPROF_SHARDS shards followed by the fprof_take() baseline,
+	 * allocated by fprof_init().
+	*/
+	struct fprof_shard *shards;
+};
+
+/* Counters merged from every shard, times are in performance counter ticks.
+ * Percentiles are the upper bound of the histogram bucket they fall in. When
+ * summarising an interval, max_time is found the same way, limited to the
+ * longest call ever recorded.
+*/
+struct fprof_summary
+{
 	unsigned int n_calls;
-	CRITICAL_SECTION cs;
+	uint64_t total_time;
+	uint64_t max_time;
+	
+	uint64_t p50, p90, p99, p999;
 };
 
+/* Enables FPROF_RECORD_SCOPE(), the stubs have their own flag. */
+extern bool fprof_enabled;
+
 void fprof_init(struct FuncStats *fstats, size_t n_fstats);
 void fprof_cleanup(struct FuncStats *fstats, size_t n_fstats);
 
 __stdcall void fprof_record_timed(struct FuncStats *fstats, const LARGE_INTEGER *start, const LARGE_INTEGER *end);
 __stdcall void fprof_record_untimed(struct FuncStats *fstats);
 
+void fprof_read(struct FuncStats *fstats, struct fprof_shard *totals);
+void fprof_summarise(const struct fprof_shard *now, const struct fprof_shard *then, struct fprof_summary *summary);
+void fprof_take(struct FuncStats *fstats, struct fprof_summary *summary);
 void fprof_report(const char *dll_name, struct FuncStats *fstats, size_t n_fstats);
 
-#define FPROF_RECORD_SCOPE(fstats) \
-	__attribute__((cleanup (_fprof_record_scope_exit))) struct _fprof_record_scope_ctx fstats_scoped_ctx = { fstats }; \
-	QueryPerformanceCounter(&(fstats_scoped_ctx.enter_time));
+/* Time the rest of the enclosing scope. When profiling is disabled this only
+ * costs a test of fprof_enabled on entry and a test of the (still NULL)
+ * context on exit.
+*/
+#define FPROF_RECORD_SCOPE(stats) \
+	__attribute__((cleanup (_fprof_record_scope_exit))) struct _fprof_record_scope_ctx fstats_scoped_ctx = { NULL }; \
+	if(__builtin_expect(fprof_enabled, 0)) \
+	{ \
+		fstats_scoped_ctx.fstats = (stats); \
+		QueryPerformanceCounter(&(fstats_scoped_ctx.enter_time)); \
+	}
 
 struct _fprof_record_scope_ctx {
 	struct FuncStats *fstats;
@@ -51,10 +117,13 @@ struct _fprof_record_scope_ctx {
 
 static inline void _fprof_record_scope_exit(struct _fprof_record_scope_ctx *ctx)
 {
-	LARGE_INTEGER leave_time;
-	QueryPerformanceCounter(&leave_time);
-	
-	fprof_record_timed(ctx->fstats, &(ctx->enter_time), &leave_time);
+	if(ctx->fstats != NULL)
+	{
+		LARGE_INTEGER leave_time;
+		QueryPerformanceCounter(&leave_time);
+		
+		fprof_record_timed(ctx->fstats, &(ctx->enter_time), &leave_time);
+	}
 }
 
 #ifdef __cplusplus
@@ -40,10 +40,19 @@ addr48_t dosbox_local_nodenum;
 
 static CRITICAL_SECTION interface_cache_cs;
 
-static ipx_interface_t *interface_cache = NULL;
+/* The current interface snapshot is replaced (under interface_cache_cs) when
+ * the cache is renewed, and read without any locks by ipx_interfaces_acquire().
+ *
+ * snapshot_acquiring counts the threads between loading interface_snapshot and
+ * taking a reference to it, so the thread replacing the snapshot can wait for
+ * them before dropping its own reference to the old one.
+*/
+static ipx_interface_snapshot_t *interface_snapshot = NULL;
+static LONG snapshot_acquiring = 0;
 static time_t interface_cache_ctime = 0;
 
 static void renew_interface_cache(bool force);
+static ipx_interface_snapshot_t *_new_snapshot(ipx_interface_t *interfaces);
 
 /* Allocate and initialise a new ipx_interface structure.
  * Returns NULL on malloc failure.
@@ -330,8 +339,10 @@ void free_ipx_interface_list(ipx_interface_t **list)
 	}
 }
 
-static void _init_pcap_interfaces(void)
+static ipx_interface_t *_init_pcap_interfaces(void)
 {
+	ipx_interface_t *interfaces = NULL;
+	
 	ipx_pcap_interface_t *pcap_interfaces = ipx_get_pcap_interfaces();
 	
 	log_printf(LOG_INFO, "Listing WinPcap interfaces:");
@@ -383,20 +394,21 @@ static void _init_pcap_interfaces(void)
 		if(i->mac_addr == primary)
 		{
 			/* Primary interface, insert at the start of the list */
-			DL_PREPEND(interface_cache, iface);
+			DL_PREPEND(interfaces, iface);
 		}
 		else{
-			DL_APPEND(interface_cache, iface);
+			DL_APPEND(interfaces, iface);
 		}
 	}
 	
 	ipx_free_pcap_interfaces(&pcap_interfaces);
+	
+	return interfaces;
 }
 
 /* Initialise the IPX interface cache. */
 void ipx_interfaces_init(void)
 {
-	interface_cache       = NULL;
 	interface_cache_ctime = 0;
 	
 	if(!InitializeCriticalSectionAndSpinCount(&interface_cache_cs, 0x80000000))
@@ -409,9 +421,11 @@ void ipx_interfaces_init(void)
 	
 	log_printf(LOG_INFO, "--");
 	
+	ipx_interface_t *initial_interfaces = NULL;
+	
 	if(ipx_encap_type == ENCAP_TYPE_PCAP)
 	{
-		_init_pcap_interfaces();
+		initial_interfaces = _init_pcap_interfaces();
 	}
 	else if(ipx_encap_type == ENCAP_TYPE_IPXWRAPPER)
 	{
@@ -460,6 +474,15 @@ void ipx_interfaces_init(void)
 		free(ip_ifaces);
 	}
 	
+	/* There is always a current snapshot, this one will be replaced on
+	 * first use unless we are using pcap.
+	*/
+	
+	if((interface_snapshot = _new_snapshot(initial_interfaces)) == NULL)
+	{
+		abort();
+	}
+	
 	if(ipx_encap_type == ENCAP_TYPE_DOSBOX)
 	{
 		log_printf(LOG_INFO, "Using DOSBox server: %s port %hu",
@@ -511,21 +534,71 @@ void ipx_interfaces_cleanup(void)
 {
 	DeleteCriticalSection(&interface_cache_cs);
 	
-	if(ipx_encap_type == ENCAP_TYPE_PCAP)
+	ipx_interface_snapshot_t *snapshot = __atomic_exchange_n(&interface_snapshot, NULL, __ATOMIC_SEQ_CST);
+	
+	if(ipx_encap_type == ENCAP_TYPE_PCAP && snapshot != NULL)
 	{
-		for(ipx_interface_t *i = interface_cache; i; i = i->next)
+		for(ipx_interface_t *i = snapshot->interfaces; i; i = i->next)
 		{
 			pcap_close(i->pcap);
 		}
 	}
 	
-	free_ipx_interface_list(&interface_cache);
+	if(snapshot != NULL)
+	{
+		ipx_interfaces_release(snapshot);
+	}
 }
 
 /* Flush and repopulate the interface cache. */
 void ipx_interfaces_reload(void)
 {
+	EnterCriticalSection(&interface_cache_cs);
 	renew_interface_cache(true);
+	LeaveCriticalSection(&interface_cache_cs);
+}
+
+/* Wrap a list of interfaces in a new snapshot with a single reference held
+ * by the caller. Takes ownership of the list, even on failure.
+*/
+static ipx_interface_snapshot_t *_new_snapshot(ipx_interface_t *interfaces)
+{
+	ipx_interface_snapshot_t *snapshot = malloc(sizeof(ipx_interface_snapshot_t));
+	if(!snapshot)
+	{
+		log_printf(LOG_ERROR, "Cannot allocate ipx_interface_snapshot!");
+		
+		free_ipx_interface_list(&interfaces);
+		return NULL;
+	}
+	
+	snapshot->refcount   = 1;
+	snapshot->interfaces = interfaces;
+	snapshot->classify   = ipclassify_build(interfaces);
+	
+	return snapshot;
+}
+
+/* Replace the current snapshot with a new one, dropping the reference held on
+ * the old one once no reader can still be about to take a reference to it.
+ * Ensure you hold interface_cache_cs before calling.
+*/
+static void _publish_snapshot(ipx_interface_snapshot_t *snapshot)
+{
+	ipx_interface_snapshot_t *old = __atomic_exchange_n(&interface_snapshot, snapshot, __ATOMIC_SEQ_CST);
+	
+	if(old != NULL)
+	{
+		/* Any reader which loaded the old pointer is still counted in
+		 * snapshot_acquiring until it has incremented the refcount.
+		*/
+		while(__atomic_load_n(&snapshot_acquiring, __ATOMIC_SEQ_CST) > 0)
+		{
+			Sleep(0);
+		}
+		
+		ipx_interfaces_release(old);
+	}
 }
 
 /* Check the age of the IPX interface cache and reload it if necessary.
@@ -535,98 +608,198 @@ static void renew_interface_cache(bool force)
 {
 	if(ipx_encap_type == ENCAP_TYPE_PCAP)
 	{
-		/* interface_cache is initialised during init when pcap is in
-		 * use and survives for the lifetime of the program.
+		/* The interface snapshot is created during init when pcap is
+		 * in use and survives for the lifetime of the program.
 		*/
 		return;
 	}
 	
-	if(force || time(NULL) - interface_cache_ctime > INTERFACE_CACHE_TTL)
+	if(force || time(NULL) - __atomic_load_n(&interface_cache_ctime, __ATOMIC_RELAXED) > INTERFACE_CACHE_TTL)
 	{
-		free_ipx_interface_list(&interface_cache);
+		ipx_interface_t *interfaces;
 		
 		if(ipx_encap_type == ENCAP_TYPE_DOSBOX)
 		{
-			interface_cache = load_dosbox_interfaces();
+			interfaces = load_dosbox_interfaces();
 		}
 		else{
-			interface_cache = load_ipx_interfaces();
+			interfaces = load_ipx_interfaces();
 		}
 		
-		interface_cache_ctime = time(NULL);
+		ipx_interface_snapshot_t *snapshot = _new_snapshot(interfaces);
+		if(snapshot != NULL)
+		{
+			_publish_snapshot(snapshot);
+		}
+		
+		__atomic_store_n(&interface_cache_ctime, time(NULL), __ATOMIC_RELAXED);
 	}
 }
 
-/* Return a copy of the IPX interface cache. The cache will be reloaded before
- * copying if too old.
+/* Take a reference to the current snapshot of the IPX interface list, which
+ * will be reloaded first if too old.
+ *
+ * The snapshot and the interfaces within it must not be modified and remain
+ * valid until released using ipx_interfaces_release(), even if the interface
+ * cache is reloaded in the meantime. No locks are taken unless the cache has
+ * to be reloaded.
 */
-ipx_interface_t *get_ipx_interfaces(void)
+ipx_interface_snapshot_t *ipx_interfaces_acquire(void)
 {
-	EnterCriticalSection(&interface_cache_cs);
+	if(ipx_encap_type != ENCAP_TYPE_PCAP
+		&& time(NULL) - __atomic_load_n(&interface_cache_ctime, __ATOMIC_RELAXED) > INTERFACE_CACHE_TTL)
+	{
+		EnterCriticalSection(&interface_cache_cs);
+		renew_interface_cache(false);
+		LeaveCriticalSection(&interface_cache_cs);
+	}
 	
-	renew_interface_cache(false);
+	__atomic_add_fetch(&snapshot_acquiring, 1, __ATOMIC_SEQ_CST);
 	
-	ipx_interface_t *copy = copy_ipx_interface_list(interface_cache);
+	ipx_interface_snapshot_t *snapshot = __atomic_load_n(&interface_snapshot, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&(snapshot->refcount), 1, __ATOMIC_SEQ_CST);
 	
-	LeaveCriticalSection(&interface_cache_cs);
+	__atomic_sub_fetch(&snapshot_acquiring, 1, __ATOMIC_SEQ_CST);
 	
-	return copy;
+	return snapshot;
 }
 
-/* Search for an IPX interface by address.
- * Returns NULL if the interface doesn't exist or malloc failure.
+/* Release a reference obtained using ipx_interfaces_acquire(). */
+void ipx_interfaces_release(ipx_interface_snapshot_t *snapshot)
+{
+	if(__atomic_sub_fetch(&(snapshot->refcount), 1, __ATOMIC_SEQ_CST) == 0)
+	{
+		ipclassify_free(snapshot->classify);
+		free_ipx_interface_list(&(snapshot->interfaces));
+		free(snapshot);
+	}
+}
+
+/* Search a snapshot for an IPX interface by address.
+ * Returns NULL if the interface doesn't exist.
 */
-ipx_interface_t *ipx_interface_by_addr(addr32_t net, addr48_t node)
+const ipx_interface_t *ipx_snapshot_by_addr(const ipx_interface_snapshot_t *snapshot, addr32_t net, addr48_t node)
 {
-	EnterCriticalSection(&interface_cache_cs);
-	
-	renew_interface_cache(false);
-	
-	ipx_interface_t *iface;
+	const ipx_interface_t *iface;
 	
-	DL_FOREACH(interface_cache, iface)
+	DL_FOREACH(snapshot->interfaces, iface)
 	{
 		if(iface->ipx_net == net && iface->ipx_node == node)
 		{
-			iface = copy_ipx_interface(iface);
-			break;
+			return iface;
 		}
 	}
 	
-	LeaveCriticalSection(&interface_cache_cs);
+	return NULL;
+}
+
+/* Search a snapshot for an IPX interface by associated IP subnet.
+ * Returns NULL if no interfaces match.
+*/
+const ipx_interface_t *ipx_snapshot_by_subnet(const ipx_interface_snapshot_t *snapshot, uint32_t ipaddr)
+{
+	const ipx_interface_t *iface;
 	
-	return iface;
+	DL_FOREACH(snapshot->interfaces, iface)
+	{
+		const ipx_interface_ip_t *ip;
+		DL_FOREACH(iface->ipaddr, ip)
+		{
+			if((ip->ipaddr & ip->netmask) == (ipaddr & ip->netmask))
+			{
+				return iface;
+			}
+		}
+	}
+	
+	return NULL;
 }
 
-/* Search for an IPX interface by associated IP subnet.
- * Returns NULL if no interfaces match or on malloc failure.
+/* Check if a UDP packet from the given IPv4 address may carry an IPX packet
+ * for the given destination address. IPX broadcast packets are accepted from
+ * the subnet of any interface, unicast only from the subnet of the interface
+ * with the destination address.
 */
-ipx_interface_t *ipx_interface_by_subnet(uint32_t ipaddr)
+bool ipx_snapshot_source_ok(const ipx_interface_snapshot_t *snapshot, uint32_t src_ipaddr, addr32_t dest_net, addr48_t dest_node)
 {
-	EnterCriticalSection(&interface_cache_cs);
+	if(snapshot->classify != NULL)
+	{
+		uint64_t ifaces = ipclassify_subnet_ifaces(snapshot->classify, src_ipaddr);
+		
+		if(dest_node == BCAST_NODE)
+		{
+			return ifaces != 0;
+		}
+		
+		int index = ipclassify_iface_index(snapshot->classify, dest_net, dest_node);
+		
+		return index >= 0 && (ifaces & ((uint64_t)(1) << index)) != 0;
+	}
 	
-	renew_interface_cache(false);
+	if(dest_node == BCAST_NODE)
+	{
+		return ipx_snapshot_by_subnet(snapshot, src_ipaddr) != NULL;
+	}
 	
-	ipx_interface_t *iface;
+	const ipx_interface_t *iface = ipx_snapshot_by_addr(snapshot, dest_net, dest_node);
 	
-	DL_FOREACH(interface_cache, iface)
+	if(iface != NULL)
 	{
-		ipx_interface_ip_t *ip;
+		const ipx_interface_ip_t *ip;
 		DL_FOREACH(iface->ipaddr, ip)
 		{
-			if((ip->ipaddr & ip->netmask) == (ipaddr & ip->netmask))
+			if((ip->ipaddr & ip->netmask) == (src_ipaddr & ip->netmask))
 			{
-				iface = copy_ipx_interface(iface);
-				goto DONE;
+				return true;
 			}
 		}
 	}
 	
-	DONE:
+	return false;
+}
+
+/* Return a copy of the IPX interface cache. The cache will be reloaded before
+ * copying if too old.
+*/
+ipx_interface_t *get_ipx_interfaces(void)
+{
+	ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
 	
-	LeaveCriticalSection(&interface_cache_cs);
+	ipx_interface_t *copy = copy_ipx_interface_list(snapshot->interfaces);
 	
-	return iface;
+	ipx_interfaces_release(snapshot);
+	
+	return copy;
+}
+
+/* Search for an IPX interface by address.
+ * Returns NULL if the interface doesn't exist or malloc failure.
+*/
+ipx_interface_t *ipx_interface_by_addr(addr32_t net, addr48_t node)
+{
+	ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
+	
+	const ipx_interface_t *iface = ipx_snapshot_by_addr(snapshot, net, node);
+	ipx_interface_t *copy = iface != NULL ? copy_ipx_interface(iface) : NULL;
+	
+	ipx_interfaces_release(snapshot);
+	
+	return copy;
+}
+
+/* Search for an IPX interface by associated IP subnet.
+ * Returns NULL if no interfaces match or on malloc failure.
+*/
+ipx_interface_t *ipx_interface_by_subnet(uint32_t ipaddr)
+{
+	ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
+	
+	const ipx_interface_t *iface = ipx_snapshot_by_subnet(snapshot, ipaddr);
+	ipx_interface_t *copy = iface != NULL ? copy_ipx_interface(iface) : NULL;
+	
+	ipx_interfaces_release(snapshot);
+	
+	return copy;
 }
 
 /* Search for an IPX interface by index.
@@ -634,14 +807,12 @@ ipx_interface_t *ipx_interface_by_subnet(uint32_t ipaddr)
 */
 ipx_interface_t *ipx_interface_by_index(int index)
 {
-	EnterCriticalSection(&interface_cache_cs);
-	
-	renew_interface_cache(false);
+	ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
 	
 	int iface_index = 0;
 	ipx_interface_t *iface;
 	
-	DL_FOREACH(interface_cache, iface)
+	DL_FOREACH(snapshot->interfaces, iface)
 	{
 		if(iface_index++ == index)
 		{
@@ -650,7 +821,7 @@ ipx_interface_t *ipx_interface_by_index(int index)
 		}
 	}
 	
-	LeaveCriticalSection(&interface_cache_cs);
+	ipx_interfaces_release(snapshot);
 	
 	return iface;
 }
@@ -658,19 +829,17 @@ ipx_interface_t *ipx_interface_by_index(int index)
 /* Returns the number of IPX interfaces. */
 int ipx_interface_count(void)
 {
-	EnterCriticalSection(&interface_cache_cs);
-	
-	renew_interface_cache(false);
+	ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
 	
 	int count = 0;
 	ipx_interface_t *iface;
 	
-	DL_FOREACH(interface_cache, iface)
+	DL_FOREACH(snapshot->interfaces, iface)
 	{
 		count++;
 	}
 	
-	LeaveCriticalSection(&interface_cache_cs);
+	ipx_interfaces_release(snapshot);
 	
 	return count;
 }
@@ -685,32 +854,36 @@ BOOL ipv4_address_is_local(addr32_t ipaddr)
 		return TRUE;
 	}
 
-	EnterCriticalSection(&interface_cache_cs);
-	
-	renew_interface_cache(false);
+	ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
 	
 	ipx_interface_t *iface;
 	BOOL is_local = FALSE;
 
-	DL_FOREACH(interface_cache, iface)
+	if(snapshot->classify != NULL)
 	{
-		ipx_interface_ip_t *ip;
-		DL_FOREACH(iface->ipaddr, ip)
+		is_local = ipclassify_is_local(snapshot->classify, ipaddr);
+	}
+	else{
+		DL_FOREACH(snapshot->interfaces, iface)
 		{
-			if(ip->ipaddr == ipaddr)
+			ipx_interface_ip_t *ip;
+			DL_FOREACH(iface->ipaddr, ip)
 			{
-				is_local = TRUE;
-				break;
+				if(ip->ipaddr == ipaddr)
+				{
+					is_local = TRUE;
+					break;
+				}
 			}
-		}
 
-		if(is_local)
-		{
-			break;
+			if(is_local)
+			{
+				break;
+			}
 		}
 	}
 	
-	LeaveCriticalSection(&interface_cache_cs);
+	ipx_interfaces_release(snapshot);
 	
 	return is_local;
 }
@@ -26,6 +26,7 @@
 #include "config.h"
 #include "common.h"
 #include "interface2.h"
+#include "ipclassify.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -60,6 +61,23 @@ struct ipx_interface {
 	ipx_interface_t *next;
 };
 
+/* A read-only snapshot of the IPX interface list.
+ *
+ * Hot paths should use ipx_interfaces_acquire() and ipx_interfaces_release()
+ * to access the current snapshot directly rather than the functions which
+ * return a copy of the interfaces.
+*/
+
+typedef struct ipx_interface_snapshot ipx_interface_snapshot_t;
+
+struct ipx_interface_snapshot {
+	LONG refcount;
+	ipx_interface_t *interfaces;
+	
+	/* Compiled from interfaces, NULL if it couldn't be built. */
+	ipclassify_t *classify;
+};
+
 extern enum main_config_encap_type ipx_encap_type;
 
 enum dosbox_state
@@ -86,6 +104,13 @@ void ipx_interfaces_init(void);
 void ipx_interfaces_cleanup(void);
 void ipx_interfaces_reload(void);
 
+ipx_interface_snapshot_t *ipx_interfaces_acquire(void);
+void ipx_interfaces_release(ipx_interface_snapshot_t *snapshot);
+
+const ipx_interface_t *ipx_snapshot_by_addr(const ipx_interface_snapshot_t *snapshot, addr32_t net, addr48_t node);
+const ipx_interface_t *ipx_snapshot_by_subnet(const ipx_interface_snapshot_t *snapshot, uint32_t ipaddr);
+bool ipx_snapshot_source_ok(const ipx_interface_snapshot_t *snapshot, uint32_t src_ipaddr, addr32_t dest_net, addr48_t dest_node);
+
 ipx_interface_t *get_ipx_interfaces(void);
 ipx_interface_t *ipx_interface_by_addr(addr32_t net, addr48_t node);
 ipx_interface_t *ipx_interface_by_subnet(uint32_t ipaddr);
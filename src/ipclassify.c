@@ -0,0 +1,332 @@
+/* IPXWrapper - Receive classification tables
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+#include <utlist.h>
+
+#include "common.h"
+#include "interface.h"
+#include "ipclassify.h"
+
+typedef struct ipclassify_addr ipclassify_addr_t;
+
+struct ipclassify_addr
+{
+	uint32_t ipaddr;  /* Network byte order */
+	
+	UT_hash_handle hh;
+};
+
+typedef struct ipclassify_subnet ipclassify_subnet_t;
+
+struct ipclassify_subnet
+{
+	uint32_t network;  /* Network byte order, already masked */
+	uint64_t ifaces;   /* Bitmask of interfaces with this subnet */
+	
+	UT_hash_handle hh;
+};
+
+/* All the subnets which share a netmask are kept in the same table, so a
+ * lookup costs one hash probe per distinct netmask in use, which is usually
+ * one or two.
+*/
+
+typedef struct ipclassify_prefix ipclassify_prefix_t;
+
+struct ipclassify_prefix
+{
+	uint32_t netmask;  /* Network byte order */
+	ipclassify_subnet_t *subnets;
+};
+
+typedef struct ipclassify_iface ipclassify_iface_t;
+
+struct ipclassify_iface
+{
+	struct {
+		addr32_t net;
+		addr48_t node;
+	} key;
+	
+	int index;
+	
+	UT_hash_handle hh;
+};
+
+struct ipclassify
+{
+	ipclassify_addr_t *local_addrs;
+	
+	ipclassify_prefix_t *prefixes;
+	int n_prefixes;
+	
+	ipclassify_iface_t *ifaces;
+};
+
+static bool _add_local_addr(ipclassify_t *classify, uint32_t ipaddr)
+{
+	ipclassify_addr_t *addr;
+	HASH_FIND(hh, classify->local_addrs, &ipaddr, sizeof(ipaddr), addr);
+	
+	if(addr != NULL)
+	{
+		return true;
+	}
+	
+	if((addr = malloc(sizeof(ipclassify_addr_t))) == NULL)
+	{
+		return false;
+	}
+	
+	addr->ipaddr = ipaddr;
+	HASH_ADD(hh, classify->local_addrs, ipaddr, sizeof(addr->ipaddr), addr);
+	
+	return true;
+}
+
+static bool _add_subnet(ipclassify_t *classify, uint32_t ipaddr, uint32_t netmask, int iface_index)
+{
+	ipclassify_prefix_t *prefix = NULL;
+	
+	for(int i = 0; i < classify->n_prefixes; ++i)
+	{
+		if(classify->prefixes[i].netmask == netmask)
+		{
+			prefix = &(classify->prefixes[i]);
+			break;
+		}
+	}
+	
+	if(prefix == NULL)
+	{
+		ipclassify_prefix_t *new_prefixes = realloc(classify->prefixes, (classify->n_prefixes + 1) * sizeof(ipclassify_prefix_t));
+		if(new_prefixes == NULL)
+		{
+			return false;
+		}
+		
+		classify->prefixes = new_prefixes;
+		
+		prefix = &(classify->prefixes[ classify->n_prefixes++ ]);
+		
+		prefix->netmask = netmask;
+		prefix->subnets = NULL;
+	}
+	
+	uint32_t network = ipaddr & netmask;
+	
+	ipclassify_subnet_t *subnet;
+	HASH_FIND(hh, prefix->subnets, &network, sizeof(network), subnet);
+	
+	if(subnet == NULL)
+	{
+		if((subnet = malloc(sizeof(ipclassify_subnet_t))) == NULL)
+		{
+			return false;
+		}
+		
+		subnet->network = network;
+		subnet->ifaces  = 0;
+		
+		HASH_ADD(hh, prefix->subnets, network, sizeof(subnet->network), subnet);
+	}
+	
+	subnet->ifaces |= ((uint64_t)(1) << iface_index);
+	
+	return true;
+}
+
+static bool _add_iface(ipclassify_t *classify, addr32_t net, addr48_t node, int iface_index)
+{
+	ipclassify_iface_t *iface = malloc(sizeof(ipclassify_iface_t));
+	if(iface == NULL)
+	{
+		return false;
+	}
+	
+	/* Clear any padding within the key. */
+	memset(&(iface->key), 0, sizeof(iface->key));
+	
+	iface->key.net  = net;
+	iface->key.node = node;
+	iface->index    = iface_index;
+	
+	ipclassify_iface_t *existing;
+	HASH_FIND(hh, classify->ifaces, &(iface->key), sizeof(iface->key), existing);
+	
+	if(existing != NULL)
+	{
+		/* Duplicate address, the first interface wins like it would
+		 * when searching the list.
+		*/
+		free(iface);
+		return true;
+	}
+	
+	HASH_ADD(hh, classify->ifaces, key, sizeof(iface->key), iface);
+	
+	return true;
+}
+
+/* Compile a classifier from a list of IPX interfaces.
+ *
+ * Returns NULL if there are too many interfaces to represent or on malloc
+ * failure, callers must be prepared to fall back to searching the interface
+ * list themselves.
+*/
+ipclassify_t *ipclassify_build(const struct ipx_interface *interfaces)
+{
+	ipclassify_t *classify = malloc(sizeof(ipclassify_t));
+	if(classify == NULL)
+	{
+		log_printf(LOG_ERROR, "Cannot allocate ipclassify!");
+		return NULL;
+	}
+	
+	classify->local_addrs = NULL;
+	classify->prefixes    = NULL;
+	classify->n_prefixes  = 0;
+	classify->ifaces      = NULL;
+	
+	int iface_index = 0;
+	const ipx_interface_t *iface;
+	
+	DL_FOREACH(interfaces, iface)
+	{
+		if(iface_index >= IPCLASSIFY_MAX_IFACES)
+		{
+			log_printf(LOG_DEBUG, "Too many interfaces for ipclassify, using slow path");
+			
+			ipclassify_free(classify);
+			return NULL;
+		}
+		
+		if(!_add_iface(classify, iface->ipx_net, iface->ipx_node, iface_index))
+		{
+			goto FAIL;
+		}
+		
+		const ipx_interface_ip_t *ip;
+		DL_FOREACH(iface->ipaddr, ip)
+		{
+			if(!_add_local_addr(classify, ip->ipaddr)
+				|| !_add_subnet(classify, ip->ipaddr, ip->netmask, iface_index))
+			{
+				goto FAIL;
+			}
+		}
+		
+		++iface_index;
+	}
+	
+	return classify;
+	
+	FAIL:
+	
+	log_printf(LOG_ERROR, "Cannot allocate memory for ipclassify!");
+	
+	ipclassify_free(classify);
+	return NULL;
+}
+
+void ipclassify_free(ipclassify_t *classify)
+{
+	if(classify == NULL)
+	{
+		return;
+	}
+	
+	ipclassify_addr_t *addr, *addr_tmp;
+	HASH_ITER(hh, classify->local_addrs, addr, addr_tmp)
+	{
+		HASH_DEL(classify->local_addrs, addr);
+		free(addr);
+	}
+	
+	for(int i = 0; i < classify->n_prefixes; ++i)
+	{
+		ipclassify_subnet_t *subnet, *subnet_tmp;
+		HASH_ITER(hh, classify->prefixes[i].subnets, subnet, subnet_tmp)
+		{
+			HASH_DEL(classify->prefixes[i].subnets, subnet);
+			free(subnet);
+		}
+	}
+	
+	free(classify->prefixes);
+	
+	ipclassify_iface_t *iface, *iface_tmp;
+	HASH_ITER(hh, classify->ifaces, iface, iface_tmp)
+	{
+		HASH_DEL(classify->ifaces, iface);
+		free(iface);
+	}
+	
+	free(classify);
+}
+
+/* Check if an IPv4 address is one of the addresses of the interfaces. */
+bool ipclassify_is_local(const ipclassify_t *classify, uint32_t ipaddr)
+{
+	ipclassify_addr_t *addr;
+	HASH_FIND(hh, classify->local_addrs, &ipaddr, sizeof(ipaddr), addr);
+	
+	return addr != NULL;
+}
+
+/* Return a bitmask of the interfaces which have an IP subnet containing the
+ * given IPv4 address.
+*/
+uint64_t ipclassify_subnet_ifaces(const ipclassify_t *classify, uint32_t ipaddr)
+{
+	uint64_t ifaces = 0;
+	
+	for(int i = 0; i < classify->n_prefixes; ++i)
+	{
+		uint32_t network = ipaddr & classify->prefixes[i].netmask;
+		
+		ipclassify_subnet_t *subnet;
+		HASH_FIND(hh, classify->prefixes[i].subnets, &network, sizeof(network), subnet);
+		
+		if(subnet != NULL)
+		{
+			ifaces |= subnet->ifaces;
+		}
+	}
+	
+	return ifaces;
+}
+
+/* Return the index of the interface with the given IPX address, -1 if there
+ * isn't one.
+*/
+int ipclassify_iface_index(const ipclassify_t *classify, addr32_t net, addr48_t node)
+{
+	ipclassify_iface_t key;
+	memset(&(key.key), 0, sizeof(key.key));
+	
+	key.key.net  = net;
+	key.key.node = node;
+	
+	ipclassify_iface_t *iface;
+	HASH_FIND(hh, classify->ifaces, &(key.key), sizeof(key.key), iface);
+	
+	return iface != NULL ? iface->index : -1;
+}
@@ -0,0 +1,57 @@
+/* IPXWrapper - Receive classification tables
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_IPCLASSIFY_H
+#define IPXWRAPPER_IPCLASSIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "addr.h"
+
+struct ipx_interface;
+
+/* Maximum number of IPX interfaces which can be represented in a classifier,
+ * one bit of a uint64_t is used for each.
+*/
+#define IPCLASSIFY_MAX_IFACES 64
+
+/* A classifier is compiled from a list of IPX interfaces and answers the
+ * questions asked about the source of every UDP packet we receive without
+ * walking the interface list or allocating any memory:
+ *
+ * - Is the source address one of our own IP addresses?
+ * - Which IPX interfaces have an IP subnet containing the source address?
+ * - Which IPX interface (by list position) has a given IPX address?
+ *
+ * Each IPX interface is identified by its position in the list it was built
+ * from, so the subnet lookup returns a bitmask of interfaces.
+ *
+ * Classifiers are immutable once built and are only freed once nothing can be
+ * using them, so no locking is required to query them.
+*/
+
+typedef struct ipclassify ipclassify_t;
+
+ipclassify_t *ipclassify_build(const struct ipx_interface *interfaces);
+void ipclassify_free(ipclassify_t *classify);
+
+bool ipclassify_is_local(const ipclassify_t *classify, uint32_t ipaddr);
+uint64_t ipclassify_subnet_ifaces(const ipclassify_t *classify, uint32_t ipaddr);
+int ipclassify_iface_index(const ipclassify_t *classify, addr32_t net, addr48_t node);
+
+#endif /* !IPXWRAPPER_IPCLASSIFY_H */
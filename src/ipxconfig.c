@@ -56,6 +56,7 @@ enum {
 	
 	ID_IPXWRAPPER_PORT = 61,
 	ID_IPXWRAPPER_FW_EXCEPT = 62,
+	ID_IPXWRAPPER_COALESCE = 63,
 };
 
 struct iface {
@@ -159,6 +160,7 @@ static struct {
 	HWND box_ipxwrapper_options;
 	HWND ipxwrapper_port_lbl;
 	HWND ipxwrapper_port;
+	HWND ipxwrapper_coalesce;
 	HWND ipxwrapper_fw_except;
 	
 	HWND box_dosbox_options;
@@ -597,6 +599,7 @@ static bool save_config()
 		
 		main_config.udp_port = port;
 		
+		main_config.udp_coalesce = get_checkbox(wh.ipxwrapper_coalesce);
 		main_config.fw_except = get_checkbox(wh.ipxwrapper_fw_except);
 	}
 	else if(main_config.encap_type == ENCAP_TYPE_DOSBOX)
@@ -791,6 +794,7 @@ static void main_window_init()
 	/* +- Network options ---------------------------------------+
 	 * |       Broadcast port | 54792             |              |
 	 * |                                                         |
+	 * | □ Coalesce packets when saturated                       |
 	 * | □ Automatically create Windows Firewall exceptions      |
 	 * +---------------------------------------------------------+
 	*/
@@ -803,6 +807,7 @@ static void main_window_init()
 		wh.ipxwrapper_port_lbl = create_STATIC(wh.box_ipxwrapper_options, "Broadcast port");
 		wh.ipxwrapper_port     = create_child(wh.box_ipxwrapper_options, "EDIT", "", WS_TABSTOP, WS_EX_CLIENTEDGE, ID_IPXWRAPPER_PORT);
 		
+		wh.ipxwrapper_coalesce  = create_checkbox(wh.box_ipxwrapper_options, "Coalesce packets when saturated", ID_IPXWRAPPER_COALESCE);
 		wh.ipxwrapper_fw_except = create_checkbox(wh.box_ipxwrapper_options, "Automatically create Windows Firewall exceptions", ID_IPXWRAPPER_FW_EXCEPT);
 		
 		/* Initialise controls. */
@@ -812,6 +817,7 @@ static void main_window_init()
 		sprintf(port_s, "%hu", main_config.udp_port);
 		SetWindowText(wh.ipxwrapper_port, port_s);
 		
+		set_checkbox(wh.ipxwrapper_coalesce, main_config.udp_coalesce);
 		set_checkbox(wh.ipxwrapper_fw_except, main_config.fw_except);
 		
 		// TODO: Layout controls
@@ -1023,6 +1029,9 @@ static void main_window_init()
 		MoveWindow(wh.ipxwrapper_port, BOX_SIDE_PAD + 5 + lbl_w, box_ipxwrapper_options_y, port_w, edit_h, TRUE);
 		box_ipxwrapper_options_y += edit_h;
 		
+		MoveWindow(wh.ipxwrapper_coalesce, BOX_SIDE_PAD, box_ipxwrapper_options_y, BOX_INNER_WIDTH, text_h, TRUE);
+		box_ipxwrapper_options_y += text_h;
+		
 		MoveWindow(wh.ipxwrapper_fw_except, BOX_SIDE_PAD, box_ipxwrapper_options_y, BOX_INNER_WIDTH, text_h, TRUE);
 		box_ipxwrapper_options_y += text_h;
 		
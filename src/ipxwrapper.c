@@ -29,11 +29,17 @@
 #include <time.h>
 
 #include "ipxwrapper.h"
+#include "capture.h"
 #include "common.h"
 #include "funcprof.h"
 #include "interface.h"
 #include "router.h"
 #include "addrcache.h"
+#include "pacer.h"
+#include "peerstats.h"
+#include "slab.h"
+#include "sockindex.h"
+#include "statsmem.h"
 
 extern const char *version_string;
 extern const char *compile_time;
@@ -44,9 +50,20 @@ struct ipaddr_list {
 };
 
 ipx_socket *sockets = NULL;
+
+/* Bound IPX sockets which are able to receive packets, indexed by socket
+ * number for deliver_packet().
+*/
+ipx_socket_index *ipx_recv_index = NULL;
+
+/* Listening SPX sockets, indexed by socket number for IPX_MAGIC_SPXLOOKUP. */
+ipx_socket_index *spx_listen_index = NULL;
 main_config_t main_config;
 
-static CRITICAL_SECTION sockets_cs;
+/* Protects the structure of the sockets table and indexes above, see the
+ * comment above struct ipx_socket for details.
+*/
+static rwlock_t sockets_lock;
 
 typedef ULONGLONG WINAPI (*GetTickCount64_t)(void);
 static HMODULE kernel32 = NULL;
@@ -61,11 +78,19 @@ static uint64_t perf_counter_freq = 0;
 
 const unsigned int ipxwrapper_fstats_size = sizeof(ipxwrapper_fstats) / sizeof(*ipxwrapper_fstats);
 
-unsigned int send_packets = 0, send_bytes = 0;  /* Sent from emulated socket */
-unsigned int recv_packets = 0, recv_bytes = 0;  /* Forwarded to emulated socket */
+/* These counters are never reset, they are exported by statsmem.c and the
+ * periodic log report logs the difference since the last one.
+*/
+
+uint64_t send_packets = 0, send_bytes = 0;  /* Sent from emulated socket */
+uint64_t recv_packets = 0, recv_bytes = 0;  /* Forwarded to emulated socket */
+
+uint64_t send_packets_udp = 0, send_bytes_udp = 0;  /* Sent over UDP transport */
+uint64_t recv_packets_udp = 0, recv_bytes_udp = 0;  /* Received over UDP transport */
+
+unsigned int coalesce_max_delay = 0;  /* Longest time data waited to be coalesced since the last report (microseconds) */
 
-unsigned int send_packets_udp = 0, send_bytes_udp = 0;  /* Sent over UDP transport */
-unsigned int recv_packets_udp = 0, recv_bytes_udp = 0;  /* Received over UDP transport */
+uint64_t coalesce_table_hits = 0, coalesce_table_misses = 0, coalesce_table_evictions = 0;
 
 static void init_cs(CRITICAL_SECTION *cs)
 {
@@ -79,25 +104,178 @@ static void init_cs(CRITICAL_SECTION *cs)
 static HANDLE prof_thread_handle = NULL;
 static HANDLE prof_thread_exit = NULL;
 
+/* Copy the traffic counters of a socket. The caller must hold a reference to
+ * the socket, but doesn't need to hold its lock.
+*/
+void ipx_socket_read_stats(ipx_socket *sock, IPX_SOCKET_STATS_DATA *out)
+{
+	#define READ_STAT(name) out->name = __atomic_load_n(&(sock->stats.name), __ATOMIC_RELAXED)
+	
+	READ_STAT(send_packets);
+	READ_STAT(send_bytes);
+	READ_STAT(send_deferred);
+	READ_STAT(send_queue_full);
+	READ_STAT(send_errors);
+	
+	READ_STAT(recv_packets);
+	READ_STAT(recv_bytes);
+	READ_STAT(recv_queue_full);
+	READ_STAT(recv_drops);
+	
+	#undef READ_STAT
+}
+
+/* Returns how much a counter has gone up since the value in last, and updates
+ * last to its current value.
+*/
+static unsigned int counter_delta(uint64_t *counter, uint64_t *last)
+{
+	uint64_t now = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	uint64_t delta = now - *last;
+	
+	*last = now;
+	
+	return delta;
+}
+
+/* Log the counters of every IPX socket which has sent or received anything. */
+static void report_socket_stats(void)
+{
+	lock_sockets_shared();
+	
+	unsigned int max_sockets = HASH_COUNT(sockets);
+	
+	SOCKET *fds = malloc(max_sockets * sizeof(SOCKET));
+	IPX_SOCKET_STATS_DATA *stats = malloc(max_sockets * sizeof(IPX_SOCKET_STATS_DATA));
+	
+	unsigned int n_sockets = 0;
+	
+	if(fds != NULL && stats != NULL)
+	{
+		/* The stats of a socket in the table can be read without
+		 * locking it, the table holds a reference.
+		*/
+		
+		ipx_socket *sock, *tmp;
+		HASH_ITER(hh, sockets, sock, tmp)
+		{
+			if(!(sock->flags & IPX_IS_SPX))
+			{
+				fds[n_sockets] = sock->fd;
+				ipx_socket_read_stats(sock, &(stats[n_sockets]));
+				
+				++n_sockets;
+			}
+		}
+	}
+	
+	unlock_sockets_shared();
+	
+	for(unsigned int i = 0; i < n_sockets; ++i)
+	{
+		IPX_SOCKET_STATS_DATA *s = &(stats[i]);
+		
+		if(s->send_packets == 0 && s->send_errors == 0 && s->recv_packets == 0 && s->recv_drops == 0)
+		{
+			continue;
+		}
+		
+		log_printf(LOG_INFO, "Socket %d sent %llu packets (%llu bytes), %llu deferred by rate limits, send queue full %llu times, %llu errors",
+			(int)(fds[i]),
+			(unsigned long long)(s->send_packets), (unsigned long long)(s->send_bytes),
+			(unsigned long long)(s->send_deferred), (unsigned long long)(s->send_queue_full),
+			(unsigned long long)(s->send_errors));
+		
+		log_printf(LOG_INFO, "Socket %d received %llu packets (%llu bytes), receive queue full %llu times, %llu dropped",
+			(int)(fds[i]),
+			(unsigned long long)(s->recv_packets), (unsigned long long)(s->recv_bytes),
+			(unsigned long long)(s->recv_queue_full), (unsigned long long)(s->recv_drops));
+	}
+	
+	free(stats);
+	free(fds);
+}
+
+/* Number of peers listed in each profiling report. */
+#define REPORT_PEERS 16
+
+/* Log the counters of the most recently active peers. */
+static void report_peer_stats(void)
+{
+	peer_stats peers[REPORT_PEERS];
+	unsigned int n_peers = peerstats_read(peers, REPORT_PEERS);
+	
+	DWORD now = GetTickCount();
+	
+	for(unsigned int i = 0; i < n_peers; ++i)
+	{
+		peer_stats *p = &(peers[i]);
+		
+		char net_s[ADDR32_STRING_SIZE], node_s[ADDR48_STRING_SIZE];
+		addr32_string(net_s, p->net);
+		addr48_string(node_s, p->node);
+		
+		log_printf(LOG_INFO, "Peer %s/%s sent %llu packets (%llu bytes), received %llu packets (%llu bytes), last active %u ms ago",
+			net_s, node_s,
+			(unsigned long long)(p->send_packets), (unsigned long long)(p->send_bytes),
+			(unsigned long long)(p->recv_packets), (unsigned long long)(p->recv_bytes),
+			(unsigned)(now - p->last_seen));
+	}
+	
+	uint64_t evictions = peerstats_evictions();
+	if(evictions > 0)
+	{
+		log_printf(LOG_INFO, "%llu peers forgotten to make room for others", (unsigned long long)(evictions));
+	}
+}
+
 static void report_packet_stats(void)
 {
-	unsigned int my_send_packets = __atomic_exchange_n(&send_packets, 0, __ATOMIC_RELAXED);
-	unsigned int my_send_bytes   = __atomic_exchange_n(&send_bytes,   0, __ATOMIC_RELAXED);
+	static uint64_t last_send_packets, last_send_bytes, last_recv_packets, last_recv_bytes;
+	static uint64_t last_send_packets_udp, last_send_bytes_udp, last_recv_packets_udp, last_recv_bytes_udp;
+	static uint64_t last_coalesce_table_hits, last_coalesce_table_misses, last_coalesce_table_evictions;
 	
-	unsigned int my_recv_packets = __atomic_exchange_n(&recv_packets, 0, __ATOMIC_RELAXED);
-	unsigned int my_recv_bytes   = __atomic_exchange_n(&recv_bytes,   0, __ATOMIC_RELAXED);
+	unsigned int my_send_packets = counter_delta(&send_packets, &last_send_packets);
+	unsigned int my_send_bytes   = counter_delta(&send_bytes,   &last_send_bytes);
 	
-	unsigned int my_send_packets_udp = __atomic_exchange_n(&send_packets_udp, 0, __ATOMIC_RELAXED);
-	unsigned int my_send_bytes_udp   = __atomic_exchange_n(&send_bytes_udp,   0, __ATOMIC_RELAXED);
+	unsigned int my_recv_packets = counter_delta(&recv_packets, &last_recv_packets);
+	unsigned int my_recv_bytes   = counter_delta(&recv_bytes,   &last_recv_bytes);
 	
-	unsigned int my_recv_packets_udp = __atomic_exchange_n(&recv_packets_udp, 0, __ATOMIC_RELAXED);
-	unsigned int my_recv_bytes_udp   = __atomic_exchange_n(&recv_bytes_udp,   0, __ATOMIC_RELAXED);
+	unsigned int my_send_packets_udp = counter_delta(&send_packets_udp, &last_send_packets_udp);
+	unsigned int my_send_bytes_udp   = counter_delta(&send_bytes_udp,   &last_send_bytes_udp);
+	
+	unsigned int my_recv_packets_udp = counter_delta(&recv_packets_udp, &last_recv_packets_udp);
+	unsigned int my_recv_bytes_udp   = counter_delta(&recv_bytes_udp,   &last_recv_bytes_udp);
 	
 	log_printf(LOG_INFO, "IPX sockets sent %u packets (%u bytes)", my_send_packets, my_send_bytes);
 	log_printf(LOG_INFO, "IPX sockets received %u packets (%u bytes)", my_recv_packets, my_recv_bytes);
 	
 	log_printf(LOG_INFO, "UDP sockets sent %u packets (%u bytes)", my_send_packets_udp, my_send_bytes_udp);
 	log_printf(LOG_INFO, "UDP sockets received %u packets (%u bytes)", my_recv_packets_udp, my_recv_bytes_udp);
+	
+	size_t slab_reserved, slab_used;
+	slab_stats(&slab_reserved, &slab_used);
+	
+	log_printf(LOG_INFO, "Packet buffers using %u of %u bytes allocated", (unsigned)(slab_used), (unsigned)(slab_reserved));
+	
+	if(pacer_enabled())
+	{
+		pacer_report_stats();
+	}
+	
+	if((ipx_encap_type == ENCAP_TYPE_DOSBOX && main_config.dosbox_coalesce)
+		|| (ipx_encap_type == ENCAP_TYPE_IPXWRAPPER && main_config.udp_coalesce))
+	{
+		unsigned int my_coalesce_max_delay = __atomic_exchange_n(&coalesce_max_delay, 0, __ATOMIC_RELAXED);
+		log_printf(LOG_INFO, "Coalesced packets waited at most %u microseconds", my_coalesce_max_delay);
+		
+		unsigned int my_coalesce_table_hits      = counter_delta(&coalesce_table_hits,      &last_coalesce_table_hits);
+		unsigned int my_coalesce_table_misses    = counter_delta(&coalesce_table_misses,    &last_coalesce_table_misses);
+		unsigned int my_coalesce_table_evictions = counter_delta(&coalesce_table_evictions, &last_coalesce_table_evictions);
+		
+		log_printf(LOG_INFO, "Coalescing table lookups: %u hits, %u misses, %u evictions",
+			my_coalesce_table_hits, my_coalesce_table_misses, my_coalesce_table_evictions);
+	}
 }
 
 static DWORD WINAPI prof_thread_main(LPVOID lpParameter)
@@ -109,6 +287,8 @@ static DWORD WINAPI prof_thread_main(LPVOID lpParameter)
 		fprof_report(STUBS_DLL_NAME, stub_fstats, NUM_STUBS);
 		fprof_report("ipxwrapper.dll", ipxwrapper_fstats, ipxwrapper_fstats_size);
 		report_packet_stats();
+		report_socket_stats();
+		report_peer_stats();
 	}
 	
 	return 0;
@@ -131,6 +311,8 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 		
 		main_config = get_main_config(false);
 		min_log_level = main_config.log_level;
+		log_start(main_config.log_queue_drop);
+		
 		ipx_encap_type = main_config.encap_type;
 		
 		log_printf(LOG_INFO, "IPXWrapper %s", version_string);
@@ -155,10 +337,18 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 		}
 		
 		addr_cache_init();
+		peerstats_init();
+		
+		if(main_config.profile)
+		{
+			peerstats_enable();
+		}
 		
 		ipx_interfaces_init();
 		
-		init_cs(&sockets_cs);
+		rwlock_init(&sockets_lock);
+		
+		slab_init();
 		
 		WSADATA wsdata;
 		int err = WSAStartup(MAKEWORD(1,1), &wsdata);
@@ -168,11 +358,26 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 			return FALSE;
 		}
 		
+		if(main_config.capture_file != NULL && main_config.capture_file[0] != '\0')
+		{
+			capture_init(main_config.capture_file);
+		}
+		
 		router_init();
 		
+		pacer_config pacer_limits = {
+			.total  = { main_config.rate_limit_packets, main_config.rate_limit_bytes },
+			.socket = { main_config.socket_rate_limit_packets, main_config.socket_rate_limit_bytes },
+			.dest   = { main_config.dest_rate_limit_packets, main_config.dest_rate_limit_bytes },
+		};
+		
+		pacer_init(&pacer_limits, GetTickCount());
+		pacer_start();
+		
 		if(main_config.profile)
 		{
 			stubs_enable_profile = true;
+			fprof_enabled = true;
 			
 			prof_thread_exit = CreateEvent(NULL, FALSE, FALSE, NULL);
 			if(prof_thread_exit != NULL)
@@ -198,6 +403,11 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 					w32_error(GetLastError()));
 			}
 		}
+		
+		if(main_config.stats_export)
+		{
+			statsmem_init();
+		}
 	}
 	else if(fdwReason == DLL_PROCESS_DETACH)
 	{
@@ -205,9 +415,14 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 		 * than the DLL being unloaded dynamically and any threads will have been terminated
 		 * at unknown points, meaning any global data may be in an inconsistent state and we
 		 * cannot (safely) clean up. MSDN states we should do nothing.
+		 *
+		 * The one exception is writing out any messages left in the log queue by the
+		 * (terminated) log writer thread, which only reads the queue and appends to the
+		 * log file, so that the messages leading up to the exit aren't lost.
 		*/
 		if(lpvReserved != NULL)
 		{
+			log_flush();
 			return TRUE;
 		}
 		
@@ -227,11 +442,19 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 			prof_thread_exit = NULL;
 		}
 		
+		statsmem_cleanup();
+		
+		pacer_cleanup();
+		
 		router_cleanup();
 		
+		capture_cleanup();
+		
 		WSACleanup();
 		
-		DeleteCriticalSection(&sockets_cs);
+		rwlock_destroy(&sockets_lock);
+		
+		slab_cleanup();
 		
 		ipx_interfaces_cleanup();
 		
@@ -245,8 +468,11 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 			fprof_report("ipxwrapper.dll", ipxwrapper_fstats, ipxwrapper_fstats_size);
 			
 			report_packet_stats();
+			report_peer_stats();
 		}
 		
+		peerstats_cleanup();
+		
 		log_close();
 		
 		if(kernel32)
@@ -262,21 +488,76 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 	return TRUE;
 }
 
-/* Lock the sockets table and search for one by file descriptor.
+/* Initialise the lock and reference count of a new socket and add it to the
+ * sockets table. Returns false if the lock could not be initialised.
+*/
+bool add_socket(ipx_socket *sock)
+{
+	if(!InitializeCriticalSectionAndSpinCount(&(sock->lock), 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		return false;
+	}
+	
+	/* Reference held by the sockets table. */
+	sock->refcount = 1;
+	
+	lock_sockets();
+	HASH_ADD_INT(sockets, fd, sock);
+	unlock_sockets();
+	
+	return true;
+}
+
+/* Remove a socket from the sockets table and any index it is a member of,
+ * then drop the table's reference to it. The caller must hold the socket's
+ * lock and a reference, anything else waiting for the lock will see
+ * IPX_CLOSED set once it gets it.
+*/
+void remove_socket(ipx_socket *sock)
+{
+	lock_sockets();
+	
+	sockindex_remove(sock);
+	HASH_DEL(sockets, sock);
+	
+	unlock_sockets();
+	
+	sock->flags |= IPX_CLOSED;
+	unref_socket(sock);
+}
+
+/* Search the sockets table for a socket by file descriptor.
  *
- * Returns an ipx_socket pointer on success, unlocks the sockets table and
- * returns NULL if no match is found.
+ * Returns an ipx_socket pointer with its lock held and a reference taken on
+ * success, which must be given up using release_socket(). Returns NULL if no
+ * match is found.
 */
 ipx_socket *get_socket(SOCKET sockfd)
 {
-	lock_sockets();
+	lock_sockets_shared();
 	
 	ipx_socket *sock;
 	HASH_FIND_INT(sockets, &sockfd, sock);
 	
-	if(!sock)
+	if(sock)
 	{
-		unlock_sockets();
+		ref_socket(sock);
+	}
+	
+	unlock_sockets_shared();
+	
+	if(sock)
+	{
+		lock_socket(sock);
+		
+		if(sock->flags & IPX_CLOSED)
+		{
+			/* Closed while we were waiting for the lock. */
+			
+			release_socket(sock);
+			sock = NULL;
+		}
 	}
 	
 	return sock;
@@ -289,27 +570,74 @@ ipx_socket *get_socket_wait_for_ready(SOCKET sockfd, int timeout_ms)
 	
 	if(sock)
 	{
-		unlock_sockets();
+		release_socket(sock);
 		wait_for_ready(timeout_ms);
 		
 		sock = get_socket(sockfd);
 	}
 	
 	return sock;
-	lock_sockets();
 }
 
-/* Lock the mutex */
+/* Unlock a socket returned by get_socket() and release the reference. */
+void release_socket(ipx_socket *sock)
+{
+	unlock_socket(sock);
+	unref_socket(sock);
+}
+
+/* Lock a socket which the caller holds a reference to. */
+void lock_socket(ipx_socket *sock)
+{
+	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_lock_socket]));
+	EnterCriticalSection(&(sock->lock));
+}
+
+/* Unlock a socket without releasing the reference. */
+void unlock_socket(ipx_socket *sock)
+{
+	LeaveCriticalSection(&(sock->lock));
+}
+
+void ref_socket(ipx_socket *sock)
+{
+	__atomic_add_fetch(&(sock->refcount), 1, __ATOMIC_RELAXED);
+}
+
+/* Release a reference to a socket, freeing it if it was the last one. */
+void unref_socket(ipx_socket *sock)
+{
+	if(__atomic_sub_fetch(&(sock->refcount), 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		DeleteCriticalSection(&(sock->lock));
+		free(sock);
+	}
+}
+
+/* Lock the sockets table for modification. */
 void lock_sockets(void)
 {
 	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_lock_sockets]));
-	EnterCriticalSection(&sockets_cs);
+	rwlock_lock_exclusive(&sockets_lock);
 }
 
-/* Unlock the mutex */
 void unlock_sockets(void)
 {
-	LeaveCriticalSection(&sockets_cs);
+	rwlock_unlock_exclusive(&sockets_lock);
+}
+
+/* Lock the sockets table for lookups, any number of threads may hold the
+ * lock shared at once.
+*/
+void lock_sockets_shared(void)
+{
+	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_lock_sockets]));
+	rwlock_lock_shared(&sockets_lock);
+}
+
+void unlock_sockets_shared(void)
+{
+	rwlock_unlock_shared(&sockets_lock);
 }
 
 uint64_t get_ticks(void)
@@ -22,6 +22,7 @@
 #include <windows.h>
 #include <iphlpapi.h>
 #include <wsipx.h>
+#include <wsnwlink.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <uthash.h>
@@ -29,6 +30,7 @@
 #include "config.h"
 #include "funcprof.h"
 #include "router.h"
+#include "rwlock.h"
 
 /* The standard Windows driver (in XP) only allows 1467 bytes anyway */
 #define MAX_DATA_SIZE 8192
@@ -57,43 +59,84 @@
 #define IPX_IS_SPXII	(int)(1<<11)
 #define IPX_LISTENING	(int)(1<<12)
 #define IPX_CONNECT_OK	(int)(1<<13)
+#define IPX_CLOSED	(int)(1<<14)
+#define IPX_NONBLOCK	(int)(1<<15)
 
 typedef struct ipx_socket ipx_socket;
 typedef struct ipx_packet ipx_packet;
-
-#define RECV_QUEUE_MAX_PACKETS 32
+typedef struct ipx_socket_index ipx_socket_index;
 
 #define IPX_RECV_QUEUE_FREE -1
 #define IPX_RECV_QUEUE_LOCKED -2
 
+/* Size of a doorbell datagram, which is too small to be a valid packet. */
+#define RECV_QUEUE_DOORBELL_SIZE 1
+
 /* Any AF_IPX IPX socket has an associated recv_queue.
  *
- * When a recv_pump() operation is running, the sockets lock has to be released
- * in case the recv() blocks, which means the socket could be closed before it
- * regains the lock.
+ * Packets are placed into the queue either directly by deliver_packet() in
+ * the router thread, or by recv_pump() reading them from the loopback UDP
+ * socket when deliver_packet() had to fall back to relaying them because the
+ * queue was full.
+ *
+ * When deliver_packet() queues a packet directly, it also sends a 1 byte
+ * "doorbell" datagram to the underlying UDP socket so that anything waiting on
+ * it (blocking recv(), select(), WSAAsyncSelect(), etc) is woken up. Only one
+ * doorbell is outstanding at a time, doorbell_pending is set when one is sent
+ * and cleared when recv_pump() reads it back. recv_packet() reads the doorbell
+ * out as soon as it takes a packet from the queue, so another one can be rung
+ * for the next packet to raise a new FD_READ event.
+ *
+ * n_relayed counts the packets which deliver_packet() has relayed that
+ * recv_pump() hasn't read back yet. While it is non-zero, deliver_packet()
+ * keeps relaying packets rather than queueing them directly, so they can't
+ * overtake the ones still waiting in the UDP receive buffer. recv_pump()
+ * decrements it once for each relayed datagram it reads back.
+ *
+ * When a recv_pump() operation is running, the socket's lock has to be
+ * released in case the recv() blocks, which means the socket could be closed
+ * before it regains the lock.
  *
  * An ipx_recv_queue isn't destroyed until the refcount reaches zero. The
  * ipx_socket holds one reference and each in-progress recv_pump() also holds a
- * reference while the sockets lock isn't held.
+ * reference while the socket's lock isn't held.
  *
  * Access to the refcount is protected by refcount_lock.
  *
- * data[] holds an array of buffers for each queued packet, the status and size
- * of which is indicated by the sizes[] array.
+ * The queue is only allocated when an IPX socket is bound, with enough slots
+ * for main_config.recv_queue_depth packets. The slot arrays are allocated
+ * along with the ipx_recv_queue structure itself.
  *
- * If sizes[x] is IPX_RECV_QUEUE_FREE, the buffer is available to be claimed by
- * a recv_pump() operation, which then sets it to IPX_RECV_QUEUE_LOCKED until
- * it completes, which prevents a recv_pump() in another thread from trying to
- * use the same receive buffer. Once a packet is read in, sizes[x] is set to
- * the size of the packet and x is added to the end of the ready[] array.
+ * data[] holds a buffer for each queued packet, allocated from the slab
+ * allocator (see slab.h) at the actual size of the packet when it is queued
+ * and released when it is read. The status and size of each slot is indicated
+ * by the sizes[] array, data[x] is NULL while a slot is free or locked.
  *
- * When a read is requested, the packet will be read from the data[] index
- * stored in ready[0], and unless MSG_PEEK was used, that slot will then be
- * released (sizes[x] set to IPX_RECV_QUEUE_FREE) and any subsequent slots in
- * read[] will be advanced for the next read to pick up from ready[0].
+ * If sizes[x] is IPX_RECV_QUEUE_FREE, the slot is available to be claimed by
+ * deliver_packet() or a recv_pump() operation. recv_pump() sets it to
+ * IPX_RECV_QUEUE_LOCKED until it completes, which prevents a recv_pump() in
+ * another thread from trying to use the same slot. Once a packet is read in,
+ * data[x] is set to a copy of it, sizes[x] is set to the size of the packet
+ * and x is added to the end of the ready list.
  *
- * Access to the ready, n_ready and sizes members is only permitted when a
- * thread holds the main sockets lock.
+ * Free slots are also tracked in the free_slots bitmap, where the bit for
+ * each free slot is set, and free_summary has a bit set for each word of
+ * free_slots with any bits set, so a free slot can be found using two
+ * count-trailing-zeros operations rather than searching sizes[].
+ *
+ * ready[] is a ring buffer of the slot indices of queued packets in the order
+ * they were received, n_ready entries long starting from ready_head.
+ *
+ * When a read is requested, the packet will be read from the slot at the head
+ * of the ready list, and unless MSG_PEEK was used, that slot will then be
+ * removed from the list and released (data[x] freed and sizes[x] set to
+ * IPX_RECV_QUEUE_FREE).
+ *
+ * The functions in recvqueue.h should be used to manipulate the queue.
+ *
+ * Access to the ready, ready_head, n_ready, doorbell_pending, n_relayed,
+ * free_summary, free_slots, data and sizes members is only permitted when a
+ * thread holds the lock of the socket which owns the queue.
 */
 
 struct ipx_recv_queue
@@ -101,18 +144,56 @@ struct ipx_recv_queue
 	CRITICAL_SECTION refcount_lock;
 	int refcount;
 	
-	int ready[RECV_QUEUE_MAX_PACKETS];
+	int depth;
+	
+	int *ready;
+	int ready_head;
 	int n_ready;
 	
-	unsigned char data[RECV_QUEUE_MAX_PACKETS][MAX_PKT_SIZE];
-	int sizes[RECV_QUEUE_MAX_PACKETS];
+	bool doorbell_pending;
+	int n_relayed;
+	
+	uint32_t free_summary;
+	uint32_t *free_slots;
+	
+	unsigned char **data;
+	int *sizes;
 };
 
 typedef struct ipx_recv_queue ipx_recv_queue;
 
+/* Each ipx_socket has its own lock, which must be held to access any of its
+ * members other than fd, refcount, stats and the table links (hh, index_prev
+ * and index_next). The sockets table (the sockets hash and the socket number
+ * indexes) is protected separately by a reader/writer lock, which is only held
+ * long enough to look up or modify the table and never while making system
+ * calls.
+ *
+ * A socket's lock may be acquired and then the sockets table lock, but never
+ * the other way around. Changing which index a socket is a member of requires
+ * both its lock and the sockets table lock held exclusively, so either one is
+ * sufficient to read its index member, but the links between sockets in an
+ * index may only be followed with the sockets table lock held. The addr and
+ * port members of a socket don't change while it is in an index, so they may
+ * also be read by a thread which found the socket that way.
+ *
+ * get_socket() returns a socket with its lock held and a reference taken,
+ * both of which are given up by release_socket(). A thread which needs to
+ * block (e.g. in recv()) can release just the lock with unlock_socket() and
+ * reacquire it with lock_socket(), but must check for IPX_CLOSED afterwards
+ * in case the application closed the socket in the meantime.
+ *
+ * The sockets table holds one reference, which closesocket() gives up after
+ * removing the socket from the table and setting IPX_CLOSED. The ipx_socket
+ * is freed when the last reference is released.
+*/
+
 struct ipx_socket {
 	SOCKET fd;
 	
+	CRITICAL_SECTION lock;
+	int refcount;
+	
 	/* Locally bound UDP port number (Network byte order).
 	 * Undefined before IPX bind() call.
 	*/
@@ -122,6 +203,9 @@ struct ipx_socket {
 	uint8_t s_ptype;
 	uint8_t f_ptype;	/* Undefined when IPX_FILTER isn't set */
 	
+	/* IPX_PRIORITY_XXX value set using the IPX_PRIORITY option. */
+	int priority;
+	
 	/* The following values are undefined when IPX_BOUND is not set */
 	struct sockaddr_ipx addr;
 	HANDLE sock_mut;
@@ -131,6 +215,24 @@ struct ipx_socket {
 	
 	struct ipx_recv_queue *recv_queue;
 	
+	/* Rate limits and packets waiting to be sent by the pacer thread,
+	 * NULL until the first sendto() while rate limiting is enabled. See
+	 * pacer.h.
+	*/
+	struct pacer_socket *pacer;
+	
+	/* Traffic counters returned by the IPX_SOCKET_STATS option. These are
+	 * only ever updated and read atomically, so they may be accessed
+	 * without holding the socket's lock by any thread with a reference.
+	*/
+	IPX_SOCKET_STATS_DATA stats;
+	
+	/* Socket number index this socket is listed in (NULL if none), see
+	 * sockindex.h for details.
+	*/
+	ipx_socket_index **index;
+	ipx_socket *index_prev, *index_next;
+	
 	UT_hash_handle hh;
 };
 
@@ -149,8 +251,10 @@ struct ipx_packet {
 	char data[1];
 } __attribute__((__packed__));
 
-#define IPX_MAGIC_SPXLOOKUP 1
-#define IPX_MAGIC_COALESCED 2
+#define IPX_MAGIC_SPXLOOKUP      1
+#define IPX_MAGIC_COALESCED      2
+#define IPX_MAGIC_COALESCE_QUERY 3
+#define IPX_MAGIC_COALESCE_REPLY 4
 
 typedef struct spxlookup_req spxlookup_req_t;
 
@@ -176,6 +280,19 @@ struct spxlookup_reply
 	char padding[18];
 }  __attribute__((__packed__));
 
+typedef struct coalesce_query coalesce_query_t;
+
+/* Payload of IPX_MAGIC_COALESCE_QUERY packets and the matching
+ * IPX_MAGIC_COALESCE_REPLY, identifies the destination which the sender
+ * wants to start coalescing packets to.
+*/
+struct coalesce_query
+{
+	unsigned char net[4];
+	unsigned char node[6];
+	uint16_t socket;
+} __attribute__((__packed__));
+
 typedef struct spxinit spxinit_t;
 
 struct spxinit
@@ -188,9 +305,12 @@ struct spxinit
 } __attribute__((__packed__));
 
 extern ipx_socket *sockets;
+extern ipx_socket_index *ipx_recv_index;
+extern ipx_socket_index *spx_listen_index;
 extern main_config_t main_config;
 
 extern struct FuncStats ipxwrapper_fstats[];
+extern const unsigned int ipxwrapper_fstats_size;
 
 enum {
 	#define FPROF_DECL(func) IPXWRAPPER_FSTATS_ ## func,
@@ -198,21 +318,46 @@ enum {
 	#undef FPROF_DECL
 };
 
-extern unsigned int send_packets, send_bytes;  /* Sent from emulated socket */
-extern unsigned int recv_packets, recv_bytes;  /* Forwarded to emulated socket */
+extern uint64_t send_packets, send_bytes;  /* Sent from emulated socket */
+extern uint64_t recv_packets, recv_bytes;  /* Forwarded to emulated socket */
+
+extern uint64_t send_packets_udp, send_bytes_udp;  /* Sent over UDP transport */
+extern uint64_t recv_packets_udp, recv_bytes_udp;  /* Received over UDP transport */
 
-extern unsigned int send_packets_udp, send_bytes_udp;  /* Sent over UDP transport */
-extern unsigned int recv_packets_udp, recv_bytes_udp;  /* Received over UDP transport */
+extern unsigned int coalesce_max_delay;  /* Longest time data waited to be coalesced since the last report (microseconds) */
 
+extern uint64_t coalesce_table_hits, coalesce_table_misses, coalesce_table_evictions;
+
+bool add_socket(ipx_socket *sock);
+void remove_socket(ipx_socket *sock);
 ipx_socket *get_socket(SOCKET sockfd);
 ipx_socket *get_socket_wait_for_ready(SOCKET sockfd, int timeout_ms);
+void release_socket(ipx_socket *sock);
+void lock_socket(ipx_socket *sock);
+void unlock_socket(ipx_socket *sock);
+void ref_socket(ipx_socket *sock);
+void unref_socket(ipx_socket *sock);
+void ipx_socket_read_stats(ipx_socket *sock, IPX_SOCKET_STATS_DATA *out);
 void lock_sockets(void);
 void unlock_sockets(void);
+void lock_sockets_shared(void);
+void unlock_sockets_shared(void);
 uint64_t get_ticks(void);
 uint64_t get_uticks(void);
 
 void add_self_to_firewall(void);
 
+DWORD ipx_send_packet(
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size);
+
 INT APIENTRY r_EnumProtocolsA(LPINT,LPVOID,LPDWORD);
 INT APIENTRY r_EnumProtocolsW(LPINT,LPVOID,LPDWORD);
 int PASCAL FAR r_WSARecvEx(SOCKET,char*,int,int*);
@@ -233,6 +378,7 @@ int PASCAL r_getpeername(SOCKET fd, struct sockaddr *addr, int *addrlen);
 int PASCAL r_listen(SOCKET s, int backlog);
 SOCKET PASCAL r_accept(SOCKET s, struct sockaddr *addr, int *addrlen);
 int PASCAL r_WSAAsyncSelect(SOCKET s, HWND hWnd, unsigned int wMsg, long lEvent);
+int WSAAPI r_WSAEventSelect(SOCKET s, WSAEVENT hEventObject, long lNetworkEvents);
 int WSAAPI r_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, const PTIMEVAL timeout);
 
 #endif /* !IPXWRAPPER_H */
@@ -1,8 +1,10 @@
 FPROF_DECL(deliver_packet)
+FPROF_DECL(deliver_packets)
 FPROF_DECL(_handle_udp_recv)
 FPROF_DECL(_handle_dosbox_recv)
 FPROF_DECL(_handle_pcap_frame)
 FPROF_DECL(lock_sockets)
+FPROF_DECL(lock_socket)
 FPROF_DECL(ioctlsocket_recv_pump)
 FPROF_DECL(ioctlsocket_accumulate)
 FPROF_DECL(recv_pump_select)
@@ -1,5 +1,5 @@
 /* ipxwrapper - Logging functions
- * Copyright (C) 2011-2024 Daniel Collins <solemnwarning@solemnwarning.net>
+ * Copyright (C) 2011-2026 Daniel Collins <solemnwarning@solemnwarning.net>
  *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License version 2 as published by
@@ -23,15 +23,55 @@
 
 #include "ipxwrapper.h"
 #include "common.h"
+#include "logring.h"
+
+/* Once log_start() has been called, log_printf() formats each message into a
+ * slot in log_queue and returns, leaving the log writer thread to append them
+ * to the log file in batches. Before log_start() (or if the writer couldn't
+ * be started) and after log_close() or log_flush(), messages are written out by
+ * the calling thread instead.
+ *
+ * When the queue is full, messages are either dropped (and counted, so the
+ * log shows how many were lost) or the caller waits for the writer to make
+ * room, depending on the "log queue full" setting.
+*/
+
+#define LOG_QUEUE_SIZE 128
+
+/* Size of the buffer lines are batched up in by the writer, and the most any
+ * single line can take up.
+*/
+#define LOG_BATCH_SIZE 65536
+#define LOG_LINE_MAX   (LOG_RECORD_MAX + 64)
 
 static HANDLE log_fh = NULL;
 static HANDLE log_mutex = NULL;
 
+static LONGLONG log_counter_freq = 0;
+
+static log_ring *log_queue = NULL;
+static bool log_drop_when_full = false;
+static unsigned int log_dropped = 0;
+
+static HANDLE log_wake_event = NULL;
+static HANDLE log_thread = NULL;
+static bool log_writer_started = false;
+static bool log_writer_idle = false;
+static bool log_exit = false;
+
+static char log_batch[LOG_BATCH_SIZE];
+
 void log_init()
 {
 	if(!(log_mutex = CreateMutex(NULL, FALSE, NULL))) {
 		abort();
 	}
+	
+	LARGE_INTEGER freq;
+	if(QueryPerformanceFrequency(&freq))
+	{
+		log_counter_freq = freq.QuadPart;
+	}
 }
 
 void log_open(const char *file) {
@@ -50,26 +90,59 @@ void log_open(const char *file) {
 	}
 }
 
-void log_close() {
-	if(log_fh) {
-		CloseHandle(log_fh);
-		log_fh = NULL;
+/* Monotonic timestamp in performance counter ticks, or milliseconds if the
+ * performance counter isn't available.
+*/
+static uint64_t log_timestamp(void)
+{
+	LARGE_INTEGER now;
+	if(log_counter_freq > 0 && QueryPerformanceCounter(&now))
+	{
+		return now.QuadPart;
 	}
-	
-	if(log_mutex) {
-		CloseHandle(log_mutex);
-		log_mutex = NULL;
+	else{
+		return GetTickCount();
 	}
 }
 
-void log_printf(enum ipx_log_level level, const char *fmt, ...) {
-	DWORD called = GetTickCount();
+/* Format a line of the log file into buf, returns the length of the line. */
+static size_t log_format_line(char *buf, size_t bufsize, uint64_t timestamp, DWORD thread_id, const char *msg)
+{
+	uint64_t freq = log_counter_freq > 0 ? log_counter_freq : 1000;
 	
-	if(level < min_log_level) {
-		return;
+	unsigned int secs  = timestamp / freq;
+	unsigned int usecs = ((timestamp % freq) * 1000000) / freq;
+	
+	int len = snprintf(buf, bufsize, "[%u.%06u, thread %u] %s\r\n", secs, usecs, (unsigned int)(thread_id), msg);
+	
+	if(len < 0)
+	{
+		return 0;
+	}
+	else if((size_t)(len) >= bufsize)
+	{
+		/* Truncated, make sure it still ends with a newline. */
+		
+		len = bufsize - 1;
+		
+		buf[len - 2] = '\r';
+		buf[len - 1] = '\n';
 	}
 	
-	WaitForSingleObject(log_mutex, INFINITE);
+	return len;
+}
+
+/* Append data to the log file, opening it first if necessary. The log file is
+ * locked so that lines from other processes (and other DLLs within this one)
+ * don't end up interleaved.
+*/
+static void log_write(const char *data, size_t size)
+{
+	/* If the mutex was abandoned, the thread holding it was terminated
+	 * while writing to the log and may have left the file locked, which
+	 * we would wait on forever, so just write without the file lock.
+	*/
+	bool abandoned = WaitForSingleObject(log_mutex, INFINITE) == WAIT_ABANDONED;
 	
 	if(!log_fh) {
 		log_open("ipxwrapper.log");
@@ -80,34 +153,319 @@ void log_printf(enum ipx_log_level level, const char *fmt, ...) {
 		return;
 	}
 	
-	va_list argv;
-	char msg[1024], tstr[64];
-	
-	va_start(argv, fmt);
-	vsnprintf(msg, 1024, fmt, argv);
-	va_end(argv);
-	
-	snprintf(tstr, 64, "[%u.%02u, thread %u] ", (unsigned int)(called/1000), (unsigned int)((called % 1000) / 10), (unsigned int)GetCurrentThreadId());
-	
 	OVERLAPPED off;
 	off.Offset = 0;
 	off.OffsetHigh = 0;
 	off.hEvent = 0;
 	
-	if(!LockFileEx(log_fh, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &off)) {
+	if(!abandoned && !LockFileEx(log_fh, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &off)) {
 		ReleaseMutex(log_mutex);
 		return;
 	}
 	
 	if(SetFilePointer(log_fh, 0, NULL, FILE_END) != INVALID_SET_FILE_POINTER) {
 		DWORD written;
-		
-		WriteFile(log_fh, tstr, strlen(tstr), &written, NULL);
-		WriteFile(log_fh, msg, strlen(msg), &written, NULL);
-		WriteFile(log_fh, "\r\n", 2, &written, NULL);
+		WriteFile(log_fh, data, size, &written, NULL);
 	}
 	
-	UnlockFile(log_fh, 0, 0, 1, 0);
+	if(!abandoned) {
+		UnlockFile(log_fh, 0, 0, 1, 0);
+	}
 	
 	ReleaseMutex(log_mutex);
 }
+
+static DWORD WINAPI log_writer_main(LPVOID lpParameter)
+{
+	log_ring *queue = (log_ring*)(lpParameter);
+	
+	__atomic_store_n(&log_writer_started, true, __ATOMIC_RELEASE);
+	
+	while(1)
+	{
+		size_t used = 0;
+		
+		log_record *record;
+		while((record = log_ring_peek(queue)) != NULL)
+		{
+			if((LOG_BATCH_SIZE - used) < LOG_LINE_MAX)
+			{
+				log_write(log_batch, used);
+				used = 0;
+			}
+			
+			used += log_format_line(log_batch + used, LOG_BATCH_SIZE - used,
+				record->timestamp, record->thread_id, record->msg);
+			
+			log_ring_release(queue);
+		}
+		
+		unsigned int dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+		if(dropped > 0)
+		{
+			if((LOG_BATCH_SIZE - used) < LOG_LINE_MAX)
+			{
+				log_write(log_batch, used);
+				used = 0;
+			}
+			
+			char msg[128];
+			snprintf(msg, sizeof(msg), "%u log messages were dropped because the log queue was full", dropped);
+			
+			used += log_format_line(log_batch + used, LOG_BATCH_SIZE - used,
+				log_timestamp(), GetCurrentThreadId(), msg);
+		}
+		
+		if(used > 0)
+		{
+			log_write(log_batch, used);
+		}
+		
+		if(__atomic_load_n(&log_exit, __ATOMIC_RELAXED))
+		{
+			if(log_ring_peek(queue) == NULL)
+			{
+				break;
+			}
+			
+			continue;
+		}
+		
+		/* Tell log_printf() we need waking before checking the queue
+		 * one last time, so a message committed after the check will
+		 * always signal the event.
+		*/
+		
+		__atomic_store_n(&log_writer_idle, true, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		
+		if(log_ring_peek(queue) == NULL)
+		{
+			WaitForSingleObject(log_wake_event, INFINITE);
+		}
+		
+		__atomic_store_n(&log_writer_idle, false, __ATOMIC_RELAXED);
+	}
+	
+	return 0;
+}
+
+/* Start the log writer thread. Must be called after min_log_level has been
+ * set, since the queue and writer aren't needed when logging is disabled.
+*/
+void log_start(bool drop_when_full)
+{
+	if(min_log_level >= LOG_DISABLED)
+	{
+		return;
+	}
+	
+	log_drop_when_full = drop_when_full;
+	log_dropped = 0;
+	log_writer_started = false;
+	log_writer_idle = false;
+	log_exit = false;
+	
+	log_wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if(log_wake_event == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create log_wake_event event object: %s", w32_error(GetLastError()));
+		return;
+	}
+	
+	log_ring *queue = log_ring_create(LOG_QUEUE_SIZE);
+	if(queue == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to allocate log queue");
+		
+		CloseHandle(log_wake_event);
+		log_wake_event = NULL;
+		
+		return;
+	}
+	
+	log_thread = CreateThread(
+		NULL,              /* lpThreadAttributes */
+		0,                 /* dwStackSize */
+		&log_writer_main,  /* lpStartAddress */
+		queue,             /* lpParameter */
+		0,                 /* dwCreationFlags */
+		NULL);             /* lpThreadId */
+	
+	if(log_thread == NULL)
+	{
+		log_ring_destroy(queue);
+		
+		CloseHandle(log_wake_event);
+		log_wake_event = NULL;
+		
+		log_printf(LOG_ERROR, "Unable to create log_writer_main thread: %s", w32_error(GetLastError()));
+		return;
+	}
+	
+	/* Only start queueing messages once the writer is there to take
+	 * them off the queue.
+	*/
+	__atomic_store_n(&log_queue, queue, __ATOMIC_RELEASE);
+}
+
+/* Write out any messages still in a log queue from the calling thread, once
+ * the writer thread isn't running.
+*/
+static void log_drain(log_ring *queue)
+{
+	log_record *record;
+	while((record = log_ring_peek(queue)) != NULL)
+	{
+		char line[LOG_LINE_MAX];
+		
+		size_t len = log_format_line(line, sizeof(line), record->timestamp, record->thread_id, record->msg);
+		log_write(line, len);
+		
+		log_ring_release(queue);
+	}
+	
+	unsigned int dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+	if(dropped > 0)
+	{
+		log_printf(LOG_WARNING, "%u log messages were dropped because the log queue was full", dropped);
+	}
+}
+
+void log_close() {
+	if(log_thread) {
+		/* Anything logged from here on is written directly, the writer
+		 * flushes whatever is still queued before exiting.
+		*/
+		
+		log_ring *queue = log_queue;
+		__atomic_store_n(&log_queue, NULL, __ATOMIC_RELEASE);
+		
+		__atomic_store_n(&log_exit, true, __ATOMIC_RELAXED);
+		SetEvent(log_wake_event);
+		
+		/* We're called from DllMain(), where the writer can't finish
+		 * exiting while we hold the loader lock, so don't wait for it
+		 * forever, and write out anything it didn't get to ourselves.
+		*/
+		
+		if(WaitForSingleObject(log_thread, 3000) == WAIT_TIMEOUT)
+		{
+			log_printf(LOG_WARNING, "Log writer thread didn't exit in 3 seconds, killing");
+			TerminateThread(log_thread, 0);
+		}
+		
+		CloseHandle(log_thread);
+		log_thread = NULL;
+		
+		log_drain(queue);
+		log_ring_destroy(queue);
+	}
+	
+	if(log_wake_event) {
+		CloseHandle(log_wake_event);
+		log_wake_event = NULL;
+	}
+	
+	if(log_fh) {
+		CloseHandle(log_fh);
+		log_fh = NULL;
+	}
+	
+	if(log_mutex) {
+		CloseHandle(log_mutex);
+		log_mutex = NULL;
+	}
+}
+
+/* Write out any messages still in the log queue from the calling thread.
+ *
+ * This is for when the process is exiting, where the writer thread has
+ * already been terminated (possibly part way through writing a batch) and
+ * log_close() can't be used. Anything logged afterwards is written directly.
+*/
+void log_flush() {
+	log_ring *queue = __atomic_exchange_n(&log_queue, NULL, __ATOMIC_ACQ_REL);
+	if(queue != NULL) {
+		log_drain(queue);
+	}
+}
+
+/* Claim a slot in the log queue, waiting for the writer to free one up if the
+ * queue is full and we aren't dropping messages. Returns NULL if the message
+ * should be dropped or written directly instead.
+*/
+static log_record *log_claim_record(log_ring *queue)
+{
+	log_record *record;
+	while((record = log_ring_claim(queue)) == NULL)
+	{
+		if(log_drop_when_full)
+		{
+			__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+		
+		/* The writer can't start running until DllMain() returns, so
+		 * anything logged while the queue is full before then has to
+		 * be written directly.
+		*/
+		if(!__atomic_load_n(&log_writer_started, __ATOMIC_ACQUIRE))
+		{
+			return NULL;
+		}
+		
+		SetEvent(log_wake_event);
+		Sleep(1);
+	}
+	
+	return record;
+}
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...) {
+	if(level < min_log_level) {
+		return;
+	}
+	
+	uint64_t called = log_timestamp();
+	
+	va_list argv;
+	
+	log_ring *queue = __atomic_load_n(&log_queue, __ATOMIC_ACQUIRE);
+	if(queue != NULL)
+	{
+		log_record *record = log_claim_record(queue);
+		
+		if(record != NULL)
+		{
+			record->timestamp = called;
+			record->thread_id = GetCurrentThreadId();
+			
+			va_start(argv, fmt);
+			vsnprintf(record->msg, LOG_RECORD_MAX, fmt, argv);
+			va_end(argv);
+			
+			log_ring_commit(queue, record);
+			
+			if(__atomic_exchange_n(&log_writer_idle, false, __ATOMIC_SEQ_CST))
+			{
+				SetEvent(log_wake_event);
+			}
+			
+			return;
+		}
+		else if(log_drop_when_full)
+		{
+			return;
+		}
+	}
+	
+	char msg[LOG_RECORD_MAX], line[LOG_LINE_MAX];
+	
+	va_start(argv, fmt);
+	vsnprintf(msg, LOG_RECORD_MAX, fmt, argv);
+	va_end(argv);
+	
+	size_t len = log_format_line(line, sizeof(line), called, GetCurrentThreadId(), msg);
+	log_write(line, len);
+}
@@ -0,0 +1,130 @@
+/* IPXWrapper - Log message ring buffer
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "logring.h"
+
+/* Create a ring with at least size slots (rounded up to a power of two).
+ * Returns NULL if memory couldn't be allocated.
+*/
+log_ring *log_ring_create(unsigned int size)
+{
+	uint32_t real_size = 1;
+	while(real_size < size)
+	{
+		real_size *= 2;
+	}
+	
+	log_ring *ring = malloc(sizeof(log_ring) + (real_size * sizeof(log_ring_slot)));
+	if(ring == NULL)
+	{
+		return NULL;
+	}
+	
+	ring->size = real_size;
+	ring->write_pos = 0;
+	ring->read_pos = 0;
+	
+	for(uint32_t i = 0; i < real_size; ++i)
+	{
+		ring->slots[i].sequence = i;
+	}
+	
+	return ring;
+}
+
+void log_ring_destroy(log_ring *ring)
+{
+	free(ring);
+}
+
+/* Claim the next free slot for a new record. Returns NULL if the ring is full,
+ * otherwise the caller must fill in the record and pass it to
+ * log_ring_commit().
+*/
+log_record *log_ring_claim(log_ring *ring)
+{
+	uint32_t pos = __atomic_load_n(&(ring->write_pos), __ATOMIC_RELAXED);
+	
+	while(1)
+	{
+		log_ring_slot *slot = &(ring->slots[pos & (ring->size - 1)]);
+		
+		uint32_t sequence = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE);
+		int32_t diff = (int32_t)(sequence - pos);
+		
+		if(diff == 0)
+		{
+			/* Slot is free for this lap, try to take it. On failure
+			 * pos is updated to the current write position.
+			*/
+			
+			if(__atomic_compare_exchange_n(&(ring->write_pos), &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				slot->pos = pos;
+				return &(slot->record);
+			}
+		}
+		else if(diff < 0)
+		{
+			/* The reader hasn't released this slot from the
+			 * previous lap yet.
+			*/
+			return NULL;
+		}
+		else{
+			/* Another writer claimed it first. */
+			pos = __atomic_load_n(&(ring->write_pos), __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Publish a record obtained from log_ring_claim() to the reader. */
+void log_ring_commit(log_ring *ring, log_record *record)
+{
+	log_ring_slot *slot = (log_ring_slot*)((char*)(record) - offsetof(log_ring_slot, record));
+	__atomic_store_n(&(slot->sequence), slot->pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns the oldest record in the ring, or NULL if the next record hasn't
+ * been committed yet. The record remains in the ring until it is released by
+ * log_ring_release(). Only one thread may read from a ring.
+*/
+log_record *log_ring_peek(log_ring *ring)
+{
+	log_ring_slot *slot = &(ring->slots[ring->read_pos & (ring->size - 1)]);
+	
+	if(__atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE) == ring->read_pos + 1)
+	{
+		return &(slot->record);
+	}
+	else{
+		return NULL;
+	}
+}
+
+/* Release the record returned by log_ring_peek() for reuse. */
+void log_ring_release(log_ring *ring)
+{
+	log_ring_slot *slot = &(ring->slots[ring->read_pos & (ring->size - 1)]);
+	
+	__atomic_store_n(&(slot->sequence), ring->read_pos + ring->size, __ATOMIC_RELEASE);
+	++(ring->read_pos);
+}
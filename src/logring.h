@@ -0,0 +1,86 @@
+/* IPXWrapper - Log message ring buffer
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_LOGRING_H
+#define IPXWRAPPER_LOGRING_H
+
+#include <windows.h>
+#include <stdint.h>
+
+/* Fixed size ring of log records, which any number of threads may write to
+ * without taking a lock while a single thread (the log writer) reads them.
+ *
+ * Each slot has a sequence number which says whose turn it is: a slot whose
+ * sequence matches the write position may be claimed by a writer, once the
+ * record has been filled in the sequence is advanced to tell the reader it is
+ * ready, and the reader advances it again by the size of the ring when it is
+ * done with it, ready for the next lap.
+ *
+ * Writers claim slots in order by advancing the write position with a
+ * compare-and-swap, so records are read in the order they were claimed, but
+ * a slow writer will hold up the reader until its record is committed.
+*/
+
+#define LOG_RECORD_MAX 1024
+
+typedef struct log_record log_record;
+
+struct log_record
+{
+	/* QueryPerformanceCounter() value when the message was logged. */
+	uint64_t timestamp;
+	
+	DWORD thread_id;
+	
+	char msg[LOG_RECORD_MAX];
+};
+
+typedef struct log_ring_slot log_ring_slot;
+
+struct log_ring_slot
+{
+	uint32_t sequence;
+	
+	/* Write position the slot was claimed at. */
+	uint32_t pos;
+	
+	log_record record;
+};
+
+typedef struct log_ring log_ring;
+
+struct log_ring
+{
+	/* Number of slots, always a power of two. */
+	uint32_t size;
+	
+	uint32_t write_pos;
+	uint32_t read_pos;
+	
+	log_ring_slot slots[];
+};
+
+log_ring *log_ring_create(unsigned int size);
+void log_ring_destroy(log_ring *ring);
+
+log_record *log_ring_claim(log_ring *ring);
+void log_ring_commit(log_ring *ring, log_record *record);
+
+log_record *log_ring_peek(log_ring *ring);
+void log_ring_release(log_ring *ring);
+
+#endif /* !IPXWRAPPER_LOGRING_H */
@@ -0,0 +1,858 @@
+/* IPXWrapper - Send rate limiting
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+#include <utlist.h>
+#include <wsnwlink.h>
+
+#include "common.h"
+#include "ipxwrapper.h"
+#include "pacer.h"
+
+/* Token bucket credit is kept in thousandths of a token, so that a rate in
+ * tokens per second adds exactly 'rate' units of credit every millisecond.
+*/
+#define TOKEN_BUCKET_SCALE 1000
+
+typedef struct pacer_dest_key pacer_dest_key;
+
+struct pacer_dest_key
+{
+	addr32_t netnum;
+	addr48_t nodenum;
+	uint16_t socket;
+};
+
+typedef struct pacer_dest pacer_dest;
+
+struct pacer_dest
+{
+	UT_hash_handle hh;
+	
+	pacer_dest_key dest;
+	DWORD last_used;
+	
+	token_bucket packet_bucket;
+	token_bucket byte_bucket;
+};
+
+static CRITICAL_SECTION pacer_lock;
+
+static pacer_config settings;
+
+/* Total budget, shared by both classes. */
+static token_bucket total_packet_bucket;
+static token_bucket total_byte_bucket;
+
+static pacer_dest *dest_table = NULL;
+
+/* Table size which triggers the next pacer_sweep_dests(), raised when most
+ * entries are still in use so that sweeps don't happen on every insert.
+*/
+static unsigned int dest_sweep_at = PACER_MAX_DESTS;
+
+/* Queues with packets waiting to be sent for each priority, in the order the
+ * sender thread will service them, and how many of them there are.
+*/
+static pacer_queue *waiting_queues[PACER_NUM_PRIOS];
+static int n_waiting[PACER_NUM_PRIOS];
+
+static pacer_stats stats[PACER_NUM_PRIOS];
+
+static HANDLE pacer_wake_event = NULL;
+static HANDLE pacer_space_event = NULL;
+
+static HANDLE pacer_thread = NULL;
+static bool pacer_exit = false;
+
+static uint64_t token_bucket_capacity(const token_bucket *bucket)
+{
+	return (uint64_t)(bucket->rate) * TOKEN_BUCKET_SCALE;
+}
+
+/* Credit needed to take count tokens. A packet larger than the bucket can hold
+ * only needs a full bucket, otherwise it could never be sent.
+*/
+static uint64_t token_bucket_cost(const token_bucket *bucket, unsigned int count)
+{
+	return (uint64_t)(min(count, bucket->rate)) * TOKEN_BUCKET_SCALE;
+}
+
+static void token_bucket_refill(token_bucket *bucket, DWORD now)
+{
+	/* Callers sample the clock before taking the pacer lock, so another
+	 * thread may have already refilled the bucket at a later time.
+	*/
+	if((int32_t)(now - bucket->last_refill) <= 0)
+	{
+		return;
+	}
+	
+	DWORD elapsed = now - bucket->last_refill;
+	uint64_t capacity = token_bucket_capacity(bucket);
+	
+	if(elapsed >= 1000)
+	{
+		bucket->credit = capacity;
+	}
+	else{
+		bucket->credit = min(capacity, bucket->credit + ((uint64_t)(elapsed) * bucket->rate));
+	}
+	
+	bucket->last_refill = now;
+}
+
+void token_bucket_init(token_bucket *bucket, unsigned int rate, DWORD now)
+{
+	bucket->rate = rate;
+	bucket->credit = token_bucket_capacity(bucket);
+	bucket->last_refill = now;
+}
+
+/* Take count tokens from the bucket if they are available. Always succeeds
+ * when the bucket has no rate limit.
+*/
+bool token_bucket_take(token_bucket *bucket, unsigned int count, DWORD now)
+{
+	if(bucket->rate == 0)
+	{
+		return true;
+	}
+	
+	token_bucket_refill(bucket, now);
+	
+	uint64_t cost = token_bucket_cost(bucket, count);
+	
+	if(bucket->credit >= cost)
+	{
+		bucket->credit -= cost;
+		return true;
+	}
+	else{
+		return false;
+	}
+}
+
+/* Returns how many milliseconds until count tokens will be available, zero if
+ * they can be taken now.
+*/
+DWORD token_bucket_wait_time(token_bucket *bucket, unsigned int count, DWORD now)
+{
+	if(bucket->rate == 0)
+	{
+		return 0;
+	}
+	
+	token_bucket_refill(bucket, now);
+	
+	uint64_t cost = token_bucket_cost(bucket, count);
+	
+	if(bucket->credit >= cost)
+	{
+		return 0;
+	}
+	else{
+		return ((cost - bucket->credit) + bucket->rate - 1) / bucket->rate;
+	}
+}
+
+static bool pacer_limits_enabled(const pacer_limits *limits)
+{
+	return limits->packets_per_second > 0 || limits->bytes_per_second > 0;
+}
+
+static enum pacer_class pacer_classify(addr48_t dest_node)
+{
+	return dest_node == addr48_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF,0xFF,0xFF})
+		? PACER_BROADCAST
+		: PACER_UNICAST;
+}
+
+/* Discard destinations which haven't been sent to for long enough that their
+ * buckets are full again.
+*/
+static void pacer_sweep_dests(DWORD now)
+{
+	pacer_dest *pd, *tmp;
+	HASH_ITER(hh, dest_table, pd, tmp)
+	{
+		if((int32_t)(now - pd->last_used) >= 1000)
+		{
+			HASH_DEL(dest_table, pd);
+			free(pd);
+		}
+	}
+	
+	dest_sweep_at = max(PACER_MAX_DESTS, (HASH_COUNT(dest_table) * 2));
+}
+
+/* Find (or create) the budget for a destination address. Returns NULL if
+ * destination limits aren't enabled or memory couldn't be allocated, in
+ * which case the packet isn't limited by destination.
+*/
+static pacer_dest *pacer_get_dest(addr32_t netnum, addr48_t nodenum, uint16_t socket, DWORD now)
+{
+	if(!pacer_limits_enabled(&(settings.dest)))
+	{
+		return NULL;
+	}
+	
+	pacer_dest_key key;
+	
+	/* Clear any padding, the whole structure is hashed. */
+	memset(&key, 0, sizeof(key));
+	
+	key.netnum  = netnum;
+	key.nodenum = nodenum;
+	key.socket  = socket;
+	
+	pacer_dest *pd;
+	HASH_FIND(hh, dest_table, &key, sizeof(key), pd);
+	
+	if(pd == NULL)
+	{
+		if(HASH_COUNT(dest_table) >= dest_sweep_at)
+		{
+			pacer_sweep_dests(now);
+		}
+		
+		if((pd = malloc(sizeof(pacer_dest))) == NULL)
+		{
+			return NULL;
+		}
+		
+		pd->dest = key;
+		pd->last_used = now;
+		
+		token_bucket_init(&(pd->packet_bucket), settings.dest.packets_per_second, now);
+		token_bucket_init(&(pd->byte_bucket), settings.dest.bytes_per_second, now);
+		
+		HASH_ADD(hh, dest_table, dest, sizeof(pd->dest), pd);
+	}
+	
+	if((int32_t)(now - pd->last_used) > 0)
+	{
+		pd->last_used = now;
+	}
+	
+	return pd;
+}
+
+/* Take the tokens needed to send a packet from every bucket which applies to
+ * it, or none if any of them are short. When the packet can't be sent yet,
+ * *wait is set to the number of milliseconds until it can and *total_short is
+ * set if the total budget is one of the buckets holding it up.
+ * The pacer lock must be held.
+*/
+static bool pacer_take_tokens(pacer_queue *queue, addr32_t dest_net, addr48_t dest_node, uint16_t dest_socket, size_t data_size, DWORD now, DWORD *wait, bool *total_short)
+{
+	pacer_socket *ps = queue->owner;
+	
+	
+	token_bucket *buckets[6];
+	unsigned int counts[6];
+	int n_buckets = 0;
+	
+	buckets[n_buckets]  = &total_packet_bucket;
+	counts[n_buckets++] = 1;
+	
+	buckets[n_buckets]  = &total_byte_bucket;
+	counts[n_buckets++] = data_size;
+	
+	buckets[n_buckets]  = &(ps->packet_buckets[queue->class]);
+	counts[n_buckets++] = 1;
+	
+	buckets[n_buckets]  = &(ps->byte_buckets[queue->class]);
+	counts[n_buckets++] = data_size;
+	
+	pacer_dest *pd = pacer_get_dest(dest_net, dest_node, dest_socket, now);
+	if(pd != NULL)
+	{
+		buckets[n_buckets]  = &(pd->packet_bucket);
+		counts[n_buckets++] = 1;
+		
+		buckets[n_buckets]  = &(pd->byte_bucket);
+		counts[n_buckets++] = data_size;
+	}
+	
+	DWORD max_wait = 0;
+	*total_short = false;
+	
+	for(int i = 0; i < n_buckets; ++i)
+	{
+		DWORD bucket_wait = token_bucket_wait_time(buckets[i], counts[i], now);
+		
+		/* The first two buckets are the total budget. */
+		if(i < 2 && bucket_wait > 0)
+		{
+			*total_short = true;
+		}
+		
+		max_wait = max(max_wait, bucket_wait);
+	}
+	
+	if(max_wait > 0)
+	{
+		*wait = max_wait;
+		return false;
+	}
+	
+	for(int i = 0; i < n_buckets; ++i)
+	{
+		token_bucket_take(buckets[i], counts[i], now);
+	}
+	
+	return true;
+}
+
+static void pacer_socket_free_if_done(pacer_socket *ps)
+{
+	if(ps->closed && ps->n_packets == 0)
+	{
+		free(ps);
+	}
+}
+
+static DWORD WINAPI pacer_main(LPVOID lpParameter)
+{
+	while(!__atomic_load_n(&pacer_exit, __ATOMIC_RELAXED))
+	{
+		DWORD wait;
+		pacer_packet *packet = pacer_next(GetTickCount(), &wait);
+		
+		if(packet != NULL)
+		{
+			DWORD error = ipx_send_packet(
+				packet->type,
+				packet->src_net, packet->src_node, packet->src_socket,
+				packet->dest_net, packet->dest_node, packet->dest_socket,
+				packet->data, packet->data_size);
+			
+			if(error != ERROR_SUCCESS)
+			{
+				log_printf(LOG_WARNING, "Unable to send queued packet: %s", w32_error(error));
+			}
+			
+			free(packet);
+		}
+		else{
+			WaitForSingleObject(pacer_wake_event, wait);
+		}
+	}
+	
+	return 0;
+}
+
+void pacer_init(const pacer_config *config, DWORD now)
+{
+	InitializeCriticalSection(&pacer_lock);
+	
+	settings = *config;
+	
+	token_bucket_init(&total_packet_bucket, settings.total.packets_per_second, now);
+	token_bucket_init(&total_byte_bucket, settings.total.bytes_per_second, now);
+	
+	for(int p = 0; p < PACER_NUM_PRIOS; ++p)
+	{
+		waiting_queues[p] = NULL;
+		n_waiting[p] = 0;
+	}
+	
+	memset(stats, 0, sizeof(stats));
+	
+	dest_table = NULL;
+	dest_sweep_at = PACER_MAX_DESTS;
+	pacer_exit = false;
+	
+	pacer_wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if(pacer_wake_event == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create pacer_wake_event event object: %s", w32_error(GetLastError()));
+	}
+	
+	pacer_space_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if(pacer_space_event == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create pacer_space_event event object: %s", w32_error(GetLastError()));
+	}
+}
+
+/* Returns true if any rate limit is configured. */
+bool pacer_enabled(void)
+{
+	return pacer_limits_enabled(&(settings.total))
+		|| pacer_limits_enabled(&(settings.socket))
+		|| pacer_limits_enabled(&(settings.dest));
+}
+
+/* Start the sender thread, only needed if a rate limit is configured. */
+void pacer_start(void)
+{
+	if(!pacer_enabled())
+	{
+		return;
+	}
+	
+	pacer_thread = CreateThread(
+		NULL,         /* lpThreadAttributes */
+		0,            /* dwStackSize */
+		&pacer_main,  /* lpStartAddress */
+		NULL,         /* lpParameter */
+		0,            /* dwCreationFlags */
+		NULL);        /* lpThreadId */
+	
+	if(pacer_thread == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create pacer_main thread: %s", w32_error(GetLastError()));
+	}
+}
+
+void pacer_cleanup(void)
+{
+	if(pacer_thread != NULL)
+	{
+		__atomic_store_n(&pacer_exit, true, __ATOMIC_RELAXED);
+		SetEvent(pacer_wake_event);
+		
+		/* Wait for it to exit, kill if it takes too long. */
+		
+		if(WaitForSingleObject(pacer_thread, 3000) == WAIT_TIMEOUT)
+		{
+			log_printf(LOG_WARNING, "Pacer thread didn't exit in 3 seconds, killing");
+			TerminateThread(pacer_thread, 0);
+		}
+		
+		CloseHandle(pacer_thread);
+		pacer_thread = NULL;
+	}
+	
+	/* Any packets still waiting are dropped. Sockets which are still open
+	 * are left for the socket to free.
+	*/
+	
+	int dropped = 0;
+	
+	for(int p = 0; p < PACER_NUM_PRIOS; ++p)
+	{
+		pacer_queue *queue, *queue_tmp;
+		DL_FOREACH_SAFE(waiting_queues[p], queue, queue_tmp)
+		{
+			pacer_packet *packet, *packet_tmp;
+			DL_FOREACH_SAFE(queue->packets, packet, packet_tmp)
+			{
+				DL_DELETE(queue->packets, packet);
+				free(packet);
+				
+				++dropped;
+			}
+			
+			queue->owner->n_packets -= queue->n_packets;
+			queue->n_packets = 0;
+			
+			DL_DELETE(waiting_queues[p], queue);
+			--(n_waiting[p]);
+			
+			pacer_socket_free_if_done(queue->owner);
+		}
+		
+		stats[p].depth = 0;
+	}
+	
+	if(dropped > 0)
+	{
+		log_printf(LOG_WARNING, "Dropped %d rate limited packets which were never sent", dropped);
+	}
+	
+	pacer_dest *pd, *pd_tmp;
+	HASH_ITER(hh, dest_table, pd, pd_tmp)
+	{
+		HASH_DEL(dest_table, pd);
+		free(pd);
+	}
+	
+	if(pacer_space_event != NULL)
+	{
+		/* Release anything still waiting in pacer_wait_for_space(). */
+		SetEvent(pacer_space_event);
+		
+		CloseHandle(pacer_space_event);
+		pacer_space_event = NULL;
+	}
+	
+	if(pacer_wake_event != NULL)
+	{
+		CloseHandle(pacer_wake_event);
+		pacer_wake_event = NULL;
+	}
+	
+	DeleteCriticalSection(&pacer_lock);
+}
+
+pacer_socket *pacer_socket_create(DWORD now)
+{
+	pacer_socket *ps = malloc(sizeof(pacer_socket));
+	if(ps == NULL)
+	{
+		return NULL;
+	}
+	
+	for(int p = 0; p < PACER_NUM_PRIOS; ++p)
+	{
+		for(int i = 0; i < PACER_NUM_CLASSES; ++i)
+		{
+			pacer_queue *queue = &(ps->queues[p][i]);
+			
+			queue->owner = ps;
+			queue->priority = p;
+			queue->class = i;
+			
+			queue->packets = NULL;
+			queue->n_packets = 0;
+			
+			queue->prev = NULL;
+			queue->next = NULL;
+		}
+	}
+	
+	for(int i = 0; i < PACER_NUM_CLASSES; ++i)
+	{
+		token_bucket_init(&(ps->packet_buckets[i]), settings.socket.packets_per_second, now);
+		token_bucket_init(&(ps->byte_buckets[i]), settings.socket.bytes_per_second, now);
+	}
+	
+	ps->n_packets = 0;
+	ps->closed = false;
+	
+	return ps;
+}
+
+/* Give up the socket's reference to its pacer_socket. Any packets still
+ * waiting will be sent before it is freed.
+*/
+void pacer_socket_close(pacer_socket *ps)
+{
+	EnterCriticalSection(&pacer_lock);
+	
+	ps->closed = true;
+	pacer_socket_free_if_done(ps);
+	
+	LeaveCriticalSection(&pacer_lock);
+}
+
+/* Get the number of packets waiting in the socket's queues. The caller must
+ * hold the lock of the socket which owns ps so it can't be closed.
+*/
+int pacer_socket_depth(pacer_socket *ps)
+{
+	EnterCriticalSection(&pacer_lock);
+	int depth = ps->n_packets;
+	LeaveCriticalSection(&pacer_lock);
+	
+	return depth;
+}
+
+/* Choose the priority for a packet from the socket's IPX_PRIORITY setting.
+ * Sockets which haven't set one send small packets, which are most likely to
+ * be latency sensitive, ahead of larger ones.
+*/
+enum pacer_priority pacer_choose_priority(int socket_priority, size_t data_size)
+{
+	switch(socket_priority)
+	{
+		case IPX_PRIORITY_HIGH:
+			return PACER_PRIO_HIGH;
+		
+		case IPX_PRIORITY_NORMAL:
+			return PACER_PRIO_NORMAL;
+		
+		case IPX_PRIORITY_BULK:
+			return PACER_PRIO_BULK;
+		
+		default:
+			return data_size <= PACER_SMALL_PACKET
+				? PACER_PRIO_HIGH
+				: PACER_PRIO_NORMAL;
+	}
+}
+
+/* Returns true if a new packet of the given priority and class must wait
+ * behind packets which are already queued. The pacer lock must be held.
+*/
+static bool pacer_must_queue(pacer_socket *ps, enum pacer_priority priority, enum pacer_class class)
+{
+	bool total_limited = total_packet_bucket.rate > 0 || total_byte_bucket.rate > 0;
+	
+	for(int p = 0; p <= (int)(priority); ++p)
+	{
+		/* Packets from this socket which are waiting ahead of this one,
+		 * either to keep them in order or because they need the same
+		 * socket budget.
+		*/
+		if(ps->queues[p][class].n_packets > 0)
+		{
+			return true;
+		}
+		
+		/* Anything else waiting for the total budget, otherwise new
+		 * senders could take the tokens the sender thread is waiting
+		 * for.
+		*/
+		if(total_limited && n_waiting[p] > 0)
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/* Submit a packet to be sent. If PACER_SEND_NOW is returned, the tokens for
+ * it have been taken and the caller must send it. If PACER_QUEUED is returned,
+ * a copy of the packet has been placed in the queue for the sender thread.
+ *
+ * The socket which owns the pacer_socket must be locked to prevent it from
+ * being closed.
+*/
+enum pacer_result pacer_submit(
+	pacer_socket *ps,
+	enum pacer_priority priority,
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size,
+	DWORD now)
+{
+	enum pacer_class class = pacer_classify(dest_node);
+	pacer_queue *queue = &(ps->queues[priority][class]);
+	
+	EnterCriticalSection(&pacer_lock);
+	
+	DWORD wait;
+	bool total_short;
+	
+	if(!pacer_must_queue(ps, priority, class)
+		&& pacer_take_tokens(queue, dest_net, dest_node, dest_socket, data_size, now, &wait, &total_short))
+	{
+		++(stats[priority].sent_now);
+		
+		LeaveCriticalSection(&pacer_lock);
+		return PACER_SEND_NOW;
+	}
+	
+	if(queue->n_packets >= PACER_QUEUE_DEPTH)
+	{
+		/* Reset under the lock so a packet being dequeued after this
+		 * point will wake us in pacer_wait_for_space().
+		*/
+		ResetEvent(pacer_space_event);
+		
+		LeaveCriticalSection(&pacer_lock);
+		return PACER_FULL;
+	}
+	
+	pacer_packet *packet = malloc(sizeof(pacer_packet) + data_size);
+	if(packet == NULL)
+	{
+		LeaveCriticalSection(&pacer_lock);
+		return PACER_NOMEM;
+	}
+	
+	packet->type        = type;
+	packet->src_net     = src_net;
+	packet->src_node    = src_node;
+	packet->src_socket  = src_socket;
+	packet->dest_net    = dest_net;
+	packet->dest_node   = dest_node;
+	packet->dest_socket = dest_socket;
+	packet->data_size   = data_size;
+	packet->queued_at   = now;
+	
+	memcpy(packet->data, data, data_size);
+	
+	DL_APPEND(queue->packets, packet);
+	++(ps->n_packets);
+	
+	++(stats[priority].queued);
+	
+	if(++(stats[priority].depth) > stats[priority].max_depth)
+	{
+		stats[priority].max_depth = stats[priority].depth;
+	}
+	
+	if((queue->n_packets)++ == 0)
+	{
+		DL_APPEND(waiting_queues[priority], queue);
+		++(n_waiting[priority]);
+		
+		/* The new queue may be able to go before whatever the sender
+		 * thread is currently waiting for.
+		*/
+		SetEvent(pacer_wake_event);
+	}
+	
+	LeaveCriticalSection(&pacer_lock);
+	
+	return PACER_QUEUED;
+}
+
+/* Remove the next packet to be sent from the queues, taking the tokens for it.
+ * Returns NULL if no packet can be sent yet, in which case *wait is set to the
+ * number of milliseconds until one might be (INFINITE if none are waiting).
+ *
+ * The caller must send the packet and then free() it.
+*/
+pacer_packet *pacer_next(DWORD now, DWORD *wait)
+{
+	EnterCriticalSection(&pacer_lock);
+	
+	pacer_packet *packet = NULL;
+	pacer_queue *queue = NULL;
+	*wait = INFINITE;
+	
+	/* Set when the total budget is needed by a higher priority packet
+	 * which can't be sent yet. Lower priority queues are passed over until
+	 * it has gone, even if they could fit into what is left of the budget.
+	*/
+	bool total_reserved = false;
+	
+	for(int p = 0; p < PACER_NUM_PRIOS && packet == NULL && !total_reserved; ++p)
+	{
+		bool total_short = false;
+		
+		DL_FOREACH(waiting_queues[p], queue)
+		{
+			
+			pacer_packet *head = queue->packets;
+			
+			DWORD queue_wait;
+			bool queue_total_short;
+			
+			if(pacer_take_tokens(queue, head->dest_net, head->dest_node, head->dest_socket, head->data_size, now, &queue_wait, &queue_total_short))
+			{
+				packet = head;
+				break;
+			}
+			
+			*wait = min(*wait, queue_wait);
+			
+			if(queue_total_short)
+			{
+				total_short = true;
+			}
+		}
+		
+		total_reserved = total_short;
+	}
+	
+	if(packet != NULL)
+	{
+		enum pacer_priority priority = queue->priority;
+		
+		DL_DELETE(queue->packets, packet);
+		--(queue->n_packets);
+		--(queue->owner->n_packets);
+		
+		DWORD latency = (int32_t)(now - packet->queued_at) > 0
+			? now - packet->queued_at
+			: 0;
+		
+		--(stats[priority].depth);
+		++(stats[priority].sent_queued);
+		stats[priority].total_latency += latency;
+		stats[priority].max_latency = max(stats[priority].max_latency, latency);
+		
+		/* Move the queue to the back of the line so that every socket
+		 * gets a turn, or drop it from the list if it's empty.
+		*/
+		
+		DL_DELETE(waiting_queues[priority], queue);
+		
+		if(queue->n_packets > 0)
+		{
+			DL_APPEND(waiting_queues[priority], queue);
+		}
+		else{
+			--(n_waiting[priority]);
+			pacer_socket_free_if_done(queue->owner);
+		}
+		
+		SetEvent(pacer_space_event);
+		
+		*wait = 0;
+	}
+	
+	LeaveCriticalSection(&pacer_lock);
+	
+	return packet;
+}
+
+/* Wait until a packet has been removed from any queue. The caller must not
+ * hold any socket locks.
+*/
+void pacer_wait_for_space(void)
+{
+	WaitForSingleObject(pacer_space_event, INFINITE);
+}
+
+/* Copy the counters for each priority into out and reset them. */
+void pacer_take_stats(pacer_stats out[PACER_NUM_PRIOS])
+{
+	EnterCriticalSection(&pacer_lock);
+	
+	for(int p = 0; p < PACER_NUM_PRIOS; ++p)
+	{
+		out[p] = stats[p];
+		
+		unsigned int depth = stats[p].depth;
+		
+		memset(&(stats[p]), 0, sizeof(stats[p]));
+		stats[p].depth     = depth;
+		stats[p].max_depth = depth;
+	}
+	
+	LeaveCriticalSection(&pacer_lock);
+}
+
+void pacer_report_stats(void)
+{
+	static const char *PRIO_NAMES[PACER_NUM_PRIOS] = { "High", "Normal", "Bulk" };
+	
+	pacer_stats my_stats[PACER_NUM_PRIOS];
+	pacer_take_stats(my_stats);
+	
+	for(int p = 0; p < PACER_NUM_PRIOS; ++p)
+	{
+		unsigned int avg_latency = my_stats[p].sent_queued > 0
+			? my_stats[p].total_latency / my_stats[p].sent_queued
+			: 0;
+		
+		log_printf(LOG_INFO, "%s priority packets: %u sent immediately, %u queued, %u sent from queue",
+			PRIO_NAMES[p], my_stats[p].sent_now, my_stats[p].queued, my_stats[p].sent_queued);
+		
+		log_printf(LOG_INFO, "%s priority queue depth %u (max %u), queued packets waited %u ms on average (max %u ms)",
+			PRIO_NAMES[p], my_stats[p].depth, my_stats[p].max_depth, avg_latency, (unsigned)(my_stats[p].max_latency));
+	}
+}
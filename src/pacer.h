@@ -0,0 +1,275 @@
+/* IPXWrapper - Send rate limiting
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_PACER_H
+#define IPXWRAPPER_PACER_H
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "addr.h"
+
+/* Packets sent by IPX sockets can be paced through token buckets at three
+ * levels, each with its own packets per second and bytes per second limits:
+ *
+ *   total  - Shared by every socket ("send packet limit" and "send byte
+ *            limit" in ipxwrapper.ini).
+ *
+ *   socket - Applied to each socket separately ("socket packet limit" and
+ *            "socket byte limit").
+ *
+ *   dest   - Applied to each destination IPX address separately
+ *            ("destination packet limit" and "destination byte limit").
+ *
+ * The total budget is shared by broadcast and unicast packets, so the
+ * configured limit holds however they are mixed. Each socket has separate
+ * broadcast and unicast budgets, each of which may use the whole socket limit,
+ * so a socket flooding the network with broadcasts doesn't hold up its own
+ * unicast traffic. Broadcasts are sent to a different destination address
+ * than unicast packets, so they never share destination budgets either.
+ *
+ * A packet has to take tokens from every bucket which applies to it. When it
+ * fits within all of them it is sent immediately by the calling thread,
+ * otherwise it is copied into one of the socket's send queues and sendto()
+ * returns straight away, leaving the sender thread to transmit it once enough
+ * tokens have accumulated.
+ *
+ * Each packet also has a priority, either set for the socket using the
+ * IPX_PRIORITY socket option or chosen by its size, so that small packets
+ * (typically game state updates) aren't stuck behind bulk transfers such as
+ * map downloads. Each socket has a queue for each combination of priority and
+ * broadcast/unicast class.
+ *
+ * The sender thread uses strict priority scheduling: it always sends from
+ * the highest priority queue which has the tokens for its next packet,
+ * servicing queues of the same priority in turn so one busy socket (or a
+ * flood of broadcasts) can't starve the others. A lower priority packet can't take tokens from a total
+ * budget which a higher priority packet is waiting on, and a new packet can
+ * only skip the queues if nothing of equal or higher priority is waiting for
+ * the same budgets, but queues waiting on their own socket or destination
+ * budget don't hold up anyone else.
+ *
+ * Once a packet has been queued, any further packets of the same priority and
+ * class from the same socket are also queued behind it so they are sent in
+ * order. When a queue has PACER_QUEUE_DEPTH packets waiting, pacer_submit()
+ * returns PACER_FULL and the caller must either wait for space (blocking
+ * sockets) or fail with WSAEWOULDBLOCK (non-blocking sockets).
+ *
+ * Each bucket holds up to one second worth of tokens, so a socket which has
+ * been idle can send a burst of that size before being paced, which matches
+ * the sliding window used by ratelimit_get_delay().
+ *
+ * Destination buckets are kept in a hash table. A destination which hasn't
+ * been sent to for a second has a full bucket, which is no different from a
+ * new one, so such entries are discarded when the table grows beyond
+ * PACER_MAX_DESTS entries.
+ *
+ * All pacer state, including the token buckets, is protected by the pacer's
+ * lock and only accessed through the functions below.
+ *
+ * Times are passed in as GetTickCount() values so that the tests can supply
+ * their own clock.
+*/
+
+#define PACER_QUEUE_DEPTH 64
+#define PACER_MAX_DESTS 256
+
+/* Packets with payloads up to this size are sent with PACER_PRIO_HIGH from
+ * sockets which haven't set IPX_PRIORITY.
+*/
+#define PACER_SMALL_PACKET 256
+
+typedef struct token_bucket token_bucket;
+
+struct token_bucket
+{
+	/* Tokens added per second, zero for no limit. */
+	unsigned int rate;
+	
+	/* Available tokens, in thousandths of a token. */
+	uint64_t credit;
+	
+	/* Time credit was last topped up. */
+	DWORD last_refill;
+};
+
+void token_bucket_init(token_bucket *bucket, unsigned int rate, DWORD now);
+bool token_bucket_take(token_bucket *bucket, unsigned int count, DWORD now);
+DWORD token_bucket_wait_time(token_bucket *bucket, unsigned int count, DWORD now);
+
+typedef struct pacer_limits pacer_limits;
+
+struct pacer_limits
+{
+	/* Zero for no limit. */
+	unsigned int packets_per_second;
+	unsigned int bytes_per_second;
+};
+
+typedef struct pacer_config pacer_config;
+
+struct pacer_config
+{
+	pacer_limits total;
+	pacer_limits socket;
+	pacer_limits dest;
+};
+
+enum pacer_class
+{
+	PACER_UNICAST = 0,
+	PACER_BROADCAST,
+	
+	PACER_NUM_CLASSES
+};
+
+/* Highest priority first. */
+enum pacer_priority
+{
+	PACER_PRIO_HIGH = 0,
+	PACER_PRIO_NORMAL,
+	PACER_PRIO_BULK,
+	
+	PACER_NUM_PRIOS
+};
+
+typedef struct pacer_packet pacer_packet;
+
+struct pacer_packet
+{
+	uint8_t type;
+	
+	addr32_t src_net;
+	addr48_t src_node;
+	uint16_t src_socket;
+	
+	addr32_t dest_net;
+	addr48_t dest_node;
+	uint16_t dest_socket;
+	
+	size_t data_size;
+	
+	/* Time the packet was queued. */
+	DWORD queued_at;
+	
+	pacer_packet *prev, *next;
+	
+	unsigned char data[];
+};
+
+typedef struct pacer_socket pacer_socket;
+typedef struct pacer_queue pacer_queue;
+
+/* Queue of packets of one priority and class from a socket. */
+struct pacer_queue
+{
+	pacer_socket *owner;
+	enum pacer_priority priority;
+	enum pacer_class class;
+	
+	pacer_packet *packets;
+	int n_packets;
+	
+	/* Links in the list of queues of this priority with packets waiting to
+	 * be sent.
+	*/
+	pacer_queue *prev, *next;
+};
+
+/* Each ipx_socket which has sent a packet while rate limiting is enabled has
+ * a pacer_socket, which holds its queues and its budget for each class.
+ *
+ * A pacer_socket whose socket has been closed is marked as such by
+ * pacer_socket_close() and freed once the sender thread has sent whatever was
+ * still waiting in its queues.
+*/
+struct pacer_socket
+{
+	pacer_queue queues[PACER_NUM_PRIOS][PACER_NUM_CLASSES];
+	int n_packets;
+	
+	token_bucket packet_buckets[PACER_NUM_CLASSES];
+	token_bucket byte_buckets[PACER_NUM_CLASSES];
+	
+	bool closed;
+};
+
+/* Counters for each priority, reset each time they are read by
+ * pacer_take_stats().
+*/
+typedef struct pacer_stats pacer_stats;
+
+struct pacer_stats
+{
+	/* Packets which were within the budget and sent immediately. */
+	unsigned int sent_now;
+	
+	/* Packets which were queued, and how many of them have been sent. */
+	unsigned int queued;
+	unsigned int sent_queued;
+	
+	/* Packets waiting to be sent, now and at most. */
+	unsigned int depth;
+	unsigned int max_depth;
+	
+	/* Time queued packets waited before being sent, in milliseconds. */
+	uint64_t total_latency;
+	DWORD max_latency;
+};
+
+enum pacer_result
+{
+	PACER_SEND_NOW,
+	PACER_QUEUED,
+	PACER_FULL,
+	PACER_NOMEM,
+};
+
+void pacer_init(const pacer_config *config, DWORD now);
+void pacer_start(void);
+void pacer_cleanup(void);
+bool pacer_enabled(void);
+
+enum pacer_priority pacer_choose_priority(int socket_priority, size_t data_size);
+
+pacer_socket *pacer_socket_create(DWORD now);
+void pacer_socket_close(pacer_socket *ps);
+int pacer_socket_depth(pacer_socket *ps);
+
+enum pacer_result pacer_submit(
+	pacer_socket *ps,
+	enum pacer_priority priority,
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size,
+	DWORD now);
+
+pacer_packet *pacer_next(DWORD now, DWORD *wait);
+void pacer_wait_for_space(void);
+
+void pacer_take_stats(pacer_stats stats[PACER_NUM_PRIOS]);
+void pacer_report_stats(void);
+
+#endif /* !IPXWRAPPER_PACER_H */
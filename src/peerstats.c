@@ -0,0 +1,230 @@
+/* IPXWrapper - Per-peer traffic accounting
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+#include <utlist.h>
+
+#include "common.h"
+#include "peerstats.h"
+
+struct peer_key
+{
+	addr32_t net;
+	addr48_t node;
+};
+
+typedef struct peer_key peer_key;
+
+typedef struct peer_entry peer_entry;
+
+struct peer_entry
+{
+	UT_hash_handle hh;
+	
+	peer_key key;
+	peer_stats stats;
+	
+	/* Links in peer_lru, or peer_free when unused. */
+	peer_entry *prev, *next;
+};
+
+/* Every entry lives in peer_slab. Unused entries are kept in peer_free, the
+ * rest are in peer_table and in peer_lru, which is ordered from least to most
+ * recently active.
+*/
+static peer_entry peer_slab[PEERSTATS_MAX_PEERS];
+static peer_entry *peer_free  = NULL;
+static peer_entry *peer_lru   = NULL;
+static peer_entry *peer_table = NULL;
+
+static uint64_t peer_evictions = 0;
+
+/* Protects all of the above. */
+static CRITICAL_SECTION peer_lock;
+
+bool peerstats_enabled = false;
+
+void peerstats_init(void)
+{
+	if(!InitializeCriticalSectionAndSpinCount(&peer_lock, 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		abort();
+	}
+	
+	peer_free  = NULL;
+	peer_lru   = NULL;
+	peer_table = NULL;
+	
+	peer_evictions = 0;
+	
+	peerstats_enabled = false;
+	
+	for(int i = 0; i < PEERSTATS_MAX_PEERS; ++i)
+	{
+		LL_PREPEND(peer_free, &(peer_slab[i]));
+	}
+}
+
+void peerstats_cleanup(void)
+{
+	HASH_CLEAR(hh, peer_table);
+	
+	peer_free = NULL;
+	peer_lru  = NULL;
+	
+	DeleteCriticalSection(&peer_lock);
+}
+
+/* Start counting packets. */
+void peerstats_enable(void)
+{
+	__atomic_store_n(&peerstats_enabled, true, __ATOMIC_RELAXED);
+}
+
+/* Find the entry for a peer, creating it if necessary, and move it to the
+ * most recently active end of peer_lru. Must be called with peer_lock held.
+*/
+static peer_entry *_peer_get(addr32_t net, addr48_t node)
+{
+	peer_key key;
+	
+	/* Clear any padding, the whole structure is hashed. */
+	memset(&key, 0, sizeof(key));
+	
+	key.net  = net;
+	key.node = node;
+	
+	peer_entry *peer;
+	HASH_FIND(hh, peer_table, &key, sizeof(key), peer);
+	
+	if(peer != NULL)
+	{
+		if(peer->next != NULL)
+		{
+			DL_DELETE(peer_lru, peer);
+			DL_APPEND(peer_lru, peer);
+		}
+		
+		return peer;
+	}
+	
+	if(peer_free != NULL)
+	{
+		peer = peer_free;
+		LL_DELETE(peer_free, peer);
+	}
+	else{
+		peer = peer_lru;
+		
+		HASH_DEL(peer_table, peer);
+		DL_DELETE(peer_lru, peer);
+		
+		++peer_evictions;
+	}
+	
+	memset(peer, 0, sizeof(*peer));
+	
+	peer->key = key;
+	peer->stats.net  = net;
+	peer->stats.node = node;
+	
+	HASH_ADD(hh, peer_table, key, sizeof(peer->key), peer);
+	DL_APPEND(peer_lru, peer);
+	
+	return peer;
+}
+
+/* Count a packet sent to a remote node. */
+void peerstats_record_send(addr32_t net, addr48_t node, size_t data_size, DWORD now)
+{
+	EnterCriticalSection(&peer_lock);
+	
+	peer_entry *peer = _peer_get(net, node);
+	
+	++(peer->stats.send_packets);
+	peer->stats.send_bytes += data_size;
+	peer->stats.last_send = now;
+	peer->stats.last_seen = now;
+	
+	LeaveCriticalSection(&peer_lock);
+}
+
+/* Count a packet received from a remote node. */
+void peerstats_record_recv(addr32_t net, addr48_t node, size_t data_size, DWORD now)
+{
+	EnterCriticalSection(&peer_lock);
+	
+	peer_entry *peer = _peer_get(net, node);
+	
+	++(peer->stats.recv_packets);
+	peer->stats.recv_bytes += data_size;
+	peer->stats.last_recv = now;
+	peer->stats.last_seen = now;
+	
+	LeaveCriticalSection(&peer_lock);
+}
+
+/* Copy out the counters of up to max_peers peers, most recently active
+ * first. Returns the number of peers copied.
+*/
+unsigned int peerstats_read(peer_stats *out, unsigned int max_peers)
+{
+	EnterCriticalSection(&peer_lock);
+	
+	unsigned int n_peers = 0;
+	
+	if(peer_lru != NULL)
+	{
+		/* The head of a utlist doubly-linked list points back to
+		 * the tail, walk from there towards the head.
+		*/
+		
+		peer_entry *peer = peer_lru->prev;
+		
+		while(n_peers < max_peers)
+		{
+			out[n_peers++] = peer->stats;
+			
+			if(peer == peer_lru)
+			{
+				break;
+			}
+			
+			peer = peer->prev;
+		}
+	}
+	
+	LeaveCriticalSection(&peer_lock);
+	
+	return n_peers;
+}
+
+/* Returns the number of peers which have been forgotten to make room for new
+ * ones.
+*/
+uint64_t peerstats_evictions(void)
+{
+	EnterCriticalSection(&peer_lock);
+	uint64_t evictions = peer_evictions;
+	LeaveCriticalSection(&peer_lock);
+	
+	return evictions;
+}
@@ -0,0 +1,82 @@
+/* IPXWrapper - Per-peer traffic accounting
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_PEERSTATS_H
+#define IPXWRAPPER_PEERSTATS_H
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "addr.h"
+
+/* Packets and bytes sent to and received from each remote IPX node (network
+ * and node number, any socket) are counted in a table of at most
+ * PEERSTATS_MAX_PEERS entries. Once the table is full, the peer which was
+ * least recently sent to or received from is forgotten to make room for a new
+ * one, so a flood of packets from spoofed addresses can't grow it without
+ * bound. Broadcasts are counted against the broadcast node.
+ *
+ * Times are passed in as GetTickCount() values so that the tests can supply
+ * their own clock.
+ *
+ * The table has its own lock, which is never held while taking any other, so
+ * the functions below may be called from any thread with any other locks
+ * held, except peerstats_init() and peerstats_cleanup().
+ *
+ * Every thread sending or receiving a packet would serialise on that lock, so
+ * packets are only counted once peerstats_enable() has been called, which is
+ * done when profiling is enabled or the first time an application asks for
+ * the counters. Callers check PEERSTATS_ENABLED() before counting a packet.
+*/
+
+#define PEERSTATS_MAX_PEERS 256
+
+typedef struct peer_stats peer_stats;
+
+struct peer_stats
+{
+	addr32_t net;
+	addr48_t node;
+	
+	uint64_t send_packets, send_bytes;
+	uint64_t recv_packets, recv_bytes;
+	
+	/* Times a packet was last sent to and received from the peer, and
+	 * the later of the two. last_send and last_recv are only meaningful
+	 * when the matching packet counter is non-zero.
+	*/
+	DWORD last_send;
+	DWORD last_recv;
+	DWORD last_seen;
+};
+
+extern bool peerstats_enabled;
+
+#define PEERSTATS_ENABLED() __atomic_load_n(&peerstats_enabled, __ATOMIC_RELAXED)
+
+void peerstats_init(void);
+void peerstats_cleanup(void);
+void peerstats_enable(void);
+
+void peerstats_record_send(addr32_t net, addr48_t node, size_t data_size, DWORD now);
+void peerstats_record_recv(addr32_t net, addr48_t node, size_t data_size, DWORD now);
+
+unsigned int peerstats_read(peer_stats *out, unsigned int max_peers);
+uint64_t peerstats_evictions(void);
+
+#endif /* !IPXWRAPPER_PEERSTATS_H */
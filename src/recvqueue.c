@@ -0,0 +1,200 @@
+/* IPXWrapper - Socket receive queues
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "recvqueue.h"
+#include "common.h"
+#include "slab.h"
+
+#define FREE_SLOTS_WORDS(depth) (((depth) + 31) / 32)
+
+/* Allocate a receive queue with room for depth packets, the slot arrays are
+ * placed after the ipx_recv_queue structure in the same allocation.
+*/
+ipx_recv_queue *create_recv_queue(int depth)
+{
+	assert(depth > 0 && depth <= RECV_QUEUE_MAX_DEPTH);
+	
+	ipx_recv_queue *recv_queue = malloc(sizeof(ipx_recv_queue)
+		+ (depth * sizeof(unsigned char*))
+		+ (FREE_SLOTS_WORDS(depth) * sizeof(uint32_t))
+		+ (depth * sizeof(int) * 2));
+	
+	if(recv_queue == NULL)
+	{
+		return NULL;
+	}
+	
+	if(!InitializeCriticalSectionAndSpinCount(&(recv_queue->refcount_lock), 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		
+		free(recv_queue);
+		return NULL;
+	}
+	
+	recv_queue->refcount = 1;
+	recv_queue->depth = depth;
+	recv_queue->ready_head = 0;
+	recv_queue->n_ready = 0;
+	recv_queue->doorbell_pending = false;
+	recv_queue->n_relayed = 0;
+	
+	recv_queue->data       = (unsigned char**)(recv_queue + 1);
+	recv_queue->free_slots = (uint32_t*)(recv_queue->data + depth);
+	recv_queue->ready      = (int*)(recv_queue->free_slots + FREE_SLOTS_WORDS(depth));
+	recv_queue->sizes      = recv_queue->ready + depth;
+	
+	recv_queue->free_summary = 0;
+	
+	for(int i = 0; i < FREE_SLOTS_WORDS(depth); ++i)
+	{
+		recv_queue->free_slots[i] = 0;
+	}
+	
+	for(int i = 0; i < depth; ++i)
+	{
+		recv_queue->data[i] = NULL;
+		recv_queue->sizes[i] = IPX_RECV_QUEUE_LOCKED;
+		
+		recv_queue_free_slot(recv_queue, i);
+	}
+	
+	return recv_queue;
+}
+
+int recv_queue_adjust_refcount(ipx_recv_queue *recv_queue, int adj)
+{
+	EnterCriticalSection(&(recv_queue->refcount_lock));
+	int new_refcount = (recv_queue->refcount += adj);
+	LeaveCriticalSection(&(recv_queue->refcount_lock));
+	
+	return new_refcount;
+}
+
+void release_recv_queue(ipx_recv_queue *recv_queue)
+{
+	int new_refcount = recv_queue_adjust_refcount(recv_queue, -1);
+	
+	if(new_refcount == 0)
+	{
+		for(int i = 0; i < recv_queue->depth; ++i)
+		{
+			slab_free(recv_queue->data[i]);
+		}
+		
+		DeleteCriticalSection(&(recv_queue->refcount_lock));
+		free(recv_queue);
+	}
+}
+
+/* Claim a free slot in the queue, returns the slot index or -1 if the queue is
+ * full. The slot's size is set to IPX_RECV_QUEUE_LOCKED.
+*/
+int recv_queue_claim_slot(ipx_recv_queue *recv_queue)
+{
+	if(recv_queue->free_summary == 0)
+	{
+		return -1;
+	}
+	
+	int word = __builtin_ctz(recv_queue->free_summary);
+	int bit  = __builtin_ctz(recv_queue->free_slots[word]);
+	
+	recv_queue->free_slots[word] &= ~((uint32_t)(1) << bit);
+	
+	if(recv_queue->free_slots[word] == 0)
+	{
+		recv_queue->free_summary &= ~((uint32_t)(1) << word);
+	}
+	
+	int slot = (word * 32) + bit;
+	
+	assert(recv_queue->sizes[slot] == IPX_RECV_QUEUE_FREE);
+	recv_queue->sizes[slot] = IPX_RECV_QUEUE_LOCKED;
+	
+	return slot;
+}
+
+/* Release a slot claimed by recv_queue_claim_slot(), freeing any packet stored
+ * in it. The slot must not be in the ready list.
+*/
+void recv_queue_free_slot(ipx_recv_queue *recv_queue, int slot)
+{
+	assert(recv_queue->sizes[slot] != IPX_RECV_QUEUE_FREE);
+	
+	slab_free(recv_queue->data[slot]);
+	
+	recv_queue->data[slot] = NULL;
+	recv_queue->sizes[slot] = IPX_RECV_QUEUE_FREE;
+	
+	recv_queue->free_slots[slot / 32] |= (uint32_t)(1) << (slot % 32);
+	recv_queue->free_summary |= (uint32_t)(1) << (slot / 32);
+}
+
+/* Add a slot to the end of the ready list. */
+void recv_queue_push_ready(ipx_recv_queue *recv_queue, int slot)
+{
+	assert(recv_queue->n_ready < recv_queue->depth);
+	assert(recv_queue->sizes[slot] >= 0);
+	
+	int tail = recv_queue->ready_head + recv_queue->n_ready;
+	if(tail >= recv_queue->depth)
+	{
+		tail -= recv_queue->depth;
+	}
+	
+	recv_queue->ready[tail] = slot;
+	++(recv_queue->n_ready);
+}
+
+/* Get the slot index of the packet at the given position in the ready list,
+ * index 0 is the next packet to be read.
+*/
+int recv_queue_ready_slot(const ipx_recv_queue *recv_queue, int index)
+{
+	assert(index >= 0 && index < recv_queue->n_ready);
+	
+	int i = recv_queue->ready_head + index;
+	if(i >= recv_queue->depth)
+	{
+		i -= recv_queue->depth;
+	}
+	
+	return recv_queue->ready[i];
+}
+
+/* Remove the first slot from the ready list and return its index. The slot
+ * remains claimed until it is passed to recv_queue_free_slot().
+*/
+int recv_queue_pop_ready(ipx_recv_queue *recv_queue)
+{
+	assert(recv_queue->n_ready > 0);
+	
+	int slot = recv_queue->ready[recv_queue->ready_head];
+	
+	if(++(recv_queue->ready_head) == recv_queue->depth)
+	{
+		recv_queue->ready_head = 0;
+	}
+	
+	--(recv_queue->n_ready);
+	
+	return slot;
+}
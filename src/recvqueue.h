@@ -0,0 +1,38 @@
+/* IPXWrapper - Socket receive queues
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_RECVQUEUE_H
+#define IPXWRAPPER_RECVQUEUE_H
+
+#include "ipxwrapper.h"
+
+/* See the comment above struct ipx_recv_queue in ipxwrapper.h for details of
+ * how receive queues work and which functions require the socket's lock.
+*/
+
+ipx_recv_queue *create_recv_queue(int depth);
+int recv_queue_adjust_refcount(ipx_recv_queue *recv_queue, int adj);
+void release_recv_queue(ipx_recv_queue *recv_queue);
+
+int recv_queue_claim_slot(ipx_recv_queue *recv_queue);
+void recv_queue_free_slot(ipx_recv_queue *recv_queue, int slot);
+
+void recv_queue_push_ready(ipx_recv_queue *recv_queue, int slot);
+int recv_queue_ready_slot(const ipx_recv_queue *recv_queue, int index);
+int recv_queue_pop_ready(ipx_recv_queue *recv_queue);
+
+#endif /* !IPXWRAPPER_RECVQUEUE_H */
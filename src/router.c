@@ -25,6 +25,7 @@
 #include <Win32-Extensions.h>
 
 #include "router.h"
+#include "capture.h"
 #include "coalesce.h"
 #include "common.h"
 #include "funcprof.h"
@@ -32,15 +33,57 @@
 #include "interface.h"
 #include "addrcache.h"
 #include "ethernet.h"
+#include "sockindex.h"
+#include "peerstats.h"
+#include "recvqueue.h"
+#include "slab.h"
 
 #define IPX_SOCK_ECHO 2
 
 /* Maximum number of packets to dispatch per iteration of the router loop. */
 #define MAX_RECV_PER_LOOP 50
 
+/* Limits on the packets received by the router thread which may be waiting to
+ * be delivered together by deliver_packets().
+*/
+#define DELIVERY_BATCH_MAX_PACKETS 64
+#define DELIVERY_BATCH_DATA_SIZE   (64 * 1024)
+
+/* Maximum number of sockets whose doorbells deliver_packets() can hold back
+ * until the end of a batch, any more are rung straight away.
+*/
+#define DELIVERY_MAX_DOORBELLS 32
+
+/* Number of sockets bound to the same socket number which deliver_packets()
+ * can deliver a packet to without allocating memory.
+*/
+#define DELIVERY_MAX_TARGETS 16
+
+/* Upper limit on how long the router loop will wait for an event. */
+#define ROUTER_MAX_WAIT_MS 1000
+
 static bool router_running   = false;
 static WSAEVENT router_event = WSA_INVALID_EVENT;
 static HANDLE router_thread  = NULL;
+static DWORD router_thread_id = 0;
+
+/* Timers run by the router thread, the router loop sleeps until the earliest
+ * deadline (a get_uticks() value) in the heap or until an event arrives.
+ *
+ * router_timers is protected by router_timers_cs, callbacks are invoked from
+ * the router thread with the lock released.
+*/
+static timer_heap router_timers = TIMER_HEAP_INIT;
+static CRITICAL_SECTION router_timers_cs;
+
+/* Packets received during the current iteration of the router loop which are
+ * waiting to be delivered to local sockets, the packet data is copied into
+ * delivery_batch_data. Only accessed by the router thread.
+*/
+static ipx_delivery_t delivery_batch[DELIVERY_BATCH_MAX_PACKETS];
+static size_t delivery_batch_n = 0;
+static unsigned char delivery_batch_data[DELIVERY_BATCH_DATA_SIZE];
+static size_t delivery_batch_data_used = 0;
 
 /* The shared socket uses the UDP port number specified in the configuration,
  * every IPXWrapper instance will share it and use it to receive broadcast
@@ -66,12 +109,8 @@ uint16_t private_port = 0; /**< Local port of private UDP socket (network byte o
 struct sockaddr_in dosbox_server_addr;
 static HANDLE dosbox_ready_event = NULL;
 
-static uint64_t dosbox_next_connection_attempt_at;
 static const unsigned int dosbox_connect_retry_interval_ms = 10000;
-
-static uint64_t dosbox_next_registration_request_at;
 static unsigned int dosbox_registration_retry_interval_ms;
-static uint64_t dosbox_registration_timeout_at;
 
 static const unsigned int INITIAL_DOSBOX_REGISTRATION_RETRY_INTERVAL_MS = 250;
 static const unsigned int MAX_DOSBOX_REGISTRATION_RETRY_INTERVAL_MS = 8000;
@@ -80,6 +119,15 @@ static const unsigned int DOSBOX_REGISTRATION_TIMEOUT_MS = 30000;
 
 static void _send_dosbox_registration_request(void);
 static DWORD router_main(void *arg);
+static void _flush_deliveries(void);
+
+static void _dosbox_connect_timer_fired(ipx_timer *timer, uint64_t now);
+static void _dosbox_registration_timer_fired(ipx_timer *timer, uint64_t now);
+static void _dosbox_timeout_timer_fired(ipx_timer *timer, uint64_t now);
+
+static ipx_timer dosbox_connect_timer      = IPX_TIMER_INIT(&_dosbox_connect_timer_fired);
+static ipx_timer dosbox_registration_timer = IPX_TIMER_INIT(&_dosbox_registration_timer_fired);
+static ipx_timer dosbox_timeout_timer      = IPX_TIMER_INIT(&_dosbox_timeout_timer_fired);
 
 /* Initialise a UDP socket. */
 static void _init_socket(SOCKET *sock, uint16_t port, BOOL broadcast, BOOL reuseaddr)
@@ -136,6 +184,14 @@ void router_init(void)
 		abort();
 	}
 	
+	if(!InitializeCriticalSectionAndSpinCount(&router_timers_cs, 0x80000000))
+	{
+		log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
+		abort();
+	}
+	
+	coalesce_init();
+	
 	if(ipx_encap_type == ENCAP_TYPE_PCAP)
 	{
 		if((private_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
@@ -166,7 +222,10 @@ void router_init(void)
 		
 		_init_socket(&private_socket, 0, FALSE, FALSE);
 		
-		dosbox_next_connection_attempt_at = 0;
+		if(!router_timer_schedule(&dosbox_connect_timer, 0))
+		{
+			abort();
+		}
 	}
 	else{
 		_init_socket(&shared_socket, main_config.udp_port, TRUE, TRUE);
@@ -188,7 +247,7 @@ void router_init(void)
 	
 	router_running = true;
 	
-	if(!(router_thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)(&router_main), NULL, 0, NULL)))
+	if(!(router_thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)(&router_main), NULL, 0, &router_thread_id)))
 	{
 		log_printf(LOG_ERROR, "Cannot create router worker thread: %s", w32_error(GetLastError()));
 		abort();
@@ -217,6 +276,9 @@ void router_cleanup(void)
 	
 	coalesce_cleanup();
 	
+	timer_heap_free(&router_timers);
+	DeleteCriticalSection(&router_timers_cs);
+	
 	if(private_socket != -1)
 	{
 		closesocket(private_socket);
@@ -236,142 +298,480 @@ void router_cleanup(void)
 	}
 }
 
-void deliver_packet(
-	uint8_t type,
-	addr32_t src_net,
-	addr48_t src_node,
-	uint16_t src_socket,
-	addr32_t dest_net,
-	addr48_t dest_node,
-	uint16_t dest_socket,
-	const void *data,
-	size_t data_size)
+/* Deliver a packet to a single local socket if it passes the socket's
+ * filters. If the packet is placed in the socket's receive queue, the socket
+ * is added to the ring array with a reference held so the caller can ring
+ * each doorbell once after delivering a batch of packets.
+ *
+ * The socket's lock must be held by the caller.
+*/
+static void _deliver_to_socket(ipx_socket *sock, const ipx_delivery_t *packet, ipx_socket **ring, int *n_ring)
 {
-	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_deliver_packet]));
+	uint8_t type         = packet->type;
+	addr32_t src_net     = packet->src_net;
+	addr48_t src_node    = packet->src_node;
+	uint16_t src_socket  = packet->src_socket;
+	addr32_t dest_net    = packet->dest_net;
+	addr48_t dest_node   = packet->dest_node;
+	uint16_t dest_socket = packet->dest_socket;
+	const void *data     = packet->data;
+	size_t data_size     = packet->data_size;
+	
+	if((sock->flags & IPX_FILTER) && sock->f_ptype != type)
+	{
+		/* Socket has packet type filtering enabled and this packet is
+		 * of the wrong type.
+		*/
+		return;
+	}
 	
+	if((dest_net != addr32_in(sock->addr.sa_netnum) && dest_net != BCAST_NET)
+		|| (dest_node != addr48_in(sock->addr.sa_nodenum) && dest_node != BCAST_NODE))
 	{
-		IPX_STRING_ADDR(src_addr, src_net, src_node, src_socket);
-		IPX_STRING_ADDR(dest_addr, dest_net, dest_node, dest_socket);
-		
-		log_printf(LOG_DEBUG, "Delivering %u byte payload from %s to %s",
-			(unsigned int)(data_size), src_addr, dest_addr);
+		/* Packet destination address is neither the local address of
+		 * this socket nor broadcast.
+		*/
+		return;
 	}
 	
-	lock_sockets();
+	if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
+		&& !(sock->flags & IPX_RECV_BCAST))
+	{
+		/* Packet destination address includes a broadcast part and
+		 * this socket has explicitly disabled reception of broadcasts.
+		*/
+		return;
+	}
 	
-	ipx_socket *sock, *tmp;
-	HASH_ITER(hh, sockets, sock, tmp)
+	if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
+		&& (main_config.w95_bug && !(sock->flags & IPX_BROADCAST)))
 	{
-		if(sock->flags & IPX_IS_SPX)
-		{
-			/* Socket is SPX */
-			continue;
-		}
+		/* Packet destination address includes a broadcast part, socket
+		 * has not enabled the SO_BROADCAST option and the Windows 95
+		 * SO_BROADCAST bug is being emulated.
+		*/
+		return;
+	}
+	
+	if((sock->flags & IPX_CONNECTED)
+		&& (src_net != addr32_in(sock->remote_addr.sa_netnum)
+		|| src_node != addr48_in(sock->remote_addr.sa_nodenum)
+		|| src_socket != sock->remote_addr.sa_socket))
+	{
+		/* Socket is "connected" and the source address isn't the
+		 * remote address of the socket.
+		*/
+		return;
+	}
+	
+	/* The header is sent along with the caller's payload buffer using
+	 * scatter/gather rather than assembling a complete copy of the
+	 * packet.
+	*/
+	
+	ipx_packet header;
+	
+	header.ptype = type;
+	
+	addr32_out(header.dest_net, dest_net);
+	addr48_out(header.dest_node, dest_node);
+	header.dest_socket = dest_socket;
+	
+	addr32_out(header.src_net, src_net);
+	addr48_out(header.src_node, src_node);
+	header.src_socket = src_socket;
+	
+	header.size = data_size;
+	
+	WSABUF bufs[2];
+	
+	bufs[0].buf = (char*)(&header);
+	bufs[0].len = sizeof(ipx_packet) - 1;
+	
+	bufs[1].buf = (char*)(data);
+	bufs[1].len = data_size;
+	
+	/* Place the packet directly into the socket's receive queue if there
+	 * is space, otherwise fall back to relaying it over the loopback
+	 * interface where it will wait in the socket's UDP receive buffer
+	 * until recv_pump() can take it.
+	 *
+	 * Once a packet has been relayed, later packets are relayed too until
+	 * recv_pump() has read them all back, so they are received in order.
+	*/
+	
+	ipx_recv_queue *queue = sock->recv_queue;
+	int slot = -1;
+	
+	if(data_size <= MAX_DATA_SIZE && queue->n_relayed == 0)
+	{
+		slot = recv_queue_claim_slot(queue);
+	}
+	
+	/* The packet is stored at its actual size rather than in a
+	 * MAX_PKT_SIZE buffer, if we can't get one then treat the queue as
+	 * full.
+	*/
+	
+	if(slot >= 0 && (queue->data[slot] = slab_alloc((sizeof(ipx_packet) - 1) + data_size)) == NULL)
+	{
+		recv_queue_free_slot(queue, slot);
+		slot = -1;
+	}
+	
+	if(slot >= 0)
+	{
+		LOG_PRINTF(LOG_DEBUG, "...queueing for local port %hu", ntohs(sock->port));
 		
-		if(!(sock->flags & IPX_BOUND))
-		{
-			/* Socket isn't bound */
-			continue;
-		}
+		memcpy(queue->data[slot], &header, sizeof(ipx_packet) - 1);
+		memcpy(queue->data[slot] + sizeof(ipx_packet) - 1, data, data_size);
 		
-		if(!(sock->flags & IPX_RECV))
-		{
-			/* Socket is shut down for receive operations. */
-			continue;
-		}
+		queue->sizes[slot] = (sizeof(ipx_packet) - 1) + data_size;
+		recv_queue_push_ready(queue, slot);
 		
-		if((sock->flags & IPX_FILTER) && sock->f_ptype != type)
-		{
-			/* Socket has packet type filtering enabled and this
-			 * packet is of the wrong type.
-			*/
-			continue;
-		}
+		int r;
+		for(r = 0; r < *n_ring && ring[r] != sock; ++r) {}
 		
-		if((dest_net != addr32_in(sock->addr.sa_netnum) && dest_net != BCAST_NET)
-			|| (dest_node != addr48_in(sock->addr.sa_nodenum) && dest_node != BCAST_NODE)
-			|| dest_socket != sock->addr.sa_socket)
+		if(r == *n_ring)
 		{
-			/* Packet destination address is neither the local
-			 * address of this socket nor broadcast.
-			*/
-			continue;
+			if(*n_ring < DELIVERY_MAX_DOORBELLS)
+			{
+				ref_socket(sock);
+				ring[(*n_ring)++] = sock;
+			}
+			else{
+				recv_queue_ring_doorbell(sock);
+			}
 		}
 		
-		if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
-			&& !(sock->flags & IPX_RECV_BCAST))
-		{
-			/* Packet destination address includes a broadcast part
-			 * and this socket has explicitly disabled reception of
-			 * broadcasts.
-			*/
-			continue;
-		}
+		__atomic_add_fetch(&recv_packets, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&recv_bytes, data_size, __ATOMIC_RELAXED);
 		
-		if((dest_net == BCAST_NET || dest_node == BCAST_NODE)
-			&& (main_config.w95_bug && !(sock->flags & IPX_BROADCAST)))
-		{
-			/* Packet destination address includes a broadcast part,
-			 * socket has not enabled the SO_BROADCAST option and
-			 * the Windows 95 SO_BROADCAST bug is being emulated.
-			*/
-			continue;
-		}
+		__atomic_add_fetch(&(sock->stats.recv_packets), 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&(sock->stats.recv_bytes), data_size, __ATOMIC_RELAXED);
 		
-		if((sock->flags & IPX_CONNECTED)
-			&& (src_net != addr32_in(sock->remote_addr.sa_netnum)
-			|| src_node != addr48_in(sock->remote_addr.sa_nodenum)
-			|| src_socket != sock->remote_addr.sa_socket))
+		return;
+	}
+	
+	LOG_PRINTF(LOG_DEBUG, "...relaying to local port %hu", ntohs(sock->port));
+	
+	if(data_size <= MAX_DATA_SIZE && queue->n_relayed == 0)
+	{
+		__atomic_add_fetch(&(sock->stats.recv_queue_full), 1, __ATOMIC_RELAXED);
+	}
+	
+	/* Ring any doorbell held back for this socket first, so the packets
+	 * already in its queue are received before this one.
+	*/
+	
+	for(int r = 0; r < *n_ring; ++r)
+	{
+		if(ring[r] == sock)
 		{
-			/* Socket is "connected" and the source address isn't
-			 * the remote address of the socket.
-			*/
-			continue;
+			recv_queue_ring_doorbell(sock);
+			ring[r] = ring[--(*n_ring)];
+			
+			/* Can't be the last reference, the caller has one. */
+			unref_socket(sock);
+			
+			break;
 		}
+	}
+	
+	struct sockaddr_in send_addr;
+	
+	send_addr.sin_family      = AF_INET;
+	send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	send_addr.sin_port        = sock->port;
+	
+	DWORD sent;
+	
+	if(WSASendTo(private_socket, bufs, 2, &sent, 0, (struct sockaddr*)(&send_addr), sizeof(send_addr), NULL, NULL) == SOCKET_ERROR)
+	{
+		log_printf(LOG_ERROR, "Error relaying packet: %s", w32_error(WSAGetLastError()));
+		
+		__atomic_add_fetch(&(sock->stats.recv_drops), 1, __ATOMIC_RELAXED);
+	}
+	else{
+		++(queue->n_relayed);
 		
-		log_printf(LOG_DEBUG, "...relaying to local port %hu", ntohs(sock->port));
+		__atomic_add_fetch(&recv_packets, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&recv_bytes, data_size, __ATOMIC_RELAXED);
 		
-		size_t packet_size = (sizeof(ipx_packet) + data_size) - 1;
+		__atomic_add_fetch(&(sock->stats.recv_packets), 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&(sock->stats.recv_bytes), data_size, __ATOMIC_RELAXED);
+	}
+}
+
+/* Deliver every packet in a batch which is addressed to the same socket
+ * number as the first one to any matching local sockets.
+ *
+ * The sockets bound to the destination socket number are collected with a
+ * reference held while the sockets table is locked, then each socket is
+ * locked in turn to deliver all of the packets to it once the table lock has
+ * been released, so neither lock is taken for every packet.
+*/
+static void _deliver_to_socket_number(const ipx_delivery_t *packets, size_t n_packets, ipx_socket **ring, int *n_ring)
+{
+	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_deliver_packet]));
+	
+	uint16_t dest_socket = packets[0].dest_socket;
+	
+	for(size_t i = 0; i < n_packets; ++i)
+	{
+		const ipx_delivery_t *packet = &(packets[i]);
 		
-		ipx_packet *packet = malloc(packet_size);
-		if(!packet)
+		if(packet->dest_socket != dest_socket)
 		{
-			log_printf(LOG_ERROR, "Cannot allocate memory!");
 			continue;
 		}
 		
-		packet->ptype = type;
+		if(LOG_ENABLED(LOG_DEBUG))
+		{
+			IPX_STRING_ADDR(src_addr, packet->src_net, packet->src_node, packet->src_socket);
+			IPX_STRING_ADDR(dest_addr, packet->dest_net, packet->dest_node, packet->dest_socket);
+			
+			log_printf(LOG_DEBUG, "Delivering %u byte payload from %s to %s",
+				(unsigned int)(packet->data_size), src_addr, dest_addr);
+		}
 		
-		addr32_out(packet->dest_net, dest_net);
-		addr48_out(packet->dest_node, dest_node);
-		packet->dest_socket = dest_socket;
+		capture_packet(CAPTURE_INBOUND, packet->type,
+			packet->src_net, packet->src_node, packet->src_socket,
+			packet->dest_net, packet->dest_node, packet->dest_socket,
+			packet->data, packet->data_size);
+	}
+	
+	/* Only bound IPX sockets which haven't been shut down for receive
+	 * operations are present in ipx_recv_index, so we only need to check
+	 * the remaining filters on sockets bound to the destination socket
+	 * number.
+	*/
+	
+	ipx_socket *targets_buf[DELIVERY_MAX_TARGETS];
+	ipx_socket **targets = targets_buf;
+	int n_targets = 0;
+	
+	lock_sockets_shared();
+	
+	int max_targets = 0;
+	for(ipx_socket *sock = sockindex_find(ipx_recv_index, dest_socket); sock != NULL; sock = sock->index_next)
+	{
+		++max_targets;
+	}
+	
+	if(max_targets > DELIVERY_MAX_TARGETS
+		&& (targets = malloc(max_targets * sizeof(ipx_socket*))) == NULL)
+	{
+		log_printf(LOG_ERROR, "Cannot allocate memory, delivering to %d of %d sockets",
+			DELIVERY_MAX_TARGETS, max_targets);
 		
-		addr32_out(packet->src_net, src_net);
-		addr48_out(packet->src_node, src_node);
-		packet->src_socket = src_socket;
+		targets     = targets_buf;
+		max_targets = DELIVERY_MAX_TARGETS;
+	}
+	
+	for(ipx_socket *sock = sockindex_find(ipx_recv_index, dest_socket); sock != NULL && n_targets < max_targets; sock = sock->index_next)
+	{
+		ref_socket(sock);
+		targets[n_targets++] = sock;
+	}
+	
+	unlock_sockets_shared();
+	
+	for(int t = 0; t < n_targets; ++t)
+	{
+		ipx_socket *sock = targets[t];
 		
-		packet->size = data_size;
-		memcpy(packet->data, data, data_size);
+		lock_socket(sock);
 		
-		struct sockaddr_in send_addr;
+		/* The socket may have been closed or shut down for receive
+		 * operations since we found it.
+		*/
+		
+		if(!(sock->flags & IPX_CLOSED) && sock->index == &ipx_recv_index)
+		{
+			for(size_t i = 0; i < n_packets; ++i)
+			{
+				if(packets[i].dest_socket == dest_socket)
+				{
+					_deliver_to_socket(sock, &(packets[i]), ring, n_ring);
+				}
+			}
+		}
+		
+		release_socket(sock);
+	}
+	
+	if(targets != targets_buf)
+	{
+		free(targets);
+	}
+}
+
+/* Deliver an array of packets to local sockets, ringing the doorbell of each
+ * socket which received any of them once at the end.
+ *
+ * Packets are delivered to each socket in the order they appear in the array,
+ * but not necessarily in that order across different sockets.
+ *
+ * Must not be called with the sockets table or any socket locked, as each
+ * socket which the packets are delivered to is locked in turn.
+*/
+void deliver_packets(const ipx_delivery_t *packets, size_t n_packets)
+{
+	FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_deliver_packets]));
+	
+	ipx_socket *ring[DELIVERY_MAX_DOORBELLS];
+	int n_ring = 0;
+	
+	for(size_t i = 0; i < n_packets; ++i)
+	{
+		/* Skip over packets to a socket number which has already been
+		 * delivered along with an earlier packet in the batch.
+		*/
 		
-		send_addr.sin_family      = AF_INET;
-		send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-		send_addr.sin_port        = sock->port;
+		size_t j;
+		for(j = 0; j < i && packets[j].dest_socket != packets[i].dest_socket; ++j) {}
 		
-		if(sendto(private_socket, (void*)(packet), packet_size, 0, (struct sockaddr*)(&send_addr), sizeof(send_addr)) == -1)
+		if(j == i)
 		{
-			log_printf(LOG_ERROR, "Error relaying packet: %s", w32_error(WSAGetLastError()));
+			_deliver_to_socket_number(&(packets[i]), (n_packets - i), ring, &n_ring);
 		}
-		else{
-			__atomic_add_fetch(&recv_packets, 1, __ATOMIC_RELAXED);
-			__atomic_add_fetch(&recv_bytes, data_size, __ATOMIC_RELAXED);
+	}
+	
+	for(int i = 0; i < n_ring; ++i)
+	{
+		lock_socket(ring[i]);
+		
+		if(!(ring[i]->flags & IPX_CLOSED))
+		{
+			recv_queue_ring_doorbell(ring[i]);
 		}
 		
-		free(packet);
+		release_socket(ring[i]);
+	}
+}
+
+void deliver_packet(
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size)
+{
+	ipx_delivery_t packet = {
+		.type        = type,
+		.src_net     = src_net,
+		.src_node    = src_node,
+		.src_socket  = src_socket,
+		.dest_net    = dest_net,
+		.dest_node   = dest_node,
+		.dest_socket = dest_socket,
+		.data        = data,
+		.data_size   = data_size,
+	};
+	
+	deliver_packets(&packet, 1);
+}
+
+/* Queue a packet received by the router thread for delivery at the end of
+ * the current router loop iteration. The data is copied, so the caller's
+ * buffer can be reused immediately.
+*/
+static void _queue_delivery(
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size)
+{
+	if(PEERSTATS_ENABLED())
+	{
+		peerstats_record_recv(src_net, src_node, data_size, GetTickCount());
+	}
+	
+	if(data_size > DELIVERY_BATCH_DATA_SIZE)
+	{
+		/* Too big to ever fit in the batch buffer. */
+		
+		_flush_deliveries();
+		deliver_packet(type, src_net, src_node, src_socket, dest_net, dest_node, dest_socket, data, data_size);
+		
+		return;
+	}
+	
+	if(delivery_batch_n == DELIVERY_BATCH_MAX_PACKETS
+		|| (delivery_batch_data_used + data_size) > DELIVERY_BATCH_DATA_SIZE)
+	{
+		_flush_deliveries();
+	}
+	
+	unsigned char *batch_data = delivery_batch_data + delivery_batch_data_used;
+	memcpy(batch_data, data, data_size);
+	
+	delivery_batch_data_used += data_size;
+	
+	ipx_delivery_t *packet = &(delivery_batch[delivery_batch_n++]);
+	
+	packet->type        = type;
+	packet->src_net     = src_net;
+	packet->src_node    = src_node;
+	packet->src_socket  = src_socket;
+	packet->dest_net    = dest_net;
+	packet->dest_node   = dest_node;
+	packet->dest_socket = dest_socket;
+	packet->data        = batch_data;
+	packet->data_size   = data_size;
+}
+
+/* Deliver any packets queued by _queue_delivery(). */
+static void _flush_deliveries(void)
+{
+	if(delivery_batch_n > 0)
+	{
+		deliver_packets(delivery_batch, delivery_batch_n);
 	}
 	
-	unlock_sockets();
+	delivery_batch_n = 0;
+	delivery_batch_data_used = 0;
+}
+
+/* Send a doorbell datagram to the underlying UDP socket of an IPX socket to
+ * wake up anything waiting to receive from it, unless one is already waiting
+ * to be read.
+ *
+ * The socket's lock must be held by the caller.
+*/
+void recv_queue_ring_doorbell(struct ipx_socket *sock)
+{
+	if(sock->recv_queue->doorbell_pending)
+	{
+		return;
+	}
+	
+	struct sockaddr_in send_addr;
+	
+	send_addr.sin_family      = AF_INET;
+	send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	send_addr.sin_port        = sock->port;
+	
+	char doorbell[RECV_QUEUE_DOORBELL_SIZE] = { 0 };
+	
+	if(r_sendto(private_socket, doorbell, sizeof(doorbell), 0, (struct sockaddr*)(&send_addr), sizeof(send_addr)) == -1)
+	{
+		log_printf(LOG_ERROR, "Error sending doorbell to local port %hu: %s",
+			ntohs(sock->port), w32_error(WSAGetLastError()));
+	}
+	else{
+		sock->recv_queue->doorbell_pending = true;
+	}
 }
 
 static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sockaddr_in src_ip)
@@ -406,61 +806,126 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 			
 			if(data_size != sizeof(spxlookup_req_t))
 			{
-				log_printf(LOG_DEBUG, "Recieved IPX_MAGIC_SPXLOOKUP packet with %hu byte payload, dropping", data_size);
+				LOG_PRINTF(LOG_DEBUG, "Recieved IPX_MAGIC_SPXLOOKUP packet with %hu byte payload, dropping", data_size);
 				return;
 			}
 			
 			spxlookup_req_t *req = (spxlookup_req_t*)(packet->data);
 			
-			/* Search the sockets table for a listening socket which
-			 * is bound to the requested address.
+			/* Search the SPX listener index for a listening socket which
+			 * is bound to the requested address. The address and port of
+			 * a socket don't change while it is in the index, so they can
+			 * be read without locking the socket itself.
 			*/
 			
-			lock_sockets();
+			bool found = false;
+			uint16_t port;
 			
-			ipx_socket *s, *tmp;
-			HASH_ITER(hh, sockets, s, tmp)
+			lock_sockets_shared();
+			
+			for(ipx_socket *s = sockindex_find(spx_listen_index, req->socket); s != NULL; s = s->index_next)
 			{
 				if(
-					s->flags & IPX_IS_SPX
-					&& s->flags & IPX_LISTENING
-					&& (memcmp(req->net, s->addr.sa_netnum, 4) == 0
+					(memcmp(req->net, s->addr.sa_netnum, 4) == 0
 						|| addr32_in(req->net) == ZERO_NET)
-					&& memcmp(req->node, s->addr.sa_nodenum, 6) == 0
-					&& req->socket == s->addr.sa_socket)
+					&& memcmp(req->node, s->addr.sa_nodenum, 6) == 0)
 				{
-					/* This socket seems to fit the bill.
-					 * Reply with the port number.
-					*/
-					
-					spxlookup_reply_t reply;
-					memset(&reply, 0, sizeof(reply));
-					
-					memcpy(reply.net, req->net, 4);
-					memcpy(reply.node, req->node, 6);
-					reply.socket = req->socket;
+					/* This socket seems to fit the bill. */
 					
-					reply.port = s->port;
-					
-					if(sendto(private_socket, (char*)(&reply), sizeof(reply), 0, (struct sockaddr*)(&src_ip), sizeof(src_ip)) == -1)
-					{
-						log_printf(LOG_ERROR, "Cannot send spxlookup_reply packet: %s", w32_error(WSAGetLastError()));
-					}
+					port  = s->port;
+					found = true;
 					
 					break;
 				}
 			}
 			
-			unlock_sockets();
+			unlock_sockets_shared();
+			
+			if(found)
+			{
+				/* Reply with the port number. */
+				
+				spxlookup_reply_t reply;
+				memset(&reply, 0, sizeof(reply));
+				
+				memcpy(reply.net, req->net, 4);
+				memcpy(reply.node, req->node, 6);
+				reply.socket = req->socket;
+				
+				reply.port = port;
+				
+				if(sendto(private_socket, (char*)(&reply), sizeof(reply), 0, (struct sockaddr*)(&src_ip), sizeof(src_ip)) == -1)
+				{
+					log_printf(LOG_ERROR, "Cannot send spxlookup_reply packet: %s", w32_error(WSAGetLastError()));
+				}
+			}
+		}
+		else if(packet->ptype == IPX_MAGIC_COALESCE_QUERY || packet->ptype == IPX_MAGIC_COALESCE_REPLY)
+		{
+			if(data_size != sizeof(coalesce_query_t))
+			{
+				LOG_PRINTF(LOG_DEBUG, "Recieved coalescing query packet with %zu byte payload, dropping", data_size);
+				return;
+			}
+			
+			const coalesce_query_t *query = (const coalesce_query_t*)(packet->data);
+			
+			if(packet->ptype == IPX_MAGIC_COALESCE_QUERY)
+			{
+				coalesce_handle_query(query, (struct sockaddr*)(&src_ip), sizeof(src_ip));
+			}
+			else{
+				coalesce_handle_reply(query, (struct sockaddr*)(&src_ip), sizeof(src_ip));
+			}
+		}
+		else if(packet->ptype == IPX_MAGIC_COALESCED)
+		{
+			/* Sanity check the lengths of each inner packet before
+			 * delivering any of them. Coalesced packets can't be
+			 * nested.
+			*/
+			
+			LOG_PRINTF(LOG_DEBUG, "Recieved coalesced packet (%zu bytes)", packet_size);
+			
+			const size_t header_size = sizeof(ipx_packet) - 1;
+			
+			unsigned char *inner_packets = (unsigned char*)(packet->data);
+			unsigned char *end = inner_packets + data_size;
+			
+			for(unsigned char *p = inner_packets; p < end;)
+			{
+				ipx_packet *inner = (ipx_packet*)(p);
+				size_t remaining_data = end - p;
+				
+				if(remaining_data < header_size
+					|| (header_size + ntohs(inner->size)) > remaining_data
+					|| inner->src_socket == 0)
+				{
+					LOG_PRINTF(LOG_DEBUG, "Recieved invalid coalesced packet from %s, dropping", inet_ntoa(src_ip.sin_addr));
+					return;
+				}
+				
+				p += header_size + ntohs(inner->size);
+			}
+			
+			for(unsigned char *p = inner_packets; p < end;)
+			{
+				ipx_packet *inner = (ipx_packet*)(p);
+				size_t inner_size = header_size + ntohs(inner->size);
+				
+				_handle_udp_recv(inner, inner_size, src_ip);
+				
+				p += inner_size;
+			}
 		}
 		else{
-			log_printf(LOG_DEBUG, "Recieved magic packet unknown ptype %u, dropping", (unsigned int)(packet->ptype));
+			LOG_PRINTF(LOG_DEBUG, "Recieved magic packet unknown ptype %u, dropping", (unsigned int)(packet->ptype));
 		}
 		
 		return;
 	}
 	
-	if(min_log_level <= LOG_DEBUG)
+	if(LOG_ENABLED(LOG_DEBUG))
 	{
 		IPX_STRING_ADDR(src_addr, addr32_in(packet->src_net), addr48_in(packet->src_node), packet->src_socket);
 		IPX_STRING_ADDR(dest_addr, addr32_in(packet->dest_net), addr48_in(packet->dest_node), packet->dest_socket);
@@ -474,36 +939,16 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 	 * address.
 	*/
 	
-	ipx_interface_t *allow_interfaces;
-	BOOL source_ok = FALSE;
+	ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
 	
-	if(addr48_in(packet->dest_node) == BCAST_NODE)
-	{
-		allow_interfaces = get_ipx_interfaces();
-	}
-	else{
-		allow_interfaces = ipx_interface_by_addr(
-			addr32_in(packet->dest_net), addr48_in(packet->dest_node));
-	}
-	
-	ipx_interface_t *i;
-	DL_FOREACH(allow_interfaces, i)
-	{
-		ipx_interface_ip_t *ip;
-		DL_FOREACH(i->ipaddr, ip)
-		{
-			if((ip->ipaddr & ip->netmask) == (src_ip.sin_addr.s_addr & ip->netmask))
-			{
-				source_ok = TRUE;
-			}
-		}
-	}
+	bool source_ok = ipx_snapshot_source_ok(snapshot,
+		src_ip.sin_addr.s_addr, addr32_in(packet->dest_net), addr48_in(packet->dest_node));
 	
-	free_ipx_interface_list(&allow_interfaces);
+	ipx_interfaces_release(snapshot);
 	
 	if(!source_ok)
 	{
-		log_printf(LOG_DEBUG, "Packet did not come from an expected subnet, dropping");
+		LOG_PRINTF(LOG_DEBUG, "Packet did not come from an expected subnet, dropping");
 		return;
 	}
 	
@@ -517,7 +962,7 @@ static void _handle_udp_recv(ipx_packet *packet, size_t packet_size, struct sock
 		addr32_in(packet->src_net), addr48_in(packet->src_node), packet->src_socket
 	);
 	
-	deliver_packet(packet->ptype,
+	_queue_delivery(packet->ptype,
 		addr32_in(packet->src_net),
 		addr48_in(packet->src_node),
 		packet->src_socket,
@@ -546,6 +991,9 @@ static void _handle_dosbox_registration_response(novell_ipx_packet *packet, size
 	
 	dosbox_state = DOSBOX_CONNECTED;
 	
+	router_timer_cancel(&dosbox_registration_timer);
+	router_timer_cancel(&dosbox_timeout_timer);
+	
 	ipx_interfaces_reload();
 	
 	char local_netnum_s[ADDR32_STRING_SIZE];
@@ -574,7 +1022,7 @@ static void _handle_dosbox_recv(novell_ipx_packet *packet, size_t packet_size)
 	{
 		/* Sanity check the lengths of each inner packet. */
 		
-		log_printf(LOG_DEBUG, "Recieved coalesced packet (%zu bytes)", packet_size);
+		LOG_PRINTF(LOG_DEBUG, "Recieved coalesced packet (%zu bytes)", packet_size);
 		
 		novell_ipx_packet *inner_packets = (novell_ipx_packet*)(packet->data);
 		size_t remaining_data = packet_size - sizeof(novell_ipx_packet);
@@ -597,7 +1045,7 @@ static void _handle_dosbox_recv(novell_ipx_packet *packet, size_t packet_size)
 		
 		for(novell_ipx_packet *p = inner_packets; p < end;)
 		{
-			if(min_log_level <= LOG_DEBUG)
+			if(LOG_ENABLED(LOG_DEBUG))
 			{
 				IPX_STRING_ADDR(src_addr, addr32_in(p->src_net), addr48_in(p->src_node), p->src_socket);
 				IPX_STRING_ADDR(dest_addr, addr32_in(p->dest_net), addr48_in(p->dest_node), p->dest_socket);
@@ -607,7 +1055,7 @@ static void _handle_dosbox_recv(novell_ipx_packet *packet, size_t packet_size)
 			
 			size_t data_size = ntohs(p->length) - sizeof(novell_ipx_packet);
 			
-			deliver_packet(
+			_queue_delivery(
 				p->type,
 				
 				addr32_in(p->src_net),
@@ -625,7 +1073,7 @@ static void _handle_dosbox_recv(novell_ipx_packet *packet, size_t packet_size)
 		}
 	}
 	else{
-		if(min_log_level <= LOG_DEBUG)
+		if(LOG_ENABLED(LOG_DEBUG))
 		{
 			IPX_STRING_ADDR(src_addr, addr32_in(packet->src_net), addr48_in(packet->src_node), packet->src_socket);
 			IPX_STRING_ADDR(dest_addr, addr32_in(packet->dest_net), addr48_in(packet->dest_node), packet->dest_socket);
@@ -635,7 +1083,7 @@ static void _handle_dosbox_recv(novell_ipx_packet *packet, size_t packet_size)
 		
 		size_t data_size = ntohs(packet->length) - sizeof(novell_ipx_packet);
 		
-		deliver_packet(
+		_queue_delivery(
 			packet->type,
 			
 			addr32_in(packet->src_net),
@@ -767,7 +1215,7 @@ static void _handle_pcap_frame(u_char *user, const struct pcap_pkthdr *pkt_heade
 		}
 	}
 	
-	deliver_packet(ipx->type,
+	_queue_delivery(ipx->type,
 		addr32_in(ipx->src_net),
 		addr48_in(ipx->src_node),
 		ipx->src_socket,
@@ -803,6 +1251,143 @@ static void _send_dosbox_registration_request(void)
 	}
 }
 
+static void _dosbox_connect_timer_fired(ipx_timer *timer, uint64_t now)
+{
+	if(dosbox_state != DOSBOX_DISCONNECTED)
+	{
+		return;
+	}
+	
+	struct hostent *host = gethostbyname(main_config.dosbox_server_addr);
+	
+	/* Name resolution may have taken a while. */
+	now = get_uticks();
+	
+	if(host != NULL)
+	{
+		dosbox_server_addr.sin_family = AF_INET;
+		memcpy(&(dosbox_server_addr.sin_addr), host->h_addr, 4);
+		dosbox_server_addr.sin_port = htons(main_config.dosbox_server_port);
+		
+		log_printf(LOG_INFO, "Resolved DOSBox server address %s, connecting...\n", inet_ntoa(dosbox_server_addr.sin_addr));
+		
+		dosbox_registration_retry_interval_ms = INITIAL_DOSBOX_REGISTRATION_RETRY_INTERVAL_MS;
+		
+		router_timer_schedule(&dosbox_registration_timer, now);
+		router_timer_schedule(&dosbox_timeout_timer, now + (DOSBOX_REGISTRATION_TIMEOUT_MS * 1000ULL));
+		
+		dosbox_state = DOSBOX_REGISTERING;
+	}
+	else{
+		DWORD error = WSAGetLastError();
+		log_printf(LOG_ERROR, "Error resolving %s: %s (%u)",
+			main_config.dosbox_server_addr, w32_error(error), (unsigned int)(error));
+		
+		router_timer_schedule(&dosbox_connect_timer, now + (dosbox_connect_retry_interval_ms * 1000ULL));
+	}
+}
+
+static void _dosbox_registration_timer_fired(ipx_timer *timer, uint64_t now)
+{
+	if(dosbox_state != DOSBOX_REGISTERING)
+	{
+		return;
+	}
+	
+	_send_dosbox_registration_request();
+	
+	router_timer_schedule(&dosbox_registration_timer, now + (dosbox_registration_retry_interval_ms * 1000ULL));
+	
+	dosbox_registration_retry_interval_ms *= 2;
+	dosbox_registration_retry_interval_ms = min(dosbox_registration_retry_interval_ms, MAX_DOSBOX_REGISTRATION_RETRY_INTERVAL_MS);
+}
+
+static void _dosbox_timeout_timer_fired(ipx_timer *timer, uint64_t now)
+{
+	if(dosbox_state != DOSBOX_REGISTERING)
+	{
+		return;
+	}
+	
+	log_printf(LOG_ERROR, "Connection to DOSBox server %s timed out", inet_ntoa(dosbox_server_addr.sin_addr));
+	dosbox_state = DOSBOX_DISCONNECTED;
+	
+	router_timer_cancel(&dosbox_registration_timer);
+	router_timer_schedule(&dosbox_connect_timer, now);
+}
+
+/* Schedule a timer to be run by the router thread at the given deadline (a
+ * get_uticks() value), moving it if it is already scheduled.
+ *
+ * The router thread is woken up if the timer is now the earliest one, so it
+ * doesn't sleep past the deadline.
+*/
+bool router_timer_schedule(ipx_timer *timer, uint64_t deadline)
+{
+	EnterCriticalSection(&router_timers_cs);
+	
+	bool scheduled = timer_heap_schedule(&router_timers, timer, deadline);
+	bool earliest  = scheduled && timer_heap_peek(&router_timers) == timer;
+	
+	LeaveCriticalSection(&router_timers_cs);
+	
+	if(earliest && GetCurrentThreadId() != router_thread_id)
+	{
+		SetEvent(router_event);
+	}
+	
+	return scheduled;
+}
+
+void router_timer_cancel(ipx_timer *timer)
+{
+	EnterCriticalSection(&router_timers_cs);
+	timer_heap_cancel(&router_timers, timer);
+	LeaveCriticalSection(&router_timers_cs);
+}
+
+/* Run any timers whose deadlines have passed and return how long the router
+ * thread can wait for events before the next deadline.
+*/
+static DWORD _router_run_timers(void)
+{
+	uint64_t now = get_uticks();
+	
+	while(1)
+	{
+		EnterCriticalSection(&router_timers_cs);
+		ipx_timer *timer = timer_heap_pop_expired(&router_timers, now);
+		LeaveCriticalSection(&router_timers_cs);
+		
+		if(timer == NULL)
+		{
+			break;
+		}
+		
+		timer->callback(timer, now);
+		now = get_uticks();
+	}
+	
+	DWORD wait_ms = ROUTER_MAX_WAIT_MS;
+	
+	EnterCriticalSection(&router_timers_cs);
+	
+	ipx_timer *next = timer_heap_peek(&router_timers);
+	if(next != NULL)
+	{
+		/* Round up so we don't wake just before the deadline. */
+		uint64_t next_ms = next->deadline > now
+			? ((next->deadline - now) + 999) / 1000
+			: 0;
+		
+		wait_ms = min(next_ms, wait_ms);
+	}
+	
+	LeaveCriticalSection(&router_timers_cs);
+	
+	return wait_ms;
+}
+
 static DWORD router_main(void *arg)
 {
 	DWORD exit_status = 0;
@@ -842,41 +1427,7 @@ static DWORD router_main(void *arg)
 	
 	while(1)
 	{
-		DWORD wait_ms = 1000;
-		
-		if(ipx_encap_type == ENCAP_TYPE_DOSBOX)
-		{
-			lock_sockets();
-			coalesce_flush_waiting();
-			unlock_sockets();
-			
-			if(dosbox_state == DOSBOX_DISCONNECTED)
-			{
-				uint64_t now = get_ticks();
-				
-				if(now >= dosbox_next_connection_attempt_at)
-				{
-					wait_ms = 0;
-				}
-				else{
-					wait_ms = dosbox_next_connection_attempt_at - now;
-					wait_ms = min(wait_ms, 1000);
-				}
-			}
-			else if(dosbox_state == DOSBOX_REGISTERING)
-			{
-				uint64_t now = get_ticks();
-				
-				if(now >= dosbox_next_registration_request_at)
-				{
-					wait_ms = 0;
-				}
-				else{
-					wait_ms = dosbox_next_registration_request_at - now;
-					wait_ms = min(wait_ms, 1000);
-				}
-			}
-		}
+		DWORD wait_ms = _router_run_timers();
 		
 		WaitForMultipleObjects(n_events, wait_events, FALSE, wait_ms);
 		WSAResetEvent(router_event);
@@ -946,60 +1497,12 @@ static DWORD router_main(void *arg)
 			}
 		}
 		
-		if(ipx_encap_type == ENCAP_TYPE_DOSBOX && dosbox_state == DOSBOX_DISCONNECTED)
-		{
-			if(get_ticks() >= dosbox_next_connection_attempt_at)
-			{
-				struct hostent *host = gethostbyname(main_config.dosbox_server_addr);
-				
-				uint64_t now = get_ticks();
-				
-				if(host != NULL)
-				{
-					dosbox_server_addr.sin_family = AF_INET;
-					memcpy(&(dosbox_server_addr.sin_addr), host->h_addr, 4);
-					dosbox_server_addr.sin_port = htons(main_config.dosbox_server_port);
-					
-					log_printf(LOG_INFO, "Resolved DOSBox server address %s, connecting...\n", inet_ntoa(dosbox_server_addr.sin_addr));
-					
-					dosbox_next_registration_request_at = 0;
-					dosbox_registration_retry_interval_ms = INITIAL_DOSBOX_REGISTRATION_RETRY_INTERVAL_MS;
-					
-					dosbox_registration_timeout_at = now + DOSBOX_REGISTRATION_TIMEOUT_MS;
-					
-					dosbox_state = DOSBOX_REGISTERING;
-				}
-				else{
-					DWORD error = WSAGetLastError();
-					log_printf(LOG_ERROR, "Error resolving %s: %s (%u)",
-						main_config.dosbox_server_addr, w32_error(error), (unsigned int)(error));
-					
-					dosbox_next_connection_attempt_at = now + dosbox_connect_retry_interval_ms;
-				}
-			}
-		}
-		
-		if(ipx_encap_type == ENCAP_TYPE_DOSBOX && dosbox_state == DOSBOX_REGISTERING)
-		{
-			uint64_t now = get_ticks();
-			
-			if(now >= dosbox_registration_timeout_at)
-			{
-				log_printf(LOG_ERROR, "Connection to DOSBox server %s timed out", inet_ntoa(dosbox_server_addr.sin_addr));
-				dosbox_state = DOSBOX_DISCONNECTED;
-			}
-			if(now >= dosbox_next_registration_request_at)
-			{
-				_send_dosbox_registration_request();
-				
-				dosbox_next_registration_request_at = now + dosbox_registration_retry_interval_ms;
-				
-				dosbox_registration_retry_interval_ms *= 2;
-				dosbox_registration_retry_interval_ms = min(dosbox_registration_retry_interval_ms, MAX_DOSBOX_REGISTRATION_RETRY_INTERVAL_MS);
-			}
-		}
+		/* Deliver everything received during this wakeup together. */
+		_flush_deliveries();
 	}
 	
+	_flush_deliveries();
+	
 	if(ipx_encap_type == ENCAP_TYPE_PCAP)
 	{
 		free(wait_events);
@@ -24,11 +24,14 @@
 #include <stdint.h>
 
 #include "addr.h"
+#include "timerheap.h"
 
 #define BCAST_NET  addr32_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF})
 #define BCAST_NODE addr48_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF,0xFF,0xFF})
 #define ZERO_NET   addr32_in((unsigned char[]){0x00,0x00,0x00,0x00})
 
+struct ipx_socket;
+
 extern SOCKET shared_socket;
 extern SOCKET private_socket;
 
@@ -39,6 +42,30 @@ void router_cleanup(void);
 
 void wait_for_ready(DWORD timeout);
 
+bool router_timer_schedule(ipx_timer *timer, uint64_t deadline);
+void router_timer_cancel(ipx_timer *timer);
+
+/* A packet to be delivered to local sockets by deliver_packets(). */
+struct ipx_delivery
+{
+	uint8_t type;
+	
+	addr32_t src_net;
+	addr48_t src_node;
+	uint16_t src_socket;
+	
+	addr32_t dest_net;
+	addr48_t dest_node;
+	uint16_t dest_socket;
+	
+	const void *data;
+	size_t data_size;
+};
+
+typedef struct ipx_delivery ipx_delivery_t;
+
+void deliver_packets(const ipx_delivery_t *packets, size_t n_packets);
+
 void deliver_packet(
     uint8_t type,
 	addr32_t src_net,
@@ -50,4 +77,6 @@ void deliver_packet(
 	const void *data,
 	size_t data_size);
 
+void recv_queue_ring_doorbell(struct ipx_socket *sock);
+
 #endif /* !IPXWRAPPER_ROUTER_H */
@@ -0,0 +1,166 @@
+/* IPXWrapper - Reader/writer locks
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <windows.h>
+
+#include "rwlock.h"
+
+/* The SRW lock functions are looked up at runtime, so we still load on
+ * versions of Windows which don't have them.
+*/
+
+typedef VOID WINAPI (*SRWLockFunc_t)(void **lock);
+
+static SRWLockFunc_t p_InitializeSRWLock       = NULL;
+static SRWLockFunc_t p_AcquireSRWLockShared    = NULL;
+static SRWLockFunc_t p_ReleaseSRWLockShared    = NULL;
+static SRWLockFunc_t p_AcquireSRWLockExclusive = NULL;
+static SRWLockFunc_t p_ReleaseSRWLockExclusive = NULL;
+
+static BOOL srwlock_available = FALSE;
+
+/* Take the critical section used when SRW locks aren't available. */
+static void _cs_lock(rwlock_t *lock)
+{
+	#ifndef NDEBUG
+	/* Nothing else can set cs_owner to our own ID while we're here. */
+	assert(__atomic_load_n(&(lock->cs_owner), __ATOMIC_RELAXED) != GetCurrentThreadId());
+	#endif
+	
+	EnterCriticalSection(&(lock->cs));
+	
+	#ifndef NDEBUG
+	__atomic_store_n(&(lock->cs_owner), GetCurrentThreadId(), __ATOMIC_RELAXED);
+	#endif
+}
+
+static void _cs_unlock(rwlock_t *lock)
+{
+	#ifndef NDEBUG
+	assert(lock->cs_owner == GetCurrentThreadId());
+	__atomic_store_n(&(lock->cs_owner), 0, __ATOMIC_RELAXED);
+	#endif
+	
+	LeaveCriticalSection(&(lock->cs));
+}
+
+static void _load_srwlock_funcs(void)
+{
+	static BOOL loaded = FALSE;
+	
+	if(loaded)
+	{
+		return;
+	}
+	
+	/* kernel32.dll is always loaded, so there is no need to hold our own
+	 * reference to it.
+	*/
+	HMODULE kernel32 = GetModuleHandle("kernel32.dll");
+	
+	if(kernel32 != NULL)
+	{
+		p_InitializeSRWLock       = (SRWLockFunc_t)(GetProcAddress(kernel32, "InitializeSRWLock"));
+		p_AcquireSRWLockShared    = (SRWLockFunc_t)(GetProcAddress(kernel32, "AcquireSRWLockShared"));
+		p_ReleaseSRWLockShared    = (SRWLockFunc_t)(GetProcAddress(kernel32, "ReleaseSRWLockShared"));
+		p_AcquireSRWLockExclusive = (SRWLockFunc_t)(GetProcAddress(kernel32, "AcquireSRWLockExclusive"));
+		p_ReleaseSRWLockExclusive = (SRWLockFunc_t)(GetProcAddress(kernel32, "ReleaseSRWLockExclusive"));
+	}
+	
+	srwlock_available = p_InitializeSRWLock != NULL
+		&& p_AcquireSRWLockShared != NULL
+		&& p_ReleaseSRWLockShared != NULL
+		&& p_AcquireSRWLockExclusive != NULL
+		&& p_ReleaseSRWLockExclusive != NULL;
+	
+	loaded = TRUE;
+}
+
+/* Initialise a lock. Must not be called concurrently with any other rwlock
+ * function, as the first call resolves the SRW lock functions.
+*/
+void rwlock_init(rwlock_t *lock)
+{
+	_load_srwlock_funcs();
+	
+	if(srwlock_available)
+	{
+		p_InitializeSRWLock(&(lock->srwlock));
+	}
+	else{
+		InitializeCriticalSection(&(lock->cs));
+		
+		#ifndef NDEBUG
+		lock->cs_owner = 0;
+		#endif
+	}
+}
+
+void rwlock_destroy(rwlock_t *lock)
+{
+	/* SRW locks don't need to be destroyed. */
+	
+	if(!srwlock_available)
+	{
+		DeleteCriticalSection(&(lock->cs));
+	}
+}
+
+void rwlock_lock_shared(rwlock_t *lock)
+{
+	if(srwlock_available)
+	{
+		p_AcquireSRWLockShared(&(lock->srwlock));
+	}
+	else{
+		_cs_lock(lock);
+	}
+}
+
+void rwlock_unlock_shared(rwlock_t *lock)
+{
+	if(srwlock_available)
+	{
+		p_ReleaseSRWLockShared(&(lock->srwlock));
+	}
+	else{
+		_cs_unlock(lock);
+	}
+}
+
+void rwlock_lock_exclusive(rwlock_t *lock)
+{
+	if(srwlock_available)
+	{
+		p_AcquireSRWLockExclusive(&(lock->srwlock));
+	}
+	else{
+		_cs_lock(lock);
+	}
+}
+
+void rwlock_unlock_exclusive(rwlock_t *lock)
+{
+	if(srwlock_available)
+	{
+		p_ReleaseSRWLockExclusive(&(lock->srwlock));
+	}
+	else{
+		_cs_unlock(lock);
+	}
+}
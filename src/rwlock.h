@@ -0,0 +1,61 @@
+/* IPXWrapper - Reader/writer locks
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_RWLOCK_H
+#define IPXWRAPPER_RWLOCK_H
+
+#include <windows.h>
+
+/* Reader/writer lock which allows any number of threads to hold it shared at
+ * once, or a single thread to hold it exclusively.
+ *
+ * Slim reader/writer locks are used where the system provides them (Vista
+ * and later), older versions of Windows fall back to a critical section, in
+ * which case shared holders exclude each other too.
+ *
+ * Unlike critical sections, rwlocks are NOT recursive. The critical section
+ * fallback would happily allow it, so unless NDEBUG is defined it remembers
+ * which thread holds it and asserts that the holder doesn't lock it again, so
+ * code which only works on older versions of Windows is caught everywhere.
+*/
+
+struct rwlock
+{
+	/* Storage for an SRWLOCK, which is the size of a pointer. */
+	void *srwlock;
+	
+	/* Used instead when SRW locks aren't available. */
+	CRITICAL_SECTION cs;
+	
+	#ifndef NDEBUG
+	/* ID of the thread holding cs, zero when it isn't held. */
+	DWORD cs_owner;
+	#endif
+};
+
+typedef struct rwlock rwlock_t;
+
+void rwlock_init(rwlock_t *lock);
+void rwlock_destroy(rwlock_t *lock);
+
+void rwlock_lock_shared(rwlock_t *lock);
+void rwlock_unlock_shared(rwlock_t *lock);
+
+void rwlock_lock_exclusive(rwlock_t *lock);
+void rwlock_unlock_exclusive(rwlock_t *lock);
+
+#endif /* !IPXWRAPPER_RWLOCK_H */
@@ -0,0 +1,54 @@
+/* IPXWrapper - Send rate tracking
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "sendrate.h"
+
+/* Record a send operation at the given timestamp and return whether packets
+ * to the destination should be coalesced.
+ *
+ * Coalescing starts when the oldest of the tracked send operations happened
+ * within IPXWRAPPER_COALESCE_PACKET_START_THRESH microseconds of this one and
+ * stops once it is more than IPXWRAPPER_COALESCE_PACKET_STOP_THRESH
+ * microseconds old, otherwise the current state (active) is kept.
+*/
+bool send_rate_register(send_rate_t *rate, uint64_t timestamp, bool active)
+{
+	/* Overwrite the oldest timestamp with this one, the timestamp after
+	 * it in the buffer is now the oldest.
+	*/
+	
+	rate->timestamps[rate->oldest] = timestamp;
+	
+	if(++(rate->oldest) == IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT)
+	{
+		rate->oldest = 0;
+	}
+	
+	uint64_t oldest = rate->timestamps[rate->oldest];
+	
+	if((oldest + IPXWRAPPER_COALESCE_PACKET_START_THRESH) >= timestamp)
+	{
+		return true;
+	}
+	else if(active && (oldest + IPXWRAPPER_COALESCE_PACKET_STOP_THRESH) < timestamp)
+	{
+		return false;
+	}
+	else{
+		return active;
+	}
+}
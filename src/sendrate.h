@@ -0,0 +1,45 @@
+/* IPXWrapper - Send rate tracking
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_SENDRATE_H
+#define IPXWRAPPER_SENDRATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "coalesce.h"
+
+/* Timestamps of the past IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT send
+ * operations to a destination, used to decide when to start and stop
+ * coalescing packets to it.
+ *
+ * The timestamps are stored in a circular buffer, 'oldest' is the index of
+ * the oldest timestamp, which is also the slot the next timestamp will be
+ * written to. A zero-initialised structure is ready for use.
+*/
+
+struct send_rate
+{
+	uint64_t timestamps[IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT];
+	unsigned int oldest;
+};
+
+typedef struct send_rate send_rate_t;
+
+bool send_rate_register(send_rate_t *rate, uint64_t timestamp, bool active);
+
+#endif /* !IPXWRAPPER_SENDRATE_H */
@@ -0,0 +1,233 @@
+/* IPXWrapper - Size-classed slab allocator
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+/* Number of power-of-two size classes from SLAB_MIN_SIZE to SLAB_MAX_SIZE. */
+#define SLAB_NUM_CLASSES 10
+
+/* size_class value of allocations passed through to malloc(). */
+#define SLAB_CLASS_LARGE SLAB_NUM_CLASSES
+
+/* Every object is preceded by a header recording which class it belongs to,
+ * so slab_free() knows which free list to return it to. The header is 8 bytes
+ * long so the object data stays 8-byte aligned.
+*/
+
+struct slab_header
+{
+	uint32_t size_class;
+	uint32_t size;
+};
+
+/* Free objects are linked through their data area. */
+
+struct slab_free_object
+{
+	struct slab_free_object *next;
+};
+
+/* Chunks are never returned to the heap until slab_cleanup(), they are kept
+ * in a list so they can be released then.
+*/
+
+union slab_chunk
+{
+	union slab_chunk *next;
+	uint64_t align;
+};
+
+static CRITICAL_SECTION slab_lock;
+
+static struct slab_free_object *slab_free_lists[SLAB_NUM_CLASSES];
+static union slab_chunk *slab_chunks = NULL;
+
+static size_t slab_reserved = 0;
+static size_t slab_used = 0;
+
+void slab_init(void)
+{
+	InitializeCriticalSection(&slab_lock);
+}
+
+void slab_cleanup(void)
+{
+	while(slab_chunks != NULL)
+	{
+		union slab_chunk *chunk = slab_chunks;
+		slab_chunks = chunk->next;
+		
+		free(chunk);
+	}
+	
+	for(int i = 0; i < SLAB_NUM_CLASSES; ++i)
+	{
+		slab_free_lists[i] = NULL;
+	}
+	
+	slab_reserved = 0;
+	slab_used = 0;
+	
+	DeleteCriticalSection(&slab_lock);
+}
+
+static int _size_class(size_t size)
+{
+	int size_class = 0;
+	
+	while(size_class < SLAB_NUM_CLASSES && ((size_t)(SLAB_MIN_SIZE) << size_class) < size)
+	{
+		++size_class;
+	}
+	
+	return size_class;
+}
+
+/* Carve a new chunk up into objects of the given class and add them to its
+ * free list. Must be called with slab_lock held.
+*/
+static bool _slab_grow(int size_class)
+{
+	size_t size = (size_t)(SLAB_MIN_SIZE) << size_class;
+	size_t stride = sizeof(struct slab_header) + size;
+	
+	size_t n_objects = SLAB_CHUNK_SIZE / stride;
+	if(n_objects < 1)
+	{
+		n_objects = 1;
+	}
+	
+	size_t chunk_size = sizeof(union slab_chunk) + (n_objects * stride);
+	
+	union slab_chunk *chunk = malloc(chunk_size);
+	if(chunk == NULL)
+	{
+		return false;
+	}
+	
+	chunk->next = slab_chunks;
+	slab_chunks = chunk;
+	
+	slab_reserved += chunk_size;
+	
+	unsigned char *p = (unsigned char*)(chunk + 1);
+	
+	for(size_t i = 0; i < n_objects; ++i, p += stride)
+	{
+		struct slab_header *header = (struct slab_header*)(p);
+		header->size_class = size_class;
+		header->size = size;
+		
+		struct slab_free_object *object = (struct slab_free_object*)(header + 1);
+		object->next = slab_free_lists[size_class];
+		slab_free_lists[size_class] = object;
+	}
+	
+	return true;
+}
+
+/* Allocate a buffer of at least size bytes, returns NULL on failure. */
+void *slab_alloc(size_t size)
+{
+	int size_class = _size_class(size);
+	
+	if(size_class == SLAB_CLASS_LARGE)
+	{
+		struct slab_header *header = malloc(sizeof(struct slab_header) + size);
+		if(header == NULL)
+		{
+			return NULL;
+		}
+		
+		header->size_class = SLAB_CLASS_LARGE;
+		header->size = size;
+		
+		EnterCriticalSection(&slab_lock);
+		
+		slab_reserved += sizeof(struct slab_header) + size;
+		slab_used += size;
+		
+		LeaveCriticalSection(&slab_lock);
+		
+		return header + 1;
+	}
+	
+	EnterCriticalSection(&slab_lock);
+	
+	if(slab_free_lists[size_class] == NULL && !_slab_grow(size_class))
+	{
+		LeaveCriticalSection(&slab_lock);
+		return NULL;
+	}
+	
+	struct slab_free_object *object = slab_free_lists[size_class];
+	slab_free_lists[size_class] = object->next;
+	
+	slab_used += (size_t)(SLAB_MIN_SIZE) << size_class;
+	
+	LeaveCriticalSection(&slab_lock);
+	
+	return object;
+}
+
+/* Release a buffer returned by slab_alloc(), ptr may be NULL. */
+void slab_free(void *ptr)
+{
+	if(ptr == NULL)
+	{
+		return;
+	}
+	
+	struct slab_header *header = (struct slab_header*)(ptr) - 1;
+	
+	EnterCriticalSection(&slab_lock);
+	
+	slab_used -= header->size;
+	
+	if(header->size_class == SLAB_CLASS_LARGE)
+	{
+		slab_reserved -= sizeof(struct slab_header) + header->size;
+		LeaveCriticalSection(&slab_lock);
+		
+		free(header);
+		return;
+	}
+	
+	struct slab_free_object *object = ptr;
+	object->next = slab_free_lists[header->size_class];
+	slab_free_lists[header->size_class] = object;
+	
+	LeaveCriticalSection(&slab_lock);
+}
+
+/* Get the number of bytes obtained from the heap by the allocator and the
+ * number of bytes in objects which are currently allocated.
+*/
+void slab_stats(size_t *reserved_bytes, size_t *used_bytes)
+{
+	EnterCriticalSection(&slab_lock);
+	
+	*reserved_bytes = slab_reserved;
+	*used_bytes = slab_used;
+	
+	LeaveCriticalSection(&slab_lock);
+}
@@ -0,0 +1,48 @@
+/* IPXWrapper - Size-classed slab allocator
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_SLAB_H
+#define IPXWRAPPER_SLAB_H
+
+#include <stddef.h>
+
+/* Shared allocator for packet buffers.
+ *
+ * Allocations are rounded up to a power of two between SLAB_MIN_SIZE and
+ * SLAB_MAX_SIZE bytes and taken from a free list for that size class, which
+ * is refilled SLAB_CHUNK_SIZE bytes at a time. Freed objects go back onto
+ * their class' free list for reuse rather than back to the heap, so the
+ * memory held by the allocator only grows to the peak number of packets in
+ * flight. Anything larger than SLAB_MAX_SIZE is passed through to malloc().
+ *
+ * All functions other than slab_init() and slab_cleanup() may be called from
+ * any thread.
+*/
+
+#define SLAB_MIN_SIZE   32
+#define SLAB_MAX_SIZE   16384
+#define SLAB_CHUNK_SIZE 65536
+
+void slab_init(void);
+void slab_cleanup(void);
+
+void *slab_alloc(size_t size);
+void slab_free(void *ptr);
+
+void slab_stats(size_t *reserved_bytes, size_t *used_bytes);
+
+#endif /* !IPXWRAPPER_SLAB_H */
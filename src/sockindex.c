@@ -0,0 +1,91 @@
+/* IPXWrapper - Socket number index
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <uthash.h>
+#include <utlist.h>
+
+#include "common.h"
+#include "ipxwrapper.h"
+#include "sockindex.h"
+
+/* Add a socket to an index, keyed by its bound socket number.
+ *
+ * The socket is removed from any index it is already a member of first.
+ * Returns false if memory could not be allocated.
+*/
+bool sockindex_add(ipx_socket_index **index, ipx_socket *sock)
+{
+	sockindex_remove(sock);
+	
+	ipx_socket_index *bucket;
+	HASH_FIND(hh, *index, &(sock->addr.sa_socket), sizeof(bucket->socket), bucket);
+	
+	if(bucket == NULL)
+	{
+		bucket = malloc(sizeof(ipx_socket_index));
+		if(bucket == NULL)
+		{
+			log_printf(LOG_ERROR, "Cannot allocate memory!");
+			return false;
+		}
+		
+		bucket->socket  = sock->addr.sa_socket;
+		bucket->sockets = NULL;
+		
+		HASH_ADD(hh, *index, socket, sizeof(bucket->socket), bucket);
+	}
+	
+	DL_APPEND2(bucket->sockets, sock, index_prev, index_next);
+	sock->index = index;
+	
+	return true;
+}
+
+/* Remove a socket from whichever index it is a member of, if any. */
+void sockindex_remove(ipx_socket *sock)
+{
+	if(sock->index == NULL)
+	{
+		return;
+	}
+	
+	ipx_socket_index *bucket;
+	HASH_FIND(hh, *(sock->index), &(sock->addr.sa_socket), sizeof(bucket->socket), bucket);
+	
+	DL_DELETE2(bucket->sockets, sock, index_prev, index_next);
+	
+	if(bucket->sockets == NULL)
+	{
+		HASH_DEL(*(sock->index), bucket);
+		free(bucket);
+	}
+	
+	sock->index = NULL;
+}
+
+/* Return the first socket in an index bound to the given socket number, or
+ * NULL if there are none. Further sockets can be found by following the
+ * index_next pointers.
+*/
+ipx_socket *sockindex_find(ipx_socket_index *index, uint16_t socket)
+{
+	ipx_socket_index *bucket;
+	HASH_FIND(hh, index, &socket, sizeof(bucket->socket), bucket);
+	
+	return bucket != NULL ? bucket->sockets : NULL;
+}
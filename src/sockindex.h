@@ -0,0 +1,52 @@
+/* IPXWrapper - Socket number index
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _SOCKINDEX_H
+#define _SOCKINDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uthash.h>
+
+#include "ipxwrapper.h"
+
+/* A socket index maps an IPX socket number to the list of ipx_socket
+ * structures which are bound to it, so packet delivery only has to look at
+ * sockets which could possibly accept the packet rather than every socket in
+ * the process.
+ *
+ * Each ipx_socket can be a member of at most one index at a time, membership
+ * is tracked by the index/index_prev/index_next members of ipx_socket.
+ *
+ * Access to an index is protected by the sockets table lock, which must be
+ * held exclusively to add or remove sockets. See the comment above struct
+ * ipx_socket in ipxwrapper.h for details.
+*/
+
+struct ipx_socket_index
+{
+	uint16_t socket;  /* IPX socket number (network byte order) */
+	ipx_socket *sockets;
+	
+	UT_hash_handle hh;
+};
+
+bool sockindex_add(ipx_socket_index **index, ipx_socket *sock);
+void sockindex_remove(ipx_socket *sock);
+ipx_socket *sockindex_find(ipx_socket_index *index, uint16_t socket);
+
+#endif /* !_SOCKINDEX_H */
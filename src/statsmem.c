@@ -0,0 +1,314 @@
+/* IPXWrapper - Live statistics export
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <uthash.h>
+
+#include "addrcache.h"
+#include "coalesce.h"
+#include "common.h"
+#include "funcprof.h"
+#include "ipxwrapper.h"
+#include "pacer.h"
+#include "slab.h"
+#include "statsmem.h"
+
+static HANDLE statsmem_mapping = NULL;
+static struct ipx_stats_block *statsmem_block = NULL;
+
+static HANDLE statsmem_thread = NULL;
+static HANDLE statsmem_exit = NULL;
+
+static void copy_func_stats(unsigned int *n_funcs, const char *dll_name, struct FuncStats *fstats, size_t n_fstats)
+{
+	for(size_t i = 0; i < n_fstats && *n_funcs < STATSMEM_MAX_FUNCS; ++i)
+	{
+		struct ipx_stats_func *func = &(statsmem_block->funcs[(*n_funcs)++]);
+		
+		snprintf(func->dll_name, sizeof(func->dll_name), "%s", dll_name);
+		snprintf(func->func_name, sizeof(func->func_name), "%s", fstats[i].func_name);
+		
+		fprof_read(&(fstats[i]), &(func->totals));
+	}
+}
+
+/* Take a snapshot of the state of each socket. */
+static unsigned int copy_socket_stats(struct ipx_stats_socket *out)
+{
+	ipx_socket *targets[STATSMEM_MAX_SOCKETS];
+	unsigned int n_targets = 0;
+	
+	lock_sockets_shared();
+	
+	ipx_socket *sock, *tmp;
+	HASH_ITER(hh, sockets, sock, tmp)
+	{
+		if(n_targets == STATSMEM_MAX_SOCKETS)
+		{
+			break;
+		}
+		
+		ref_socket(sock);
+		targets[n_targets++] = sock;
+	}
+	
+	unlock_sockets_shared();
+	
+	unsigned int n_out = 0;
+	
+	for(unsigned int i = 0; i < n_targets; ++i)
+	{
+		sock = targets[i];
+		
+		lock_socket(sock);
+		
+		if(!(sock->flags & IPX_CLOSED))
+		{
+			struct ipx_stats_socket *s = &(out[n_out++]);
+			memset(s, 0, sizeof(*s));
+			
+			s->fd = sock->fd;
+			
+			if(sock->flags & IPX_BOUND)
+			{
+				s->flags |= STATSMEM_SOCKET_BOUND;
+				
+				memcpy(s->net,  sock->addr.sa_netnum,  sizeof(s->net));
+				memcpy(s->node, sock->addr.sa_nodenum, sizeof(s->node));
+				s->socket = sock->addr.sa_socket;
+			}
+			
+			if(sock->flags & IPX_IS_SPX)
+			{
+				s->flags |= STATSMEM_SOCKET_SPX;
+			}
+			
+			if(sock->flags & IPX_CONNECTED)
+			{
+				s->flags |= STATSMEM_SOCKET_CONNECTED;
+			}
+			
+			if(sock->flags & IPX_LISTENING)
+			{
+				s->flags |= STATSMEM_SOCKET_LISTENING;
+			}
+			
+			if(sock->recv_queue != NULL)
+			{
+				s->recv_queued      = sock->recv_queue->n_ready;
+				s->recv_queue_depth = sock->recv_queue->depth;
+			}
+			
+			if(sock->pacer != NULL)
+			{
+				s->send_queued = pacer_socket_depth(sock->pacer);
+			}
+		}
+		
+		release_socket(sock);
+	}
+	
+	return n_out;
+}
+
+static void statsmem_update(void)
+{
+	struct ipx_stats_counters counters;
+	memset(&counters, 0, sizeof(counters));
+	
+	counters.send_packets = __atomic_load_n(&send_packets, __ATOMIC_RELAXED);
+	counters.send_bytes   = __atomic_load_n(&send_bytes,   __ATOMIC_RELAXED);
+	counters.recv_packets = __atomic_load_n(&recv_packets, __ATOMIC_RELAXED);
+	counters.recv_bytes   = __atomic_load_n(&recv_bytes,   __ATOMIC_RELAXED);
+	
+	counters.send_packets_udp = __atomic_load_n(&send_packets_udp, __ATOMIC_RELAXED);
+	counters.send_bytes_udp   = __atomic_load_n(&send_bytes_udp,   __ATOMIC_RELAXED);
+	counters.recv_packets_udp = __atomic_load_n(&recv_packets_udp, __ATOMIC_RELAXED);
+	counters.recv_bytes_udp   = __atomic_load_n(&recv_bytes_udp,   __ATOMIC_RELAXED);
+	
+	addr_cache_stats(&(counters.addr_cache_hits), &(counters.addr_cache_misses));
+	
+	counters.coalesce_table_hits      = __atomic_load_n(&coalesce_table_hits,      __ATOMIC_RELAXED);
+	counters.coalesce_table_misses    = __atomic_load_n(&coalesce_table_misses,    __ATOMIC_RELAXED);
+	counters.coalesce_table_evictions = __atomic_load_n(&coalesce_table_evictions, __ATOMIC_RELAXED);
+	
+	unsigned int coalesce_dests, coalesce_active, coalesce_pending;
+	coalesce_stats(&coalesce_dests, &coalesce_active, &coalesce_pending);
+	
+	counters.coalesce_dests   = coalesce_dests;
+	counters.coalesce_active  = coalesce_active;
+	counters.coalesce_pending = coalesce_pending;
+	
+	size_t slab_reserved, slab_used;
+	slab_stats(&slab_reserved, &slab_used);
+	
+	counters.slab_reserved = slab_reserved;
+	counters.slab_used     = slab_used;
+	
+	struct ipx_stats_socket socket_stats[STATSMEM_MAX_SOCKETS];
+	unsigned int n_sockets = copy_socket_stats(socket_stats);
+	
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	
+	/* Everything has been gathered, now update the block as quickly as
+	 * possible while the sequence number is odd.
+	*/
+	
+	__atomic_add_fetch(&(statsmem_block->sequence), 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	statsmem_block->updated_at = now.QuadPart;
+	statsmem_block->counters = counters;
+	
+	statsmem_block->n_sockets = n_sockets;
+	memcpy(statsmem_block->sockets, socket_stats, n_sockets * sizeof(*socket_stats));
+	
+	if(fprof_enabled)
+	{
+		unsigned int n_funcs = 0;
+		
+		copy_func_stats(&n_funcs, STUBS_DLL_NAME, stub_fstats, NUM_STUBS);
+		copy_func_stats(&n_funcs, "ipxwrapper.dll", ipxwrapper_fstats, ipxwrapper_fstats_size);
+		
+		statsmem_block->n_funcs = n_funcs;
+	}
+	
+	__atomic_add_fetch(&(statsmem_block->sequence), 1, __ATOMIC_RELEASE);
+}
+
+static DWORD WINAPI statsmem_main(LPVOID lpParameter)
+{
+	do {
+		statsmem_update();
+	} while(WaitForSingleObject(statsmem_exit, STATSMEM_INTERVAL) == WAIT_TIMEOUT);
+	
+	return 0;
+}
+
+/* Create the shared memory section and start updating it. Failures are logged
+ * and otherwise ignored, the application works the same without it.
+*/
+void statsmem_init(void)
+{
+	char name[64];
+	snprintf(name, sizeof(name), STATSMEM_NAME_FMT, (unsigned)(GetCurrentProcessId()));
+	
+	statsmem_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(struct ipx_stats_block), name);
+	if(statsmem_mapping == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create statistics section %s: %s", name, w32_error(GetLastError()));
+		return;
+	}
+	
+	statsmem_block = MapViewOfFile(statsmem_mapping, FILE_MAP_WRITE, 0, 0, sizeof(struct ipx_stats_block));
+	if(statsmem_block == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to map statistics section: %s", w32_error(GetLastError()));
+		goto FAIL;
+	}
+	
+	/* The section is zeroed by the system when it is created. */
+	
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	
+	statsmem_block->version   = STATSMEM_VERSION;
+	statsmem_block->size      = sizeof(struct ipx_stats_block);
+	statsmem_block->pid       = GetCurrentProcessId();
+	statsmem_block->perf_freq = freq.QuadPart;
+	
+	__atomic_store_n(&(statsmem_block->magic), STATSMEM_MAGIC, __ATOMIC_RELEASE);
+	
+	statsmem_exit = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if(statsmem_exit == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create event object: %s", w32_error(GetLastError()));
+		goto FAIL;
+	}
+	
+	statsmem_thread = CreateThread(
+		NULL,           /* lpThreadAttributes */
+		0,              /* dwStackSize */
+		&statsmem_main, /* lpStartAddress */
+		NULL,           /* lpParameter */
+		0,              /* dwCreationFlags */
+		NULL);          /* lpThreadId */
+	
+	if(statsmem_thread == NULL)
+	{
+		log_printf(LOG_ERROR, "Unable to create statsmem_main thread: %s", w32_error(GetLastError()));
+		goto FAIL;
+	}
+	
+	log_printf(LOG_INFO, "Publishing statistics in %s", name);
+	
+	return;
+	
+	FAIL:
+	
+	if(statsmem_exit != NULL)
+	{
+		CloseHandle(statsmem_exit);
+		statsmem_exit = NULL;
+	}
+	
+	if(statsmem_block != NULL)
+	{
+		UnmapViewOfFile(statsmem_block);
+		statsmem_block = NULL;
+	}
+	
+	CloseHandle(statsmem_mapping);
+	statsmem_mapping = NULL;
+}
+
+/* Stop updating the statistics and remove the shared memory section, it will
+ * stay around until any readers have closed it.
+*/
+void statsmem_cleanup(void)
+{
+	if(statsmem_thread == NULL)
+	{
+		return;
+	}
+	
+	SetEvent(statsmem_exit);
+	
+	/* Wait for it to exit, kill if it takes too long. */
+	
+	if(WaitForSingleObject(statsmem_thread, 3000) == WAIT_TIMEOUT)
+	{
+		log_printf(LOG_WARNING, "Statistics thread didn't exit in 3 seconds, killing");
+		TerminateThread(statsmem_thread, 0);
+	}
+	
+	CloseHandle(statsmem_thread);
+	statsmem_thread = NULL;
+	
+	CloseHandle(statsmem_exit);
+	statsmem_exit = NULL;
+	
+	UnmapViewOfFile(statsmem_block);
+	statsmem_block = NULL;
+	
+	CloseHandle(statsmem_mapping);
+	statsmem_mapping = NULL;
+}
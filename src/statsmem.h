@@ -0,0 +1,142 @@
+/* IPXWrapper - Live statistics export
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_STATSMEM_H
+#define IPXWRAPPER_STATSMEM_H
+
+#include <windows.h>
+#include <stdint.h>
+
+#include "funcprof.h"
+
+/* When the "stats export" option is enabled in ipxwrapper.ini, ipxwrapper.dll
+ * creates a named shared memory section holding a struct ipx_stats_block and
+ * a background thread copies the current statistics into it every
+ * STATSMEM_INTERVAL milliseconds, for tools/ipxstat.exe to read.
+ *
+ * The section is named using STATSMEM_NAME_FMT and the ID of the process.
+ *
+ * Counters are never reset while the process is running, so a reader finds
+ * rates by comparing two copies of the block. Function timings are only
+ * exported when profiling is enabled, as funcprof.h describes.
+ *
+ * The block is updated under a sequence lock: the writer makes sequence odd
+ * before it starts changing the block and even again once it has finished. A
+ * reader copies the whole block out and must retry if sequence was odd or
+ * changed while it was copying. Readers only ever map the section read-only.
+ *
+ * Any change to the layout of the block must increment STATSMEM_VERSION.
+*/
+
+#define STATSMEM_NAME_FMT "Local\\IPXWrapper-Stats-%u"
+
+#define STATSMEM_MAGIC 0x54535049 /* "IPST" */
+#define STATSMEM_VERSION 1
+
+#define STATSMEM_INTERVAL 500
+
+#define STATSMEM_MAX_SOCKETS 256
+#define STATSMEM_MAX_FUNCS 128
+
+struct ipx_stats_counters
+{
+	/* Sent from and delivered to IPX sockets. */
+	uint64_t send_packets, send_bytes;
+	uint64_t recv_packets, recv_bytes;
+	
+	/* Sent and received over the UDP transport. */
+	uint64_t send_packets_udp, send_bytes_udp;
+	uint64_t recv_packets_udp, recv_bytes_udp;
+	
+	/* Address cache lookups. */
+	uint64_t addr_cache_hits, addr_cache_misses;
+	
+	/* Coalescing table lookups and the current state of the table. */
+	uint64_t coalesce_table_hits, coalesce_table_misses, coalesce_table_evictions;
+	uint32_t coalesce_dests;
+	uint32_t coalesce_active;
+	uint32_t coalesce_pending;
+	
+	/* Packet buffers, in bytes. */
+	uint32_t slab_reserved;
+	uint32_t slab_used;
+};
+
+#define STATSMEM_SOCKET_BOUND     (1 << 0)
+#define STATSMEM_SOCKET_SPX       (1 << 1)
+#define STATSMEM_SOCKET_CONNECTED (1 << 2)
+#define STATSMEM_SOCKET_LISTENING (1 << 3)
+
+struct ipx_stats_socket
+{
+	uint32_t fd;
+	uint32_t flags;
+	
+	/* Bound address in network byte order, zero unless STATSMEM_SOCKET_BOUND
+	 * is set.
+	*/
+	unsigned char net[4];
+	unsigned char node[6];
+	uint16_t socket;
+	
+	/* Packets waiting to be read by the application. */
+	uint32_t recv_queued;
+	uint32_t recv_queue_depth;
+	
+	/* Packets held back by the send rate limits. */
+	uint32_t send_queued;
+};
+
+struct ipx_stats_func
+{
+	char dll_name[16];
+	char func_name[48];
+	
+	/* Counters merged from every shard by fprof_read(). */
+	struct fprof_shard totals;
+};
+
+struct ipx_stats_block
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	
+	uint32_t sequence;
+	
+	uint32_t pid;
+	
+	/* Performance counter frequency and value when the block was last
+	 * updated. Function timings are in performance counter ticks.
+	*/
+	uint64_t perf_freq;
+	uint64_t updated_at;
+	
+	struct ipx_stats_counters counters;
+	
+	/* Sockets beyond STATSMEM_MAX_SOCKETS are left out. */
+	uint32_t n_sockets;
+	struct ipx_stats_socket sockets[STATSMEM_MAX_SOCKETS];
+	
+	uint32_t n_funcs;
+	struct ipx_stats_func funcs[STATSMEM_MAX_FUNCS];
+};
+
+void statsmem_init(void);
+void statsmem_cleanup(void);
+
+#endif /* !IPXWRAPPER_STATSMEM_H */
@@ -38,6 +38,7 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
 		main_config_t config = get_main_config(false);
 		
 		min_log_level = config.log_level;
+		log_start(config.log_queue_drop);
 		
 		if(config.profile)
 		{
@@ -74,9 +75,14 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
 		 * than the DLL being unloaded dynamically and any threads will have been terminated
 		 * at unknown points, meaning any global data may be in an inconsistent state and we
 		 * cannot (safely) clean up. MSDN states we should do nothing.
+		 *
+		 * The one exception is writing out any messages left in the log queue by the
+		 * (terminated) log writer thread, which only reads the queue and appends to the
+		 * log file, so that the messages leading up to the exit aren't lost.
 		*/
 		if(lpvReserved != NULL)
 		{
+			log_flush();
 			return TRUE;
 		}
 		
@@ -0,0 +1,200 @@
+/* IPXWrapper - Timer heap
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "timerheap.h"
+
+#define TIMER_HEAP_INITIAL_SIZE 8
+
+static void _heap_set(timer_heap *heap, size_t index, ipx_timer *timer)
+{
+	heap->timers[index] = timer;
+	timer->heap_index = index;
+}
+
+/* Move the timer at index towards the root until its parent is not later. */
+static void _sift_up(timer_heap *heap, size_t index)
+{
+	ipx_timer *timer = heap->timers[index];
+	
+	while(index > 0)
+	{
+		size_t parent = (index - 1) / 2;
+		
+		if(heap->timers[parent]->deadline <= timer->deadline)
+		{
+			break;
+		}
+		
+		_heap_set(heap, index, heap->timers[parent]);
+		index = parent;
+	}
+	
+	_heap_set(heap, index, timer);
+}
+
+/* Move the timer at index towards the leaves until neither child is earlier. */
+static void _sift_down(timer_heap *heap, size_t index)
+{
+	ipx_timer *timer = heap->timers[index];
+	
+	while(1)
+	{
+		size_t child = (index * 2) + 1;
+		
+		if(child >= heap->n_timers)
+		{
+			break;
+		}
+		
+		if((child + 1) < heap->n_timers && heap->timers[child + 1]->deadline < heap->timers[child]->deadline)
+		{
+			++child;
+		}
+		
+		if(timer->deadline <= heap->timers[child]->deadline)
+		{
+			break;
+		}
+		
+		_heap_set(heap, index, heap->timers[child]);
+		index = child;
+	}
+	
+	_heap_set(heap, index, timer);
+}
+
+/* Add a timer to the heap, or move it if it is already scheduled.
+ *
+ * Returns false if the heap could not be grown to make room for the timer.
+*/
+bool timer_heap_schedule(timer_heap *heap, ipx_timer *timer, uint64_t deadline)
+{
+	if(timer_is_scheduled(timer))
+	{
+		uint64_t old_deadline = timer->deadline;
+		timer->deadline = deadline;
+		
+		if(deadline < old_deadline)
+		{
+			_sift_up(heap, timer->heap_index);
+		}
+		else{
+			_sift_down(heap, timer->heap_index);
+		}
+		
+		return true;
+	}
+	
+	if(heap->n_timers == heap->max_timers)
+	{
+		size_t new_max = heap->max_timers > 0
+			? (heap->max_timers * 2)
+			: TIMER_HEAP_INITIAL_SIZE;
+		
+		ipx_timer **new_timers = realloc(heap->timers, new_max * sizeof(*new_timers));
+		if(new_timers == NULL)
+		{
+			log_printf(LOG_ERROR, "Cannot allocate memory!");
+			return false;
+		}
+		
+		heap->timers = new_timers;
+		heap->max_timers = new_max;
+	}
+	
+	timer->deadline = deadline;
+	
+	_heap_set(heap, heap->n_timers++, timer);
+	_sift_up(heap, timer->heap_index);
+	
+	return true;
+}
+
+/* Remove a timer from the heap. Does nothing if the timer isn't scheduled. */
+void timer_heap_cancel(timer_heap *heap, ipx_timer *timer)
+{
+	if(!timer_is_scheduled(timer))
+	{
+		return;
+	}
+	
+	size_t index = timer->heap_index;
+	timer->heap_index = TIMER_NOT_SCHEDULED;
+	
+	if(index == --(heap->n_timers))
+	{
+		/* Was the last timer in the heap. */
+		return;
+	}
+	
+	/* Fill the hole with the last timer in the heap and move it to wherever
+	 * it belongs relative to its new parent and children.
+	*/
+	
+	_heap_set(heap, index, heap->timers[heap->n_timers]);
+	
+	if(index > 0 && heap->timers[index]->deadline < heap->timers[(index - 1) / 2]->deadline)
+	{
+		_sift_up(heap, index);
+	}
+	else{
+		_sift_down(heap, index);
+	}
+}
+
+/* Returns the timer with the earliest deadline, NULL if the heap is empty. */
+ipx_timer *timer_heap_peek(const timer_heap *heap)
+{
+	return heap->n_timers > 0
+		? heap->timers[0]
+		: NULL;
+}
+
+/* Removes and returns the timer with the earliest deadline if the deadline is
+ * at or before now, otherwise returns NULL.
+*/
+ipx_timer *timer_heap_pop_expired(timer_heap *heap, uint64_t now)
+{
+	ipx_timer *timer = timer_heap_peek(heap);
+	
+	if(timer == NULL || timer->deadline > now)
+	{
+		return NULL;
+	}
+	
+	timer_heap_cancel(heap, timer);
+	
+	return timer;
+}
+
+/* Release the heap's memory. Any timers still in the heap are unscheduled. */
+void timer_heap_free(timer_heap *heap)
+{
+	for(size_t i = 0; i < heap->n_timers; ++i)
+	{
+		heap->timers[i]->heap_index = TIMER_NOT_SCHEDULED;
+	}
+	
+	free(heap->timers);
+	
+	heap->timers = NULL;
+	heap->n_timers = 0;
+	heap->max_timers = 0;
+}
@@ -0,0 +1,73 @@
+/* IPXWrapper - Timer heap
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_TIMERHEAP_H
+#define IPXWRAPPER_TIMERHEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A timer_heap is a binary min-heap of ipx_timer structures ordered by
+ * deadline, so the earliest deadline can be found in constant time and timers
+ * can be added, moved or removed in O(log n).
+ *
+ * ipx_timer structures are owned by the caller and must remain valid while
+ * they are in a heap. The heap does no locking of its own.
+*/
+
+#define TIMER_NOT_SCHEDULED ((size_t)(-1))
+
+struct ipx_timer;
+
+typedef void (*ipx_timer_callback)(struct ipx_timer *timer, uint64_t now);
+
+struct ipx_timer
+{
+	uint64_t deadline;
+	ipx_timer_callback callback;
+	
+	/* Index of this timer in the heap, TIMER_NOT_SCHEDULED if it isn't in
+	 * a heap.
+	*/
+	size_t heap_index;
+};
+
+typedef struct ipx_timer ipx_timer;
+
+#define IPX_TIMER_INIT(callback) { 0, callback, TIMER_NOT_SCHEDULED }
+
+struct timer_heap
+{
+	ipx_timer **timers;
+	size_t n_timers;
+	size_t max_timers;
+};
+
+typedef struct timer_heap timer_heap;
+
+#define TIMER_HEAP_INIT { NULL, 0, 0 }
+
+bool timer_heap_schedule(timer_heap *heap, ipx_timer *timer, uint64_t deadline);
+void timer_heap_cancel(timer_heap *heap, ipx_timer *timer);
+ipx_timer *timer_heap_peek(const timer_heap *heap);
+ipx_timer *timer_heap_pop_expired(timer_heap *heap, uint64_t now);
+void timer_heap_free(timer_heap *heap);
+
+#define timer_is_scheduled(timer) ((timer)->heap_index != TIMER_NOT_SCHEDULED)
+
+#endif /* !IPXWRAPPER_TIMERHEAP_H */
@@ -25,12 +25,18 @@
 #include <wsnwlink.h>
 
 #include "ipxwrapper.h"
+#include "capture.h"
 #include "coalesce.h"
 #include "common.h"
 #include "interface.h"
 #include "router.h"
 #include "addrcache.h"
 #include "ethernet.h"
+#include "sockindex.h"
+#include "recvqueue.h"
+#include "pacer.h"
+#include "peerstats.h"
+#include "slab.h"
 
 struct sockaddr_ipx_ext {
 	short sa_family;
@@ -304,29 +310,9 @@ INT WINAPI WSHEnumProtocols(LPINT protocols, LPWSTR ign, LPVOID buf, LPDWORD bsp
 	return do_EnumProtocols(protocols, buf, bsptr, false);
 }
 
-static int recv_queue_adjust_refcount(ipx_recv_queue *recv_queue, int adj)
-{
-	EnterCriticalSection(&(recv_queue->refcount_lock));
-	int new_refcount = (recv_queue->refcount += adj);
-	LeaveCriticalSection(&(recv_queue->refcount_lock));
-	
-	return new_refcount;
-}
-
-static void release_recv_queue(ipx_recv_queue *recv_queue)
-{
-	int new_refcount = recv_queue_adjust_refcount(recv_queue, -1);
-	
-	if(new_refcount == 0)
-	{
-		DeleteCriticalSection(&(recv_queue->refcount_lock));
-		free(recv_queue);
-	}
-}
-
 SOCKET WSAAPI socket(int af, int type, int protocol)
 {
-	log_printf(LOG_CALL, "socket(%d, %d, %d)", af, type, protocol);
+	LOG_PRINTF(LOG_CALL, "socket(%d, %d, %d)", af, type, protocol);
 	
 	if(af == AF_IPX)
 	{
@@ -339,52 +325,37 @@ SOCKET WSAAPI socket(int af, int type, int protocol)
 				return -1;
 			}
 			
-			ipx_recv_queue *recv_queue = malloc(sizeof(ipx_recv_queue));
-			if(recv_queue == NULL)
-			{
-				free(nsock);
-				
-				WSASetLastError(ERROR_OUTOFMEMORY);
-				return -1;
-			}
-			
-			if(!InitializeCriticalSectionAndSpinCount(&(recv_queue->refcount_lock), 0x80000000))
-			{
-				log_printf(LOG_ERROR, "Failed to initialise critical section: %s", w32_error(GetLastError()));
-				WSASetLastError(GetLastError());
-				
-				free(recv_queue);
-				free(nsock);
-				return -1;
-			}
-			
-			recv_queue->refcount = 1;
-			recv_queue->n_ready = 0;
-			
-			for(int i = 0; i < RECV_QUEUE_MAX_PACKETS; ++i)
-			{
-				recv_queue->sizes[i] = IPX_RECV_QUEUE_FREE;
-			}
-			
 			if((nsock->fd = r_socket(AF_INET, SOCK_DGRAM, 0)) == -1)
 			{
 				log_printf(LOG_ERROR, "Cannot create UDP socket: %s", w32_error(WSAGetLastError()));
 				
-				release_recv_queue(recv_queue);
 				free(nsock);
 				return -1;
 			}
 			
 			nsock->flags = IPX_SEND | IPX_RECV | IPX_RECV_BCAST;
 			nsock->s_ptype = (protocol ? protocol - NSPROTO_IPX : 0);
+			nsock->priority = IPX_PRIORITY_AUTO;
+			
+			/* The receive queue is allocated by bind(), the pacer
+			 * state by the first sendto() if rate limiting is enabled.
+			*/
+			nsock->recv_queue = NULL;
+			nsock->pacer = NULL;
+			nsock->index = NULL;
 			
-			nsock->recv_queue = recv_queue;
+			memset(&(nsock->stats), 0, sizeof(nsock->stats));
 			
 			log_printf(LOG_INFO, "IPX socket created (fd = %d)", nsock->fd);
 			
-			lock_sockets();
-			HASH_ADD_INT(sockets, fd, nsock);
-			unlock_sockets();
+			if(!add_socket(nsock))
+			{
+				r_closesocket(nsock->fd);
+				free(nsock);
+				
+				WSASetLastError(WSAENOBUFS);
+				return -1;
+			}
 			
 			return nsock->fd;
 		}
@@ -407,7 +378,7 @@ SOCKET WSAAPI socket(int af, int type, int protocol)
 			
 			if(protocol != 0 && protocol != NSPROTO_SPX && protocol != NSPROTO_SPXII)
 			{
-				log_printf(LOG_DEBUG, "Unknown protocol (%d) for AF_INET/SOCK_STREAM", protocol);
+				LOG_PRINTF(LOG_DEBUG, "Unknown protocol (%d) for AF_INET/SOCK_STREAM", protocol);
 				
 				WSASetLastError(WSAEPROTONOSUPPORT);
 				return -1;
@@ -435,18 +406,28 @@ SOCKET WSAAPI socket(int af, int type, int protocol)
 				nsock->flags |= IPX_IS_SPXII;
 			}
 			
+			nsock->priority = IPX_PRIORITY_AUTO;
 			nsock->recv_queue = NULL;
+			nsock->pacer = NULL;
+			nsock->index = NULL;
+			
+			memset(&(nsock->stats), 0, sizeof(nsock->stats));
 			
 			log_printf(LOG_INFO, "SPX socket created (fd = %d)", nsock->fd);
 			
-			lock_sockets();
-			HASH_ADD_INT(sockets, fd, nsock);
-			unlock_sockets();
+			if(!add_socket(nsock))
+			{
+				r_closesocket(nsock->fd);
+				free(nsock);
+				
+				WSASetLastError(WSAENOBUFS);
+				return -1;
+			}
 			
 			return nsock->fd;
 		}
 		else{
-			log_printf(LOG_DEBUG, "Unknown type (%d) for family AF_IPX", type);
+			LOG_PRINTF(LOG_DEBUG, "Unknown type (%d) for family AF_IPX", type);
 			
 			WSASetLastError(WSAEINVAL);
 			return -1;
@@ -472,7 +453,7 @@ int WSAAPI closesocket(SOCKET sockfd)
 	{
 		log_printf(LOG_ERROR, "closesocket(%d): %s", sockfd, w32_error(WSAGetLastError()));
 		
-		unlock_sockets();
+		release_socket(sock);
 		return -1;
 	}
 	
@@ -483,15 +464,26 @@ int WSAAPI closesocket(SOCKET sockfd)
 		release_recv_queue(sock->recv_queue);
 	}
 	
+	if(sock->pacer != NULL)
+	{
+		/* Anything still waiting to be sent is sent by the pacer
+		 * thread before the queue is freed.
+		*/
+		pacer_socket_close(sock->pacer);
+	}
+	
 	if(sock->flags & IPX_BOUND)
 	{
 		CloseHandle(sock->sock_mut);
 	}
 	
-	HASH_DEL(sockets, sock);
-	free(sock);
+	/* Anything else holding a reference to the socket will see that it
+	 * has been closed once it reacquires the lock, the structure is freed
+	 * when the last reference is released.
+	*/
 	
-	unlock_sockets();
+	remove_socket(sock);
+	release_socket(sock);
 	
 	return 0;
 }
@@ -606,7 +598,7 @@ int WSAAPI bind(SOCKET fd, const struct sockaddr *addr, int addrlen)
 		{
 			WSASetLastError(WSAEFAULT);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 		
@@ -620,19 +612,32 @@ int WSAAPI bind(SOCKET fd, const struct sockaddr *addr, int addrlen)
 		{
 			log_printf(LOG_ERROR, "bind failed: socket already bound");
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			WSASetLastError(WSAEINVAL);
 			return -1;
 		}
 		
+		if(!(sock->flags & IPX_IS_SPX) && sock->recv_queue == NULL)
+		{
+			if((sock->recv_queue = create_recv_queue(main_config.recv_queue_depth)) == NULL)
+			{
+				log_printf(LOG_ERROR, "bind failed: cannot allocate receive queue");
+				
+				release_socket(sock);
+				
+				WSASetLastError(WSAENOBUFS);
+				return -1;
+			}
+		}
+		
 		sock->addr.sa_family = AF_IPX;
 		
 		/* Resolve any wildcards in the requested address. */
 		
 		if(!_resolve_bind_address(sock, &ipxaddr))
 		{
-			unlock_sockets();
+			release_socket(sock);
 			
 			WSASetLastError(WSAEADDRNOTAVAIL);
 			return -1;
@@ -642,7 +647,7 @@ int WSAAPI bind(SOCKET fd, const struct sockaddr *addr, int addrlen)
 		
 		if(!_complete_bind(sock))
 		{
-			unlock_sockets();
+			release_socket(sock);
 			
 			WSASetLastError(WSAEADDRINUSE);
 			return -1;
@@ -667,7 +672,7 @@ int WSAAPI bind(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			CloseHandle(sock->sock_mut);
 			sock->flags &= ~IPX_BOUND;
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return -1;
 		}
@@ -692,15 +697,39 @@ int WSAAPI bind(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			CloseHandle(sock->sock_mut);
 			sock->flags &= ~IPX_BOUND;
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return -1;
 		}
 		
 		sock->port = bind_addr.sin_port;
-		log_printf(LOG_DEBUG, "Bound to local port %hu", ntohs(sock->port));
+		LOG_PRINTF(LOG_DEBUG, "Bound to local port %hu", ntohs(sock->port));
+		
+		/* Make the socket visible to deliver_packet(). */
 		
-		unlock_sockets();
+		bool indexed = true;
+		
+		if(!(sock->flags & IPX_IS_SPX) && (sock->flags & IPX_RECV))
+		{
+			lock_sockets();
+			indexed = sockindex_add(&ipx_recv_index, sock);
+			unlock_sockets();
+		}
+		
+		if(!indexed)
+		{
+			log_printf(LOG_WARNING, "Socket %d is NOW INCONSISTENT!", fd);
+			
+			CloseHandle(sock->sock_mut);
+			sock->flags &= ~IPX_BOUND;
+			
+			release_socket(sock);
+			
+			WSASetLastError(WSAENOBUFS);
+			return -1;
+		}
+		
+		release_socket(sock);
 		
 		return 0;
 	}
@@ -723,20 +752,20 @@ int WSAAPI getsockname(SOCKET fd, struct sockaddr *addr, int *addrlen)
 				
 				WSASetLastError(WSAEFAULT);
 				
-				unlock_sockets();
+				release_socket(sock);
 				return -1;
 			}
 			
 			memcpy(addr, &(sock->addr), sizeof(sock->addr));
 			*addrlen = sizeof(struct sockaddr_ipx);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return 0;
 		}
 		else{
 			WSASetLastError(WSAEINVAL);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 	}
@@ -745,29 +774,6 @@ int WSAAPI getsockname(SOCKET fd, struct sockaddr *addr, int *addrlen)
 	}
 }
 
-static BOOL reclaim_socket(ipx_socket *sockptr, int lookup_fd)
-{
-	/* Reclaim the lock, ensure the socket hasn't been
-	 * closed by the application (naughty!) while we were
-	 * waiting.
-	*/
-	
-	ipx_socket *reclaim_sock = get_socket(lookup_fd);
-	if(sockptr != reclaim_sock)
-	{
-		log_printf(LOG_DEBUG, "Application closed socket while inside a WinSock call!");
-		
-		if(reclaim_sock)
-		{
-			unlock_sockets();
-		}
-		
-		return FALSE;
-	}
-	
-	return TRUE;
-}
-
 static int recv_pump(ipx_socket *sockptr, BOOL block)
 {
 	int fd = sockptr->fd;
@@ -779,7 +785,7 @@ static int recv_pump(ipx_socket *sockptr, BOOL block)
 		
 		if(r_ioctlsocket(fd, FIONREAD, &available) != 0)
 		{
-			unlock_sockets();
+			release_socket(sockptr);
 			return -1;
 		}
 		else if(available == 0)
@@ -791,22 +797,11 @@ static int recv_pump(ipx_socket *sockptr, BOOL block)
 	
 	ipx_recv_queue *queue = sockptr->recv_queue;
 	
-	int recv_slot = -1;
+	int recv_slot;
 	
 	{
 		FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_recv_pump_find_slot]));
-		
-		for(int i = 0; i < RECV_QUEUE_MAX_PACKETS; ++i)
-		{
-			if(queue->sizes[i] == IPX_RECV_QUEUE_FREE)
-			{
-				queue->sizes[i] = IPX_RECV_QUEUE_LOCKED;
-				recv_queue_adjust_refcount(queue, 1);
-				
-				recv_slot = i;
-				break;
-			}
-		}
+		recv_slot = recv_queue_claim_slot(queue);
 	}
 	
 	if(recv_slot < 0)
@@ -815,56 +810,114 @@ static int recv_pump(ipx_socket *sockptr, BOOL block)
 		return 0;
 	}
 	
-	unlock_sockets();
+	recv_queue_adjust_refcount(queue, 1);
+	
+	/* Our reference to the socket is kept while the lock is released, so
+	 * the ipx_socket stays valid even if it is closed.
+	*/
+	unlock_socket(sockptr);
+	
+	/* Read into a temporary buffer, the packet is copied into a buffer of
+	 * the right size for the queue once we know how big it is.
+	*/
+	unsigned char recv_buf[MAX_PKT_SIZE];
 	
 	int r;
 	{
 		FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_recv_pump_recv]));
-		r = r_recv(fd, (char*)(queue->data[recv_slot]), MAX_PKT_SIZE, 0);
+		r = r_recv(fd, (char*)(recv_buf), MAX_PKT_SIZE, 0);
 	}
 	
-	bool ok;
 	{
 		FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_recv_pump_reclaim_socket]));
-		ok = reclaim_socket(sockptr, fd);
+		lock_socket(sockptr);
 	}
 	
-	if(!ok)
+	if(sockptr->flags & IPX_CLOSED)
 	{
 		/* The application closed the socket while we were in the recv() call.
 		 * Just discard our handle, let the queue be destroyed.
 		*/
 		
+		LOG_PRINTF(LOG_DEBUG, "Application closed socket while inside a WinSock call!");
+		
 		release_recv_queue(queue);
+		release_socket(sockptr);
+		
 		WSASetLastError(WSAENOTSOCK);
 		return -1;
 	}
 	
 	if(r == -1)
 	{
-		queue->sizes[recv_slot] = IPX_RECV_QUEUE_FREE;
+		if(WSAGetLastError() == WSAEMSGSIZE && queue->n_relayed > 0)
+		{
+			/* An oversized packet relayed by deliver_packet(), it
+			 * has still been taken off the UDP receive buffer.
+			*/
+			--(queue->n_relayed);
+		}
+		
+		recv_queue_free_slot(queue, recv_slot);
 		release_recv_queue(queue);
-		unlock_sockets();
+		release_socket(sockptr);
 		return -1;
 	}
 	
-	struct ipx_packet *packet = (struct ipx_packet*)(queue->data[recv_slot]);
+	if(r == RECV_QUEUE_DOORBELL_SIZE)
+	{
+		/* Doorbell from deliver_packet(), any packets it was ringing
+		 * for are already in the queue.
+		*/
+		
+		recv_queue_free_slot(queue, recv_slot);
+		release_recv_queue(queue);
+		
+		queue->doorbell_pending = false;
+		
+		return 1;
+	}
+	
+	/* Anything other than a doorbell was relayed by deliver_packet(). */
+	if(queue->n_relayed > 0)
+	{
+		--(queue->n_relayed);
+	}
+	
+	struct ipx_packet *packet = (struct ipx_packet*)(recv_buf);
 	
 	if(r < sizeof(ipx_packet) - 1 || r != packet->size + sizeof(ipx_packet) - 1)
 	{
 		log_printf(LOG_ERROR, "Invalid packet received on loopback port!");
 		
-		queue->sizes[recv_slot] = IPX_RECV_QUEUE_FREE;
+		__atomic_add_fetch(&(sockptr->stats.recv_drops), 1, __ATOMIC_RELAXED);
+		
+		recv_queue_free_slot(queue, recv_slot);
 		release_recv_queue(queue);
 		
 		WSASetLastError(WSAEWOULDBLOCK);
-		unlock_sockets();
+		release_socket(sockptr);
 		return -1;
 	}
 	
+	if((queue->data[recv_slot] = slab_alloc(r)) == NULL)
+	{
+		log_printf(LOG_ERROR, "Cannot allocate receive buffer, dropping packet");
+		
+		__atomic_add_fetch(&(sockptr->stats.recv_drops), 1, __ATOMIC_RELAXED);
+		
+		recv_queue_free_slot(queue, recv_slot);
+		release_recv_queue(queue);
+		
+		WSASetLastError(WSAENOBUFS);
+		release_socket(sockptr);
+		return -1;
+	}
+	
+	memcpy(queue->data[recv_slot], recv_buf, r);
+	
 	queue->sizes[recv_slot] = r;
-	queue->ready[queue->n_ready] = recv_slot;
-	++(queue->n_ready);
+	recv_queue_push_ready(queue, recv_slot);
 	
 	return 1;
 }
@@ -872,13 +925,13 @@ static int recv_pump(ipx_socket *sockptr, BOOL block)
 /* Recieve a packet from an IPX socket
  * addr must be NULL or a region of memory big enough for a sockaddr_ipx
  *
- * The mutex should be locked before calling and will be released before returning
+ * The socket should be locked before calling and will be released before returning
  * The size of the packet will be returned on success, even if it was truncated
 */
 static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, struct sockaddr_ipx_ext *addr, int addrlen) {
 	if(!(sockptr->flags & IPX_BOUND))
 	{
-		unlock_sockets();
+		release_socket(sockptr);
 		
 		WSASetLastError(WSAEINVAL);
 		return -1;
@@ -896,12 +949,12 @@ static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, s
 		}
 	}
 	
-	int slot = sockptr->recv_queue->ready[0];
+	int slot = recv_queue_ready_slot(sockptr->recv_queue, 0);
 	
 	struct ipx_packet *packet = (struct ipx_packet*)(sockptr->recv_queue->data[slot]);
 	assert(sockptr->recv_queue->sizes[slot] >= 0);
 	
-	if(min_log_level <= LOG_DEBUG)
+	if(LOG_ENABLED(LOG_DEBUG))
 	{
 		IPX_STRING_ADDR(addr_s, addr32_in(packet->src_net), addr48_in(packet->src_node), packet->src_socket);
 		
@@ -930,16 +983,14 @@ static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, s
 				 * to be from one of our interfaces.
 				*/
 				
-				ipx_interface_t *src_iface = ipx_interface_by_addr(
-					addr32_in(packet->src_net),
-					addr48_in(packet->src_node)
-				);
+				ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
 				
-				if(src_iface)
+				if(ipx_snapshot_by_addr(snapshot, addr32_in(packet->src_net), addr48_in(packet->src_node)) != NULL)
 				{
-					free_ipx_interface(src_iface);
 					addr->sa_flags |= 0x02;
 				}
+				
+				ipx_interfaces_release(snapshot);
 			}else{
 				log_printf(LOG_ERROR, "IPX_EXTENDED_ADDRESS enabled, but recvfrom called with addrlen %d", addrlen);
 			}
@@ -951,13 +1002,44 @@ static int recv_packet(ipx_socket *sockptr, char *buf, int bufsize, int flags, s
 	
 	if((flags & MSG_PEEK) == 0)
 	{
-		sockptr->recv_queue->sizes[slot] = IPX_RECV_QUEUE_FREE;
+		recv_queue_pop_ready(sockptr->recv_queue);
+		recv_queue_free_slot(sockptr->recv_queue, slot);
+		
+		/* Read out any doorbell still waiting in the underlying
+		 * socket, otherwise doorbell_pending stays set and no further
+		 * doorbells (or FD_READ events) would be raised for packets
+		 * queued after this one. Any relayed packets ahead of it are
+		 * moved into the queue in order.
+		*/
+		
+		while(sockptr->recv_queue->doorbell_pending)
+		{
+			int pr = recv_pump(sockptr, FALSE);
+			
+			if(pr < 0)
+			{
+				/* recv_pump() has released the lock, the packet
+				 * has already been taken from the queue.
+				*/
+				return rval;
+			}
+			else if(pr == 0)
+			{
+				break;
+			}
+		}
 		
-		--(sockptr->recv_queue->n_ready);
-		memmove(&(sockptr->recv_queue->ready[0]), &(sockptr->recv_queue->ready[1]), (sockptr->recv_queue->n_ready * sizeof(int)));
+		if(sockptr->recv_queue->n_ready > 0)
+		{
+			/* Make sure the underlying socket stays readable (and
+			 * WSAAsyncSelect() posts another FD_READ) until the
+			 * queue is empty.
+			*/
+			recv_queue_ring_doorbell(sockptr);
+		}
 	}
 	
-	unlock_sockets();
+	release_socket(sockptr);
 	
 	return rval;
 }
@@ -981,14 +1063,14 @@ int WSAAPI recvfrom(SOCKET fd, char *buf, int len, int flags, struct sockaddr *a
 			 * connection-oriented sockets.
 			*/
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return r_recv(fd, buf, len, flags);
 		}
 		else{
 			if(addr && addrlen && *addrlen < sizeof(struct sockaddr_ipx))
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEFAULT);
 				return -1;
@@ -1029,7 +1111,7 @@ int WSAAPI recv(SOCKET fd, char *buf, int len, int flags)
 	{
 		if(sock->flags & IPX_IS_SPX)
 		{
-			unlock_sockets();
+			release_socket(sock);
 			
 			return r_recv(fd, buf, len, flags);
 		}
@@ -1058,7 +1140,7 @@ int PASCAL WSARecvEx(SOCKET fd, char *buf, int len, int *flags)
 	{
 		if(sock->flags & IPX_IS_SPX)
 		{
-			unlock_sockets();
+			release_socket(sock);
 			
 			return r_WSARecvEx(fd, buf, len, flags);
 		}
@@ -1099,7 +1181,7 @@ int PASCAL WSARecvEx(SOCKET fd, char *buf, int len, int *flags)
 	{\
 		*optlen = size;\
 		WSASetLastError(WSAEFAULT); \
-		unlock_sockets(); \
+		release_socket(sock); \
 		return -1; \
 	}\
 	*optlen = size;
@@ -1107,13 +1189,13 @@ int PASCAL WSARecvEx(SOCKET fd, char *buf, int len, int *flags)
 #define RETURN_INT_OPT(val) \
 	GETSOCKOPT_OPTLEN(sizeof(int)); \
 	*((int*)(optval)) = (val); \
-	unlock_sockets(); \
+	release_socket(sock); \
 	return 0;
 
 #define RETURN_BOOL_OPT(val) \
 	GETSOCKOPT_OPTLEN(sizeof(BOOL)); \
 	*((BOOL*)(optval)) = (val) ? TRUE : FALSE; \
-	unlock_sockets(); \
+	release_socket(sock); \
 	return 0;
 
 int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int FAR *optlen)
@@ -1156,7 +1238,7 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 				{
 					WSASetLastError(ERROR_NO_DATA);
 					
-					unlock_sockets();
+					release_socket(sock);
 					return -1;
 				}
 				
@@ -1170,7 +1252,7 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 				
 				free_ipx_interface(nic);
 				
-				unlock_sockets();
+				release_socket(sock);
 				return 0;
 			}
 			else if(optname == IPX_MAX_ADAPTER_NUM)
@@ -1189,12 +1271,75 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 			{
 				RETURN_BOOL_OPT(sock->flags & IPX_EXT_ADDR);
 			}
+			else if(optname == IPX_PRIORITY)
+			{
+				RETURN_INT_OPT(sock->priority);
+			}
+			else if(optname == IPX_SOCKET_STATS)
+			{
+				GETSOCKOPT_OPTLEN(sizeof(IPX_SOCKET_STATS_DATA));
+				
+				ipx_socket_read_stats(sock, (IPX_SOCKET_STATS_DATA*)(optval));
+				
+				release_socket(sock);
+				return 0;
+			}
+			else if(optname == IPX_PEER_STATS)
+			{
+				peer_stats *peers = malloc(IPX_PEER_STATS_MAX * sizeof(peer_stats));
+				if(peers == NULL)
+				{
+					WSASetLastError(WSAENOBUFS);
+					
+					release_socket(sock);
+					return -1;
+				}
+				
+				peerstats_enable();
+				
+				unsigned int n_peers = peerstats_read(peers, IPX_PEER_STATS_MAX);
+				int size = n_peers * sizeof(IPX_PEER_STATS_DATA);
+				
+				if(*optlen < size)
+				{
+					free(peers);
+					
+					*optlen = size;
+					WSASetLastError(WSAEFAULT);
+					
+					release_socket(sock);
+					return -1;
+				}
+				
+				*optlen = size;
+				
+				IPX_PEER_STATS_DATA *out = (IPX_PEER_STATS_DATA*)(optval);
+				
+				for(unsigned int i = 0; i < n_peers; ++i)
+				{
+					addr32_out(out[i].netnum, peers[i].net);
+					addr48_out(out[i].nodenum, peers[i].node);
+					
+					out[i].send_packets = peers[i].send_packets;
+					out[i].send_bytes   = peers[i].send_bytes;
+					out[i].recv_packets = peers[i].recv_packets;
+					out[i].recv_bytes   = peers[i].recv_bytes;
+					
+					out[i].last_send = peers[i].last_send;
+					out[i].last_recv = peers[i].last_recv;
+				}
+				
+				free(peers);
+				
+				release_socket(sock);
+				return 0;
+			}
 			else{
 				log_printf(LOG_ERROR, "Unknown NSPROTO_IPX socket option passed to getsockopt: %d", optname);
 				
 				WSASetLastError(WSAENOPROTOOPT);
 				
-				unlock_sockets();
+				release_socket(sock);
 				return -1;
 			}
 		}
@@ -1210,7 +1355,7 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 			}
 		}
 		
-		unlock_sockets();
+		release_socket(sock);
 	}
 	
 	return r_getsockopt(fd, level, optname, optval, optlen);
@@ -1220,7 +1365,7 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 	if(optlen < s) \
 	{ \
 		WSASetLastError(WSAEFAULT); \
-		unlock_sockets(); \
+		release_socket(sock); \
 		return -1; \
 	}
 
@@ -1233,11 +1378,12 @@ int WSAAPI getsockopt(SOCKET fd, int level, int optname, char FAR *optval, int F
 	else{ \
 		sock->flags &= ~(flag); \
 	} \
-	unlock_sockets(); \
+	release_socket(sock); \
 	return 0;
 
 int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval, int optlen)
 {
+	if(LOG_ENABLED(LOG_CALL))
 	{
 		char opt_s[24] = "";
 		
@@ -1274,7 +1420,7 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 				
 				sock->s_ptype = *intval;
 				
-				unlock_sockets();
+				release_socket(sock);
 				return 0;
 			}
 			else if(optname == IPX_FILTERPTYPE)
@@ -1284,14 +1430,14 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 				sock->f_ptype = *intval;
 				sock->flags |= IPX_FILTER;
 				
-				unlock_sockets();
+				release_socket(sock);
 				return 0;
 			}
 			else if(optname == IPX_STOPFILTERPTYPE)
 			{
 				sock->flags &= ~IPX_FILTER;
 				
-				unlock_sockets();
+				release_socket(sock);
 				return 0;
 			}
 			else if(optname == IPX_RECEIVE_BROADCAST)
@@ -1302,12 +1448,29 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 			{
 				SET_FLAG(IPX_EXT_ADDR);
 			}
+			else if(optname == IPX_PRIORITY)
+			{
+				SETSOCKOPT_OPTLEN(sizeof(int));
+				
+				if(*intval < IPX_PRIORITY_AUTO || *intval > IPX_PRIORITY_BULK)
+				{
+					WSASetLastError(WSAEINVAL);
+					
+					release_socket(sock);
+					return -1;
+				}
+				
+				sock->priority = *intval;
+				
+				release_socket(sock);
+				return 0;
+			}
 			else{
 				log_printf(LOG_ERROR, "Unknown NSPROTO_IPX socket option passed to setsockopt: %d", optname);
 				
 				WSASetLastError(WSAENOPROTOOPT);
 				
-				unlock_sockets();
+				release_socket(sock);
 				return -1;
 			}
 		}
@@ -1329,8 +1492,8 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 				 * depends on the call succeeding.
 				*/
 				
-				log_printf(LOG_DEBUG, "Ignoring SO_LINGER on IPX socket %d", sock->fd);
-				unlock_sockets();
+				LOG_PRINTF(LOG_DEBUG, "Ignoring SO_LINGER on IPX socket %d", sock->fd);
+				release_socket(sock);
 				
 				return 0;
 			}
@@ -1343,18 +1506,18 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 				 * uses it and won't work if the call fails.
 				*/
 				
-				log_printf(LOG_DEBUG, "Ignoring unknown SOL_SOCKET option 16399 on socket %d", sock->fd);
-				unlock_sockets();
+				LOG_PRINTF(LOG_DEBUG, "Ignoring unknown SOL_SOCKET option 16399 on socket %d", sock->fd);
+				release_socket(sock);
 				
 				return 0;
 			}
 		}
 		
-		unlock_sockets();
+		release_socket(sock);
 	}
 	
 	int r = r_setsockopt(fd, level, optname, optval, optlen);
-	log_printf(LOG_CALL, "r_setsockopt = %d, WSAGetLastError = %d", r, (int)(WSAGetLastError()));
+	LOG_PRINTF(LOG_CALL, "r_setsockopt = %d, WSAGetLastError = %d", r, (int)(WSAGetLastError()));
 	
 	return r;
 }
@@ -1364,7 +1527,7 @@ int WSAAPI setsockopt(SOCKET fd, int level, int optname, const char FAR *optval,
 */
 static int send_packet(const ipx_packet *packet, int len, struct sockaddr *addr, int addrlen)
 {
-	if(min_log_level <= LOG_DEBUG && addr->sa_family == AF_INET)
+	if(LOG_ENABLED(LOG_DEBUG) && addr->sa_family == AF_INET)
 	{
 		struct sockaddr_in *v4 = (struct sockaddr_in*)(addr);
 		
@@ -1395,7 +1558,7 @@ static int send_packet(const ipx_packet *packet, int len, struct sockaddr *addr,
 	return r;
 }
 
-static DWORD ipx_send_packet(
+DWORD ipx_send_packet(
 	uint8_t type,
 	addr32_t src_net,
 	addr48_t src_node,
@@ -1406,6 +1569,7 @@ static DWORD ipx_send_packet(
 	const void *data,
 	size_t data_size)
 {
+	if(LOG_ENABLED(LOG_DEBUG))
 	{
 		IPX_STRING_ADDR(src_addr, src_net, src_node, src_socket);
 		IPX_STRING_ADDR(dest_addr, dest_net, dest_node, dest_socket);
@@ -1414,9 +1578,16 @@ static DWORD ipx_send_packet(
 			(unsigned int)(data_size), src_addr, dest_addr);
 	}
 	
+	capture_packet(CAPTURE_OUTBOUND, type,
+		src_net, src_node, src_socket,
+		dest_net, dest_node, dest_socket,
+		data, data_size);
+	
 	if(ipx_encap_type == ENCAP_TYPE_PCAP)
 	{
-		ipx_interface_t *iface = ipx_interface_by_addr(src_net, src_node);
+		ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
+		
+		const ipx_interface_t *iface = ipx_snapshot_by_addr(snapshot, src_net, src_node);
 		if(iface)
 		{
 			/* Calculate the frame size and check we can actually
@@ -1448,16 +1619,18 @@ static DWORD ipx_send_packet(
 					"Tried sending a %u byte packet, too large for the selected frame type",
 					(unsigned int)(data_size));
 				
+				ipx_interfaces_release(snapshot);
 				return WSAEMSGSIZE;
 			}
 			
-			log_printf(LOG_DEBUG, "...frame size = %u", (unsigned int)(frame_size));
+			LOG_PRINTF(LOG_DEBUG, "...frame size = %u", (unsigned int)(frame_size));
 			
 			/* Serialise the frame. */
 			
 			void *frame = malloc(frame_size);
 			if(!frame)
 			{
+				ipx_interfaces_release(snapshot);
 				return ERROR_OUTOFMEMORY;
 			}
 			
@@ -1490,23 +1663,32 @@ static DWORD ipx_send_packet(
 			
 			/* Transmit the frame. */
 			
-			if(pcap_sendpacket(iface->pcap, (void*)(frame), frame_size) == 0)
+			int err = pcap_sendpacket(iface->pcap, (void*)(frame), frame_size);
+			
+			free(frame);
+			ipx_interfaces_release(snapshot);
+			
+			if(err == 0)
 			{
 				__atomic_add_fetch(&send_packets, 1, __ATOMIC_RELAXED);
 				__atomic_add_fetch(&send_bytes, data_size, __ATOMIC_RELAXED);
 				
-				free(frame);
+				if(PEERSTATS_ENABLED())
+				{
+					peerstats_record_send(dest_net, dest_node, data_size, GetTickCount());
+				}
+				
 				return ERROR_SUCCESS;
 			}
 			else{
 				log_printf(LOG_ERROR, "Could not transmit Ethernet frame");
 				
-				free(frame);
 				return WSAENETDOWN;
 			}
 		}
 		else{
 			/* It's a bug if we actually hit this. */
+			ipx_interfaces_release(snapshot);
 			return WSAENETDOWN;
 		}
 	}
@@ -1549,11 +1731,17 @@ static DWORD ipx_send_packet(
 			
 			memcpy(packet->data, data, data_size);
 			
-			DWORD error = coalesce_send(packet, packet_size, dest_net, dest_node, dest_socket);
+			DWORD error = coalesce_send(packet, packet_size, dest_net, dest_node, dest_socket,
+				(struct sockaddr*)(&dosbox_server_addr), sizeof(dosbox_server_addr));
 			if(error == ERROR_SUCCESS)
 			{
 				__atomic_add_fetch(&send_packets, 1, __ATOMIC_RELAXED);
 				__atomic_add_fetch(&send_bytes, data_size, __ATOMIC_RELAXED);
+				
+				if(PEERSTATS_ENABLED())
+				{
+					peerstats_record_send(dest_net, dest_node, data_size, GetTickCount());
+				}
 			}
 			
 			free(packet);
@@ -1602,7 +1790,18 @@ static DWORD ipx_send_packet(
 			 * host.
 			*/
 			
-			if(send_packet(
+			if(main_config.udp_coalesce && dest_node != BCAST_NODE)
+			{
+				/* Unicast packets to a known host may be batched up
+				 * with others to the same destination.
+				*/
+				
+				send_error = coalesce_send(packet, packet_size, dest_net, dest_node, dest_socket,
+					(struct sockaddr*)(&send_addr), addrlen);
+				
+				send_ok = (send_error == ERROR_SUCCESS);
+			}
+			else if(send_packet(
 				packet,
 				packet_size,
 				(struct sockaddr*)(&send_addr),
@@ -1617,7 +1816,9 @@ static DWORD ipx_send_packet(
 		else{
 			/* No cached address. Send using broadcast. */
 			
-			ipx_interface_t *iface = ipx_interface_by_addr(src_net, src_node);
+			ipx_interface_snapshot_t *snapshot = ipx_interfaces_acquire();
+			
+			const ipx_interface_t *iface = ipx_snapshot_by_addr(snapshot, src_net, src_node);
 			
 			if(iface && iface->ipaddr)
 			{
@@ -1627,7 +1828,7 @@ static DWORD ipx_send_packet(
 				 * through any of them.
 				*/
 				
-				ipx_interface_ip_t* ip;
+				const ipx_interface_ip_t* ip;
 				
 				DL_FOREACH(iface->ipaddr, ip)
 				{
@@ -1653,13 +1854,13 @@ static DWORD ipx_send_packet(
 			else{
 				/* No IP addresses; can't transmit */
 				
-				free_ipx_interface(iface);
+				ipx_interfaces_release(snapshot);
 				free(packet);
 				
 				return WSAENETUNREACH;
 			}
 			
-			free_ipx_interface(iface);
+			ipx_interfaces_release(snapshot);
 		}
 		
 		free(packet);
@@ -1670,6 +1871,11 @@ static DWORD ipx_send_packet(
 
 			__atomic_add_fetch(&send_packets, 1, __ATOMIC_RELAXED);
 			__atomic_add_fetch(&send_bytes, data_size, __ATOMIC_RELAXED);
+			
+			if(PEERSTATS_ENABLED())
+			{
+				peerstats_record_send(dest_net, dest_node, data_size, GetTickCount());
+			}
 		}
 		
 		return send_ok
@@ -1688,9 +1894,9 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 	{
 		if(sock->flags & IPX_IS_SPX)
 		{
-			unlock_sockets();
+			release_socket(sock);
 			
-			return r_send(sock->fd, buf, len, flags);
+			return r_send(fd, buf, len, flags);
 		}
 		
 		if(!addr)
@@ -1699,7 +1905,7 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 			
 			WSASetLastError(WSAEDESTADDRREQ);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 		
@@ -1709,7 +1915,7 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 			
 			WSASetLastError(WSAEFAULT);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 		
@@ -1719,7 +1925,7 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 			
 			WSASetLastError(WSAESHUTDOWN);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 		
@@ -1736,7 +1942,7 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 			
 			if(bind(fd, (struct sockaddr*)&bind_addr, sizeof(bind_addr)) == -1)
 			{
-				unlock_sockets();
+				release_socket(sock);
 				return -1;
 			}
 		}
@@ -1745,7 +1951,7 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 		{
 			WSASetLastError(WSAEMSGSIZE);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 		
@@ -1758,7 +1964,7 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 				type = ipxaddr->sa_ptype;
 			}
 			else{
-				log_printf(LOG_DEBUG, "IPX_EXTENDED_ADDRESS enabled, sendto called with addrlen %d", addrlen);
+				LOG_PRINTF(LOG_DEBUG, "IPX_EXTENDED_ADDRESS enabled, sendto called with addrlen %d", addrlen);
 			}
 		}
 		
@@ -1775,28 +1981,95 @@ int WSAAPI sendto(SOCKET fd, const char *buf, int len, int flags, const struct s
 			dest_net = src_net;
 		}
 		
-		DWORD error = ipx_send_packet(type, src_net, src_node, src_socket, dest_net, dest_node, dest_socket, buf, len);
+		enum pacer_result pace = PACER_SEND_NOW;
 		
-		static ratelimit packet_rate;
-		static ratelimit byte_rate;
+		if(pacer_enabled())
+		{
+			if(sock->pacer == NULL && (sock->pacer = pacer_socket_create(GetTickCount())) == NULL)
+			{
+				WSASetLastError(WSAENOBUFS);
+				
+				release_socket(sock);
+				return -1;
+			}
+			
+			enum pacer_priority priority = pacer_choose_priority(sock->priority, len);
+			
+			while((pace = pacer_submit(sock->pacer, priority, type,
+				src_net, src_node, src_socket,
+				dest_net, dest_node, dest_socket,
+				buf, len, GetTickCount())) == PACER_FULL
+				&& !(sock->flags & IPX_NONBLOCK))
+			{
+				/* Blocking socket with a full send queue, wait
+				 * for the pacer thread to make some room.
+				*/
+				
+				__atomic_add_fetch(&(sock->stats.send_queue_full), 1, __ATOMIC_RELAXED);
+				
+				unlock_socket(sock);
+				pacer_wait_for_space();
+				lock_socket(sock);
+				
+				if(sock->flags & IPX_CLOSED)
+				{
+					WSASetLastError(WSAENOTSOCK);
+					
+					release_socket(sock);
+					return -1;
+				}
+			}
+			
+			if(pace == PACER_FULL || pace == PACER_NOMEM)
+			{
+				if(pace == PACER_FULL)
+				{
+					__atomic_add_fetch(&(sock->stats.send_queue_full), 1, __ATOMIC_RELAXED);
+				}
+				
+				__atomic_add_fetch(&(sock->stats.send_errors), 1, __ATOMIC_RELAXED);
+				
+				WSASetLastError(pace == PACER_FULL ? WSAEWOULDBLOCK : WSAENOBUFS);
+				
+				release_socket(sock);
+				return -1;
+			}
+		}
 		
-		unsigned int packet_rate_delay = main_config.rate_limit_packets > 0
-			? ratelimit_get_delay(&packet_rate, 1, main_config.rate_limit_packets, GetTickCount())
-			: 0;
+		/* Everything needed to send the packet has been copied out of
+		 * the socket, so unlock it before sending. Local delivery
+		 * locks the receiving sockets, which could deadlock against
+		 * another thread sending from one of them if we kept ours.
+		 *
+		 * Our reference is kept until the counters have been updated.
+		*/
 		
-		unsigned int byte_rate_delay = main_config.rate_limit_bytes > 0
-			? ratelimit_get_delay(&byte_rate, len, main_config.rate_limit_bytes, GetTickCount())
-			: 0;
+		unlock_socket(sock);
 		
-		unlock_sockets();
+		DWORD error = ERROR_SUCCESS;
 		
-		Sleep(max(packet_rate_delay, byte_rate_delay));
+		if(pace == PACER_QUEUED)
+		{
+			/* The pacer thread will send it once the rate limit allows. */
+			__atomic_add_fetch(&(sock->stats.send_deferred), 1, __ATOMIC_RELAXED);
+		}
+		else{
+			error = ipx_send_packet(type, src_net, src_node, src_socket, dest_net, dest_node, dest_socket, buf, len);
+		}
 		
 		if(error == ERROR_SUCCESS)
 		{
+			__atomic_add_fetch(&(sock->stats.send_packets), 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&(sock->stats.send_bytes), len, __ATOMIC_RELAXED);
+			
+			unref_socket(sock);
 			return len;
 		}
 		else{
+			__atomic_add_fetch(&(sock->stats.send_errors), 1, __ATOMIC_RELAXED);
+			
+			unref_socket(sock);
+			
 			WSASetLastError(error);
 			return -1;
 		}
@@ -1814,13 +2087,17 @@ int PASCAL shutdown(SOCKET fd, int cmd)
 	{
 		if(sock->flags & IPX_IS_SPX)
 		{
-			unlock_sockets();
+			release_socket(sock);
 			return r_shutdown(fd, cmd);
 		}
 		else{
 			if(cmd == SD_RECEIVE || cmd == SD_BOTH)
 			{
 				sock->flags &= ~IPX_RECV;
+				
+				lock_sockets();
+				sockindex_remove(sock);
+				unlock_sockets();
 			}
 			
 			if(cmd == SD_SEND || cmd == SD_BOTH)
@@ -1828,7 +2105,7 @@ int PASCAL shutdown(SOCKET fd, int cmd)
 				sock->flags &= ~IPX_SEND;
 			}
 			
-			unlock_sockets();
+			release_socket(sock);
 			return 0;
 		}
 	}
@@ -1843,10 +2120,20 @@ int PASCAL ioctlsocket(SOCKET fd, long cmd, u_long *argp)
 	
 	if(sock)
 	{
-		log_printf(LOG_CALL, "ioctlsocket(%d, %d)", fd, cmd);
+		LOG_PRINTF(LOG_CALL, "ioctlsocket(%d, %d)", fd, cmd);
 		
 		if(cmd == FIONREAD && !(sock->flags & IPX_IS_SPX))
 		{
+			if(sock->recv_queue == NULL)
+			{
+				/* Socket isn't bound, so it can't have received anything. */
+				
+				release_socket(sock);
+				
+				*(unsigned long*)(argp) = 0;
+				return 0;
+			}
+			
 			{
 				FPROF_RECORD_SCOPE(&(ipxwrapper_fstats[IPXWRAPPER_FSTATS_ioctlsocket_recv_pump]));
 				
@@ -1874,18 +2161,40 @@ int PASCAL ioctlsocket(SOCKET fd, long cmd, u_long *argp)
 				
 				for(int i = 0; i < sock->recv_queue->n_ready; ++i)
 				{
-					const ipx_packet *packet = (const ipx_packet*)(sock->recv_queue->data[ sock->recv_queue->ready[i] ]);
+					const ipx_packet *packet = (const ipx_packet*)(sock->recv_queue->data[ recv_queue_ready_slot(sock->recv_queue, i) ]);
 					accumulated_packet_data += packet->size;
 				}
 			}
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			*(unsigned long*)(argp) = accumulated_packet_data;
 			return 0;
 		}
 		
-		unlock_sockets();
+		if(cmd == FIONBIO)
+		{
+			/* Track the blocking mode so sendto() knows whether it
+			 * can wait for space in the socket's send queue.
+			*/
+			
+			int r = r_ioctlsocket(fd, cmd, argp);
+			if(r == 0)
+			{
+				if(*argp)
+				{
+					sock->flags |= IPX_NONBLOCK;
+				}
+				else{
+					sock->flags &= ~IPX_NONBLOCK;
+				}
+			}
+			
+			release_socket(sock);
+			return r;
+		}
+		
+		release_socket(sock);
 	}
 	
 	return r_ioctlsocket(fd, cmd, argp);
@@ -1919,7 +2228,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 {
 	if(ipxaddr->sa_family != AF_IPX)
 	{
-		unlock_sockets();
+		release_socket(sock);
 		
 		WSASetLastError(WSAEAFNOSUPPORT);
 		return -1;
@@ -1972,12 +2281,13 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 	{
 		/* There isn't anywhere for us to probe. */
 		
-		unlock_sockets();
+		release_socket(sock);
 		
 		WSASetLastError(WSAENETUNREACH);
 		return -1;
 	}
 	
+	if(LOG_ENABLED(LOG_DEBUG))
 	{
 		IPX_STRING_ADDR(
 			addr_s,
@@ -2002,7 +2312,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 	ipx_packet *packet = malloc(packet_len);
 	if(!packet)
 	{
-		unlock_sockets();
+		release_socket(sock);
 		
 		WSASetLastError(ERROR_OUTOFMEMORY);
 		return -1;
@@ -2028,7 +2338,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 		log_printf(LOG_ERROR, "Cannot create UDP socket: %s", w32_error(WSAGetLastError()));
 		
 		free(packet);
-		unlock_sockets();
+		release_socket(sock);
 		
 		return -1;
 	}
@@ -2050,7 +2360,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 		
 		closesocket(lookup_fd);
 		free(packet);
-		unlock_sockets();
+		release_socket(sock);
 		
 		return -1;
 	}
@@ -2072,7 +2382,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			in_addr.sin_addr.s_addr = bcast_addrs[n];
 			in_addr.sin_port        = htons(main_config.udp_port);
 			
-			log_printf(LOG_DEBUG, "Sending IPX_MAGIC_SPXLOOKUP packet to %s:%hu", inet_ntoa(in_addr.sin_addr), main_config.udp_port);
+			LOG_PRINTF(LOG_DEBUG, "Sending IPX_MAGIC_SPXLOOKUP packet to %s:%hu", inet_ntoa(in_addr.sin_addr), main_config.udp_port);
 			
 			if(sendto(lookup_fd, (char*)(packet), packet_len, 0, (struct sockaddr*)(&in_addr), sizeof(in_addr)) == -1)
 			{
@@ -2089,7 +2399,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			
 			closesocket(lookup_fd);
 			free(packet);
-			unlock_sockets();
+			release_socket(sock);
 			
 			WSASetLastError(WSAENETUNREACH);
 			return -1;
@@ -2105,13 +2415,12 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 		
 		for(uint64_t now; (now = get_ticks()) < wait_until;)
 		{
-			/* Release the socket table in case the remote address
-			 * in question is in the same process and we block the
-			 * router from replying.
+			/* Release the socket in case the remote address in
+			 * question is in the same process and we block the
+			 * router from replying. Our reference is kept.
 			*/
 			
-			int reclaim_fd = sock->fd;
-			unlock_sockets();
+			unlock_socket(sock);
 			
 			fd_set fdset;
 			FD_ZERO(&fdset);
@@ -2126,6 +2435,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			{
 				closesocket(lookup_fd);
 				free(packet);
+				unref_socket(sock);
 				
 				return -1;
 			}
@@ -2135,18 +2445,15 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			 * waiting.
 			*/
 			
-			ipx_socket *reclaim_sock = get_socket(reclaim_fd);
-			if(sock != reclaim_sock)
+			lock_socket(sock);
+			
+			if(sock->flags & IPX_CLOSED)
 			{
-				log_printf(LOG_DEBUG, "Application closed socket during connect!");
+				LOG_PRINTF(LOG_DEBUG, "Application closed socket during connect!");
 				
 				closesocket(lookup_fd);
 				free(packet);
-				
-				if(reclaim_sock)
-				{
-					unlock_sockets();
-				}
+				release_socket(sock);
 				
 				WSASetLastError(WSAENOTSOCK);
 				return -1;
@@ -2202,15 +2509,15 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 	{
 		/* Didn't receive any replies. */
 		
-		log_printf(LOG_DEBUG, "Didn't get any replies to IPX_MAGIC_SPXLOOKUP");
+		LOG_PRINTF(LOG_DEBUG, "Didn't get any replies to IPX_MAGIC_SPXLOOKUP");
 		
-		unlock_sockets();
+		release_socket(sock);
 		
 		WSASetLastError(WSAENETUNREACH);
 		return -1;
 	}
 	
-	log_printf(LOG_DEBUG, "Got reply to IPX_MAGIC_SPXLOOKUP; connecting to %s:%hu", inet_ntoa(in_addr.sin_addr), htons(in_addr.sin_port));
+	LOG_PRINTF(LOG_DEBUG, "Got reply to IPX_MAGIC_SPXLOOKUP; connecting to %s:%hu", inet_ntoa(in_addr.sin_addr), htons(in_addr.sin_port));
 	
 	/* Attempt to connect the underlying TCP socket to the address we got in
 	 * response to the IPX_MAGIC_SPXLOOKUP packet.
@@ -2243,21 +2550,21 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			int errnum, len = sizeof(int);
 			getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, (char*)(&errnum), &len);
 			
-			log_printf(LOG_DEBUG, "Connection failed: %s", w32_error(errnum));
+			LOG_PRINTF(LOG_DEBUG, "Connection failed: %s", w32_error(errnum));
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			WSASetLastError(WSAEWOULDBLOCK);
 			return -1;
 		}
 		
-		unlock_sockets();
+		release_socket(sock);
 		return -1;
 	}
 	
 	CONNECTED:
 	
-	log_printf(LOG_DEBUG, "Connection succeeded");
+	LOG_PRINTF(LOG_DEBUG, "Connection succeeded");
 	
 	/* Set the IPX_CONNECT_OK bit which indicates the next WSAAsyncSelect
 	 * call with FD_CONNECT set should send a message indicating the
@@ -2294,13 +2601,13 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			log_printf(LOG_ERROR, "Cannot get local TCP port of SPX socket: %s", w32_error(WSAGetLastError()));
 			log_printf(LOG_WARNING, "Socket %d is NOW INCONSISTENT!", sock->fd);
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return -1;
 		}
 		
 		sock->port = local_addr.sin_port;
-		log_printf(LOG_DEBUG, "Socket %d bound to TCP port %hu by connect", sock->fd, ntohs(sock->port));
+		LOG_PRINTF(LOG_DEBUG, "Socket %d bound to TCP port %hu by connect", sock->fd, ntohs(sock->port));
 		
 		/* The sa_netnum and sa_nodenum fields are filled out above. */
 		
@@ -2309,11 +2616,12 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			log_printf(LOG_ERROR, "Cannot allocate socket number for SPX socket");
 			log_printf(LOG_WARNING, "Socket %d is NOW INCONSISTENT!", sock->fd);
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return -1;
 		}
 		
+		if(LOG_ENABLED(LOG_DEBUG))
 		{
 			IPX_STRING_ADDR(
 				addr_s,
@@ -2346,7 +2654,7 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 			log_printf(LOG_ERROR, "Cannot send spxinit structure: %s", w32_error(WSAGetLastError()));
 			log_printf(LOG_WARNING, "Socket %d is NOW INCONSISTENT!", sock->fd);
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return -1;
 		}
@@ -2354,14 +2662,14 @@ static int _connect_spx(ipx_socket *sock, struct sockaddr_ipx *ipxaddr)
 		c += s;
 	}
 	
-	unlock_sockets();
+	release_socket(sock);
 	
 	return 0;
 }
 
 int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 {
-	log_printf(LOG_CALL, "connect(%d, %p, %d)", (int)(fd), addr, addrlen);
+	LOG_PRINTF(LOG_CALL, "connect(%d, %p, %d)", (int)(fd), addr, addrlen);
 	
 	ipx_socket *sock = get_socket(fd);
 	
@@ -2373,7 +2681,7 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 		{
 			if(addrlen < sizeof(struct sockaddr_ipx))
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEFAULT);
 				return -1;
@@ -2381,7 +2689,7 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			
 			if(ipxaddr->sa_family != AF_IPX)
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEAFNOSUPPORT);
 				return -1;
@@ -2400,14 +2708,14 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			if(addrlen >= sizeof(addr->sa_family) && addr->sa_family == AF_UNSPEC)
 			{
 				sock->flags &= ~IPX_CONNECTED;
-				unlock_sockets();
+				release_socket(sock);
 				
 				return 0;
 			}
 			
 			if(addrlen < sizeof(struct sockaddr_ipx))
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEFAULT);
 				return -1;
@@ -2415,7 +2723,7 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			
 			if(addr->sa_family != AF_IPX)
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEAFNOSUPPORT);
 				return -1;
@@ -2428,7 +2736,7 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			if(memcmp(ipxaddr->sa_nodenum, (unsigned char[]){ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 6) == 0)
 			{
 				sock->flags &= ~IPX_CONNECTED;
-				unlock_sockets();
+				release_socket(sock);
 				
 				return 0;
 			}
@@ -2446,7 +2754,7 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 				
 				if(bind(fd, (struct sockaddr*)&bind_addr, sizeof(bind_addr)) == -1)
 				{
-					unlock_sockets();
+					release_socket(sock);
 					return -1;
 				}
 			}
@@ -2454,7 +2762,7 @@ int PASCAL connect(SOCKET fd, const struct sockaddr *addr, int addrlen)
 			memcpy(&(sock->remote_addr), addr, sizeof(*ipxaddr));
 			sock->flags |= IPX_CONNECTED;
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return 0;
 		}
@@ -2472,14 +2780,14 @@ int PASCAL send(SOCKET fd, const char *buf, int len, int flags)
 	{
 		if(sock->flags & IPX_IS_SPX)
 		{
-			unlock_sockets();
+			release_socket(sock);
 			
 			return r_send(fd, buf, len, flags);
 		}
 		else{
 			if(!(sock->flags & IPX_CONNECTED))
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAENOTCONN);
 				return -1;
@@ -2488,7 +2796,7 @@ int PASCAL send(SOCKET fd, const char *buf, int len, int flags)
 			/* Copy remote address to ensure it remains valid after we unlock the sockets. */
 			struct sockaddr_ipx dest_addr = sock->remote_addr;
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			int ret = sendto(fd, buf, len, 0, (struct sockaddr*)&(dest_addr), sizeof(struct sockaddr_ipx));
 			
@@ -2510,7 +2818,7 @@ int PASCAL getpeername(SOCKET fd, struct sockaddr *addr, int *addrlen)
 		{
 			WSASetLastError(WSAENOTCONN);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 		
@@ -2518,14 +2826,14 @@ int PASCAL getpeername(SOCKET fd, struct sockaddr *addr, int *addrlen)
 		{
 			WSASetLastError(WSAEFAULT);
 			
-			unlock_sockets();
+			release_socket(sock);
 			return -1;
 		}
 		
 		memcpy(addr, &(sock->remote_addr), sizeof(struct sockaddr_ipx));
 		*addrlen = sizeof(struct sockaddr_ipx);
 		
-		unlock_sockets();
+		release_socket(sock);
 		return 0;
 	}
 	else{
@@ -2543,7 +2851,7 @@ int PASCAL listen(SOCKET s, int backlog)
 		{
 			if(!(sock->flags & IPX_BOUND))
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEINVAL);
 				return -1;
@@ -2551,27 +2859,43 @@ int PASCAL listen(SOCKET s, int backlog)
 			
 			if(sock->flags & IPX_LISTENING)
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEISCONN);
 				return -1;
 			}
 			
+			lock_sockets();
+			bool indexed = sockindex_add(&spx_listen_index, sock);
+			unlock_sockets();
+			
+			if(!indexed)
+			{
+				release_socket(sock);
+				
+				WSASetLastError(WSAENOBUFS);
+				return -1;
+			}
+			
 			if(r_listen(sock->fd, backlog) == -1)
 			{
+				lock_sockets();
+				sockindex_remove(sock);
 				unlock_sockets();
 				
+				release_socket(sock);
+				
 				return -1;
 			}
 			
 			sock->flags |= IPX_LISTENING;
 			
-			unlock_sockets();
+			release_socket(sock);
 			
 			return 0;
 		}
 		else{
-			unlock_sockets();
+			release_socket(sock);
 			
 			WSASetLastError(WSAEOPNOTSUPP);
 			return -1;
@@ -2592,7 +2916,7 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 		{
 			if(addrlen && *addrlen < sizeof(struct sockaddr_ipx))
 			{
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAEFAULT);
 				return -1;
@@ -2601,6 +2925,8 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 			ipx_socket *nsock = malloc(sizeof(ipx_socket));
 			if(!nsock)
 			{
+				release_socket(sock);
+				
 				WSASetLastError(ERROR_OUTOFMEMORY);
 				return -1;
 			}
@@ -2608,7 +2934,7 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 			if((nsock->fd = r_accept(s, NULL, NULL)) == -1)
 			{
 				free(nsock);
-				unlock_sockets();
+				release_socket(sock);
 				
 				return -1;
 			}
@@ -2634,7 +2960,7 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 					
 					closesocket(nsock->fd);
 					free(nsock);
-					unlock_sockets();
+					release_socket(sock);
 					
 					WSASetLastError(WSAECONNRESET);
 					return -1;
@@ -2644,6 +2970,12 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 			}
 			
 			nsock->flags = IPX_IS_SPX | IPX_BOUND | IPX_CONNECTED | (sock->flags & IPX_IS_SPXII);
+			nsock->priority = IPX_PRIORITY_AUTO;
+			nsock->recv_queue = NULL;
+			nsock->pacer = NULL;
+			nsock->index = NULL;
+			
+			memset(&(nsock->stats), 0, sizeof(nsock->stats));
 			
 			/* Copy local address from the listening socket. */
 			
@@ -2662,7 +2994,7 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 				
 				closesocket(nsock->fd);
 				free(nsock);
-				unlock_sockets();
+				release_socket(sock);
 				
 				WSASetLastError(WSAENETDOWN);
 				return -1;
@@ -2675,19 +3007,32 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 			memcpy(nsock->remote_addr.sa_nodenum, spxinit.node, 6);
 			nsock->remote_addr.sa_socket = spxinit.socket;
 			
-			HASH_ADD_INT(sockets, fd, nsock);
-			
 			if(addr)
 			{
 				*(struct sockaddr_ipx*)(addr) = nsock->remote_addr;
 			}
 			
-			unlock_sockets();
+			release_socket(sock);
 			
-			return nsock->fd;
+			/* nsock may be closed by another thread as soon as it is
+			 * in the sockets table.
+			*/
+			SOCKET nfd = nsock->fd;
+			
+			if(!add_socket(nsock))
+			{
+				CloseHandle(nsock->sock_mut);
+				r_closesocket(nfd);
+				free(nsock);
+				
+				WSASetLastError(WSAENOBUFS);
+				return -1;
+			}
+			
+			return nfd;
 		}
 		else{
-			unlock_sockets();
+			release_socket(sock);
 			
 			WSASetLastError(WSAEOPNOTSUPP);
 			return -1;
@@ -2700,27 +3045,48 @@ SOCKET PASCAL accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 
 int PASCAL WSAAsyncSelect(SOCKET s, HWND hWnd, unsigned int wMsg, long lEvent)
 {
-	if(lEvent & FD_CONNECT)
+	ipx_socket *sock = get_socket(s);
+	
+	if(sock)
 	{
-		ipx_socket *sock = get_socket(s);
-		
-		if(sock)
+		if((lEvent & FD_CONNECT) && (sock->flags & IPX_CONNECT_OK))
 		{
-			if(sock->flags & IPX_CONNECT_OK)
-			{
-				log_printf(LOG_DEBUG, "Posting message %u for FD_CONNECT on socket %d", wMsg, sock->fd);
-				
-				PostMessage(hWnd, wMsg, sock->fd, MAKEWORD(FD_CONNECT, 0));
-				sock->flags &= ~IPX_CONNECT_OK;
-			}
+			LOG_PRINTF(LOG_DEBUG, "Posting message %u for FD_CONNECT on socket %d", wMsg, sock->fd);
 			
-			unlock_sockets();
+			PostMessage(hWnd, wMsg, sock->fd, MAKEWORD(FD_CONNECT, 0));
+			sock->flags &= ~IPX_CONNECT_OK;
+		}
+		
+		/* WSAAsyncSelect() puts the socket into non-blocking mode. */
+		if(lEvent != 0)
+		{
+			sock->flags |= IPX_NONBLOCK;
 		}
+		
+		release_socket(sock);
 	}
 	
 	return r_WSAAsyncSelect(s, hWnd, wMsg, lEvent);
 }
 
+int WSAAPI WSAEventSelect(SOCKET s, WSAEVENT hEventObject, long lNetworkEvents)
+{
+	ipx_socket *sock = get_socket(s);
+	
+	if(sock)
+	{
+		/* WSAEventSelect() puts the socket into non-blocking mode. */
+		if(lNetworkEvents != 0)
+		{
+			sock->flags |= IPX_NONBLOCK;
+		}
+		
+		release_socket(sock);
+	}
+	
+	return r_WSAEventSelect(s, hEventObject, lNetworkEvents);
+}
+
 int WSAAPI select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, const TIMEVAL* timeout)
 {
 	const struct timeval TIMEOUT_IMMEDIATE = { 0, 0 };
@@ -2738,12 +3104,30 @@ int WSAAPI select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds
 			ipx_socket *sockptr = get_socket(fd);
 			if(sockptr != NULL)
 			{
-				if(sockptr->flags & IPX_IS_SPX)
+				if((sockptr->flags & IPX_IS_SPX) || sockptr->recv_queue == NULL)
 				{
-					unlock_sockets();
+					release_socket(sockptr);
 					continue;
 				}
 				
+				if(sockptr->recv_queue->n_ready == 0 && sockptr->recv_queue->doorbell_pending)
+				{
+					/* The receive queue has been emptied, but there is
+					 * still a doorbell waiting in the underlying socket
+					 * which would make it appear readable, so read it
+					 * out (along with any relayed packets behind it).
+					*/
+					
+					int pr;
+					while((pr = recv_pump(sockptr, FALSE)) > 0) {}
+					
+					if(pr < 0)
+					{
+						/* recv_pump() has released the lock. */
+						continue;
+					}
+				}
+				
 				if(sockptr->recv_queue->n_ready > 0)
 				{
 					/* There is data in the receive queue for this socket, but
@@ -2757,7 +3141,7 @@ int WSAAPI select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds
 					use_timeout = &TIMEOUT_IMMEDIATE;
 				}
 				
-				unlock_sockets();
+				release_socket(sockptr);
 			}
 		}
 	}
@@ -0,0 +1,123 @@
+# IPXWrapper test suite
+# Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published by
+# the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc., 51
+# Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+use strict;
+use warnings;
+
+use Test::Spec;
+
+use FindBin;
+use lib "$FindBin::Bin/lib/";
+
+use IPC::Open3;
+
+use IPXWrapper::Tool::Generic;
+use IPXWrapper::Util;
+
+require "$FindBin::Bin/config.pm";
+
+our ($remote_mac_a, $remote_ip_a);
+our ($remote_mac_b, $remote_ip_b);
+
+# Start ipx-bench sending to an ipx-echo process, run the given function while
+# it is running and then wait for it to finish.
+sub while_benchmarking
+{
+	my ($func) = @_;
+	
+	my $echo = IPXWrapper::Tool::Generic->new(
+		$remote_ip_a, "Z:\\tools\\ipx-echo.exe",
+		"00:00:00:01", $remote_mac_a, "4444");
+	
+	# 500 packets of each size at 2ms intervals, long enough to take
+	# several samples.
+	my @command = ("ssh", $remote_ip_a, "Z:\\tools\\ipx-bench.exe",
+		"00:00:00:01", $remote_mac_a, "4444", "500", "2000");
+	note(join(" ", @command));
+	
+	my $bench_pid = open3(my $bench_in, my $bench_out, undef, @command);
+	
+	$func->();
+	
+	# Discard the results so ipx-bench isn't blocked writing them out.
+	1 while(<$bench_out>);
+	
+	waitpid($bench_pid, 0);
+}
+
+describe "ipxstat" => sub
+{
+	before all => sub
+	{
+		reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+		reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\00:00:00:00:00:00", "net", "00:00:00:01");
+		reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\$remote_mac_a", "net", "00:00:00:01");
+		reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\$remote_mac_b", "net", "00:00:00:02");
+		reg_set_dword( $remote_ip_a, "HKCU\\Software\\IPXWrapper", "stats_export", 1);
+		reg_set_dword( $remote_ip_a, "HKCU\\Software\\IPXWrapper", "profile", 1);
+	};
+	
+	it "reads counters from a running process" => sub
+	{
+		my $output;
+		
+		while_benchmarking(sub
+		{
+			$output = run_remote_cmd($remote_ip_a, "Z:\\ipxstat.exe",
+				"-c", "-i", "500", "-n", "4", "ipx-bench.exe");
+		});
+		
+		my ($header, @lines) = split(m/\n/, $output);
+		my @columns = split(m/,/, $header);
+		
+		my @samples = map {
+			my %sample;
+			@sample{@columns} = split(m/,/, $_);
+			\%sample;
+		} @lines;
+		
+		is(scalar(@samples), 4, "ipxstat takes the requested number of samples");
+		
+		cmp_ok($samples[-1]->{send_packets},     ">", 0, "Sent packets are counted");
+		cmp_ok($samples[-1]->{send_bytes},       ">", 0, "Sent bytes are counted");
+		cmp_ok($samples[-1]->{recv_packets},     ">", 0, "Received packets are counted");
+		cmp_ok($samples[-1]->{send_packets_udp}, ">", 0, "Packets sent over UDP are counted");
+		cmp_ok($samples[-1]->{sockets},          ">", 0, "Open sockets are listed");
+		
+		cmp_ok($samples[-1]->{send_packets}, ">", $samples[0]->{send_packets},
+			"Counters are updated while the process is running");
+		
+		ok(!(grep { $samples[$_]->{time} < $samples[$_ - 1]->{time} } (1 .. $#samples)),
+			"Sample times increase");
+	};
+	
+	it "displays function timings from a running process" => sub
+	{
+		my $output;
+		
+		while_benchmarking(sub
+		{
+			$output = run_remote_cmd($remote_ip_a, "Z:\\ipxstat.exe",
+				"-i", "500", "-n", "2", "ipx-bench.exe");
+		});
+		
+		like($output, qr/^IPX sent\s+\d+\s+\d+\s+[1-9]\d*\s+[1-9]\d*$/m, "Sent packets are displayed");
+		like($output, qr/^\d+\s+00:00:00:01\/[0-9A-F:]{17}\/\d+\s+IPX\s+\d+\/\d+\s+\d+$/m, "Bound socket is displayed");
+		like($output, qr/^ipxwrapper\.dll:\w+\s/m, "Function timings are displayed");
+	};
+};
+
+runtests unless caller;
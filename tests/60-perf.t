@@ -0,0 +1,268 @@
+# IPXWrapper test suite
+# Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published by
+# the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc., 51
+# Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# Performance regression tests.
+#
+# Runs ipx-bench against ipx-echo on the test system using each encapsulation
+# and checks the throughput, loss and round trip times against the values in
+# perf-baseline.txt, along with the time per operation measured by each of the
+# microbenchmarks in tests/bench/. Each metric must be within IPXWRAPPER_PERF_TOLERANCE
+# percent (default 25) of the baseline, metrics without a baseline are only
+# recorded.
+#
+# Every metric measured is written to IPXWRAPPER_PERF_RESULTS (default
+# perf-results.txt) in the same format as the baseline, so a new baseline can
+# be taken by copying it over perf-baseline.txt.
+
+use strict;
+use warnings;
+
+use Test::Spec;
+
+use FindBin;
+use lib "$FindBin::Bin/lib/";
+
+use List::Util qw(max);
+
+use IPXWrapper::DOSBoxServer;
+use IPXWrapper::Tool::IPXEcho;
+use IPXWrapper::Util;
+
+require "$FindBin::Bin/config.pm";
+
+our ($remote_mac_a, $remote_ip_a);
+our ($remote_mac_b, $remote_ip_b);
+our ($dosbox_port);
+
+my $tolerance     = $ENV{IPXWRAPPER_PERF_TOLERANCE} // 25;
+my $baseline_file = $ENV{IPXWRAPPER_PERF_BASELINE}  // "$FindBin::Bin/perf-baseline.txt";
+my $results_file  = $ENV{IPXWRAPPER_PERF_RESULTS}   // "perf-results.txt";
+
+# Metrics checked against the baseline. Those where lower is better have a
+# floor below which the baseline is rounded up, so that a baseline of zero
+# loss or a few microseconds of latency doesn't fail on any noise at all.
+my %METRICS = (
+	sent_packets_sec => { higher => 1 },
+	recv_packets_sec => { higher => 1 },
+	loss_percent     => { higher => 0, floor => 1 },
+	p50_rtt_us       => { higher => 0, floor => 200 },
+	p99_rtt_us       => { higher => 0, floor => 1000 },
+);
+
+# Microbenchmark programs built from tests/bench/, the time they measure is
+# checked with the same floor so the noise in timing operations which take a
+# few nanoseconds isn't mistaken for a regression.
+my @BENCHES = qw(addr addrcache ethernet coalesce ratelimit);
+my $BENCH_FLOOR_NS = 20;
+
+# ipx-bench load runs made in each encapsulation mode.
+my %RUNS = (
+	# One socket at a low rate, measures latency when idle.
+	light => [ "-t", "1", "-s", "1", "-r", "500",  "-d", "5000" ],
+	
+	# Many sockets from several threads, measures throughput and latency
+	# under contention.
+	heavy => [ "-t", "4", "-s", "4", "-r", "5000", "-d", "5000" ],
+);
+
+# Encapsulation mode name and bind address for ipx-echo, set by each describe
+# block before the shared examples run.
+my ($perf_mode, $perf_bind_net, $perf_bind_node);
+
+my %baseline = read_metrics($baseline_file);
+
+open(my $results, ">", $results_file)
+	or die "Can't open $results_file: $!";
+
+print {$results} "# IPXWrapper performance results, see tests/60-perf.t\n";
+
+# Run ipx-bench in load mode against an ipx-echo process and return the
+# results as a hash.
+sub run_bench
+{
+	my ($echo, @args) = @_;
+	
+	my $output = run_remote_cmd($remote_ip_a, "Z:\\tools\\ipx-bench.exe",
+		"-m", "load", "-f", "csv", @args,
+		$echo->net(), $echo->node(), $echo->socket());
+	
+	my ($header, $record) = ($output =~ m/^(threads,.*)\n(.*)$/m)
+		or die "Didn't get expected output from ipx-bench.exe:\n$output";
+	
+	my %result;
+	@result{ split(m/,/, $header) } = split(m/,/, $record, -1);
+	
+	return \%result;
+}
+
+sub read_metrics
+{
+	my ($file) = @_;
+	
+	open(my $fh, "<", $file)
+		or die "Can't open $file: $!";
+	
+	my %metrics;
+	
+	while(defined(my $line = <$fh>))
+	{
+		next if($line =~ m/^\s*(#|$)/);
+		
+		my ($name, $value) = ($line =~ m/^\s*(\S+)\s+(\S+)\s*$/)
+			or die "Malformed line in $file: $line";
+		
+		$metrics{$name} = $value;
+	}
+	
+	return %metrics;
+}
+
+# Record a metric in the results file and check it against the baseline.
+sub check_metric
+{
+	my ($name, $value, $higher_is_better, $floor) = @_;
+	
+	print {$results} "$name $value\n";
+	
+	SKIP: {
+		skip("$name has no baseline (measured $value)", 1)
+			unless(defined $baseline{$name});
+		
+		if($higher_is_better)
+		{
+			my $limit = $baseline{$name} * (1 - ($tolerance / 100));
+			cmp_ok($value, ">=", $limit, "$name ($value) is no worse than $tolerance% below baseline ($baseline{$name})");
+		}
+		else{
+			my $limit = max($baseline{$name}, ($floor // 0)) * (1 + ($tolerance / 100));
+			cmp_ok($value, "<=", $limit, "$name ($value) is no worse than $tolerance% above baseline ($baseline{$name})");
+		}
+	};
+}
+
+shared_examples_for "ipx performance" => sub
+{
+	foreach my $run (sort keys %RUNS)
+	{
+		it "meets the $run load baseline" => sub
+		{
+			my $echo = IPXWrapper::Tool::IPXEcho->new(
+				$remote_ip_a, $perf_bind_net, $perf_bind_node, "0");
+			
+			my $result = run_bench($echo, @{ $RUNS{$run} });
+			
+			foreach my $metric (sort keys %METRICS)
+			{
+				my $value = $result->{$metric};
+				
+				# Latency isn't measured if nothing came back.
+				if(!defined($value) || $value eq "")
+				{
+					fail("$perf_mode.$run.$metric was measured");
+					next;
+				}
+				
+				check_metric("$perf_mode.$run.$metric", $value,
+					$METRICS{$metric}->{higher}, $METRICS{$metric}->{floor});
+			}
+		};
+	}
+};
+
+describe "IPXWrapper performance" => sub
+{
+	describe "microbenchmarks" => sub
+	{
+		foreach my $bench (@BENCHES)
+		{
+			it "meet the $bench baseline" => sub
+			{
+				my $output = run_remote_cmd($remote_ip_a, "Z:\\tests\\bench\\$bench.exe", "-n", "11");
+				
+				my @results = ($output =~ m/^(\S+)\s+([0-9.]+) ns\/op/mg);
+				ok(@results > 0, "$bench.exe measured something");
+				
+				while(my ($case, $ns) = splice(@results, 0, 2))
+				{
+					check_metric("bench.$case.ns_per_op", $ns, 0, $BENCH_FLOOR_NS);
+				}
+			};
+		}
+	};
+	
+	describe "using IP encapsulation" => sub
+	{
+		before all => sub
+		{
+			reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\00:00:00:00:00:00", "net", "00:00:00:01");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\$remote_mac_a", "net", "00:00:00:01");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\$remote_mac_b", "net", "00:00:00:02");
+			
+			$perf_mode      = "udp";
+			$perf_bind_net  = "00:00:00:01";
+			$perf_bind_node = $remote_mac_a;
+		};
+		
+		it_should_behave_like "ipx performance";
+	};
+	
+	describe "using IP encapsulation with packet coalescing" => sub
+	{
+		before all => sub
+		{
+			reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\00:00:00:00:00:00", "net", "00:00:00:01");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\$remote_mac_a", "net", "00:00:00:01");
+			reg_set_addr(  $remote_ip_a, "HKCU\\Software\\IPXWrapper\\$remote_mac_b", "net", "00:00:00:02");
+			reg_set_dword( $remote_ip_a, "HKCU\\Software\\IPXWrapper", "udp_coalesce", 1);
+			
+			$perf_mode      = "udp-coalesce";
+			$perf_bind_net  = "00:00:00:01";
+			$perf_bind_node = $remote_mac_a;
+		};
+		
+		it_should_behave_like "ipx performance";
+	};
+	
+	describe "using DOSBox UDP encapsulation" => sub
+	{
+		my $dosbox_server;
+		
+		before all => sub
+		{
+			reg_delete_key($remote_ip_a, "HKCU\\Software\\IPXWrapper");
+			reg_set_dword( $remote_ip_a, "HKCU\\Software\\IPXWrapper", "use_pcap", ENCAP_TYPE_DOSBOX);
+			reg_set_string($remote_ip_a, "HKCU\\Software\\IPXWrapper", "dosbox_server_addr", "dosbox-ipv4.com");
+			reg_set_dword( $remote_ip_a, "HKCU\\Software\\IPXWrapper", "dosbox_server_port", $dosbox_port);
+			
+			$dosbox_server = IPXWrapper::DOSBoxServer->new($dosbox_port);
+			
+			$perf_mode      = "dosbox";
+			$perf_bind_net  = "00:00:00:00";
+			$perf_bind_node = "00:00:00:00:00:00";
+		};
+		
+		after all => sub
+		{
+			$dosbox_server = undef;
+		};
+		
+		it_should_behave_like "ipx performance";
+	};
+};
+
+runtests unless caller;
@@ -0,0 +1,98 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+
+#include "../../src/addr.h"
+#include "bench.h"
+
+static const unsigned char node_bytes[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+static const unsigned char net_bytes[]  = { 0x00, 0x00, 0x12, 0x34 };
+
+static void bench_addr32_in(void *ctx, uint64_t n_ops)
+{
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		BENCH_KEEP(addr32_in(net_bytes));
+	}
+}
+
+static void bench_addr32_out(void *ctx, uint64_t n_ops)
+{
+	unsigned char buf[4];
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		addr32_out(buf, (addr32_t)(i));
+		BENCH_KEEP(buf);
+	}
+}
+
+static void bench_addr48_in(void *ctx, uint64_t n_ops)
+{
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		BENCH_KEEP(addr48_in(node_bytes));
+	}
+}
+
+static void bench_addr48_out(void *ctx, uint64_t n_ops)
+{
+	unsigned char buf[6];
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		addr48_out(buf, (addr48_t)(i));
+		BENCH_KEEP(buf);
+	}
+}
+
+static void bench_addr48_string(void *ctx, uint64_t n_ops)
+{
+	char buf[ADDR48_STRING_SIZE];
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		addr48_string(buf, (addr48_t)(i));
+		BENCH_KEEP(buf);
+	}
+}
+
+static void bench_ipx_to_string(void *ctx, uint64_t n_ops)
+{
+	char buf[IPX_SADDR_SIZE];
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		ipx_to_string(buf, (addr32_t)(i), (addr48_t)(i), (uint16_t)(i));
+		BENCH_KEEP(buf);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	
+	bench_run("addr32_in",      &bench_addr32_in,      NULL);
+	bench_run("addr32_out",     &bench_addr32_out,     NULL);
+	bench_run("addr48_in",      &bench_addr48_in,      NULL);
+	bench_run("addr48_out",     &bench_addr48_out,     NULL);
+	bench_run("addr48_string",  &bench_addr48_string,  NULL);
+	bench_run("ipx_to_string",  &bench_ipx_to_string,  NULL);
+	
+	return 0;
+}
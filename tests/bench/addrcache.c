@@ -0,0 +1,143 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/addr.h"
+#include "../../src/addrcache.h"
+#include "../../src/common.h"
+#include "bench.h"
+
+/* Need to implement log_printf() and w32_error() for addrcache.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+const char *w32_error(DWORD errnum)
+{
+	return "error";
+}
+
+/* Hold the time still so no entries expire while being measured. */
+
+static time_t mock_time(void)
+{
+	return 1000;
+}
+
+/* Number of addresses in the cache, each case cycles through all of them. */
+static const unsigned int TABLE_SIZES[] = { 16, 256, 4096, 65536 };
+
+static addr48_t table_node(unsigned int i)
+{
+	return (addr48_t)(0x020000000000ULL + i);
+}
+
+static struct sockaddr_in table_addr(unsigned int i)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(0x0A000000 + i);
+	addr.sin_port        = htons(213);
+	
+	return addr;
+}
+
+static void bench_get_hit(void *ctx, uint64_t n_ops)
+{
+	unsigned int table_size = *(unsigned int*)(ctx);
+	
+	SOCKADDR_STORAGE addr;
+	size_t addrlen;
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		BENCH_KEEP(addr_cache_get(&addr, &addrlen, 1, table_node(i % table_size), 4444));
+	}
+}
+
+static void bench_get_miss(void *ctx, uint64_t n_ops)
+{
+	SOCKADDR_STORAGE addr;
+	size_t addrlen;
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		BENCH_KEEP(addr_cache_get(&addr, &addrlen, 2, table_node(i), 4444));
+	}
+}
+
+static void bench_set(void *ctx, uint64_t n_ops)
+{
+	unsigned int table_size = *(unsigned int*)(ctx);
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		struct sockaddr_in addr = table_addr(i % table_size);
+		addr_cache_set((struct sockaddr*)(&addr), sizeof(addr), 1, table_node(i % table_size), 4444);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	extern time_t (*addrcache_time)(void);
+	addrcache_time = &mock_time;
+	
+	bench_init(argc, argv);
+	
+	for(unsigned int i = 0; i < (sizeof(TABLE_SIZES) / sizeof(*TABLE_SIZES)); ++i)
+	{
+		unsigned int table_size = TABLE_SIZES[i];
+		
+		addr_cache_init();
+		
+		for(unsigned int j = 0; j < table_size; ++j)
+		{
+			struct sockaddr_in addr = table_addr(j);
+			addr_cache_set((struct sockaddr*)(&addr), sizeof(addr), 1, table_node(j), 4444);
+		}
+		
+		char name[64];
+		
+		snprintf(name, sizeof(name), "addr_cache_get/hit/%u", table_size);
+		bench_run(name, &bench_get_hit, &table_size);
+		
+		snprintf(name, sizeof(name), "addr_cache_get/miss/%u", table_size);
+		bench_run(name, &bench_get_miss, &table_size);
+		
+		snprintf(name, sizeof(name), "addr_cache_set/%u", table_size);
+		bench_run(name, &bench_set, &table_size);
+		
+		addr_cache_cleanup();
+	}
+	
+	return 0;
+}
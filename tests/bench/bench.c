@@ -0,0 +1,199 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define MAX_SAMPLES 1000
+
+static unsigned int n_samples = 21;
+static unsigned int sample_ms = 20;
+static unsigned int warmup_ms = 200;
+
+static char **filters = NULL;
+static int n_filters = 0;
+
+static LARGE_INTEGER perf_freq;
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n <samples>] [-t <sample time (ms)>] [-w <warm-up time (ms)>] [<case> ...]\n", argv0);
+	exit(1);
+}
+
+void bench_init(int argc, char **argv)
+{
+	setbuf(stdout, NULL);
+	
+	int i = 1;
+	
+	for(; i < argc && argv[i][0] == '-'; ++i)
+	{
+		if(strcmp(argv[i], "-n") == 0 && (i + 1) < argc)
+		{
+			n_samples = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-t") == 0 && (i + 1) < argc)
+		{
+			sample_ms = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-w") == 0 && (i + 1) < argc)
+		{
+			warmup_ms = atoi(argv[++i]);
+		}
+		else{
+			usage(argv[0]);
+		}
+	}
+	
+	if(n_samples < 1 || n_samples > MAX_SAMPLES || sample_ms < 1)
+	{
+		usage(argv[0]);
+	}
+	
+	filters = argv + i;
+	n_filters = argc - i;
+	
+	QueryPerformanceFrequency(&perf_freq);
+}
+
+/* Run n_ops operations and return how long they took in nanoseconds. */
+static double time_ops(bench_func_t func, void *ctx, uint64_t n_ops)
+{
+	LARGE_INTEGER start, end;
+	
+	QueryPerformanceCounter(&start);
+	func(ctx, n_ops);
+	QueryPerformanceCounter(&end);
+	
+	return (double)(end.QuadPart - start.QuadPart) * 1000000000.0 / (double)(perf_freq.QuadPart);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double da = *(const double*)(a);
+	double db = *(const double*)(b);
+	
+	return (da > db) - (da < db);
+}
+
+static bool name_matches(const char *name)
+{
+	if(n_filters == 0)
+	{
+		return true;
+	}
+	
+	for(int i = 0; i < n_filters; ++i)
+	{
+		if(strncmp(name, filters[i], strlen(filters[i])) == 0)
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/* Measure a case and print the result. Returns false if the case was skipped
+ * because it didn't match any of the names given on the command line.
+*/
+bool bench_run(const char *name, bench_func_t func, void *ctx)
+{
+	if(!name_matches(name))
+	{
+		return false;
+	}
+	
+	double sample_ns = (double)(sample_ms) * 1000000.0;
+	double warmup_ns = (double)(warmup_ms) * 1000000.0;
+	
+	/* Warm up the caches and branch predictors (and bring the CPU out of
+	 * any power saving state), doubling the number of operations until a
+	 * run takes at least a tenth of a sample so we can tell how many will
+	 * fill one.
+	*/
+	
+	uint64_t n_ops = 1;
+	double elapsed = 0.0, spent = 0.0;
+	
+	while(1)
+	{
+		elapsed = time_ops(func, ctx, n_ops);
+		spent += elapsed;
+		
+		if(elapsed >= (sample_ns / 10.0))
+		{
+			break;
+		}
+		
+		n_ops *= 2;
+	}
+	
+	n_ops = (uint64_t)((double)(n_ops) * sample_ns / elapsed);
+	
+	if(n_ops < 1)
+	{
+		n_ops = 1;
+	}
+	
+	while(spent < warmup_ns)
+	{
+		spent += time_ops(func, ctx, n_ops);
+	}
+	
+	double samples[MAX_SAMPLES];
+	
+	for(unsigned int i = 0; i < n_samples; ++i)
+	{
+		samples[i] = time_ops(func, ctx, n_ops) / (double)(n_ops);
+	}
+	
+	/* The median and median absolute deviation are used rather than the
+	 * mean and standard deviation, so a sample which was interrupted by
+	 * another process doesn't skew the results.
+	*/
+	
+	qsort(samples, n_samples, sizeof(*samples), &compare_doubles);
+	
+	double min    = samples[0];
+	double median = samples[n_samples / 2];
+	
+	double deviations[MAX_SAMPLES];
+	
+	for(unsigned int i = 0; i < n_samples; ++i)
+	{
+		deviations[i] = samples[i] > median
+			? samples[i] - median
+			: median - samples[i];
+	}
+	
+	qsort(deviations, n_samples, sizeof(*deviations), &compare_doubles);
+	
+	double mad_percent = median > 0.0
+		? deviations[n_samples / 2] * 100.0 / median
+		: 0.0;
+	
+	printf("%-40s %10.2f ns/op (min %.2f, mad %.1f%%, %u x %llu)\n",
+		name, median, min, mad_percent, n_samples, (unsigned long long)(n_ops));
+	
+	return true;
+}
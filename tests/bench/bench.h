@@ -0,0 +1,55 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef IPXWRAPPER_BENCH_H
+#define IPXWRAPPER_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Microbenchmark harness.
+ *
+ * Each case is a function which performs the operation being measured n_ops
+ * times. bench_run() first runs it repeatedly for the warm-up time, finding
+ * how many operations fill one sample, then times a number of samples of that
+ * many operations and prints the median time per operation along with the
+ * fastest sample and the median absolute deviation, which shows how stable
+ * the result was.
+ *
+ * Every benchmark program accepts the following options, followed by any
+ * number of case name prefixes to only run the matching cases:
+ *
+ *   -n <samples>          Number of samples to take (default 21)
+ *   -t <milliseconds>     Time to spend on each sample (default 20)
+ *   -w <milliseconds>     Time to spend warming up (default 200)
+ *
+ * Results are written to stdout, one line per case:
+ *
+ *   <name> <median> ns/op (min <fastest>, mad <deviation>%, <samples> x <ops>)
+*/
+
+typedef void (*bench_func_t)(void *ctx, uint64_t n_ops);
+
+void bench_init(int argc, char **argv);
+bool bench_run(const char *name, bench_func_t func, void *ctx);
+
+/* Prevent the compiler from optimising away the computation of a value which
+ * is otherwise unused.
+*/
+#define BENCH_KEEP(value) __asm__ volatile("" : : "g"(value) : "memory")
+
+#endif /* !IPXWRAPPER_BENCH_H */
@@ -0,0 +1,167 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsnwlink.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/coalesce.h"
+#include "../../src/common.h"
+#include "../../src/ethernet.h"
+#include "../../src/interface.h"
+#include "../../src/ipxwrapper.h"
+#include "bench.h"
+
+/* Need to implement the parts of ipxwrapper.dll used by coalesce.c. Packets
+ * are "sent" by a r_sendto() which does nothing and time is simulated, so
+ * each send appears to come the configured interval after the last.
+*/
+
+main_config_t main_config;
+enum main_config_encap_type ipx_encap_type;
+
+addr32_t dosbox_local_netnum;
+addr48_t dosbox_local_nodenum;
+
+SOCKET private_socket = INVALID_SOCKET;
+
+struct FuncStats ipxwrapper_fstats[] = {
+	#define FPROF_DECL(func) { #func },
+	#include "../../src/ipxwrapper_prof_defs.h"
+	#undef FPROF_DECL
+};
+
+const unsigned int ipxwrapper_fstats_size = sizeof(ipxwrapper_fstats) / sizeof(*ipxwrapper_fstats);
+
+uint64_t send_packets_udp, send_bytes_udp;
+unsigned int coalesce_max_delay;
+uint64_t coalesce_table_hits, coalesce_table_misses, coalesce_table_evictions;
+
+static uint64_t now = 0;
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	/* Discard the messages about starting and stopping coalescing. */
+}
+
+uint64_t get_uticks(void)
+{
+	return now;
+}
+
+int WSAAPI r_sendto(SOCKET s, const char *buf, int len, int flags, const struct sockaddr *to, int tolen)
+{
+	return len;
+}
+
+bool router_timer_schedule(ipx_timer *timer, uint64_t deadline)
+{
+	return true;
+}
+
+void router_timer_cancel(ipx_timer *timer)
+{
+}
+
+struct coalesce_ctx
+{
+	/* Simulated time between each send. */
+	uint64_t interval;
+	
+	/* Number of destinations sent to in turn. */
+	unsigned int n_dests;
+};
+
+static void bench_send(void *ctx, uint64_t n_ops)
+{
+	struct coalesce_ctx *cc = ctx;
+	
+	/* Size of an IPX header and a typical small game packet. */
+	unsigned char packet[sizeof(novell_ipx_packet) + 64];
+	memset(packet, 0, sizeof(packet));
+	
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	
+	addr.sin_family = AF_INET;
+	addr.sin_port   = htons(213);
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		unsigned int dest = i % cc->n_dests;
+		
+		addr.sin_addr.s_addr = htonl(0x0A000000 + dest);
+		
+		now += cc->interval;
+		
+		BENCH_KEEP(coalesce_send(packet, sizeof(packet),
+			1, (0x020000000000ULL + dest), htons(4444),
+			(struct sockaddr*)(&addr), sizeof(addr)));
+	}
+}
+
+static void run_case(const char *name, enum main_config_encap_type encap_type, bool enabled, uint64_t interval, unsigned int n_dests)
+{
+	struct coalesce_ctx cc = {
+		.interval = interval,
+		.n_dests  = n_dests,
+	};
+	
+	ipx_encap_type = encap_type;
+	
+	main_config.udp_coalesce    = enabled;
+	main_config.dosbox_coalesce = enabled;
+	main_config.coalesce_table_size = 64;
+	
+	coalesce_init();
+	bench_run(name, &bench_send, &cc);
+	coalesce_cleanup();
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	
+	dosbox_local_netnum  = 0;
+	dosbox_local_nodenum = 0x020000000099ULL;
+	
+	/* Coalescing turned off, the cost of deciding not to. */
+	run_case("coalesce_send/disabled", ENCAP_TYPE_IPXWRAPPER, false, 10, 1);
+	
+	/* One packet every 50ms, too slow to start coalescing. */
+	run_case("coalesce_send/idle", ENCAP_TYPE_DOSBOX, true, 50000, 1);
+	
+	/* One packet every 10µs to a single destination, packets are
+	 * coalesced into one flush for every dozen or so sent.
+	*/
+	run_case("coalesce_send/spam", ENCAP_TYPE_DOSBOX, true, 10, 1);
+	
+	/* Sending fast enough to coalesce to a peer which never says it
+	 * supports coalesced packets, so every packet goes out alone.
+	*/
+	run_case("coalesce_send/spam-unsupported", ENCAP_TYPE_IPXWRAPPER, true, 10, 1);
+	
+	/* Spamming as many destinations as the table holds, and then many
+	 * more than it holds so they keep evicting each other.
+	*/
+	run_case("coalesce_send/spam-64-dests",   ENCAP_TYPE_DOSBOX, true, 10, 64);
+	run_case("coalesce_send/spam-1024-dests", ENCAP_TYPE_DOSBOX, true, 10, 1024);
+	
+	return 0;
+}
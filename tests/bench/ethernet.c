@@ -0,0 +1,130 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/addr.h"
+#include "../../src/ethernet.h"
+#include "bench.h"
+
+struct frame_type
+{
+	const char *name;
+	
+	size_t (*size)(size_t);
+	void (*pack)(void*, uint8_t, addr32_t, addr48_t, uint16_t, addr32_t, addr48_t, uint16_t, const void*, size_t);
+	bool (*unpack)(const novell_ipx_packet**, size_t*, const void*, size_t);
+};
+
+static const struct frame_type FRAME_TYPES[] = {
+	{ "ethII",  &ethII_frame_size,  &ethII_frame_pack,  &ethII_frame_unpack  },
+	{ "novell", &novell_frame_size, &novell_frame_pack, &novell_frame_unpack },
+	{ "llc",    &llc_frame_size,    &llc_frame_pack,    &llc_frame_unpack    },
+};
+
+static const size_t PAYLOAD_SIZES[] = { 64, 1024 };
+
+struct frame_ctx
+{
+	const struct frame_type *type;
+	
+	size_t payload_len;
+	unsigned char payload[1500];
+	
+	size_t frame_len;
+	unsigned char frame[1500];
+};
+
+static void bench_pack(void *ctx, uint64_t n_ops)
+{
+	struct frame_ctx *fc = ctx;
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		fc->type->pack(fc->frame, 0,
+			1, 0x020000000001ULL, htons(4444),
+			2, 0x020000000002ULL, htons(5555),
+			fc->payload, fc->payload_len);
+		
+		BENCH_KEEP(fc->frame);
+	}
+}
+
+static void bench_unpack(void *ctx, uint64_t n_ops)
+{
+	struct frame_ctx *fc = ctx;
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		const novell_ipx_packet *packet;
+		size_t packet_len;
+		
+		BENCH_KEEP(fc->type->unpack(&packet, &packet_len, fc->frame, fc->frame_len));
+		BENCH_KEEP(packet);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	
+	static struct frame_ctx fc;
+	
+	for(unsigned int i = 0; i < (sizeof(FRAME_TYPES) / sizeof(*FRAME_TYPES)); ++i)
+	{
+		for(unsigned int j = 0; j < (sizeof(PAYLOAD_SIZES) / sizeof(*PAYLOAD_SIZES)); ++j)
+		{
+			fc.type        = &(FRAME_TYPES[i]);
+			fc.payload_len = PAYLOAD_SIZES[j];
+			fc.frame_len   = fc.type->size(fc.payload_len);
+			
+			memset(fc.payload, 0xAA, fc.payload_len);
+			
+			if(fc.frame_len == 0 || fc.frame_len > sizeof(fc.frame))
+			{
+				fprintf(stderr, "%s frame with %u byte payload doesn't fit\n", fc.type->name, (unsigned)(fc.payload_len));
+				return 1;
+			}
+			
+			char name[64];
+			
+			snprintf(name, sizeof(name), "%s_frame_pack/%u", fc.type->name, (unsigned)(fc.payload_len));
+			bench_run(name, &bench_pack, &fc);
+			
+			/* Make sure we unpack a valid frame, even if the pack
+			 * case was skipped.
+			*/
+			bench_pack(&fc, 1);
+			
+			const novell_ipx_packet *packet;
+			size_t packet_len;
+			
+			if(!fc.type->unpack(&packet, &packet_len, fc.frame, fc.frame_len))
+			{
+				fprintf(stderr, "%s_frame_unpack() rejected a frame from %s_frame_pack()\n", fc.type->name, fc.type->name);
+				return 1;
+			}
+			
+			snprintf(name, sizeof(name), "%s_frame_unpack/%u", fc.type->name, (unsigned)(fc.payload_len));
+			bench_run(name, &bench_unpack, &fc);
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,78 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../../src/common.h"
+#include "bench.h"
+
+/* Need to implement log_printf() for common.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+struct ratelimit_ctx
+{
+	ratelimit data;
+	DWORD now;
+	
+	unsigned int add_count;
+	unsigned int max_counts_per_second;
+};
+
+/* Each call is made a millisecond after the last, so the window moves along
+ * every 100 calls.
+*/
+static void bench_get_delay(void *ctx, uint64_t n_ops)
+{
+	struct ratelimit_ctx *rc = ctx;
+	
+	for(uint64_t i = 0; i < n_ops; ++i)
+	{
+		BENCH_KEEP(ratelimit_get_delay(&(rc->data), rc->add_count, rc->max_counts_per_second, rc->now++));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	
+	struct ratelimit_ctx rc;
+	
+	memset(&rc, 0, sizeof(rc));
+	rc.add_count = 1;
+	rc.max_counts_per_second = 1000000;
+	
+	bench_run("ratelimit_get_delay/under", &bench_get_delay, &rc);
+	
+	memset(&rc, 0, sizeof(rc));
+	rc.add_count = 100;
+	rc.max_counts_per_second = 1000;
+	
+	bench_run("ratelimit_get_delay/over", &bench_get_delay, &rc);
+	
+	return 0;
+}
@@ -0,0 +1,224 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/capture.h"
+#include "../src/common.h"
+#include "../src/ethernet.h"
+#include "tap/basic.h"
+
+#define CAPTURE_PATH "capture-test.pcapng"
+
+/* Need to implement log_printf() for capture.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+static uint32_t get32(const unsigned char *buf)
+{
+	uint32_t value;
+	memcpy(&value, buf, sizeof(value));
+	return value;
+}
+
+static uint16_t get16(const unsigned char *buf)
+{
+	uint16_t value;
+	memcpy(&value, buf, sizeof(value));
+	return value;
+}
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+	FILE *fh = fopen(path, "rb");
+	if(fh == NULL)
+	{
+		sysbail("fopen");
+	}
+	
+	static unsigned char buf[65536];
+	*size = fread(buf, 1, sizeof(buf), fh);
+	
+	fclose(fh);
+	
+	return buf;
+}
+
+/* Returns the value of the given option in a block, or NULL. */
+static const unsigned char *find_option(const unsigned char *opts, const unsigned char *end, uint16_t code, uint16_t *length)
+{
+	while((opts + 4) <= end)
+	{
+		uint16_t opt_code = get16(opts);
+		uint16_t opt_len  = get16(opts + 2);
+		
+		if(opt_code == 0)
+		{
+			break;
+		}
+		
+		if(opt_code == code)
+		{
+			*length = opt_len;
+			return opts + 4;
+		}
+		
+		opts += 4 + ((opt_len + 3) & ~3);
+	}
+	
+	return NULL;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	addr32_t net_a = addr32_in((unsigned char[]){ 0x00, 0x00, 0x00, 0x01 });
+	addr48_t node_a = addr48_in((unsigned char[]){ 0x01, 0x22, 0x33, 0x44, 0x55, 0x66 });
+	
+	addr32_t net_b = addr32_in((unsigned char[]){ 0x00, 0x00, 0x00, 0x02 });
+	addr48_t node_b = addr48_in((unsigned char[]){ 0x02, 0x22, 0x33, 0x44, 0x55, 0x66 });
+	
+	/* Nothing is captured, or crashes, before capture_init(). */
+	capture_packet(CAPTURE_OUTBOUND, 4, net_a, node_a, htons(1234), net_b, node_b, htons(5678), "x", 1);
+	
+	ok(capture_init(CAPTURE_PATH), "capture_init() succeeds");
+	
+	capture_packet(CAPTURE_OUTBOUND, 4, net_a, node_a, htons(1234), net_b, node_b, htons(5678), "hello", 5);
+	capture_packet(CAPTURE_INBOUND, 5, net_b, node_b, htons(5678), net_a, node_a, htons(1234), "world!!!", 8);
+	capture_packet(CAPTURE_INBOUND, 0, net_b, node_b, htons(5678), net_a, node_a, htons(1234), NULL, 0);
+	
+	capture_cleanup();
+	
+	/* Packets captured after capture_cleanup() are ignored. */
+	capture_packet(CAPTURE_OUTBOUND, 4, net_a, node_a, htons(1234), net_b, node_b, htons(5678), "x", 1);
+	
+	size_t size;
+	const unsigned char *buf = read_file(CAPTURE_PATH, &size);
+	const unsigned char *end = buf + size;
+	
+	/* Section Header Block */
+	
+	ok(size >= 28, "Capture file contains a section header block");
+	is_hex(0x0A0D0D0A, get32(buf),      "Section header block has the correct type");
+	is_hex(0x1A2B3C4D, get32(buf + 8),  "Section header block has the byte-order magic");
+	is_int(1,          get16(buf + 12), "Section header block has major version 1");
+	is_int(0,          get16(buf + 14), "Section header block has minor version 0");
+	
+	uint32_t shb_len = get32(buf + 4);
+	ok((shb_len % 4) == 0 && shb_len <= size && get32(buf + shb_len - 4) == shb_len,
+		"Section header block length is consistent");
+	
+	buf += shb_len;
+	
+	/* Interface Description Block */
+	
+	ok((buf + 20) <= end, "Capture file contains an interface description block");
+	is_hex(1, get32(buf),     "Interface description block has the correct type");
+	is_int(1, get16(buf + 8), "Interface description block has the Ethernet link type");
+	
+	uint32_t idb_len = get32(buf + 4);
+	ok((buf + idb_len) <= end && get32(buf + idb_len - 4) == idb_len,
+		"Interface description block length is consistent");
+	
+	uint16_t tsresol_len = 0;
+	const unsigned char *tsresol = find_option(buf + 16, buf + idb_len - 4, 9, &tsresol_len);
+	ok(tsresol != NULL && tsresol_len == 1 && *tsresol == 6, "Interface timestamps are in microseconds");
+	
+	buf += idb_len;
+	
+	/* Enhanced Packet Blocks */
+	
+	static const struct {
+		uint32_t direction;
+		uint8_t type;
+		const char *data;
+		size_t data_size;
+	} expect[] = {
+		{ CAPTURE_OUTBOUND, 4, "hello",    5 },
+		{ CAPTURE_INBOUND,  5, "world!!!", 8 },
+		{ CAPTURE_INBOUND,  0, "",         0 },
+	};
+	
+	uint64_t last_timestamp = 0;
+	
+	for(int i = 0; i < 3; ++i)
+	{
+		if((buf + 28) > end)
+		{
+			ok(false, "Packet %d is in the capture", i);
+			continue;
+		}
+		
+		uint32_t epb_len = get32(buf + 4);
+		
+		is_hex(6, get32(buf), "Packet %d is in an enhanced packet block", i);
+		ok((epb_len % 4) == 0 && (buf + epb_len) <= end && get32(buf + epb_len - 4) == epb_len,
+			"Packet %d block length is consistent", i);
+		
+		is_int(0, get32(buf + 8), "Packet %d is on interface 0", i);
+		
+		uint64_t timestamp = ((uint64_t)(get32(buf + 12)) << 32) | get32(buf + 16);
+		ok(timestamp >= last_timestamp && timestamp > 1000000000ULL * 1000000ULL,
+			"Packet %d has a plausible timestamp", i);
+		last_timestamp = timestamp;
+		
+		uint32_t caplen = get32(buf + 20);
+		is_int(ethII_frame_size(expect[i].data_size), caplen, "Packet %d has the correct captured length", i);
+		is_int(caplen, get32(buf + 24), "Packet %d has the correct original length", i);
+		
+		const novell_ipx_packet *ipx;
+		size_t ipx_len;
+		
+		bool unpacked = ethII_frame_unpack(&ipx, &ipx_len, buf + 28, caplen);
+		ok(unpacked, "Packet %d contains an Ethernet II IPX frame", i);
+		
+		if(unpacked)
+		{
+			is_int(expect[i].type, ipx->type, "Packet %d has the correct packet type", i);
+			ok(ipx_len == sizeof(novell_ipx_packet) + expect[i].data_size
+				&& memcmp(ipx->data, expect[i].data, expect[i].data_size) == 0,
+				"Packet %d has the correct payload", i);
+		}
+		
+		uint16_t flags_len = 0;
+		const unsigned char *flags = find_option(buf + 28 + ((caplen + 3) & ~3), buf + epb_len - 4, 2, &flags_len);
+		ok(flags != NULL && flags_len == 4 && (get32(flags) & 3) == expect[i].direction,
+			"Packet %d has the correct direction flag", i);
+		
+		buf += epb_len;
+	}
+	
+	ok(buf == end, "No other packets were captured");
+	
+	remove(CAPTURE_PATH);
+	
+	return 0;
+}
@@ -0,0 +1,119 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsipx.h>
+
+#include "tap/basic.h"
+#include "../tools/tools.h"
+
+/* Checks that a socket put into non-blocking mode by WSAEventSelect() fails
+ * with WSAEWOULDBLOCK rather than blocking when its send queue is full. Must
+ * be run with a low rate_limit_packets so the sends are paced.
+ *
+ * WSAEventSelect() isn't exported by wsock32.dll, so it is called through
+ * ipxwrapper.dll in the same way as dpwsockx.dll does.
+*/
+
+#define N_SENDS 256
+
+typedef int (WSAAPI *WSAEventSelect_t)(SOCKET, WSAEVENT, long);
+
+static char buf[128];
+
+static DWORD WINAPI watchdog_main(LPVOID lpParameter)
+{
+	Sleep(10000);
+	bail("sendto() blocked on a socket in non-blocking mode");
+	
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <netnum> <nodenum>\n", argv[0]);
+		return 1;
+	}
+	
+	plan_lazy();
+	
+	struct sockaddr_ipx addr1 = read_sockaddr(argv[1], argv[2], "1234");
+	struct sockaddr_ipx addr2 = read_sockaddr(argv[1], argv[2], "1235");
+	
+	WSADATA data;
+	WSAStartup(MAKEWORD(1, 1), &data);
+	
+	HMODULE ipxwrapper = GetModuleHandle("ipxwrapper.dll");
+	assert(ipxwrapper != NULL);
+	
+	WSAEventSelect_t ipx_WSAEventSelect = (WSAEventSelect_t)(GetProcAddress(ipxwrapper, "WSAEventSelect"));
+	
+	if(!ok(ipx_WSAEventSelect != NULL, "ipxwrapper.dll exports WSAEventSelect()"))
+	{
+		return 1;
+	}
+	
+	int sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(sock != SOCKET_ERROR);
+	
+	assert(bind(sock, (struct sockaddr*)(&addr1), sizeof(addr1)) == 0);
+	
+	WSAEVENT event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	assert(event != NULL);
+	
+	is_int(0, ipx_WSAEventSelect(sock, event, FD_READ), "WSAEventSelect() succeeds");
+	
+	HANDLE watchdog = CreateThread(NULL, 0, &watchdog_main, NULL, 0, NULL);
+	assert(watchdog != NULL);
+	
+	int n_sent = 0, n_wouldblock = 0, n_failed = 0;
+	
+	for(int i = 0; i < N_SENDS; ++i)
+	{
+		if(sendto(sock, buf, sizeof(buf), 0, (struct sockaddr*)(&addr2), sizeof(addr2)) == sizeof(buf))
+		{
+			++n_sent;
+		}
+		else if(WSAGetLastError() == WSAEWOULDBLOCK)
+		{
+			++n_wouldblock;
+		}
+		else{
+			++n_failed;
+		}
+	}
+	
+	ok(n_sent > 0, "sendto() queues packets while there is space");
+	ok(n_wouldblock > 0, "sendto() fails with WSAEWOULDBLOCK once the send queue is full");
+	is_int(0, n_failed, "sendto() doesn't fail with any other error");
+	
+	TerminateThread(watchdog, 0);
+	CloseHandle(watchdog);
+	
+	closesocket(sock);
+	CloseHandle(event);
+	
+	WSACleanup();
+	
+	return 0;
+}
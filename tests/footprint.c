@@ -0,0 +1,151 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsipx.h>
+#include <psapi.h>
+
+#include "tap/basic.h"
+#include "../tools/tools.h"
+
+#define N_SOCKETS 500
+#define FIRST_SOCKET 0x4000
+
+#define PACKET_SIZE 40
+
+/* Each socket used to cost over 256KiB of receive queue whether it was bound
+ * or not, these are very generous to allow for whatever Winsock allocates.
+*/
+#define MAX_BYTES_PER_SOCKET 16384
+#define MAX_BYTES_PER_PACKET 2048
+
+static char buf[4096];
+
+static SIZE_T private_bytes(void)
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+	pmc.cb = sizeof(pmc);
+	
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+	{
+		sysbail("GetProcessMemoryInfo");
+	}
+	
+	return pmc.PagefileUsage;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <netnum> <nodenum>\n", argv[0]);
+		return 1;
+	}
+	
+	plan_lazy();
+	
+	WSADATA data;
+	WSAStartup(MAKEWORD(1, 1), &data);
+	
+	struct sockaddr_ipx send_addr = read_sockaddr(argv[1], argv[2], "0");
+	
+	/* Create, bind and use a socket first so that anything allocated once
+	 * by Winsock or IPXWrapper isn't counted.
+	*/
+	
+	int send_sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(send_sock != SOCKET_ERROR);
+	
+	assert(bind(send_sock, (struct sockaddr*)(&send_addr), sizeof(send_addr)) == 0);
+	
+	int addrlen = sizeof(send_addr);
+	assert(getsockname(send_sock, (struct sockaddr*)(&send_addr), &addrlen) == 0);
+	
+	assert(sendto(send_sock, buf, PACKET_SIZE, 0, (struct sockaddr*)(&send_addr), sizeof(send_addr)) == PACKET_SIZE);
+	assert(recv(send_sock, buf, sizeof(buf), 0) == PACKET_SIZE);
+	
+	static int socks[N_SOCKETS];
+	static struct sockaddr_ipx addrs[N_SOCKETS];
+	
+	SIZE_T base_bytes = private_bytes();
+	
+	for(int i = 0; i < N_SOCKETS; ++i)
+	{
+		socks[i] = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+		assert(socks[i] != SOCKET_ERROR);
+	}
+	
+	SIZE_T open_bytes = private_bytes();
+	
+	diag("%d unbound sockets use %lu bytes", N_SOCKETS, (unsigned long)(open_bytes - base_bytes));
+	ok((open_bytes - base_bytes) < (N_SOCKETS * MAX_BYTES_PER_SOCKET), "Unbound sockets use little memory");
+	
+	for(int i = 0; i < N_SOCKETS; ++i)
+	{
+		addrs[i] = send_addr;
+		addrs[i].sa_socket = htons(FIRST_SOCKET + i);
+		
+		assert(bind(socks[i], (struct sockaddr*)(&addrs[i]), sizeof(addrs[i])) == 0);
+	}
+	
+	SIZE_T bound_bytes = private_bytes();
+	
+	diag("%d bound sockets use %lu bytes", N_SOCKETS, (unsigned long)(bound_bytes - base_bytes));
+	ok((bound_bytes - base_bytes) < (N_SOCKETS * MAX_BYTES_PER_SOCKET), "Bound sockets use little memory");
+	
+	/* Queue a small packet on every socket. */
+	
+	for(int i = 0; i < N_SOCKETS; ++i)
+	{
+		assert(sendto(send_sock, buf, PACKET_SIZE, 0, (struct sockaddr*)(&addrs[i]), sizeof(addrs[i])) == PACKET_SIZE);
+	}
+	
+	/* Just in case there's any async going on */
+	Sleep(100);
+	
+	SIZE_T queued_bytes = private_bytes();
+	
+	diag("%d queued packets use %ld bytes", N_SOCKETS, (long)(queued_bytes) - (long)(bound_bytes));
+	ok(queued_bytes < bound_bytes || (queued_bytes - bound_bytes) < (N_SOCKETS * MAX_BYTES_PER_PACKET), "Small queued packets use little memory");
+	
+	int n_received = 0;
+	
+	for(int i = 0; i < N_SOCKETS; ++i)
+	{
+		if(recv(socks[i], buf, sizeof(buf), 0) == PACKET_SIZE)
+		{
+			++n_received;
+		}
+	}
+	
+	is_int(N_SOCKETS, n_received, "Every socket received its packet");
+	
+	for(int i = 0; i < N_SOCKETS; ++i)
+	{
+		closesocket(socks[i]);
+	}
+	
+	closesocket(send_sock);
+	
+	WSACleanup();
+	
+	return 0;
+}
@@ -0,0 +1,176 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "../src/common.h"
+#include "../src/funcprof.h"
+#include "tap/basic.h"
+
+#define N_THREADS 4
+#define N_ITERATIONS 100000
+
+/* Need to implement log_printf() for funcprof.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+static struct FuncStats fstats[] = {
+	{ "one" },
+	{ "two" },
+};
+
+static void record(struct FuncStats *fstats, uint64_t ticks)
+{
+	LARGE_INTEGER start, end;
+	
+	start.QuadPart = 1000;
+	end.QuadPart = start.QuadPart + ticks;
+	
+	fprof_record_timed(fstats, &start, &end);
+}
+
+static DWORD WINAPI record_main(LPVOID param)
+{
+	for(int i = 0; i < N_ITERATIONS; ++i)
+	{
+		record(&(fstats[1]), 10);
+	}
+	
+	return 0;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	fprof_init(fstats, 2);
+	
+	struct fprof_summary s;
+	
+	{
+		for(int i = 1; i <= 1000; ++i)
+		{
+			record(&(fstats[0]), i);
+		}
+		
+		fprof_take(&(fstats[0]), &s);
+		
+		is_int(1000,   s.n_calls,    "fprof_take() returns the number of calls");
+		is_int(500500, s.total_time, "fprof_take() returns the total time");
+		is_int(1000,   s.max_time,   "fprof_take() returns the maximum time");
+		
+		ok(s.p50  >= 500 && s.p50  <= 625,  "fprof_take() returns the 50th percentile (got %u)",   (unsigned)(s.p50));
+		ok(s.p90  >= 900 && s.p90  <= 1000, "fprof_take() returns the 90th percentile (got %u)",   (unsigned)(s.p90));
+		ok(s.p99  >= 990 && s.p99  <= 1000, "fprof_take() returns the 99th percentile (got %u)",   (unsigned)(s.p99));
+		ok(s.p999 >= 999 && s.p999 <= 1000, "fprof_take() returns the 99.9th percentile (got %u)", (unsigned)(s.p999));
+		
+		fprof_take(&(fstats[0]), &s);
+		
+		is_int(0, s.n_calls,    "fprof_take() only counts calls since the last fprof_take()");
+		is_int(0, s.total_time, "fprof_take() only counts time since the last fprof_take()");
+		is_int(0, s.max_time,   "fprof_take() only returns the maximum time since the last fprof_take()");
+		is_int(0, s.p50,        "fprof_take() only counts durations since the last fprof_take()");
+		
+		struct fprof_shard totals;
+		fprof_read(&(fstats[0]), &totals);
+		
+		is_int(1000,   totals.n_calls,    "fprof_read() returns the number of calls ever made");
+		is_int(500500, totals.total_time, "fprof_read() returns the total time ever recorded");
+		is_int(1000,   totals.max_time,   "fprof_read() returns the maximum time ever recorded");
+		
+		fprof_summarise(&totals, NULL, &s);
+		
+		is_int(1000, s.n_calls,  "fprof_summarise() summarises every call without a baseline");
+		is_int(1000, s.max_time, "fprof_summarise() returns the maximum time without a baseline");
+		ok(s.p50 >= 500 && s.p50 <= 625, "fprof_summarise() returns the 50th percentile without a baseline (got %u)", (unsigned)(s.p50));
+	}
+	
+	{
+		for(int i = 0; i < 100; ++i)
+		{
+			record(&(fstats[0]), 3);
+		}
+		
+		fprof_take(&(fstats[0]), &s);
+		
+		ok(s.p50 == 3 && s.p999 == 3, "Short durations are recorded exactly");
+		is_int(3, s.max_time, "fprof_take() returns the maximum time since the last fprof_take()");
+	}
+	
+	{
+		uint64_t long_time = (uint64_t)(1) << 40;
+		record(&(fstats[0]), long_time);
+		
+		fprof_take(&(fstats[0]), &s);
+		
+		ok(s.max_time == long_time && s.p50 == long_time, "Durations beyond the last bucket are recorded");
+	}
+	
+	{
+		fprof_record_untimed(&(fstats[0]));
+		fprof_record_untimed(&(fstats[0]));
+		
+		fprof_take(&(fstats[0]), &s);
+		
+		is_int(2, s.n_calls,    "fprof_record_untimed() counts calls");
+		is_int(0, s.total_time, "fprof_record_untimed() doesn't record a duration");
+		is_int(0, s.p50,        "fprof_record_untimed() doesn't record a duration");
+	}
+	
+	{
+		HANDLE threads[N_THREADS];
+		
+		for(int i = 0; i < N_THREADS; ++i)
+		{
+			if((threads[i] = CreateThread(NULL, 0, &record_main, NULL, 0, NULL)) == NULL)
+			{
+				sysbail("CreateThread");
+			}
+		}
+		
+		WaitForMultipleObjects(N_THREADS, threads, TRUE, INFINITE);
+		
+		for(int i = 0; i < N_THREADS; ++i)
+		{
+			CloseHandle(threads[i]);
+		}
+		
+		fprof_take(&(fstats[1]), &s);
+		
+		is_int((N_THREADS * N_ITERATIONS),      s.n_calls,    "Calls from multiple threads are all counted");
+		is_int((N_THREADS * N_ITERATIONS * 10), s.total_time, "Time from multiple threads is all counted");
+		is_int(10,                              s.max_time,   "Maximum time from multiple threads is correct");
+		
+		fprof_take(&(fstats[0]), &s);
+		
+		is_int(0, s.n_calls, "Calls are recorded against the correct function");
+	}
+	
+	fprof_cleanup(fstats, 2);
+	
+	return 0;
+}
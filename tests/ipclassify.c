@@ -0,0 +1,318 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utlist.h>
+
+#include "../src/common.h"
+#include "../src/interface.h"
+#include "../src/ipclassify.h"
+#include "tap/basic.h"
+
+/* Need to implement log_printf() for ipclassify.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+static ipx_interface_t *add_iface(ipx_interface_t **list, addr32_t net, addr48_t node)
+{
+	ipx_interface_t *iface = calloc(1, sizeof(ipx_interface_t));
+	if(iface == NULL)
+	{
+		sysbail("calloc");
+	}
+	
+	iface->ipx_net  = net;
+	iface->ipx_node = node;
+	
+	DL_APPEND(*list, iface);
+	
+	return iface;
+}
+
+static void add_ip(ipx_interface_t *iface, const char *ipaddr, const char *netmask)
+{
+	ipx_interface_ip_t *ip = calloc(1, sizeof(ipx_interface_ip_t));
+	if(ip == NULL)
+	{
+		sysbail("calloc");
+	}
+	
+	ip->ipaddr  = inet_addr(ipaddr);
+	ip->netmask = inet_addr(netmask);
+	ip->bcast   = ip->ipaddr | ~(ip->netmask);
+	
+	DL_APPEND(iface->ipaddr, ip);
+}
+
+static void free_ifaces(ipx_interface_t **list)
+{
+	ipx_interface_t *iface, *iface_tmp;
+	DL_FOREACH_SAFE(*list, iface, iface_tmp)
+	{
+		ipx_interface_ip_t *ip, *ip_tmp;
+		DL_FOREACH_SAFE(iface->ipaddr, ip, ip_tmp)
+		{
+			DL_DELETE(iface->ipaddr, ip);
+			free(ip);
+		}
+		
+		DL_DELETE(*list, iface);
+		free(iface);
+	}
+}
+
+/* Reference implementations, equivalent to walking the interface list like
+ * the code ipclassify replaces.
+*/
+
+static bool slow_is_local(const ipx_interface_t *list, uint32_t ipaddr)
+{
+	const ipx_interface_t *iface;
+	DL_FOREACH(list, iface)
+	{
+		const ipx_interface_ip_t *ip;
+		DL_FOREACH(iface->ipaddr, ip)
+		{
+			if(ip->ipaddr == ipaddr)
+			{
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+static uint64_t slow_subnet_ifaces(const ipx_interface_t *list, uint32_t ipaddr)
+{
+	uint64_t ifaces = 0;
+	int index = 0;
+	
+	const ipx_interface_t *iface;
+	DL_FOREACH(list, iface)
+	{
+		const ipx_interface_ip_t *ip;
+		DL_FOREACH(iface->ipaddr, ip)
+		{
+			if((ip->ipaddr & ip->netmask) == (ipaddr & ip->netmask))
+			{
+				ifaces |= ((uint64_t)(1) << index);
+			}
+		}
+		
+		++index;
+	}
+	
+	return ifaces;
+}
+
+#define BENCH_LOOKUPS 200000
+#define BENCH_RUNS    5
+
+/* Build a list of interfaces with n_addrs IP addresses between them and
+ * return the best average time (in nanoseconds) taken to classify a source
+ * address using either the classifier or the reference implementation.
+*/
+static double bench_classify(int n_addrs, bool use_classifier)
+{
+	ipx_interface_t *list = NULL;
+	ipx_interface_t *iface = NULL;
+	
+	for(int i = 0; i < n_addrs; ++i)
+	{
+		if((i % 32) == 0)
+		{
+			iface = add_iface(&list, i + 1, i + 1);
+		}
+		
+		char ipaddr[32];
+		snprintf(ipaddr, sizeof(ipaddr), "10.%d.%d.1", (i / 256), (i % 256));
+		
+		add_ip(iface, ipaddr, ((i % 2) ? "255.255.255.0" : "255.255.0.0"));
+	}
+	
+	ipclassify_t *classify = ipclassify_build(list);
+	if(classify == NULL)
+	{
+		bail("ipclassify_build() failed");
+	}
+	
+	/* Source address which is in the subnet of the last address added. */
+	uint32_t src = inet_addr("10.0.0.200");
+	if(n_addrs > 1)
+	{
+		char ipaddr[32];
+		snprintf(ipaddr, sizeof(ipaddr), "10.%d.%d.200", ((n_addrs - 1) / 256), ((n_addrs - 1) % 256));
+		src = inet_addr(ipaddr);
+	}
+	
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	
+	double best = -1.0;
+	
+	for(int run = 0; run < BENCH_RUNS; ++run)
+	{
+		volatile uint64_t result = 0;
+		
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter(&start);
+		
+		for(int i = 0; i < BENCH_LOOKUPS; ++i)
+		{
+			if(use_classifier)
+			{
+				result += ipclassify_is_local(classify, src);
+				result += ipclassify_subnet_ifaces(classify, src);
+			}
+			else{
+				result += slow_is_local(list, src);
+				result += slow_subnet_ifaces(list, src);
+			}
+		}
+		
+		QueryPerformanceCounter(&end);
+		
+		double ns = ((double)(end.QuadPart - start.QuadPart) * 1000000000.0) / (double)(freq.QuadPart) / BENCH_LOOKUPS;
+		if(best < 0.0 || ns < best)
+		{
+			best = ns;
+		}
+	}
+	
+	ipclassify_free(classify);
+	free_ifaces(&list);
+	
+	return best;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	{
+		ipx_interface_t *list = NULL;
+		
+		ipx_interface_t *a = add_iface(&list, 0x01, 0x0A);
+		add_ip(a, "192.168.1.10", "255.255.255.0");
+		add_ip(a, "10.0.0.10",    "255.0.0.0");
+		
+		ipx_interface_t *b = add_iface(&list, 0x02, 0x0B);
+		add_ip(b, "192.168.2.10", "255.255.255.0");
+		add_ip(b, "10.1.0.10",    "255.255.0.0");
+		
+		add_iface(&list, 0x03, 0x0C);
+		
+		ipclassify_t *classify = ipclassify_build(list);
+		ok(classify != NULL, "ipclassify_build() succeeds");
+		
+		if(classify == NULL)
+		{
+			bail("Cannot continue without classifier");
+		}
+		
+		ok( ipclassify_is_local(classify, inet_addr("192.168.1.10")), "ipclassify_is_local() matches local addresses");
+		ok( ipclassify_is_local(classify, inet_addr("10.1.0.10")),    "ipclassify_is_local() matches local addresses");
+		ok(!ipclassify_is_local(classify, inet_addr("192.168.1.11")), "ipclassify_is_local() doesn't match other addresses");
+		ok(!ipclassify_is_local(classify, inet_addr("127.0.0.1")),    "ipclassify_is_local() doesn't match other addresses");
+		
+		is_hex(0x1, ipclassify_subnet_ifaces(classify, inet_addr("192.168.1.99")), "ipclassify_subnet_ifaces() matches a single interface");
+		is_hex(0x2, ipclassify_subnet_ifaces(classify, inet_addr("192.168.2.99")), "ipclassify_subnet_ifaces() matches a single interface");
+		is_hex(0x1, ipclassify_subnet_ifaces(classify, inet_addr("10.2.0.1")),     "ipclassify_subnet_ifaces() matches a single interface");
+		is_hex(0x3, ipclassify_subnet_ifaces(classify, inet_addr("10.1.2.3")),     "ipclassify_subnet_ifaces() matches overlapping subnets on different interfaces");
+		is_hex(0x0, ipclassify_subnet_ifaces(classify, inet_addr("172.16.0.1")),   "ipclassify_subnet_ifaces() doesn't match other subnets");
+		
+		is_int(0,  ipclassify_iface_index(classify, 0x01, 0x0A), "ipclassify_iface_index() finds interfaces");
+		is_int(1,  ipclassify_iface_index(classify, 0x02, 0x0B), "ipclassify_iface_index() finds interfaces");
+		is_int(2,  ipclassify_iface_index(classify, 0x03, 0x0C), "ipclassify_iface_index() finds interfaces");
+		is_int(-1, ipclassify_iface_index(classify, 0x01, 0x0B), "ipclassify_iface_index() doesn't find other addresses");
+		
+		/* Compare against the reference implementation for a range of
+		 * addresses around the configured subnets.
+		*/
+		
+		bool all_ok = true;
+		
+		for(uint32_t i = 0; i < 0x20000; ++i)
+		{
+			uint32_t src = htonl((i & 1)
+				? (0x0A000000 | ((i >> 1) << 4))   /* 10.x.x.x */
+				: (0xC0A80000 | (i >> 1)));        /* 192.168.x.x */
+			
+			if(ipclassify_is_local(classify, src) != slow_is_local(list, src)
+				|| ipclassify_subnet_ifaces(classify, src) != slow_subnet_ifaces(list, src))
+			{
+				all_ok = false;
+				break;
+			}
+		}
+		
+		ok(all_ok, "Classifier agrees with interface list search");
+		
+		ipclassify_free(classify);
+		free_ifaces(&list);
+	}
+	
+	{
+		/* Too many interfaces to represent in a bitmask. */
+		
+		ipx_interface_t *list = NULL;
+		
+		for(int i = 0; i <= IPCLASSIFY_MAX_IFACES; ++i)
+		{
+			add_iface(&list, i + 1, i + 1);
+		}
+		
+		ok(ipclassify_build(list) == NULL, "ipclassify_build() returns NULL with too many interfaces");
+		
+		free_ifaces(&list);
+	}
+	
+	{
+		/* Per-packet classification cost with increasing numbers of
+		 * configured addresses.
+		*/
+		
+		double base = bench_classify(1, true);
+		
+		for(int n_addrs = 1; n_addrs <= 256; n_addrs *= 16)
+		{
+			double fast = bench_classify(n_addrs, true);
+			double slow = bench_classify(n_addrs, false);
+			
+			diag("%3d addresses: %.1f ns per packet (interface list search: %.1f ns)", n_addrs, fast, slow);
+			
+			/* Very generous to avoid spurious failures on a busy
+			 * test machine.
+			*/
+			ok(fast < (base * 4.0) + 50.0, "Classification cost with %d addresses is close to cost with 1 address", n_addrs);
+		}
+	}
+	
+	return 0;
+}
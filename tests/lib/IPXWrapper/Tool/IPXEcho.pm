@@ -0,0 +1,100 @@
+# IPXWrapper test suite
+# Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2 as published by
+# the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, write to the Free Software Foundation, Inc., 51
+# Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+use strict;
+use warnings;
+
+package IPXWrapper::Tool::IPXEcho;
+
+use IPC::Open3;
+use POSIX qw(:signal_h);
+use Test::Spec;
+
+sub new
+{
+	my ($class, $host_ip, @exe_args) = @_;
+	
+	my @command = ("ssh", $host_ip, "Z:\\tools\\ipx-echo.exe", @exe_args);
+	note(join(" ", @command));
+	
+	# No need for error checking here - open3 throws on failure.
+	my $pid = open3(my $in, my $out, undef, @command);
+	
+	my $self = bless({
+		pid => $pid,
+		in  => $in,
+	}, $class);
+	
+	my $output = "";
+	
+	while(defined(my $line = <$out>))
+	{
+		$output .= $line;
+		
+		$line =~ s/[\r\n]//g;
+		
+		if($line =~ m{^Bound to local address: (.+)/(.+)/(.+)$})
+		{
+			$self->{net}  = $1;
+			$self->{node} = $2;
+			$self->{sock} = $3;
+		}
+		elsif($line eq "Ready" && defined($self->{net}))
+		{
+			return $self;
+		}
+	}
+	
+	die("Didn't get expected output from ipx-echo.exe:\n$output");
+}
+
+sub net
+{
+	my ($self) = @_;
+	return $self->{net};
+}
+
+sub node
+{
+	my ($self) = @_;
+	return $self->{node};
+}
+
+sub socket
+{
+	my ($self) = @_;
+	return $self->{sock};
+}
+
+sub DESTROY
+{
+	my ($self) = @_;
+	
+	# ipx-echo.exe will exit once we close its stdin
+	delete $self->{in};
+	
+	local $SIG{ALRM} = sub
+	{
+		warn "Killing hung ipx-echo.exe process";
+		kill(SIGKILL, $self->{pid});
+	};
+	
+	alarm(5);
+	waitpid($self->{pid}, 0);
+	alarm(0);
+}
+
+1;
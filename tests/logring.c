@@ -0,0 +1,235 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include "../src/logring.h"
+#include "tap/basic.h"
+
+#define N_THREADS 4
+#define N_ITERATIONS 100000
+
+static log_ring *ring;
+
+/* Each producer thread logs N_ITERATIONS records, with its index in thread_id
+ * and a sequence number in timestamp.
+*/
+static DWORD WINAPI producer_main(LPVOID param)
+{
+	DWORD index = (DWORD)(UINT_PTR)(param);
+	
+	for(int i = 0; i < N_ITERATIONS; ++i)
+	{
+		log_record *record;
+		while((record = log_ring_claim(ring)) == NULL)
+		{
+			SwitchToThread();
+		}
+		
+		record->timestamp = i;
+		record->thread_id = index;
+		snprintf(record->msg, LOG_RECORD_MAX, "%u %d", (unsigned)(index), i);
+		
+		log_ring_commit(ring, record);
+	}
+	
+	return 0;
+}
+
+static void fill_record(log_record *record, int seq)
+{
+	record->timestamp = seq;
+	record->thread_id = 0;
+	snprintf(record->msg, LOG_RECORD_MAX, "message %d", seq);
+}
+
+static bool take_record(int seq)
+{
+	log_record *record = log_ring_peek(ring);
+	
+	if(record == NULL)
+	{
+		diag("log_ring_peek() returned NULL");
+		return false;
+	}
+	
+	char expect[32];
+	snprintf(expect, sizeof(expect), "message %d", seq);
+	
+	bool ok = record->timestamp == (uint64_t)(seq) && strcmp(record->msg, expect) == 0;
+	
+	if(!ok)
+	{
+		diag("Expected \"%s\", got \"%s\"", expect, record->msg);
+	}
+	
+	log_ring_release(ring);
+	
+	return ok;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	{
+		ring = log_ring_create(100);
+		
+		is_int(128, ring->size, "log_ring_create() rounds the size up to a power of two");
+		ok(log_ring_peek(ring) == NULL, "log_ring_peek() returns NULL when the ring is empty");
+		
+		bool all_ok = true;
+		for(int i = 0; i < 128; ++i)
+		{
+			log_record *record = log_ring_claim(ring);
+			
+			if(record != NULL)
+			{
+				fill_record(record, i);
+				log_ring_commit(ring, record);
+			}
+			else{
+				all_ok = false;
+			}
+		}
+		
+		ok(all_ok, "log_ring_claim() returns a record until the ring is full");
+		ok(log_ring_claim(ring) == NULL, "log_ring_claim() returns NULL when the ring is full");
+		
+		ok(take_record(0), "log_ring_peek() returns the oldest record");
+		
+		log_record *record = log_ring_claim(ring);
+		ok(record != NULL, "log_ring_claim() returns a record once one has been released");
+		
+		fill_record(record, 128);
+		log_ring_commit(ring, record);
+		
+		all_ok = true;
+		for(int i = 1; i <= 128; ++i)
+		{
+			all_ok = all_ok && take_record(i);
+		}
+		
+		ok(all_ok, "log_ring_peek() returns records in order");
+		ok(log_ring_peek(ring) == NULL, "log_ring_peek() returns NULL when the ring is empty");
+		
+		log_ring_destroy(ring);
+	}
+	
+	{
+		ring = log_ring_create(4);
+		
+		log_record *a = log_ring_claim(ring);
+		log_record *b = log_ring_claim(ring);
+		
+		fill_record(a, 0);
+		fill_record(b, 1);
+		
+		log_ring_commit(ring, b);
+		ok(log_ring_peek(ring) == NULL, "log_ring_peek() waits for older records to be committed");
+		
+		log_ring_commit(ring, a);
+		ok(take_record(0), "log_ring_peek() returns records in the order they were claimed");
+		ok(take_record(1), "log_ring_peek() returns records in the order they were claimed");
+		
+		/* Go around the ring a few times. */
+		
+		bool all_ok = true;
+		for(int i = 0; i < 20; ++i)
+		{
+			log_record *record = log_ring_claim(ring);
+			
+			if(record == NULL)
+			{
+				all_ok = false;
+				break;
+			}
+			
+			fill_record(record, i);
+			log_ring_commit(ring, record);
+			
+			all_ok = all_ok && take_record(i);
+		}
+		
+		ok(all_ok, "Records are returned correctly after the ring wraps around");
+		
+		log_ring_destroy(ring);
+	}
+	
+	{
+		ring = log_ring_create(64);
+		
+		HANDLE threads[N_THREADS];
+		
+		for(int i = 0; i < N_THREADS; ++i)
+		{
+			if((threads[i] = CreateThread(NULL, 0, &producer_main, (LPVOID)(UINT_PTR)(i), 0, NULL)) == NULL)
+			{
+				sysbail("CreateThread");
+			}
+		}
+		
+		/* Read everything back, each thread's records must appear in the
+		 * order that thread logged them.
+		*/
+		
+		int next_seq[N_THREADS] = { 0 };
+		int received = 0;
+		bool in_order = true;
+		
+		while(received < (N_THREADS * N_ITERATIONS))
+		{
+			log_record *record = log_ring_peek(ring);
+			
+			if(record == NULL)
+			{
+				SwitchToThread();
+				continue;
+			}
+			
+			char expect[32];
+			snprintf(expect, sizeof(expect), "%u %d", (unsigned)(record->thread_id), next_seq[record->thread_id]);
+			
+			if(record->timestamp != (uint64_t)(next_seq[record->thread_id]) || strcmp(record->msg, expect) != 0)
+			{
+				in_order = false;
+			}
+			
+			++(next_seq[record->thread_id]);
+			++received;
+			
+			log_ring_release(ring);
+		}
+		
+		WaitForMultipleObjects(N_THREADS, threads, TRUE, INFINITE);
+		
+		for(int i = 0; i < N_THREADS; ++i)
+		{
+			CloseHandle(threads[i]);
+		}
+		
+		ok(in_order, "Records from multiple threads are received intact and in order");
+		ok(log_ring_peek(ring) == NULL, "log_ring_peek() returns NULL when the ring is empty");
+		
+		log_ring_destroy(ring);
+	}
+	
+	return 0;
+}
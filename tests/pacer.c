@@ -0,0 +1,563 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <winsock2.h>
+#include <windows.h>
+#include <wsnwlink.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common.h"
+#include "../src/ipxwrapper.h"
+#include "../src/pacer.h"
+#include "tap/basic.h"
+
+/* Need to implement log_printf() and ipx_send_packet() for pacer.c, the
+ * sender thread is never started so packets are taken from the queues by
+ * calling pacer_next() directly.
+*/
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+DWORD ipx_send_packet(
+	uint8_t type,
+	addr32_t src_net,
+	addr48_t src_node,
+	uint16_t src_socket,
+	addr32_t dest_net,
+	addr48_t dest_node,
+	uint16_t dest_socket,
+	const void *data,
+	size_t data_size)
+{
+	return ERROR_SUCCESS;
+}
+
+#define BROADCAST addr48_in((unsigned char[]){0xFF,0xFF,0xFF,0xFF,0xFF,0xFF})
+
+static void init_pacer(
+	unsigned int total_packets, unsigned int total_bytes,
+	unsigned int socket_packets, unsigned int socket_bytes,
+	unsigned int dest_packets, unsigned int dest_bytes)
+{
+	pacer_config config = {
+		.total  = { total_packets, total_bytes },
+		.socket = { socket_packets, socket_bytes },
+		.dest   = { dest_packets, dest_bytes },
+	};
+	
+	pacer_init(&config, 0);
+}
+
+static enum pacer_result submit_prio_to(pacer_socket *ps, enum pacer_priority priority, uint16_t src_socket, addr48_t dest_node, int seq, size_t size, DWORD now)
+{
+	unsigned char data[1500];
+	memset(data, seq, sizeof(data));
+	
+	return pacer_submit(ps, priority, 0,
+		0x00000001, 0x000000000001, src_socket,
+		0x00000001, dest_node, 0x4000,
+		data, size, now);
+}
+
+static enum pacer_result submit_to(pacer_socket *ps, uint16_t src_socket, addr48_t dest_node, int seq, size_t size, DWORD now)
+{
+	return submit_prio_to(ps, PACER_PRIO_NORMAL, src_socket, dest_node, seq, size, now);
+}
+
+static enum pacer_result submit_prio(pacer_socket *ps, enum pacer_priority priority, uint16_t src_socket, int seq, size_t size, DWORD now)
+{
+	return submit_prio_to(ps, priority, src_socket, 0x000000000002, seq, size, now);
+}
+
+static enum pacer_result submit(pacer_socket *ps, uint16_t src_socket, int seq, size_t size, DWORD now)
+{
+	return submit_to(ps, src_socket, 0x000000000002, seq, size, now);
+}
+
+/* Check the next packet is the expected one and free it. */
+static bool next_is(DWORD now, uint16_t src_socket, int seq, size_t size)
+{
+	DWORD wait;
+	pacer_packet *packet = pacer_next(now, &wait);
+	
+	if(packet == NULL)
+	{
+		diag("pacer_next() returned NULL, wait = %u", (unsigned)(wait));
+		return false;
+	}
+	
+	bool ok = packet->src_socket == src_socket
+		&& packet->data_size == size
+		&& packet->data[0] == seq
+		&& packet->data[size - 1] == seq
+		&& wait == 0;
+	
+	if(!ok)
+	{
+		diag("pacer_next() returned socket %hu, seq %d, size %u",
+			packet->src_socket, (int)(packet->data[0]), (unsigned)(packet->data_size));
+	}
+	
+	free(packet);
+	
+	return ok;
+}
+
+static DWORD next_wait(DWORD now)
+{
+	DWORD wait;
+	pacer_packet *packet = pacer_next(now, &wait);
+	
+	if(packet != NULL)
+	{
+		free(packet);
+		return 0;
+	}
+	
+	return wait;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	{
+		token_bucket bucket;
+		token_bucket_init(&bucket, 10, 1000);
+		
+		bool all_ok = true;
+		for(int i = 0; i < 10; ++i)
+		{
+			all_ok = all_ok && token_bucket_take(&bucket, 1, 1000);
+		}
+		
+		ok(all_ok, "token_bucket_take() succeeds up to the rate limit");
+		ok(!token_bucket_take(&bucket, 1, 1000), "token_bucket_take() fails when the bucket is empty");
+		is_int(100, token_bucket_wait_time(&bucket, 1, 1000), "token_bucket_wait_time() returns time until the next token");
+		is_int(50, token_bucket_wait_time(&bucket, 1, 1050), "token_bucket_wait_time() counts partially refilled tokens");
+		ok(!token_bucket_take(&bucket, 1, 1050), "token_bucket_take() fails with a partial token");
+		ok(token_bucket_take(&bucket, 1, 1100), "token_bucket_take() succeeds once a token has been added");
+		is_int(300, token_bucket_wait_time(&bucket, 3, 1100), "token_bucket_wait_time() accounts for multiple tokens");
+		
+		ok(token_bucket_take(&bucket, 10, 5000), "Bucket refills after being idle");
+		ok(!token_bucket_take(&bucket, 1, 5000), "Bucket doesn't hold more than one second of tokens");
+	}
+	
+	{
+		token_bucket bucket;
+		token_bucket_init(&bucket, 10, 1000);
+		
+		ok(token_bucket_take(&bucket, 10, 1000), "token_bucket_take() succeeds");
+		ok(!token_bucket_take(&bucket, 1, 900), "Time going backwards doesn't add tokens");
+		ok(token_bucket_take(&bucket, 1, 1100), "token_bucket_take() succeeds once a token has been added");
+	}
+	
+	{
+		token_bucket bucket;
+		token_bucket_init(&bucket, 10, 0xFFFFFFC0);
+		
+		ok(token_bucket_take(&bucket, 10, 0xFFFFFFC0), "token_bucket_take() succeeds");
+		ok(token_bucket_take(&bucket, 1, 0x00000024), "Tokens are added when the clock wraps around");
+		ok(!token_bucket_take(&bucket, 1, 0x00000024), "Only the elapsed time is counted when the clock wraps around");
+	}
+	
+	{
+		token_bucket bucket;
+		token_bucket_init(&bucket, 1000, 0);
+		
+		ok(token_bucket_take(&bucket, 1500, 0), "token_bucket_take() allows more than the rate from a full bucket");
+		is_int(1000, token_bucket_wait_time(&bucket, 1500, 0), "token_bucket_wait_time() waits for a full bucket");
+		ok(!token_bucket_take(&bucket, 1500, 999), "token_bucket_take() waits for a full bucket");
+		ok(token_bucket_take(&bucket, 1500, 1000), "token_bucket_take() waits for a full bucket");
+	}
+	
+	{
+		token_bucket bucket;
+		token_bucket_init(&bucket, 0, 0);
+		
+		bool all_ok = true;
+		for(int i = 0; i < 10000; ++i)
+		{
+			all_ok = all_ok && token_bucket_take(&bucket, 1500, 0);
+		}
+		
+		ok(all_ok, "token_bucket_take() always succeeds without a limit");
+		is_int(0, token_bucket_wait_time(&bucket, 1500, 0), "token_bucket_wait_time() returns zero without a limit");
+	}
+	
+	{
+		init_pacer(0, 0, 0, 0, 0, 0);
+		
+		pacer_socket *ps = pacer_socket_create(0);
+		
+		bool all_ok = true;
+		for(int i = 0; i < 1000; ++i)
+		{
+			all_ok = all_ok && submit(ps, 1, i, 1500, 0) == PACER_SEND_NOW;
+		}
+		
+		ok(all_ok, "pacer_submit() always returns PACER_SEND_NOW without a limit");
+		is_int(INFINITE, next_wait(0), "pacer_next() returns nothing without a limit");
+		
+		pacer_socket_close(ps);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 5 packets per second, so a token every 200ms. */
+		init_pacer(5, 0, 0, 0, 0, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		
+		bool all_ok = true;
+		for(int i = 0; i < 5; ++i)
+		{
+			all_ok = all_ok && submit(a, 1, i, 100, 0) == PACER_SEND_NOW;
+		}
+		
+		ok(all_ok, "pacer_submit() returns PACER_SEND_NOW up to the rate limit");
+		
+		all_ok = true;
+		for(int i = 0; i < PACER_QUEUE_DEPTH; ++i)
+		{
+			all_ok = all_ok && submit(a, 1, i, 100, 0) == PACER_QUEUED;
+		}
+		
+		ok(all_ok, "pacer_submit() returns PACER_QUEUED over the rate limit");
+		is_int(PACER_FULL, submit(a, 1, 0, 100, 0), "pacer_submit() returns PACER_FULL when the queue is full");
+		is_int(PACER_QUEUED, submit(b, 2, 0, 200, 0), "Each socket has its own queue");
+		
+		is_int(200, next_wait(0), "pacer_next() returns time until the next token");
+		is_int(200, next_wait(0), "pacer_next() returns time until the next token");
+		is_int(50, next_wait(150), "pacer_next() returns time until the next token");
+		
+		ok(next_is(200, 1, 0, 100), "pacer_next() returns the first queued packet once a token is available");
+		is_int(200, next_wait(200), "pacer_next() doesn't exceed the rate limit");
+		
+		ok(next_is(400, 2, 0, 200), "pacer_next() services each queue in turn");
+		ok(next_is(600, 1, 1, 100), "pacer_next() returns packets from a queue in order");
+		
+		is_int(PACER_QUEUED, submit(a, 1, PACER_QUEUE_DEPTH, 100, 600), "pacer_submit() queues again once there is room");
+		is_int(PACER_QUEUED, submit(a, 1, PACER_QUEUE_DEPTH + 1, 100, 600), "pacer_submit() queues again once there is room");
+		is_int(PACER_FULL, submit(a, 1, 0, 100, 600), "pacer_submit() returns PACER_FULL when the queue is full");
+		
+		is_int(PACER_QUEUED, submit(b, 2, 1, 100, 5000), "pacer_submit() queues while other sockets have packets waiting");
+		
+		/* After a long pause the bucket holds a second of tokens again. */
+		
+		ok((next_is(5000, 1, 2, 100)
+			&& next_is(5000, 2, 1, 100)
+			&& next_is(5000, 1, 3, 100)
+			&& next_is(5000, 1, 4, 100)
+			&& next_is(5000, 1, 5, 100)), "pacer_next() sends a burst after being idle");
+		
+		is_int(200, next_wait(5000), "pacer_next() doesn't exceed the rate limit");
+		
+		/* Packets queued before the socket was closed are still sent. */
+		
+		pacer_socket_close(a);
+		
+		all_ok = true;
+		for(int i = 6; i < (PACER_QUEUE_DEPTH + 2); ++i)
+		{
+			all_ok = all_ok && next_is(5000 + ((i - 5) * 200), 1, i, 100);
+		}
+		
+		ok(all_ok, "pacer_next() sends packets from closed sockets");
+		is_int(INFINITE, next_wait(60000), "pacer_next() returns INFINITE when no packets are waiting");
+		
+		is_int(PACER_SEND_NOW, submit(b, 2, 0, 100, 60000), "pacer_submit() returns PACER_SEND_NOW once the queues are empty");
+		
+		pacer_socket_close(b);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 1000 bytes per second */
+		init_pacer(0, 1000, 0, 0, 0, 0);
+		
+		pacer_socket *ps = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit(ps, 1, 0, 600, 0), "pacer_submit() returns PACER_SEND_NOW up to the byte limit");
+		is_int(PACER_QUEUED, submit(ps, 1, 1, 600, 0), "pacer_submit() returns PACER_QUEUED over the byte limit");
+		is_int(PACER_QUEUED, submit(ps, 1, 2, 1500, 0), "pacer_submit() queues packets larger than the byte limit");
+		
+		is_int(200, next_wait(0), "pacer_next() returns time until enough bytes are available");
+		ok(next_is(200, 1, 1, 600), "pacer_next() returns the packet once enough bytes are available");
+		
+		is_int(1000, next_wait(200), "Packets larger than the byte limit wait for a full bucket");
+		ok(next_is(1200, 1, 2, 1500), "Packets larger than the byte limit are sent from a full bucket");
+		
+		/* Dropped by pacer_cleanup() */
+		is_int(PACER_QUEUED, submit(ps, 1, 3, 600, 1200), "pacer_submit() returns PACER_QUEUED over the byte limit");
+		
+		pacer_socket_close(ps);
+		pacer_cleanup();
+	}
+	
+	{
+		/* Broadcast and unicast packets share the total budget. */
+		init_pacer(5, 0, 0, 0, 0, 0);
+		
+		pacer_socket *ps = pacer_socket_create(0);
+		
+		bool all_ok = true;
+		for(int i = 0; i < 3; ++i)
+		{
+			all_ok = all_ok && submit(ps, 1, i, 100, 0) == PACER_SEND_NOW;
+		}
+		
+		for(int i = 0; i < 2; ++i)
+		{
+			all_ok = all_ok && submit_to(ps, 1, BROADCAST, i, 100, 0) == PACER_SEND_NOW;
+		}
+		
+		ok(all_ok, "pacer_submit() returns PACER_SEND_NOW up to the rate limit");
+		is_int(PACER_QUEUED, submit_to(ps, 1, BROADCAST, 2, 100, 0), "Broadcasts are counted against the total limit");
+		is_int(PACER_QUEUED, submit_to(ps, 1, BROADCAST, 3, 100, 0), "pacer_submit() returns PACER_QUEUED over the rate limit");
+		is_int(PACER_QUEUED, submit(ps, 1, 3, 100, 0), "Unicast packets are counted against the total limit");
+		
+		ok(next_is(200, 1, 2, 100), "pacer_next() sends queued broadcast packets");
+		ok(next_is(400, 1, 3, 100), "Queued unicast packets aren't held up behind queued broadcasts");
+		ok(next_is(600, 1, 3, 100), "pacer_next() sends queued broadcast packets");
+		is_int(INFINITE, next_wait(600), "pacer_next() returns INFINITE when no packets are waiting");
+		
+		pacer_socket_close(ps);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 2 packets per second from each socket. */
+		init_pacer(0, 0, 2, 0, 0, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit(a, 1, 0, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the socket limit");
+		is_int(PACER_SEND_NOW, submit(a, 1, 1, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the socket limit");
+		is_int(PACER_QUEUED, submit(a, 1, 2, 100, 0), "pacer_submit() returns PACER_QUEUED over the socket limit");
+		
+		is_int(PACER_SEND_NOW, submit(b, 2, 0, 100, 0), "Each socket has its own limit");
+		is_int(PACER_SEND_NOW, submit_to(a, 1, BROADCAST, 0, 100, 0), "Each socket has a separate broadcast limit");
+		
+		is_int(500, next_wait(0), "pacer_next() returns time until the socket's next token");
+		ok(next_is(500, 1, 2, 100), "pacer_next() sends the packet once the socket has a token");
+		
+		pacer_socket_close(a);
+		pacer_socket_close(b);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 1000 bytes per second from each socket. Queues waiting on
+		 * their own socket's budget are skipped over.
+		*/
+		init_pacer(0, 0, 0, 1000, 0, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit(a, 1, 0, 1000, 0), "pacer_submit() returns PACER_SEND_NOW up to the socket limit");
+		is_int(PACER_QUEUED, submit(a, 1, 1, 1000, 0), "pacer_submit() returns PACER_QUEUED over the socket limit");
+		
+		is_int(PACER_SEND_NOW, submit(b, 2, 0, 900, 0), "Each socket has its own limit");
+		is_int(PACER_QUEUED, submit(b, 2, 1, 200, 0), "pacer_submit() returns PACER_QUEUED over the socket limit");
+		
+		is_int(100, next_wait(0), "pacer_next() returns the shortest time until a queue can send");
+		ok(next_is(200, 2, 1, 200), "pacer_next() skips queues waiting for their socket's budget");
+		is_int(800, next_wait(200), "pacer_next() returns time until the socket's budget allows");
+		ok(next_is(1000, 1, 1, 1000), "pacer_next() sends the packet once the socket's budget allows");
+		
+		pacer_socket_close(a);
+		pacer_socket_close(b);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 2 packets per second to each destination. */
+		init_pacer(0, 0, 0, 0, 2, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit_to(a, 1, 0x000000000002, 0, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the destination limit");
+		is_int(PACER_SEND_NOW, submit_to(a, 1, 0x000000000002, 1, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the destination limit");
+		is_int(PACER_QUEUED, submit_to(a, 1, 0x000000000002, 2, 100, 0), "pacer_submit() returns PACER_QUEUED over the destination limit");
+		
+		is_int(PACER_SEND_NOW, submit_to(b, 2, 0x000000000003, 0, 100, 0), "Each destination has its own limit");
+		is_int(PACER_QUEUED, submit_to(b, 2, 0x000000000002, 1, 100, 0), "The destination limit is shared by every socket");
+		
+		is_int(500, next_wait(0), "pacer_next() returns time until the destination's next token");
+		ok(next_is(500, 1, 2, 100), "pacer_next() sends the packet once the destination has a token");
+		is_int(500, next_wait(500), "pacer_next() doesn't exceed the destination limit");
+		ok(next_is(1000, 2, 1, 100), "pacer_next() sends the packet once the destination has a token");
+		
+		/* Destinations which are still being limited aren't discarded
+		 * when the table fills up.
+		*/
+		
+		is_int(PACER_SEND_NOW, submit_to(a, 1, 0x000000000004, 0, 100, 1000), "pacer_submit() returns PACER_SEND_NOW up to the destination limit");
+		is_int(PACER_SEND_NOW, submit_to(a, 1, 0x000000000004, 1, 100, 1000), "pacer_submit() returns PACER_SEND_NOW up to the destination limit");
+		
+		bool all_ok = true;
+		for(int i = 0; i < (PACER_MAX_DESTS * 2); ++i)
+		{
+			all_ok = all_ok && submit_to(b, 2, 0x000000010000 + i, 0, 100, 1000) == PACER_SEND_NOW;
+		}
+		
+		ok(all_ok, "pacer_submit() returns PACER_SEND_NOW for many destinations");
+		is_int(PACER_QUEUED, submit_to(a, 1, 0x000000000004, 2, 100, 1000), "Destination limits are kept when the table is full");
+		
+		pacer_socket_close(a);
+		pacer_socket_close(b);
+		pacer_cleanup();
+	}
+	
+	is_int(PACER_PRIO_HIGH, pacer_choose_priority(IPX_PRIORITY_AUTO, PACER_SMALL_PACKET), "pacer_choose_priority() sends small packets at high priority");
+	is_int(PACER_PRIO_NORMAL, pacer_choose_priority(IPX_PRIORITY_AUTO, PACER_SMALL_PACKET + 1), "pacer_choose_priority() sends large packets at normal priority");
+	is_int(PACER_PRIO_HIGH, pacer_choose_priority(IPX_PRIORITY_HIGH, 1400), "pacer_choose_priority() uses the socket's priority");
+	is_int(PACER_PRIO_NORMAL, pacer_choose_priority(IPX_PRIORITY_NORMAL, 10), "pacer_choose_priority() uses the socket's priority");
+	is_int(PACER_PRIO_BULK, pacer_choose_priority(IPX_PRIORITY_BULK, 10), "pacer_choose_priority() uses the socket's priority");
+	
+	{
+		/* 2 packets per second in total. */
+		init_pacer(2, 0, 0, 0, 0, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit_prio(a, PACER_PRIO_BULK, 1, 0, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the rate limit");
+		is_int(PACER_SEND_NOW, submit_prio(a, PACER_PRIO_BULK, 1, 1, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the rate limit");
+		is_int(PACER_QUEUED, submit_prio(a, PACER_PRIO_BULK, 1, 2, 100, 0), "pacer_submit() returns PACER_QUEUED over the rate limit");
+		is_int(PACER_QUEUED, submit_prio(b, PACER_PRIO_HIGH, 2, 0, 100, 0), "pacer_submit() returns PACER_QUEUED over the rate limit");
+		is_int(PACER_QUEUED, submit_prio(b, PACER_PRIO_HIGH, 2, 1, 100, 0), "pacer_submit() returns PACER_QUEUED over the rate limit");
+		
+		is_int(500, next_wait(0), "pacer_next() returns time until the next token");
+		ok(next_is(500, 2, 0, 100), "pacer_next() sends high priority packets first");
+		ok(next_is(1000, 2, 1, 100), "pacer_next() sends high priority packets first");
+		ok(next_is(1500, 1, 2, 100), "pacer_next() sends bulk packets once nothing else is waiting");
+		
+		pacer_stats stats[PACER_NUM_PRIOS];
+		pacer_take_stats(stats);
+		
+		is_int(0, stats[PACER_PRIO_HIGH].sent_now, "pacer_take_stats() counts packets sent immediately");
+		is_int(2, stats[PACER_PRIO_HIGH].queued, "pacer_take_stats() counts queued packets");
+		is_int(2, stats[PACER_PRIO_HIGH].sent_queued, "pacer_take_stats() counts packets sent from the queue");
+		is_int(0, stats[PACER_PRIO_HIGH].depth, "pacer_take_stats() returns the queue depth");
+		is_int(2, stats[PACER_PRIO_HIGH].max_depth, "pacer_take_stats() returns the maximum queue depth");
+		is_int(1500, stats[PACER_PRIO_HIGH].total_latency, "pacer_take_stats() returns the total latency");
+		is_int(1000, stats[PACER_PRIO_HIGH].max_latency, "pacer_take_stats() returns the maximum latency");
+		
+		is_int(2, stats[PACER_PRIO_BULK].sent_now, "pacer_take_stats() counts packets sent immediately");
+		is_int(1, stats[PACER_PRIO_BULK].queued, "pacer_take_stats() counts queued packets");
+		is_int(1, stats[PACER_PRIO_BULK].sent_queued, "pacer_take_stats() counts packets sent from the queue");
+		is_int(1500, stats[PACER_PRIO_BULK].max_latency, "pacer_take_stats() returns the maximum latency");
+		
+		is_int(0, stats[PACER_PRIO_NORMAL].queued, "pacer_take_stats() counts each priority separately");
+		
+		pacer_take_stats(stats);
+		
+		is_int(0, stats[PACER_PRIO_HIGH].queued, "pacer_take_stats() resets the counters");
+		is_int(0, stats[PACER_PRIO_HIGH].max_depth, "pacer_take_stats() resets the counters");
+		is_int(0, stats[PACER_PRIO_BULK].sent_now, "pacer_take_stats() resets the counters");
+		
+		pacer_socket_close(a);
+		pacer_socket_close(b);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 2 packets per second in total. */
+		init_pacer(2, 0, 0, 0, 0, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		pacer_socket *c = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit_prio(a, PACER_PRIO_BULK, 1, 0, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the rate limit");
+		is_int(PACER_SEND_NOW, submit_prio(a, PACER_PRIO_BULK, 1, 1, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the rate limit");
+		is_int(PACER_QUEUED, submit_prio(a, PACER_PRIO_BULK, 1, 2, 100, 0), "pacer_submit() returns PACER_QUEUED over the rate limit");
+		
+		is_int(PACER_SEND_NOW, submit_prio(b, PACER_PRIO_HIGH, 2, 0, 100, 500), "Higher priority packets skip lower priority queues");
+		is_int(PACER_QUEUED, submit_prio(b, PACER_PRIO_HIGH, 2, 1, 100, 500), "pacer_submit() returns PACER_QUEUED over the rate limit");
+		is_int(PACER_QUEUED, submit_prio(c, PACER_PRIO_NORMAL, 3, 0, 100, 1000), "Lower priority packets don't skip higher priority queues");
+		
+		ok(next_is(1000, 2, 1, 100), "pacer_next() sends high priority packets first");
+		ok(next_is(1500, 3, 0, 100), "pacer_next() sends normal priority packets before bulk");
+		ok(next_is(2000, 1, 2, 100), "pacer_next() sends bulk packets once nothing else is waiting");
+		
+		pacer_socket_close(a);
+		pacer_socket_close(b);
+		pacer_socket_close(c);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 1000 bytes per second in total. */
+		init_pacer(0, 1000, 0, 0, 0, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit_prio(a, PACER_PRIO_HIGH, 1, 0, 1000, 0), "pacer_submit() returns PACER_SEND_NOW up to the byte limit");
+		is_int(PACER_QUEUED, submit_prio(a, PACER_PRIO_HIGH, 1, 1, 1000, 0), "pacer_submit() returns PACER_QUEUED over the byte limit");
+		is_int(PACER_QUEUED, submit_prio(b, PACER_PRIO_BULK, 2, 0, 100, 0), "pacer_submit() returns PACER_QUEUED over the byte limit");
+		
+		is_int(500, next_wait(500), "Lower priority packets don't take budget higher priority packets are waiting for");
+		ok(next_is(1000, 1, 1, 1000), "pacer_next() sends high priority packets first");
+		ok(next_is(1100, 2, 0, 100), "pacer_next() sends bulk packets once nothing else is waiting");
+		
+		pacer_socket_close(a);
+		pacer_socket_close(b);
+		pacer_cleanup();
+	}
+	
+	{
+		/* 1 packet per second from each socket. */
+		init_pacer(0, 0, 1, 0, 0, 0);
+		
+		pacer_socket *a = pacer_socket_create(0);
+		pacer_socket *b = pacer_socket_create(0);
+		
+		is_int(PACER_SEND_NOW, submit_prio(a, PACER_PRIO_HIGH, 1, 0, 100, 0), "pacer_submit() returns PACER_SEND_NOW up to the socket limit");
+		is_int(PACER_QUEUED, submit_prio(a, PACER_PRIO_HIGH, 1, 1, 100, 0), "pacer_submit() returns PACER_QUEUED over the socket limit");
+		is_int(PACER_QUEUED, submit_prio(a, PACER_PRIO_BULK, 1, 2, 100, 0), "Lower priority packets don't skip the socket's higher priority queues");
+		is_int(PACER_SEND_NOW, submit_prio(b, PACER_PRIO_BULK, 2, 0, 100, 0), "Queues waiting on their socket limit don't hold up other sockets");
+		
+		ok(next_is(1000, 1, 1, 100), "pacer_next() sends high priority packets first");
+		is_int(1000, next_wait(1000), "pacer_next() doesn't exceed the socket limit");
+		ok(next_is(2000, 1, 2, 100), "pacer_next() sends bulk packets once nothing else is waiting");
+		
+		pacer_socket_close(a);
+		pacer_socket_close(b);
+		pacer_cleanup();
+	}
+	
+	return 0;
+}
@@ -0,0 +1,133 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "../src/addr.h"
+#include "../src/common.h"
+#include "../src/peerstats.h"
+#include "tap/basic.h"
+
+/* Need to implement log_printf() and w32_error() for peerstats.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+const char *w32_error(DWORD errnum)
+{
+	return "error";
+}
+
+#define NET(n) addr32_in((unsigned char[]){ 0x00, 0x00, 0x00, (n) })
+#define NODE(n) addr48_in((unsigned char[]){ 0x00, 0x00, 0x00, 0x00, ((n) >> 8), ((n) & 0xFF) })
+
+static peer_stats peers[PEERSTATS_MAX_PEERS + 1];
+
+int main()
+{
+	plan_lazy();
+	
+	{
+		peerstats_init();
+		
+		is_int(0, peerstats_read(peers, PEERSTATS_MAX_PEERS), "peerstats_read() returns no peers before any packets are counted");
+		
+		peerstats_cleanup();
+	}
+	
+	{
+		peerstats_init();
+		
+		peerstats_record_send(NET(1), NODE(1), 100, 1000);
+		peerstats_record_send(NET(1), NODE(1), 200, 1001);
+		peerstats_record_recv(NET(1), NODE(1), 50,  1002);
+		
+		peerstats_record_recv(NET(1), NODE(2), 10,  1003);
+		
+		peerstats_record_send(NET(2), NODE(1), 1,   1004);
+		
+		is_int(3, peerstats_read(peers, PEERSTATS_MAX_PEERS), "peerstats_read() returns each peer");
+		
+		ok(peers[0].net == NET(2) && peers[0].node == NODE(1), "peerstats_read() returns the most recently active peer first");
+		ok(peers[1].net == NET(1) && peers[1].node == NODE(2), "peerstats_read() returns peers in order of activity");
+		ok(peers[2].net == NET(1) && peers[2].node == NODE(1), "peerstats_read() returns the least recently active peer last");
+		
+		is_int(2,    peers[2].send_packets, "Sent packets are counted");
+		is_int(300,  peers[2].send_bytes,   "Sent bytes are counted");
+		is_int(1,    peers[2].recv_packets, "Received packets are counted");
+		is_int(50,   peers[2].recv_bytes,   "Received bytes are counted");
+		is_int(1001, peers[2].last_send,    "Time of the last sent packet is recorded");
+		is_int(1002, peers[2].last_recv,    "Time of the last received packet is recorded");
+		is_int(1002, peers[2].last_seen,    "Time of the last packet is recorded");
+		
+		is_int(0,  peers[1].send_packets, "Packets are counted against the correct peer");
+		is_int(1,  peers[1].recv_packets, "Packets are counted against the correct peer");
+		is_int(10, peers[1].recv_bytes,   "Packets are counted against the correct peer");
+		
+		peerstats_record_recv(NET(1), NODE(1), 1, 1005);
+		
+		is_int(1, peerstats_read(peers, 1), "peerstats_read() returns no more than the requested number of peers");
+		ok(peers[0].net == NET(1) && peers[0].node == NODE(1), "Counting a packet makes a peer the most recently active");
+		
+		is_int(0, peerstats_evictions(), "No peers are forgotten while the table has room");
+		
+		peerstats_cleanup();
+	}
+	
+	{
+		peerstats_init();
+		
+		for(int i = 0; i < PEERSTATS_MAX_PEERS; ++i)
+		{
+			peerstats_record_send(NET(1), NODE(i), 1, i);
+		}
+		
+		/* Make the first peer the most recently active. */
+		peerstats_record_recv(NET(1), NODE(0), 1, PEERSTATS_MAX_PEERS);
+		
+		peerstats_record_send(NET(2), NODE(0), 1, PEERSTATS_MAX_PEERS + 1);
+		
+		is_int(PEERSTATS_MAX_PEERS, peerstats_read(peers, PEERSTATS_MAX_PEERS + 1), "The table doesn't grow beyond PEERSTATS_MAX_PEERS peers");
+		is_int(1, peerstats_evictions(), "Forgotten peers are counted");
+		
+		bool found_first = false, found_second = false, found_new = false;
+		
+		for(int i = 0; i < PEERSTATS_MAX_PEERS; ++i)
+		{
+			found_first  |= (peers[i].net == NET(1) && peers[i].node == NODE(0));
+			found_second |= (peers[i].net == NET(1) && peers[i].node == NODE(1));
+			found_new    |= (peers[i].net == NET(2) && peers[i].node == NODE(0));
+		}
+		
+		ok(found_new,     "A new peer is added to a full table");
+		ok(!found_second, "The least recently active peer is forgotten");
+		ok(found_first,   "Recently active peers are kept");
+		
+		peerstats_cleanup();
+	}
+	
+	return 0;
+}
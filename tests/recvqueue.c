@@ -0,0 +1,233 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common.h"
+#include "../src/recvqueue.h"
+#include "../src/slab.h"
+#include "tap/basic.h"
+
+/* Need to implement log_printf() for recvqueue.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+/* Depth which doesn't fit in a single word of the free slot bitmap. */
+#define DEPTH 40
+
+static void queue_packet(ipx_recv_queue *queue, int slot, int size)
+{
+	queue->data[slot] = slab_alloc(size);
+	if(queue->data[slot] == NULL)
+	{
+		bail("slab_alloc() failed");
+	}
+	
+	queue->sizes[slot] = size;
+	recv_queue_push_ready(queue, slot);
+}
+
+int main()
+{
+	plan_lazy();
+	
+	slab_init();
+	
+	{
+		ipx_recv_queue *queue = create_recv_queue(DEPTH);
+		ok(queue != NULL, "create_recv_queue() succeeds");
+		
+		if(queue == NULL)
+		{
+			bail("Cannot continue without queue");
+		}
+		
+		is_int(0, queue->n_ready, "New queue is empty");
+		
+		bool claimed[DEPTH] = { false };
+		bool all_ok = true;
+		
+		for(int i = 0; i < DEPTH; ++i)
+		{
+			int slot = recv_queue_claim_slot(queue);
+			
+			if(slot < 0 || slot >= DEPTH || claimed[slot] || queue->sizes[slot] != IPX_RECV_QUEUE_LOCKED)
+			{
+				all_ok = false;
+				break;
+			}
+			
+			claimed[slot] = true;
+		}
+		
+		ok(all_ok, "recv_queue_claim_slot() returns every slot once");
+		is_int(-1, recv_queue_claim_slot(queue), "recv_queue_claim_slot() returns -1 when the queue is full");
+		
+		recv_queue_free_slot(queue, 33);
+		is_int(IPX_RECV_QUEUE_FREE, queue->sizes[33], "recv_queue_free_slot() marks the slot as free");
+		is_int(33, recv_queue_claim_slot(queue), "recv_queue_claim_slot() returns a freed slot");
+		
+		recv_queue_free_slot(queue, 35);
+		recv_queue_free_slot(queue, 5);
+		
+		is_int(5,  recv_queue_claim_slot(queue), "recv_queue_claim_slot() returns the lowest free slot");
+		is_int(35, recv_queue_claim_slot(queue), "recv_queue_claim_slot() returns the lowest free slot");
+		is_int(-1, recv_queue_claim_slot(queue), "recv_queue_claim_slot() returns -1 when the queue is full");
+		
+		for(int i = 0; i < DEPTH; ++i)
+		{
+			recv_queue_free_slot(queue, i);
+		}
+		
+		release_recv_queue(queue);
+	}
+	
+	{
+		/* Push and pop packets in a pattern which wraps around the
+		 * ready list many times and compare it against a simple
+		 * array.
+		*/
+		
+		ipx_recv_queue *queue = create_recv_queue(DEPTH);
+		if(queue == NULL)
+		{
+			bail("create_recv_queue() failed");
+		}
+		
+		int expect[DEPTH];
+		int n_expect = 0;
+		
+		bool all_ok = true;
+		
+		srand(1);
+		
+		for(int i = 0; i < 10000 && all_ok; ++i)
+		{
+			if(n_expect < DEPTH && (n_expect == 0 || (rand() % 3) != 0))
+			{
+				int slot = recv_queue_claim_slot(queue);
+				if(slot < 0)
+				{
+					all_ok = false;
+					break;
+				}
+				
+				queue_packet(queue, slot, 1 + (rand() % 1500));
+				expect[n_expect++] = slot;
+			}
+			else{
+				int slot = recv_queue_pop_ready(queue);
+				
+				if(slot != expect[0])
+				{
+					all_ok = false;
+					break;
+				}
+				
+				memmove(&(expect[0]), &(expect[1]), (--n_expect * sizeof(int)));
+				recv_queue_free_slot(queue, slot);
+			}
+			
+			if(queue->n_ready != n_expect)
+			{
+				all_ok = false;
+			}
+			
+			for(int j = 0; j < n_expect; ++j)
+			{
+				if(recv_queue_ready_slot(queue, j) != expect[j])
+				{
+					all_ok = false;
+				}
+			}
+		}
+		
+		ok(all_ok, "Ready list returns packets in the order they were queued");
+		
+		size_t reserved, used;
+		slab_stats(&reserved, &used);
+		ok(used > 0, "Queued packets are allocated from the slab allocator");
+		
+		/* Packets still in the queue are freed when it is destroyed. */
+		release_recv_queue(queue);
+		
+		slab_stats(&reserved, &used);
+		is_int(0, used, "release_recv_queue() frees queued packets");
+	}
+	
+	{
+		ipx_recv_queue *queue = create_recv_queue(1);
+		if(queue == NULL)
+		{
+			bail("create_recv_queue() failed");
+		}
+		
+		int slot = recv_queue_claim_slot(queue);
+		is_int(0, slot, "recv_queue_claim_slot() works with a depth of 1");
+		is_int(-1, recv_queue_claim_slot(queue), "recv_queue_claim_slot() returns -1 when the queue is full");
+		
+		queue_packet(queue, slot, 64);
+		
+		is_int(0, recv_queue_ready_slot(queue, 0), "recv_queue_ready_slot() works with a depth of 1");
+		is_int(0, recv_queue_pop_ready(queue), "recv_queue_pop_ready() works with a depth of 1");
+		is_int(0, queue->n_ready, "recv_queue_pop_ready() works with a depth of 1");
+		
+		recv_queue_free_slot(queue, slot);
+		release_recv_queue(queue);
+	}
+	
+	{
+		ipx_recv_queue *queue = create_recv_queue(RECV_QUEUE_MAX_DEPTH);
+		if(queue == NULL)
+		{
+			bail("create_recv_queue() failed");
+		}
+		
+		int n_claimed = 0;
+		while(recv_queue_claim_slot(queue) >= 0)
+		{
+			++n_claimed;
+		}
+		
+		is_int(RECV_QUEUE_MAX_DEPTH, n_claimed, "recv_queue_claim_slot() can claim every slot with the maximum depth");
+		
+		recv_queue_free_slot(queue, RECV_QUEUE_MAX_DEPTH - 1);
+		is_int(RECV_QUEUE_MAX_DEPTH - 1, recv_queue_claim_slot(queue), "recv_queue_claim_slot() finds the last slot with the maximum depth");
+		
+		for(int i = 0; i < RECV_QUEUE_MAX_DEPTH; ++i)
+		{
+			recv_queue_free_slot(queue, i);
+		}
+		
+		release_recv_queue(queue);
+	}
+	
+	slab_cleanup();
+	
+	return 0;
+}
@@ -0,0 +1,199 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <windows.h>
+
+#include "../src/rwlock.h"
+#include "tap/basic.h"
+
+#define N_THREADS 4
+#define N_ITERATIONS 100000
+
+static rwlock_t lock;
+
+static volatile int counter;
+static volatile int pair_a, pair_b;
+static volatile LONG mismatches;
+
+static HANDLE shared_held;
+static HANDLE shared_release;
+
+static DWORD WINAPI increment_main(LPVOID param)
+{
+	for(int i = 0; i < N_ITERATIONS; ++i)
+	{
+		rwlock_lock_exclusive(&lock);
+		
+		int c = counter;
+		SwitchToThread();
+		counter = c + 1;
+		
+		rwlock_unlock_exclusive(&lock);
+	}
+	
+	return 0;
+}
+
+static DWORD WINAPI writer_main(LPVOID param)
+{
+	for(int i = 0; i < N_ITERATIONS; ++i)
+	{
+		rwlock_lock_exclusive(&lock);
+		
+		pair_a = i;
+		SwitchToThread();
+		pair_b = i;
+		
+		rwlock_unlock_exclusive(&lock);
+	}
+	
+	return 0;
+}
+
+static DWORD WINAPI reader_main(LPVOID param)
+{
+	for(int i = 0; i < N_ITERATIONS; ++i)
+	{
+		rwlock_lock_shared(&lock);
+		
+		if(pair_a != pair_b)
+		{
+			InterlockedIncrement(&mismatches);
+		}
+		
+		rwlock_unlock_shared(&lock);
+	}
+	
+	return 0;
+}
+
+static DWORD WINAPI shared_holder_main(LPVOID param)
+{
+	rwlock_lock_shared(&lock);
+	
+	SetEvent(shared_held);
+	WaitForSingleObject(shared_release, INFINITE);
+	
+	rwlock_unlock_shared(&lock);
+	
+	return 0;
+}
+
+static void run_threads(LPTHREAD_START_ROUTINE *funcs, int n_threads)
+{
+	HANDLE threads[N_THREADS + 1];
+	
+	for(int i = 0; i < n_threads; ++i)
+	{
+		if((threads[i] = CreateThread(NULL, 0, funcs[i], NULL, 0, NULL)) == NULL)
+		{
+			sysbail("CreateThread");
+		}
+	}
+	
+	WaitForMultipleObjects(n_threads, threads, TRUE, INFINITE);
+	
+	for(int i = 0; i < n_threads; ++i)
+	{
+		CloseHandle(threads[i]);
+	}
+}
+
+int main()
+{
+	plan_lazy();
+	
+	rwlock_init(&lock);
+	
+	{
+		LPTHREAD_START_ROUTINE funcs[N_THREADS];
+		
+		for(int i = 0; i < N_THREADS; ++i)
+		{
+			funcs[i] = &increment_main;
+		}
+		
+		counter = 0;
+		run_threads(funcs, N_THREADS);
+		
+		is_int(N_THREADS * N_ITERATIONS, counter, "Exclusive holders exclude each other");
+	}
+	
+	{
+		LPTHREAD_START_ROUTINE funcs[N_THREADS + 1];
+		
+		funcs[0] = &writer_main;
+		
+		for(int i = 1; i <= N_THREADS; ++i)
+		{
+			funcs[i] = &reader_main;
+		}
+		
+		pair_a = pair_b = 0;
+		mismatches = 0;
+		
+		run_threads(funcs, N_THREADS + 1);
+		
+		is_int(0, mismatches, "Shared holders exclude exclusive holders");
+	}
+	
+	{
+		HMODULE kernel32 = GetModuleHandle("kernel32.dll");
+		
+		if(GetProcAddress(kernel32, "AcquireSRWLockShared") != NULL)
+		{
+			/* Hold the lock shared in another thread and check we can
+			 * still take it shared, but not exclusive.
+			*/
+			
+			shared_held    = CreateEvent(NULL, FALSE, FALSE, NULL);
+			shared_release = CreateEvent(NULL, FALSE, FALSE, NULL);
+			
+			HANDLE thread = CreateThread(NULL, 0, &shared_holder_main, NULL, 0, NULL);
+			if(thread == NULL)
+			{
+				sysbail("CreateThread");
+			}
+			
+			WaitForSingleObject(shared_held, INFINITE);
+			
+			/* There's no way to try for the lock, so this would hang
+			 * if shared holders excluded each other.
+			*/
+			rwlock_lock_shared(&lock);
+			rwlock_unlock_shared(&lock);
+			
+			ok(true, "Lock can be held shared by multiple threads");
+			
+			SetEvent(shared_release);
+			WaitForSingleObject(thread, INFINITE);
+			
+			CloseHandle(thread);
+			CloseHandle(shared_release);
+			CloseHandle(shared_held);
+		}
+		else{
+			skip("SRW locks not supported by this version of Windows");
+		}
+	}
+	
+	rwlock_destroy(&lock);
+	
+	return 0;
+}
@@ -0,0 +1,212 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/sendrate.h"
+#include "tap/basic.h"
+
+/* Reference implementation - the sliding window of send timestamps which
+ * coalesce_register_send() used before send_rate was introduced.
+*/
+
+struct ref_rate
+{
+	uint64_t send_timestamps[IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT];
+};
+
+static bool ref_register(struct ref_rate *node, uint64_t timestamp, bool active)
+{
+	memmove(node->send_timestamps, node->send_timestamps + 1, sizeof(node->send_timestamps) - sizeof(*(node->send_timestamps)));
+	node->send_timestamps[IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT - 1] = timestamp;
+	
+	if((node->send_timestamps[0] + IPXWRAPPER_COALESCE_PACKET_START_THRESH) >= timestamp)
+	{
+		return true;
+	}
+	else if(active && (node->send_timestamps[0] + IPXWRAPPER_COALESCE_PACKET_STOP_THRESH) < timestamp)
+	{
+		return false;
+	}
+	else{
+		return active;
+	}
+}
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+	/* xorshift32, so sequences are the same on every run. */
+	
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	
+	return rng_state;
+}
+
+enum pattern
+{
+	PATTERN_STEADY_FAST,  /* Constant rate above the start threshold */
+	PATTERN_STEADY_SLOW,  /* Constant rate below the start threshold */
+	PATTERN_BURSTS,       /* Bursts of fast sends separated by pauses */
+	PATTERN_RAMP,         /* Rate slowly falling from fast to slow */
+	PATTERN_RANDOM,       /* Random gaps over a wide range */
+};
+
+/* Returns the gap in microseconds before send number i. */
+static uint64_t next_gap(enum pattern pattern, int i, int count)
+{
+	switch(pattern)
+	{
+		case PATTERN_STEADY_FAST:
+			return 1000;
+			
+		case PATTERN_STEADY_SLOW:
+			return 10000;
+			
+		case PATTERN_BURSTS:
+			return ((i % 2000) < 1500) ? (rng() % 3000) : (rng() % 40000);
+			
+		case PATTERN_RAMP:
+			return 100 + ((uint64_t)(i) * 40000) / count;
+			
+		case PATTERN_RANDOM:
+		default:
+			return (rng() % 64) ? (rng() % 5000) : (rng() % 500000);
+	}
+}
+
+/* Feed the same sequence of send timestamps to the reference implementation
+ * and send_rate_register(), tracking the coalescing state of each like
+ * coalesce_send() does. Returns true if every decision matched and stores
+ * the number of times coalescing was started in *activations.
+*/
+static bool compare_decisions(enum pattern pattern, uint64_t start, int count, int *activations)
+{
+	struct ref_rate *ref = calloc(1, sizeof(struct ref_rate));
+	send_rate_t *rate = calloc(1, sizeof(send_rate_t));
+	
+	if(ref == NULL || rate == NULL)
+	{
+		sysbail("calloc");
+	}
+	
+	bool ref_active = false, rate_active = false;
+	bool all_ok = true;
+	
+	*activations = 0;
+	
+	uint64_t now = start;
+	rng_state = 0x12345678 + pattern;
+	
+	for(int i = 0; i < count; ++i)
+	{
+		now += next_gap(pattern, i, count);
+		
+		bool ref_result = ref_register(ref, now, ref_active);
+		bool rate_result = send_rate_register(rate, now, rate_active);
+		
+		if(ref_result != rate_result)
+		{
+			diag("Decision differs at send %d (timestamp %llu)", i, (unsigned long long)(now));
+			
+			all_ok = false;
+			break;
+		}
+		
+		if(rate_result && !rate_active)
+		{
+			++(*activations);
+		}
+		
+		ref_active = ref_result;
+		rate_active = rate_result;
+	}
+	
+	free(rate);
+	free(ref);
+	
+	return all_ok;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	{
+		send_rate_t rate;
+		memset(&rate, 0, sizeof(rate));
+		
+		/* Timestamps start at zero, so the first sends within the start
+		 * threshold of boot look like a full window.
+		*/
+		
+		ok(send_rate_register(&rate, 1000, false), "send_rate_register() starts coalescing with a full window of recent sends");
+	}
+	
+	{
+		send_rate_t rate;
+		memset(&rate, 0, sizeof(rate));
+		
+		uint64_t now = 1000000000;
+		bool result = false;
+		
+		for(int i = 0; i < (IPXWRAPPER_COALESCE_PACKET_TRACK_COUNT - 1); ++i)
+		{
+			result = send_rate_register(&rate, now, false);
+		}
+		
+		ok(!result, "send_rate_register() doesn't start coalescing before the window is full");
+		ok(send_rate_register(&rate, now, false), "send_rate_register() starts coalescing once the window is full");
+		
+		now += IPXWRAPPER_COALESCE_PACKET_STOP_THRESH;
+		ok(send_rate_register(&rate, now, true), "send_rate_register() keeps coalescing until the stop threshold");
+		
+		now += 1;
+		ok(!send_rate_register(&rate, now, true), "send_rate_register() stops coalescing after the stop threshold");
+	}
+	
+	static const struct {
+		enum pattern pattern;
+		const char *name;
+	} patterns[] = {
+		{ PATTERN_STEADY_FAST, "steady fast" },
+		{ PATTERN_STEADY_SLOW, "steady slow" },
+		{ PATTERN_BURSTS,      "bursty" },
+		{ PATTERN_RAMP,        "falling" },
+		{ PATTERN_RANDOM,      "random" },
+	};
+	
+	for(size_t i = 0; i < (sizeof(patterns) / sizeof(*patterns)); ++i)
+	{
+		int activations;
+		
+		ok(compare_decisions(patterns[i].pattern, 0, 100000, &activations),
+			"send_rate_register() matches reference with %s sends from boot", patterns[i].name);
+		
+		ok(compare_decisions(patterns[i].pattern, 1000000000, 100000, &activations),
+			"send_rate_register() matches reference with %s sends", patterns[i].name);
+		
+		diag("%s sends: coalescing started %d times", patterns[i].name, activations);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,165 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/slab.h"
+#include "tap/basic.h"
+
+#define N_OBJECTS 2000
+
+static size_t used_bytes(void)
+{
+	size_t reserved, used;
+	slab_stats(&reserved, &used);
+	
+	return used;
+}
+
+static size_t reserved_bytes(void)
+{
+	size_t reserved, used;
+	slab_stats(&reserved, &used);
+	
+	return reserved;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	slab_init();
+	
+	{
+		is_int(0, used_bytes(), "No memory is used initially");
+		is_int(0, reserved_bytes(), "No memory is reserved initially");
+		
+		void *a = slab_alloc(40);
+		ok(a != NULL, "slab_alloc() succeeds");
+		ok(((uintptr_t)(a) % 8) == 0, "slab_alloc() returns an aligned pointer");
+		
+		is_int(64, used_bytes(), "slab_alloc() rounds up to the next size class");
+		ok(reserved_bytes() <= (SLAB_CHUNK_SIZE + 64), "slab_alloc() reserves a single chunk");
+		
+		void *b = slab_alloc(8);
+		ok(b != NULL && b != a, "slab_alloc() returns a different object");
+		is_int(64 + SLAB_MIN_SIZE, used_bytes(), "slab_alloc() uses the smallest size class for small objects");
+		
+		size_t reserved = reserved_bytes();
+		
+		slab_free(a);
+		is_int(SLAB_MIN_SIZE, used_bytes(), "slab_free() releases the object");
+		is_int(reserved, reserved_bytes(), "slab_free() keeps the chunk for reuse");
+		
+		void *c = slab_alloc(64);
+		ok(c == a, "slab_alloc() reuses freed objects of the same size class");
+		is_int(reserved, reserved_bytes(), "slab_alloc() doesn't reserve more memory when reusing objects");
+		
+		slab_free(b);
+		slab_free(c);
+		slab_free(NULL);
+		
+		is_int(0, used_bytes(), "All memory is released");
+	}
+	
+	{
+		void *big = slab_alloc(SLAB_MAX_SIZE + 1);
+		ok(big != NULL, "slab_alloc() succeeds for objects larger than SLAB_MAX_SIZE");
+		is_int(SLAB_MAX_SIZE + 1, used_bytes(), "slab_alloc() doesn't round up large objects");
+		
+		memset(big, 0xAA, SLAB_MAX_SIZE + 1);
+		
+		slab_free(big);
+		is_int(0, used_bytes(), "slab_free() releases large objects");
+	}
+	
+	{
+		/* Allocate lots of objects of varying sizes, fill each with a
+		 * different pattern and check none of them overlap.
+		*/
+		
+		void *objects[N_OBJECTS];
+		size_t sizes[N_OBJECTS];
+		
+		bool all_ok = true;
+		
+		for(int i = 0; i < N_OBJECTS; ++i)
+		{
+			sizes[i] = 1 + ((i * 7919) % 9000);
+			
+			if((objects[i] = slab_alloc(sizes[i])) == NULL)
+			{
+				all_ok = false;
+				break;
+			}
+			
+			memset(objects[i], (i & 0xFF), sizes[i]);
+		}
+		
+		ok(all_ok, "slab_alloc() succeeds for many objects");
+		
+		if(!all_ok)
+		{
+			bail("Cannot continue without objects");
+		}
+		
+		for(int i = 0; i < N_OBJECTS && all_ok; ++i)
+		{
+			const unsigned char *p = objects[i];
+			
+			for(size_t j = 0; j < sizes[i]; ++j)
+			{
+				if(p[j] != (i & 0xFF))
+				{
+					all_ok = false;
+					break;
+				}
+			}
+		}
+		
+		ok(all_ok, "Objects don't overlap");
+		
+		size_t reserved = reserved_bytes();
+		
+		for(int i = 0; i < N_OBJECTS; i += 2)
+		{
+			slab_free(objects[i]);
+		}
+		
+		for(int i = 0; i < N_OBJECTS; i += 2)
+		{
+			objects[i] = slab_alloc(sizes[i]);
+		}
+		
+		is_int(reserved, reserved_bytes(), "Reallocating freed objects doesn't reserve more memory");
+		
+		for(int i = 0; i < N_OBJECTS; ++i)
+		{
+			slab_free(objects[i]);
+		}
+		
+		is_int(0, used_bytes(), "All memory is released");
+	}
+	
+	slab_cleanup();
+	
+	return 0;
+}
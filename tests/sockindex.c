@@ -0,0 +1,204 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common.h"
+#include "../src/ipxwrapper.h"
+#include "../src/sockindex.h"
+#include "tap/basic.h"
+
+/* Need to implement log_printf() for sockindex.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+static ipx_socket *make_sockets(int count)
+{
+	ipx_socket *s = calloc(count, sizeof(ipx_socket));
+	if(s == NULL)
+	{
+		sysbail("calloc");
+	}
+	
+	return s;
+}
+
+static int count_matches(ipx_socket_index *index, uint16_t socket)
+{
+	int n = 0;
+	
+	for(ipx_socket *s = sockindex_find(index, socket); s != NULL; s = s->index_next)
+	{
+		++n;
+	}
+	
+	return n;
+}
+
+/* Number of sockets bound to the socket number we deliver to in the
+ * benchmark, like a handful of applications listening for a broadcast.
+*/
+#define BENCH_LISTENERS 4
+
+#define BENCH_PACKETS 200000
+#define BENCH_RUNS    5
+
+/* Returns the best average time (in nanoseconds) taken to find every socket
+ * which a packet to socket number 0x4000 would be delivered to, with
+ * n_sockets other sockets open on different socket numbers.
+*/
+static double bench_delivery(int n_sockets)
+{
+	ipx_socket_index *index = NULL;
+	ipx_socket *socks = make_sockets(n_sockets + BENCH_LISTENERS);
+	
+	for(int i = 0; i < n_sockets; ++i)
+	{
+		socks[i].addr.sa_socket = htons(0x5000 + i);
+		sockindex_add(&index, &(socks[i]));
+	}
+	
+	for(int i = n_sockets; i < (n_sockets + BENCH_LISTENERS); ++i)
+	{
+		socks[i].addr.sa_socket = htons(0x4000);
+		sockindex_add(&index, &(socks[i]));
+	}
+	
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	
+	double best = -1.0;
+	
+	for(int run = 0; run < BENCH_RUNS; ++run)
+	{
+		volatile int matched = 0;
+		
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter(&start);
+		
+		for(int i = 0; i < BENCH_PACKETS; ++i)
+		{
+			matched += count_matches(index, htons(0x4000));
+		}
+		
+		QueryPerformanceCounter(&end);
+		
+		double ns = ((double)(end.QuadPart - start.QuadPart) * 1000000000.0) / (double)(freq.QuadPart) / BENCH_PACKETS;
+		if(best < 0.0 || ns < best)
+		{
+			best = ns;
+		}
+	}
+	
+	for(int i = 0; i < (n_sockets + BENCH_LISTENERS); ++i)
+	{
+		sockindex_remove(&(socks[i]));
+	}
+	
+	free(socks);
+	
+	return best;
+}
+
+int main()
+{
+	plan_lazy();
+	
+	{
+		ipx_socket_index *index = NULL;
+		ipx_socket *socks = make_sockets(4);
+		
+		socks[0].addr.sa_socket = htons(1234);
+		socks[1].addr.sa_socket = htons(1234);
+		socks[2].addr.sa_socket = htons(1235);
+		socks[3].addr.sa_socket = htons(1236);
+		
+		ok(sockindex_find(index, htons(1234)) == NULL, "sockindex_find() returns NULL on an empty index");
+		
+		ok(sockindex_add(&index, &(socks[0])), "sockindex_add() succeeds");
+		ok(sockindex_add(&index, &(socks[1])), "sockindex_add() succeeds");
+		ok(sockindex_add(&index, &(socks[2])), "sockindex_add() succeeds");
+		
+		is_int(2, count_matches(index, htons(1234)), "sockindex_find() returns all sockets bound to a socket number");
+		is_int(1, count_matches(index, htons(1235)), "sockindex_find() returns all sockets bound to a socket number");
+		is_int(0, count_matches(index, htons(1236)), "sockindex_find() doesn't return sockets not in the index");
+		
+		ok(socks[0].index == &index, "sockindex_add() records index membership");
+		ok(socks[3].index == NULL, "sockets not added to an index have no membership");
+		
+		sockindex_remove(&(socks[0]));
+		
+		is_int(1, count_matches(index, htons(1234)), "sockindex_remove() removes the socket from the index");
+		ok(sockindex_find(index, htons(1234)) == &(socks[1]), "sockindex_remove() leaves other sockets on the same socket number");
+		ok(socks[0].index == NULL, "sockindex_remove() clears index membership");
+		
+		sockindex_remove(&(socks[0]));
+		sockindex_remove(&(socks[3]));
+		
+		is_int(1, count_matches(index, htons(1234)), "sockindex_remove() on a socket not in an index does nothing");
+		
+		ipx_socket_index *index2 = NULL;
+		
+		ok(sockindex_add(&index2, &(socks[1])), "sockindex_add() succeeds");
+		
+		is_int(0, count_matches(index, htons(1234)), "sockindex_add() moves the socket out of its previous index");
+		is_int(1, count_matches(index2, htons(1234)), "sockindex_add() moves the socket into the new index");
+		
+		sockindex_remove(&(socks[1]));
+		sockindex_remove(&(socks[2]));
+		
+		ok(index == NULL, "Index is empty once all sockets are removed");
+		ok(index2 == NULL, "Index is empty once all sockets are removed");
+		
+		free(socks);
+	}
+	
+	{
+		/* Measure how long it takes to find the sockets a packet
+		 * should be delivered to with increasing numbers of other
+		 * sockets open in the process. This should stay roughly flat.
+		*/
+		
+		double base = bench_delivery(1);
+		diag("%4d sockets: %.1f ns per packet", 1, base);
+		
+		for(int n_sockets = 16; n_sockets <= 4096; n_sockets *= 16)
+		{
+			double ns = bench_delivery(n_sockets);
+			diag("%4d sockets: %.1f ns per packet", n_sockets, ns);
+			
+			/* Very generous to avoid spurious failures on a busy
+			 * test machine, walking the whole sockets table grew
+			 * linearly with the number of sockets.
+			*/
+			ok(ns < (base * 4.0) + 50.0, "Delivery cost with %d sockets is close to delivery cost with 1 socket", n_sockets);
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,182 @@
+/* IPXWrapper test suite
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common.h"
+#include "../src/timerheap.h"
+#include "tap/basic.h"
+
+/* Need to implement log_printf() for timerheap.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+static void dummy_callback(ipx_timer *timer, uint64_t now) {}
+
+/* Check every timer is in the right place in the heap and has the correct
+ * index recorded.
+*/
+static bool heap_valid(const timer_heap *heap)
+{
+	for(size_t i = 0; i < heap->n_timers; ++i)
+	{
+		if(heap->timers[i]->heap_index != i)
+		{
+			return false;
+		}
+		
+		if(i > 0 && heap->timers[i]->deadline < heap->timers[(i - 1) / 2]->deadline)
+		{
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+#define N_RANDOM_TIMERS 200
+#define N_RANDOM_OPS    100000
+
+int main()
+{
+	plan_lazy();
+	
+	{
+		timer_heap heap = TIMER_HEAP_INIT;
+		
+		ipx_timer a = IPX_TIMER_INIT(&dummy_callback);
+		ipx_timer b = IPX_TIMER_INIT(&dummy_callback);
+		ipx_timer c = IPX_TIMER_INIT(&dummy_callback);
+		
+		ok(timer_heap_peek(&heap) == NULL, "timer_heap_peek() returns NULL on an empty heap");
+		ok(timer_heap_pop_expired(&heap, 1000) == NULL, "timer_heap_pop_expired() returns NULL on an empty heap");
+		ok(!timer_is_scheduled(&a), "Timers start unscheduled");
+		
+		ok(timer_heap_schedule(&heap, &a, 300), "timer_heap_schedule() succeeds");
+		ok(timer_heap_schedule(&heap, &b, 100), "timer_heap_schedule() succeeds");
+		ok(timer_heap_schedule(&heap, &c, 200), "timer_heap_schedule() succeeds");
+		
+		ok(timer_is_scheduled(&a), "timer_heap_schedule() marks the timer as scheduled");
+		ok(timer_heap_peek(&heap) == &b, "timer_heap_peek() returns the earliest timer");
+		
+		ok(timer_heap_pop_expired(&heap, 99) == NULL, "timer_heap_pop_expired() doesn't return timers before their deadline");
+		ok(timer_heap_pop_expired(&heap, 100) == &b, "timer_heap_pop_expired() returns a timer at its deadline");
+		ok(!timer_is_scheduled(&b), "timer_heap_pop_expired() unschedules the timer");
+		
+		timer_heap_schedule(&heap, &a, 50);
+		ok(timer_heap_peek(&heap) == &a, "timer_heap_schedule() moves a timer to an earlier deadline");
+		
+		timer_heap_schedule(&heap, &a, 500);
+		ok(timer_heap_peek(&heap) == &c, "timer_heap_schedule() moves a timer to a later deadline");
+		
+		timer_heap_cancel(&heap, &c);
+		ok(!timer_is_scheduled(&c), "timer_heap_cancel() unschedules the timer");
+		ok(timer_heap_peek(&heap) == &a, "timer_heap_cancel() removes the timer from the heap");
+		
+		timer_heap_cancel(&heap, &c);
+		is_int(1, heap.n_timers, "timer_heap_cancel() on an unscheduled timer does nothing");
+		
+		timer_heap_free(&heap);
+		ok(!timer_is_scheduled(&a), "timer_heap_free() unschedules remaining timers");
+	}
+	
+	{
+		/* Randomly schedule, move and cancel timers and check the heap
+		 * always returns the earliest deadline.
+		*/
+		
+		timer_heap heap = TIMER_HEAP_INIT;
+		ipx_timer timers[N_RANDOM_TIMERS];
+		
+		for(int i = 0; i < N_RANDOM_TIMERS; ++i)
+		{
+			timers[i] = (ipx_timer)IPX_TIMER_INIT(&dummy_callback);
+		}
+		
+		srand(1);
+		
+		bool all_ok = true;
+		
+		for(int op = 0; op < N_RANDOM_OPS && all_ok; ++op)
+		{
+			ipx_timer *timer = &(timers[rand() % N_RANDOM_TIMERS]);
+			
+			if((rand() % 4) == 0)
+			{
+				timer_heap_cancel(&heap, timer);
+			}
+			else{
+				timer_heap_schedule(&heap, timer, (rand() % 10000));
+			}
+			
+			ipx_timer *earliest = NULL;
+			
+			for(int i = 0; i < N_RANDOM_TIMERS; ++i)
+			{
+				if(timer_is_scheduled(&(timers[i])) && (earliest == NULL || timers[i].deadline < earliest->deadline))
+				{
+					earliest = &(timers[i]);
+				}
+			}
+			
+			if(!heap_valid(&heap)
+				|| (earliest == NULL) != (timer_heap_peek(&heap) == NULL)
+				|| (earliest != NULL && timer_heap_peek(&heap)->deadline != earliest->deadline))
+			{
+				diag("Heap is inconsistent after operation %d", op);
+				all_ok = false;
+			}
+		}
+		
+		ok(all_ok, "Heap returns the earliest deadline after random operations");
+		
+		/* Drain the heap and check timers come out in order. */
+		
+		uint64_t last = 0;
+		size_t n_popped = 0, n_scheduled = heap.n_timers;
+		
+		ipx_timer *timer;
+		while((timer = timer_heap_pop_expired(&heap, UINT64_MAX)) != NULL)
+		{
+			if(timer->deadline < last)
+			{
+				all_ok = false;
+			}
+			
+			last = timer->deadline;
+			++n_popped;
+		}
+		
+		ok(all_ok, "timer_heap_pop_expired() returns timers in deadline order");
+		is_int(n_scheduled, n_popped, "timer_heap_pop_expired() returns every scheduled timer");
+		
+		timer_heap_free(&heap);
+	}
+	
+	return 0;
+}
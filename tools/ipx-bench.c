@@ -1,5 +1,5 @@
 /* IPX(Wrapper) benchmarking tool
- * Copyright (C) 2015 Daniel Collins <solemnwarning@solemnwarning.net>
+ * Copyright (C) 2015-2026 Daniel Collins <solemnwarning@solemnwarning.net>
  *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License version 2 as published by
@@ -15,17 +15,35 @@
  * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
-/* Writes all results to stdout in a tab-seperated values format suitable for
- * processing with gnuplot.
- * 
- * The fields are:
- * 
+/* ipx-bench has four modes, chosen using the -m option:
+ *
+ * pingpong (default) - Sends <packet count> packets of each payload size from
+ *   16 to 1024 bytes to ipx-echo, one at a time from a single socket, and
+ *   measures the round trip time of each.
+ *
+ * load - Sends packets from -t threads, each with -s sockets, to ipx-echo at
+ *   a fixed total rate (-r packets per second) for -d milliseconds, and
+ *   measures the rate replies come back at and their round trip times.
+ *
+ * flood - Like load, but doesn't wait for replies. Run another ipx-bench in
+ *   sink mode to receive them. A rate of zero sends as fast as possible.
+ *
+ * sink - Binds to the given address and counts the packets sent by a flood
+ *   until every sender says it has finished, nothing arrives for
+ *   SINK_IDLE_TIMEOUT or a line is read from stdin.
+ *
+ * Results are written to stdout in the format chosen using -f, which can be
+ * "gnuplot" (default), "csv" or "json".
+ *
+ * In gnuplot format, pingpong mode writes tab-separated records with the
+ * following fields:
+ *
  *  1: payload size (bytes)
- * 
+ *
  *  2: sendto() call duration (µs)
  *  3: recv() call duration (µs)
  *  4: RTT (µs)
- * 
+ *
  *  5: packets sent
  *  6: packets received
  *  7: packet loss (%)
@@ -33,12 +51,42 @@
  *  9: mean sendto() call duration (µs)
  * 10: mean recv() call duration (µs)
  * 11: mean round trip time (µs)
- * 
+ * 12: 50th percentile round trip time (µs)
+ * 13: 99th percentile round trip time (µs)
+ * 14: 99.9th percentile round trip time (µs)
+ *
  * The output will start with records containing fields 1-4 for each packet
  * sent, in order of payload size.
- * 
+ *
  * After that is the averaged statistics for each payload size, including all
  * fields except 2-4.
+ *
+ * The other modes write a single record with an "x" in any fields which
+ * aren't measured in that mode:
+ *
+ *  1: sender threads
+ *  2: sockets per thread (streams received from in sink mode)
+ *  3: payload size (bytes)
+ *  4: offered load (packets/sec)
+ *  5: packets sent
+ *  6: sendto() calls which failed with WSAEWOULDBLOCK or WSAENOBUFS
+ *  7: send rate achieved (packets/sec)
+ *  8: packets received
+ *  9: receive rate (packets/sec)
+ * 10: throughput (bytes/sec)
+ * 11: packet loss (%)
+ * 12: 50th percentile round trip time (µs)
+ * 13: 99th percentile round trip time (µs)
+ * 14: 99.9th percentile round trip time (µs)
+ *
+ * Run them repeatedly, varying the thread count, socket count or rate, and
+ * collect the records in a file to plot how performance scales.
+ *
+ * In csv format, every mode writes a header line followed by one record for
+ * each payload size (pingpong) or run (other modes), without the per-packet
+ * records. In json format, the same records are written as an array of
+ * objects. Fields which aren't measured are left empty or null. The csv
+ * output can be plotted using makecharts.pl -s.
 */
 
 #include <winsock2.h>
@@ -47,12 +95,25 @@
 #include <wsnwlink.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
 #include "tools.h"
 
+enum output_format
+{
+	FORMAT_GNUPLOT,
+	FORMAT_CSV,
+	FORMAT_JSON,
+};
+
+static enum output_format format = FORMAT_GNUPLOT;
+
+/* Number of records written by write_record() so far. */
+static unsigned int records_written = 0;
+
 /* Deferred output buffer, holds the statistics from the end of each call to
  * run_test() which must be output together for gnuplot to draw lines between
  * them.
@@ -69,6 +130,178 @@ static uint64_t get_ticks_us(void)
 	return pc.QuadPart / ((double)(PC_FREQUENCY) / 1000000);
 }
 
+/* Round trip times are counted in a histogram with HIST_SUB_BUCKETS buckets
+ * for each power of two microseconds, so percentiles are accurate to within
+ * 1/HIST_SUB_BUCKETS. Times under 2 * HIST_SUB_BUCKETS are counted exactly.
+*/
+
+#define HIST_SUB_BUCKETS_LOG2 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BUCKETS_LOG2)
+#define HIST_BUCKETS (HIST_SUB_BUCKETS * 32)
+
+typedef struct histogram
+{
+	uint64_t count;
+	unsigned int buckets[HIST_BUCKETS];
+} histogram_t;
+
+static unsigned int hist_bucket(uint64_t us)
+{
+	if(us < (2 * HIST_SUB_BUCKETS))
+	{
+		return us;
+	}
+	
+	unsigned int log2 = 63 - __builtin_clzll(us);
+	unsigned int sub  = (us >> (log2 - HIST_SUB_BUCKETS_LOG2)) & (HIST_SUB_BUCKETS - 1);
+	
+	unsigned int bucket = ((log2 - HIST_SUB_BUCKETS_LOG2 + 1) * HIST_SUB_BUCKETS) + sub;
+	
+	return bucket < HIST_BUCKETS
+		? bucket
+		: HIST_BUCKETS - 1;
+}
+
+/* Returns the largest time counted in the given bucket. */
+static uint64_t hist_bucket_max(unsigned int bucket)
+{
+	if(bucket < (2 * HIST_SUB_BUCKETS))
+	{
+		return bucket;
+	}
+	
+	unsigned int log2 = (bucket / HIST_SUB_BUCKETS) + HIST_SUB_BUCKETS_LOG2 - 1;
+	unsigned int sub  = bucket % HIST_SUB_BUCKETS;
+	
+	uint64_t width = (uint64_t)(1) << (log2 - HIST_SUB_BUCKETS_LOG2);
+	uint64_t min   = (uint64_t)(HIST_SUB_BUCKETS + sub) * width;
+	
+	return min + width - 1;
+}
+
+static void hist_add(histogram_t *hist, uint64_t us)
+{
+	++(hist->buckets[ hist_bucket(us) ]);
+	++(hist->count);
+}
+
+static void hist_merge(histogram_t *dest, const histogram_t *src)
+{
+	for(unsigned int i = 0; i < HIST_BUCKETS; ++i)
+	{
+		dest->buckets[i] += src->buckets[i];
+	}
+	
+	dest->count += src->count;
+}
+
+/* Returns the time which the given fraction of counted times are within. */
+static uint64_t hist_percentile(const histogram_t *hist, double fraction)
+{
+	uint64_t target = (hist->count * fraction) + 0.5;
+	if(target < 1)
+	{
+		target = 1;
+	}
+	
+	uint64_t seen = 0;
+	
+	for(unsigned int i = 0; i < HIST_BUCKETS; ++i)
+	{
+		seen += hist->buckets[i];
+		
+		if(seen >= target)
+		{
+			return hist_bucket_max(i);
+		}
+	}
+	
+	return 0;
+}
+
+typedef struct field
+{
+	const char *name;
+	
+	/* Whether the value was measured in this mode. */
+	bool valid;
+	
+	/* Number of decimal places to write. */
+	int precision;
+	
+	double value;
+} field_t;
+
+#define FIELD(name, valid, precision, value) ((field_t){ (name), (valid), (precision), (value) })
+
+/* Write a record in the selected output format. */
+static void write_record(const field_t *fields, size_t n_fields)
+{
+	if(format == FORMAT_CSV && records_written == 0)
+	{
+		for(size_t i = 0; i < n_fields; ++i)
+		{
+			printf("%s%s", (i > 0 ? "," : ""), fields[i].name);
+		}
+		
+		printf("\n");
+	}
+	
+	if(format == FORMAT_JSON)
+	{
+		printf("%s{", (records_written > 0 ? ",\n\t" : "[\n\t"));
+	}
+	
+	for(size_t i = 0; i < n_fields; ++i)
+	{
+		const field_t *f = &(fields[i]);
+		
+		switch(format)
+		{
+			case FORMAT_GNUPLOT:
+				printf("%s", (i > 0 ? "\t" : ""));
+				
+				if(f->valid)
+					printf("%.*f", f->precision, f->value);
+				else
+					printf("x");
+				
+				break;
+			
+			case FORMAT_CSV:
+				printf("%s", (i > 0 ? "," : ""));
+				
+				if(f->valid)
+					printf("%.*f", f->precision, f->value);
+				
+				break;
+			
+			case FORMAT_JSON:
+				printf("%s\"%s\": ", (i > 0 ? ", " : ""), f->name);
+				
+				if(f->valid)
+					printf("%.*f", f->precision, f->value);
+				else
+					printf("null");
+				
+				break;
+		}
+	}
+	
+	printf(format == FORMAT_JSON ? "}" : "\n");
+	
+	++records_written;
+}
+
+/* Finish off the output once every record has been written. */
+static void finish_output(void)
+{
+	if(format == FORMAT_JSON)
+	{
+		printf(records_written > 0 ? "\n]\n" : "[]\n");
+	}
+}
+
 #define COUNTER_MEAN(counter) \
 ({ \
 	unsigned int nz = 0; \
@@ -114,6 +347,9 @@ static void run_test(
 	struct pkt_header *packet = calloc(packet_size, 1);
 	assert(packet != NULL);
 	
+	histogram_t *rtt_hist = calloc(1, sizeof(histogram_t));
+	assert(rtt_hist != NULL);
+	
 	uint64_t first_send, last_send = 0, last_recv;
 	
 	unsigned int sent_packets = 0;
@@ -176,6 +412,8 @@ static void run_test(
 			results[ packet->id ].rc  = post - pre;
 			results[ packet->id ].rtt = post - packet->sent_at;
 			
+			hist_add(rtt_hist, results[ packet->id ].rtt);
+			
 			++recv_packets;
 		}
 		
@@ -224,27 +462,28 @@ static void run_test(
 		exit(1);
 	}
 	
-	/* Write per-packet statistics to stdout. */
-	
-	for(unsigned int i = 0; i < send_count; ++i)
+	if(format == FORMAT_GNUPLOT)
 	{
-		printf("%u\t", packet_size);
+		/* Write per-packet statistics to stdout. */
 		
-		if(results[i].sc > 0)
-			printf("%"PRIu64, results[i].sc);
-		printf("\t");
-		
-		if(results[i].sc > 0)
-			printf("%"PRIu64, results[i].rc);
-		printf("\t");
-		
-		if(results[i].sc > 0)
-			printf("%"PRIu64, results[i].rtt);
-		printf("\n");
+		for(unsigned int i = 0; i < send_count; ++i)
+		{
+			printf("%u\t", packet_size);
+			
+			if(results[i].sc > 0)
+				printf("%"PRIu64, results[i].sc);
+			printf("\t");
+			
+			if(results[i].sc > 0)
+				printf("%"PRIu64, results[i].rc);
+			printf("\t");
+			
+			if(results[i].sc > 0)
+				printf("%"PRIu64, results[i].rtt);
+			printf("\n");
+		}
 	}
 	
-	/* Append averaged statistics to deferred output buffer. */
-	
 	double loss_percent = ((double)(100) / sent_packets) * (sent_packets - recv_packets);
 	
 	unsigned int bytes_sec = (recv_packets * packet_size) / ((double)(last_recv - first_send) / 1000000);
@@ -253,64 +492,724 @@ static void run_test(
 	uint64_t mean_rc  = COUNTER_MEAN(rc);
 	uint64_t mean_rtt = COUNTER_MEAN(rtt);
 	
-	snprintf(deferred_output + strlen(deferred_output),
-		sizeof(deferred_output) - strlen(deferred_output),
-		"%u\tx\tx\tx\t%u\t%u\t%f\t%u\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\n",
-		packet_size,
-		sent_packets,
-		recv_packets,
-		loss_percent,
-		bytes_sec,
-		mean_sc,
-		mean_rc,
-		mean_rtt);
+	uint64_t p50_rtt  = hist_percentile(rtt_hist, 0.5);
+	uint64_t p99_rtt  = hist_percentile(rtt_hist, 0.99);
+	uint64_t p999_rtt = hist_percentile(rtt_hist, 0.999);
 	
+	if(format == FORMAT_GNUPLOT)
+	{
+		/* Append averaged statistics to deferred output buffer. */
+		
+		snprintf(deferred_output + strlen(deferred_output),
+			sizeof(deferred_output) - strlen(deferred_output),
+			"%u\tx\tx\tx\t%u\t%u\t%f\t%u\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\n",
+			packet_size,
+			sent_packets,
+			recv_packets,
+			loss_percent,
+			bytes_sec,
+			mean_sc,
+			mean_rc,
+			mean_rtt,
+			p50_rtt,
+			p99_rtt,
+			p999_rtt);
+	}
+	else{
+		field_t fields[] = {
+			FIELD("payload_size",   true, 0, packet_size),
+			FIELD("sent_packets",   true, 0, sent_packets),
+			FIELD("recv_packets",   true, 0, recv_packets),
+			FIELD("loss_percent",   true, 3, loss_percent),
+			FIELD("recv_bytes_sec", true, 0, bytes_sec),
+			FIELD("mean_sendto_us", true, 0, mean_sc),
+			FIELD("mean_recv_us",   true, 0, mean_rc),
+			FIELD("mean_rtt_us",    true, 0, mean_rtt),
+			FIELD("p50_rtt_us",     true, 0, p50_rtt),
+			FIELD("p99_rtt_us",     true, 0, p99_rtt),
+			FIELD("p999_rtt_us",    true, 0, p999_rtt),
+		};
+		
+		write_record(fields, sizeof(fields) / sizeof(*fields));
+	}
+	
+	free(rtt_hist);
 	free(packet);
 	free(results);
 }
 
-int main(int argc, char **argv)
+/* Header of the packets sent in load and flood modes. Each socket is a
+ * separate stream of packets, numbered from zero.
+*/
+typedef struct load_header
+{
+	uint32_t magic;
+	uint32_t stream;
+	uint32_t seq;
+	
+	/* get_ticks_us() when the packet was sent. */
+	uint64_t sent_at;
+} __attribute__((__packed__)) load_header_t;
+
+#define LOAD_MAGIC 0x44414F4C /* "LOAD" */
+
+/* Sent by flood mode after the last packet from each socket, with seq set to
+ * the number of packets sent.
+*/
+#define END_MAGIC  0x21444E45 /* "END!" */
+
+/* Number of times the end marker is sent, in case some are lost. */
+#define END_COPIES 3
+
+/* How long load mode waits for replies after it stops sending. */
+#define LOAD_DRAIN_TIME 1000000 /* 1s */
+
+/* Most packets one thread will send at once when it has fallen behind. */
+#define LOAD_MAX_BURST 64
+
+/* Largest payload accepted by -p and received by sink mode. */
+#define MAX_PAYLOAD_SIZE 65536
+
+#define SINK_MAX_STREAMS 4096
+#define SINK_IDLE_TIMEOUT 5000000 /* 5s */
+
+enum bench_mode
+{
+	MODE_PINGPONG,
+	MODE_LOAD,
+	MODE_FLOOD,
+	MODE_SINK,
+};
+
+typedef struct sender
 {
-	if(argc != 6)
+	HANDLE thread;
+	
+	SOCKET socks[FD_SETSIZE];
+	unsigned int n_socks;
+	
+	/* First stream number of this thread's sockets. */
+	uint32_t first_stream;
+	
+	/* Time between sends from this thread, zero to send as fast as
+	 * possible.
+	*/
+	double send_interval;
+	
+	uint64_t sent_packets;
+	uint64_t send_errors;
+	uint64_t recv_packets;
+	
+	uint64_t send_ended_at;
+	
+	histogram_t rtt;
+} sender_t;
+
+static enum bench_mode mode = MODE_PINGPONG;
+
+static struct sockaddr_ipx dest_addr;
+static unsigned int payload_size = 64;
+static unsigned int duration_ms = 5000;
+
+/* Time the sender threads all start sending at. */
+static uint64_t load_start;
+
+/* Read any replies waiting on the given sockets, waiting up to timeout_us
+ * for the first.
+*/
+static void load_receive(sender_t *sender, uint64_t timeout_us, unsigned char *buf)
+{
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+	
+	for(unsigned int i = 0; i < sender->n_socks; ++i)
 	{
-		fprintf(stderr, "Usage: %s <network number> <node number> <socket number> \\\n", argv[0]);
-		fprintf(stderr, "          <packet count> <min send interval (µs)>\n");
-		return 1;
+		FD_SET(sender->socks[i], &read_fds);
 	}
 	
-	struct sockaddr_ipx send_addr  = read_sockaddr(argv[1], argv[2], argv[3]);
-	unsigned int send_count        = strtoul(argv[4], NULL, 10);
-	unsigned int min_send_interval = strtoul(argv[5], NULL, 10);
+	struct timeval tv = {
+		.tv_sec  = timeout_us / 1000000,
+		.tv_usec = timeout_us % 1000000,
+	};
 	
+	if(select(0, &read_fds, NULL, NULL, &tv) <= 0)
 	{
-		LARGE_INTEGER pc_freq;
-		QueryPerformanceFrequency(&pc_freq);
+		return;
+	}
+	
+	for(unsigned int i = 0; i < sender->n_socks; ++i)
+	{
+		if(!FD_ISSET(sender->socks[i], &read_fds))
+		{
+			continue;
+		}
 		
-		PC_FREQUENCY = pc_freq.QuadPart;
+		int r;
+		while((r = recv(sender->socks[i], (char*)(buf), payload_size, 0)) >= (int)(sizeof(load_header_t)))
+		{
+			uint64_t now = get_ticks_us();
+			
+			load_header_t *header = (load_header_t*)(buf);
+			if(header->magic == LOAD_MAGIC)
+			{
+				hist_add(&(sender->rtt), now - header->sent_at);
+				++(sender->recv_packets);
+			}
+		}
+		
+		if(r == -1 && WSAGetLastError() != WSAEWOULDBLOCK)
+		{
+			fprintf(stderr, "recv = %d, WSAGetLastError = %d\n", r, (int)(WSAGetLastError()));
+			exit(1);
+		}
 	}
+}
+
+static bool load_send(sender_t *sender, unsigned int sock_idx, uint32_t magic, uint32_t seq, unsigned char *buf)
+{
+	load_header_t *header = (load_header_t*)(buf);
+	
+	header->magic   = magic;
+	header->stream  = sender->first_stream + sock_idx;
+	header->seq     = seq;
+	header->sent_at = get_ticks_us();
 	
+	int r = sendto(sender->socks[sock_idx], (char*)(buf), payload_size, 0, (struct sockaddr*)(&dest_addr), sizeof(dest_addr));
+	if(r == payload_size)
 	{
-		WSADATA wsaData;
-		assert(WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+		return true;
+	}
+	
+	int err = WSAGetLastError();
+	
+	if(r == -1 && (err == WSAEWOULDBLOCK || err == WSAENOBUFS))
+	{
+		/* Held up by the send rate limits or out of buffers. */
+		return false;
+	}
+	
+	fprintf(stderr, "sendto = %d, WSAGetLastError = %d\n", r, err);
+	exit(1);
+}
+
+static DWORD WINAPI sender_main(LPVOID lpParameter)
+{
+	sender_t *sender = lpParameter;
+	
+	unsigned char *buf = calloc(1, payload_size);
+	assert(buf != NULL);
+	
+	uint32_t *seq = calloc(sender->n_socks, sizeof(uint32_t));
+	assert(seq != NULL);
+	
+	uint64_t end_send = load_start + ((uint64_t)(duration_ms) * 1000);
+	double next_send  = load_start;
+	
+	unsigned int next_sock = 0;
+	
+	while(get_ticks_us() < load_start) {}
+	
+	for(uint64_t now; (now = get_ticks_us()) < end_send;)
+	{
+		/* Send every packet which is due, up to a limit so that
+		 * replies are still read if we can't keep up.
+		*/
+		
+		for(int burst = 0; burst < LOAD_MAX_BURST && next_send <= now && now < end_send; ++burst)
+		{
+			if(load_send(sender, next_sock, LOAD_MAGIC, seq[next_sock], buf))
+			{
+				++(seq[next_sock]);
+				++(sender->sent_packets);
+			}
+			else{
+				++(sender->send_errors);
+			}
+			
+			next_sock = (next_sock + 1) % sender->n_socks;
+			next_send += sender->send_interval;
+			
+			if(sender->send_interval == 0)
+			{
+				break;
+			}
+		}
+		
+		now = get_ticks_us();
+		
+		uint64_t wait = (next_send > now)
+			? (next_send - now)
+			: 0;
+		
+		if(mode == MODE_LOAD)
+		{
+			load_receive(sender, (wait < 1000 ? wait : 1000), buf);
+		}
+		else if(wait >= 2000)
+		{
+			Sleep(1);
+		}
 	}
 	
-	int sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
-	assert(sock != -1);
+	sender->send_ended_at = get_ticks_us();
+	
+	if(mode == MODE_LOAD)
+	{
+		/* Wait for any replies which are still on their way. */
+		
+		uint64_t end_recv = sender->send_ended_at + LOAD_DRAIN_TIME;
+		
+		for(uint64_t now; sender->recv_packets < sender->sent_packets && (now = get_ticks_us()) < end_recv;)
+		{
+			load_receive(sender, (end_recv - now), buf);
+		}
+	}
+	else{
+		/* Tell the sink how many packets were sent from each socket. */
+		
+		for(int c = 0; c < END_COPIES; ++c)
+		{
+			for(unsigned int i = 0; i < sender->n_socks; ++i)
+			{
+				load_send(sender, i, END_MAGIC, seq[i], buf);
+			}
+			
+			Sleep(10);
+		}
+	}
+	
+	free(seq);
+	free(buf);
+	
+	return 0;
+}
+
+static void write_load_result(
+	unsigned int threads,
+	unsigned int sockets,
+	double offered_pps,
+	uint64_t sent_packets,
+	uint64_t send_errors,
+	double send_time,
+	uint64_t recv_packets,
+	double recv_time,
+	const histogram_t *rtt)
+{
+	bool sending   = (mode != MODE_SINK);
+	bool receiving = (mode != MODE_FLOOD);
+	bool have_rtt  = (rtt != NULL && rtt->count > 0);
+	
+	double loss_percent = sent_packets > 0
+		? ((double)(100) / sent_packets) * ((double)(sent_packets) - recv_packets)
+		: 0;
+	
+	field_t fields[] = {
+		FIELD("threads",             sending, 0, threads),
+		FIELD("sockets",             true,    0, sockets),
+		FIELD("payload_size",        true,    0, payload_size),
+		FIELD("offered_packets_sec", (offered_pps > 0), 0, offered_pps),
+		
+		FIELD("sent_packets",        true,    0, sent_packets),
+		FIELD("send_errors",         sending, 0, send_errors),
+		FIELD("sent_packets_sec",    sending, 0, (sending ? sent_packets / send_time : 0)),
+		
+		FIELD("recv_packets",        receiving, 0, recv_packets),
+		FIELD("recv_packets_sec",    receiving, 0, (receiving ? recv_packets / recv_time : 0)),
+		FIELD("recv_bytes_sec",      receiving, 0, (receiving ? ((double)(recv_packets) * payload_size) / recv_time : 0)),
+		FIELD("loss_percent",        (receiving && sent_packets > 0), 3, loss_percent),
+		
+		FIELD("p50_rtt_us",          have_rtt, 0, (have_rtt ? hist_percentile(rtt, 0.5)   : 0)),
+		FIELD("p99_rtt_us",          have_rtt, 0, (have_rtt ? hist_percentile(rtt, 0.99)  : 0)),
+		FIELD("p999_rtt_us",         have_rtt, 0, (have_rtt ? hist_percentile(rtt, 0.999) : 0)),
+	};
+	
+	write_record(fields, sizeof(fields) / sizeof(*fields));
+}
+
+static SOCKET open_bench_socket(const struct sockaddr_ipx *bind_addr)
+{
+	SOCKET sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+	assert(sock != INVALID_SOCKET);
 	
 	BOOL bcast = TRUE;
 	assert(setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (void*)(&bcast), sizeof(bcast)) == 0);
 	
-	run_test(sock, &send_addr, 16,   send_count, min_send_interval);
-	run_test(sock, &send_addr, 32,   send_count, min_send_interval);
-	run_test(sock, &send_addr, 64,   send_count, min_send_interval);
-	run_test(sock, &send_addr, 128,  send_count, min_send_interval);
-	run_test(sock, &send_addr, 256,  send_count, min_send_interval);
-	run_test(sock, &send_addr, 512,  send_count, min_send_interval);
-	run_test(sock, &send_addr, 1024, send_count, min_send_interval);
+	assert(bind(sock, (struct sockaddr*)(bind_addr), sizeof(*bind_addr)) == 0);
+	
+	return sock;
+}
+
+/* Run the load or flood benchmarks. */
+static void run_load(unsigned int n_threads, unsigned int socks_per_thread, unsigned int rate)
+{
+	sender_t *senders = calloc(n_threads, sizeof(sender_t));
+	assert(senders != NULL);
+	
+	/* Bind each socket to a random socket number on the network we are
+	 * sending to.
+	*/
+	
+	struct sockaddr_ipx bind_addr;
+	memset(&bind_addr, 0, sizeof(bind_addr));
+	
+	bind_addr.sa_family = AF_IPX;
+	memcpy(bind_addr.sa_netnum, dest_addr.sa_netnum, sizeof(bind_addr.sa_netnum));
+	
+	for(unsigned int t = 0; t < n_threads; ++t)
+	{
+		sender_t *sender = &(senders[t]);
+		
+		sender->n_socks      = socks_per_thread;
+		sender->first_stream = t * socks_per_thread;
+		
+		sender->send_interval = rate > 0
+			? ((double)(1000000) * n_threads) / rate
+			: 0;
+		
+		for(unsigned int i = 0; i < socks_per_thread; ++i)
+		{
+			sender->socks[i] = open_bench_socket(&bind_addr);
+			
+			u_long nonblock = 1;
+			assert(ioctlsocket(sender->socks[i], FIONBIO, &nonblock) == 0);
+		}
+	}
+	
+	/* Give every thread time to start before any of them send. */
+	load_start = get_ticks_us() + 100000;
+	
+	for(unsigned int t = 0; t < n_threads; ++t)
+	{
+		senders[t].thread = CreateThread(NULL, 0, &sender_main, &(senders[t]), 0, NULL);
+		assert(senders[t].thread != NULL);
+	}
+	
+	histogram_t *rtt = calloc(1, sizeof(histogram_t));
+	assert(rtt != NULL);
+	
+	uint64_t sent_packets = 0, send_errors = 0, recv_packets = 0;
+	uint64_t send_ended_at = load_start;
+	
+	for(unsigned int t = 0; t < n_threads; ++t)
+	{
+		sender_t *sender = &(senders[t]);
+		
+		WaitForSingleObject(sender->thread, INFINITE);
+		CloseHandle(sender->thread);
+		
+		sent_packets += sender->sent_packets;
+		send_errors  += sender->send_errors;
+		recv_packets += sender->recv_packets;
+		
+		if(sender->send_ended_at > send_ended_at)
+		{
+			send_ended_at = sender->send_ended_at;
+		}
+		
+		hist_merge(rtt, &(sender->rtt));
+		
+		for(unsigned int i = 0; i < sender->n_socks; ++i)
+		{
+			closesocket(sender->socks[i]);
+		}
+	}
+	
+	if(mode == MODE_LOAD && recv_packets == 0)
+	{
+		fprintf(stderr, "Received no replies, is echo running?\n");
+		exit(1);
+	}
+	
+	double send_time = (double)(send_ended_at - load_start) / 1000000;
+	
+	write_load_result(n_threads, socks_per_thread, rate,
+		sent_packets, send_errors, send_time,
+		recv_packets, send_time,
+		(mode == MODE_LOAD ? rtt : NULL));
+	
+	free(rtt);
+	free(senders);
+}
+
+static DWORD WINAPI getchar_thread_main(LPVOID lpParameter)
+{
+	getchar();
+	return 0;
+}
+
+typedef struct sink_stream
+{
+	uint32_t received;
+	
+	/* One past the highest sequence number seen. */
+	uint32_t next_seq;
+	
+	/* Number of packets sent, from the end marker. */
+	bool ended;
+	uint32_t sent;
+} sink_stream_t;
+
+/* Receive the packets sent by a flood. */
+static void run_sink(const struct sockaddr_ipx *bind_addr)
+{
+	SOCKET sock = open_bench_socket(bind_addr);
+	
+	sink_stream_t *streams = calloc(SINK_MAX_STREAMS, sizeof(sink_stream_t));
+	assert(streams != NULL);
+	
+	unsigned char *buf = malloc(MAX_PAYLOAD_SIZE);
+	assert(buf != NULL);
+	
+	HANDLE getchar_thread = CreateThread(NULL, 0, &getchar_thread_main, NULL, 0, NULL);
+	assert(getchar_thread != NULL);
+	
+	printf("Ready\n");
+	fflush(stdout);
 	
-	printf("%s", deferred_output);
+	unsigned int n_streams = 0, n_ended = 0;
+	
+	uint64_t recv_packets = 0;
+	uint64_t first_recv = 0, last_recv = 0;
+	
+	while(n_streams == 0 || n_ended < n_streams)
+	{
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(sock, &read_fds);
+		
+		struct timeval tv = {
+			.tv_sec  = 0,
+			.tv_usec = 100000, /* 1/10th sec */
+		};
+		
+		assert(select(0, &read_fds, NULL, NULL, &tv) >= 0);
+		
+		uint64_t now = get_ticks_us();
+		
+		if(WaitForSingleObject(getchar_thread, 0) == WAIT_OBJECT_0
+			|| (n_streams > 0 && (now - last_recv) >= SINK_IDLE_TIMEOUT))
+		{
+			break;
+		}
+		
+		if(!FD_ISSET(sock, &read_fds))
+		{
+			continue;
+		}
+		
+		int size = recv(sock, (char*)(buf), MAX_PAYLOAD_SIZE, 0);
+		if(size < (int)(sizeof(load_header_t)))
+		{
+			continue;
+		}
+		
+		load_header_t *header = (load_header_t*)(buf);
+		
+		if(header->stream >= SINK_MAX_STREAMS || (header->magic != LOAD_MAGIC && header->magic != END_MAGIC))
+		{
+			continue;
+		}
+		
+		sink_stream_t *stream = &(streams[header->stream]);
+		
+		if(stream->received == 0 && !stream->ended)
+		{
+			++n_streams;
+		}
+		
+		if(header->magic == END_MAGIC)
+		{
+			if(!stream->ended)
+			{
+				stream->ended = true;
+				stream->sent  = header->seq;
+				
+				++n_ended;
+			}
+			
+			continue;
+		}
+		
+		if(recv_packets == 0)
+		{
+			first_recv = now;
+			payload_size = size;
+		}
+		
+		last_recv = now;
+		
+		++(stream->received);
+		++recv_packets;
+		
+		if(header->seq >= stream->next_seq)
+		{
+			stream->next_seq = header->seq + 1;
+		}
+	}
+	
+	/* Packets after the last one received from a stream which didn't
+	 * finish can't be counted as lost.
+	*/
+	
+	uint64_t sent_packets = 0;
+	
+	for(unsigned int i = 0; i < SINK_MAX_STREAMS; ++i)
+	{
+		sent_packets += streams[i].ended
+			? streams[i].sent
+			: streams[i].next_seq;
+	}
+	
+	double recv_time = (last_recv > first_recv)
+		? (double)(last_recv - first_recv) / 1000000
+		: 1;
+	
+	write_load_result(0, n_streams, 0,
+		sent_packets, 0, 0,
+		recv_packets, recv_time,
+		NULL);
+	
+	CloseHandle(getchar_thread);
+	
+	free(buf);
+	free(streams);
 	
 	closesocket(sock);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-f gnuplot|csv|json] <network number> <node number> <socket number> \\\n", argv0);
+	fprintf(stderr, "          <packet count> <min send interval (µs)>\n");
+	fprintf(stderr, "       %s -m load|flood [-f gnuplot|csv|json] [-t <threads>] [-s <sockets per thread>] \\\n", argv0);
+	fprintf(stderr, "          [-r <packets per second>] [-d <duration (ms)>] [-p <payload size>] \\\n");
+	fprintf(stderr, "          <network number> <node number> <socket number>\n");
+	fprintf(stderr, "       %s -m sink [-f gnuplot|csv|json] <network number> <node number> <socket number>\n", argv0);
+	
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	setbuf(stderr, NULL);
+	
+	unsigned int n_threads = 1;
+	unsigned int socks_per_thread = 1;
+	unsigned int rate = 1000;
+	
+	int i = 1;
+	
+	for(; i < argc && argv[i][0] == '-'; ++i)
+	{
+		if(strcmp(argv[i], "-m") == 0 && (i + 1) < argc)
+		{
+			const char *m = argv[++i];
+			
+			if(strcmp(m, "pingpong") == 0)
+				mode = MODE_PINGPONG;
+			else if(strcmp(m, "load") == 0)
+				mode = MODE_LOAD;
+			else if(strcmp(m, "flood") == 0)
+				mode = MODE_FLOOD;
+			else if(strcmp(m, "sink") == 0)
+				mode = MODE_SINK;
+			else
+				usage(argv[0]);
+		}
+		else if(strcmp(argv[i], "-f") == 0 && (i + 1) < argc)
+		{
+			const char *f = argv[++i];
+			
+			if(strcmp(f, "gnuplot") == 0)
+				format = FORMAT_GNUPLOT;
+			else if(strcmp(f, "csv") == 0)
+				format = FORMAT_CSV;
+			else if(strcmp(f, "json") == 0)
+				format = FORMAT_JSON;
+			else
+				usage(argv[0]);
+		}
+		else if(strcmp(argv[i], "-t") == 0 && (i + 1) < argc)
+		{
+			n_threads = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-s") == 0 && (i + 1) < argc)
+		{
+			socks_per_thread = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-r") == 0 && (i + 1) < argc)
+		{
+			rate = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-d") == 0 && (i + 1) < argc)
+		{
+			duration_ms = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-p") == 0 && (i + 1) < argc)
+		{
+			payload_size = atoi(argv[++i]);
+		}
+		else{
+			usage(argv[0]);
+		}
+	}
+	
+	if((argc - i) != (mode == MODE_PINGPONG ? 5 : 3)
+		|| n_threads < 1 || n_threads > 1024
+		|| socks_per_thread < 1 || socks_per_thread > FD_SETSIZE
+		|| (n_threads * socks_per_thread) > SINK_MAX_STREAMS
+		|| (rate == 0 && mode == MODE_LOAD)
+		|| payload_size < sizeof(load_header_t) || payload_size > MAX_PAYLOAD_SIZE)
+	{
+		usage(argv[0]);
+	}
+	
+	dest_addr = read_sockaddr(argv[i], argv[i + 1], argv[i + 2]);
+	
+	{
+		LARGE_INTEGER pc_freq;
+		QueryPerformanceFrequency(&pc_freq);
+		
+		PC_FREQUENCY = pc_freq.QuadPart;
+	}
+	
+	{
+		WSADATA wsaData;
+		assert(WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+	}
+	
+	if(mode == MODE_PINGPONG)
+	{
+		unsigned int send_count        = strtoul(argv[i + 3], NULL, 10);
+		unsigned int min_send_interval = strtoul(argv[i + 4], NULL, 10);
+		
+		int sock = socket(AF_IPX, SOCK_DGRAM, NSPROTO_IPX);
+		assert(sock != -1);
+		
+		BOOL bcast = TRUE;
+		assert(setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (void*)(&bcast), sizeof(bcast)) == 0);
+		
+		run_test(sock, &dest_addr, 16,   send_count, min_send_interval);
+		run_test(sock, &dest_addr, 32,   send_count, min_send_interval);
+		run_test(sock, &dest_addr, 64,   send_count, min_send_interval);
+		run_test(sock, &dest_addr, 128,  send_count, min_send_interval);
+		run_test(sock, &dest_addr, 256,  send_count, min_send_interval);
+		run_test(sock, &dest_addr, 512,  send_count, min_send_interval);
+		run_test(sock, &dest_addr, 1024, send_count, min_send_interval);
+		
+		printf("%s", deferred_output);
+		
+		closesocket(sock);
+	}
+	else if(mode == MODE_SINK)
+	{
+		run_sink(&dest_addr);
+	}
+	else{
+		run_load(n_threads, socks_per_thread, rate);
+	}
+	
+	finish_output();
 	
 	WSACleanup();
 	
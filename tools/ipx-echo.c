@@ -26,8 +26,17 @@
 
 #include "tools.h"
 
+static DWORD WINAPI getchar_thread_main(LPVOID lpParameter)
+{
+	getchar();
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
+	setbuf(stdout, NULL);
+	setbuf(stderr, NULL);
+	
 	if(argc != 4)
 	{
 		fprintf(stderr, "Usage: %s <network number> <node number> <socket number>\n", argv[0]);
@@ -49,8 +58,48 @@ int main(int argc, char **argv)
 	
 	assert(bind(sock, (struct sockaddr*)(&bind_addr), sizeof(bind_addr)) == 0);
 	
+	/* Print the address we actually got, the test suite needs it to send to
+	 * us when we are bound to a wildcard address.
+	*/
+	
+	int addrlen = sizeof(bind_addr);
+	assert(getsockname(sock, (struct sockaddr*)(&bind_addr), &addrlen) == 0);
+	
+	char formatted_addr[IPX_SADDR_SIZE];
+	ipx_to_string(formatted_addr,
+		addr32_in(bind_addr.sa_netnum), addr48_in(bind_addr.sa_nodenum), bind_addr.sa_socket);
+	
+	printf("Bound to local address: %s\n", formatted_addr);
+	
+	HANDLE getchar_thread = CreateThread(NULL, 0, &getchar_thread_main, NULL, 0, NULL);
+	assert(getchar_thread != NULL);
+	
+	printf("Ready\n");
+	
 	while(1)
 	{
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(sock, &read_fds);
+		
+		struct timeval timeout = {
+			.tv_sec = 0,
+			.tv_usec = 100000, /* 1/10th sec */
+		};
+		
+		assert(select(1, &read_fds, NULL, NULL, &timeout) >= 0);
+		
+		if(WaitForSingleObject(getchar_thread, 0) == WAIT_OBJECT_0)
+		{
+			/* Input is available on stdin, time to exit. */
+			break;
+		}
+		
+		if(!FD_ISSET(sock, &read_fds))
+		{
+			continue;
+		}
+		
 		char buf[65536]; /* Windows default stack limit is 1MB */
 		
 		struct sockaddr_ipx addr;
@@ -63,6 +112,8 @@ int main(int argc, char **argv)
 		}
 	}
 	
+	CloseHandle(getchar_thread);
+	
 	closesocket(sock);
 	
 	WSACleanup();
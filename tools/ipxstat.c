@@ -0,0 +1,430 @@
+/* IPXWrapper - Live statistics viewer
+ * Copyright (C) 2026 Daniel Collins <solemnwarning@solemnwarning.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Attaches to the statistics published by a process using IPXWrapper with the
+ * "stats export" option enabled (see statsmem.h) and displays them every
+ * interval until the process exits.
+ *
+ * By default the console is redrawn with the current rates, socket queues and
+ * function timings each time. With -c, a line of comma-separated values is
+ * written for each sample instead, holding the time since the first sample
+ * (in seconds) and the counters as they were at the time. The first line names
+ * the columns.
+*/
+
+#include <windows.h>
+#include <tlhelp32.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "addr.h"
+#include "common.h"
+#include "funcprof.h"
+#include "statsmem.h"
+
+/* How long to wait for the process to start and publish its statistics. */
+#define ATTACH_TIMEOUT 10000
+
+/* The copies of the block are too big to put on the stack. */
+static struct ipx_stats_block first, samples[2];
+
+/* Need to implement log_printf() for funcprof.c */
+
+void log_printf(enum ipx_log_level level, const char *fmt, ...)
+{
+	va_list argv;
+	
+	va_start(argv, fmt);
+	vfprintf(stderr, fmt, argv);
+	va_end(argv);
+	
+	fprintf(stderr, "\n");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-c] [-i <interval ms>] [-n <count>] <process ID | executable name>\n", argv0);
+	exit(1);
+}
+
+/* Find the ID of a running process by the name of its executable. */
+static DWORD find_process(const char *exe_name)
+{
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if(snapshot == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+	
+	DWORD pid = 0;
+	
+	PROCESSENTRY32 pe;
+	pe.dwSize = sizeof(pe);
+	
+	for(BOOL more = Process32First(snapshot, &pe); more && pid == 0; more = Process32Next(snapshot, &pe))
+	{
+		if(_stricmp(pe.szExeFile, exe_name) == 0)
+		{
+			pid = pe.th32ProcessID;
+		}
+	}
+	
+	CloseHandle(snapshot);
+	
+	return pid;
+}
+
+/* Copy a consistent snapshot of the block, see statsmem.h. */
+static void read_block(const struct ipx_stats_block *block, struct ipx_stats_block *out)
+{
+	while(1)
+	{
+		uint32_t sequence = __atomic_load_n(&(block->sequence), __ATOMIC_ACQUIRE);
+		
+		if((sequence % 2) == 0)
+		{
+			memcpy(out, block, sizeof(*out));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			
+			if(__atomic_load_n(&(block->sequence), __ATOMIC_RELAXED) == sequence)
+			{
+				return;
+			}
+		}
+		
+		Sleep(1);
+	}
+}
+
+static void print_csv_header(void)
+{
+	printf("time,send_packets,send_bytes,recv_packets,recv_bytes,"
+		"send_packets_udp,send_bytes_udp,recv_packets_udp,recv_bytes_udp,"
+		"addr_cache_hits,addr_cache_misses,"
+		"coalesce_table_hits,coalesce_table_misses,coalesce_table_evictions,"
+		"coalesce_dests,coalesce_active,coalesce_pending,"
+		"slab_reserved,slab_used,sockets,recv_queued,send_queued\n");
+}
+
+static void print_csv(const struct ipx_stats_block *first, const struct ipx_stats_block *now)
+{
+	const struct ipx_stats_counters *c = &(now->counters);
+	
+	unsigned int recv_queued = 0, send_queued = 0;
+	
+	for(unsigned int i = 0; i < now->n_sockets; ++i)
+	{
+		recv_queued += now->sockets[i].recv_queued;
+		send_queued += now->sockets[i].send_queued;
+	}
+	
+	printf("%.3f,"
+		"%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ","
+		"%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ","
+		"%" PRIu64 ",%" PRIu64 ","
+		"%" PRIu64 ",%" PRIu64 ",%" PRIu64 ","
+		"%u,%u,%u,%u,%u,%u,%u,%u\n",
+		((double)(now->updated_at - first->updated_at) / now->perf_freq),
+		c->send_packets, c->send_bytes, c->recv_packets, c->recv_bytes,
+		c->send_packets_udp, c->send_bytes_udp, c->recv_packets_udp, c->recv_bytes_udp,
+		c->addr_cache_hits, c->addr_cache_misses,
+		c->coalesce_table_hits, c->coalesce_table_misses, c->coalesce_table_evictions,
+		(unsigned)(c->coalesce_dests), (unsigned)(c->coalesce_active), (unsigned)(c->coalesce_pending),
+		(unsigned)(c->slab_reserved), (unsigned)(c->slab_used),
+		(unsigned)(now->n_sockets), recv_queued, send_queued);
+}
+
+static void clear_console(void)
+{
+	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+	
+	CONSOLE_SCREEN_BUFFER_INFO info;
+	if(!GetConsoleScreenBufferInfo(console, &info))
+	{
+		/* Not a console, just separate the samples. */
+		printf("\n");
+		return;
+	}
+	
+	COORD home = { 0, 0 };
+	DWORD size = info.dwSize.X * info.dwSize.Y, written;
+	
+	FillConsoleOutputCharacter(console, ' ', size, home, &written);
+	FillConsoleOutputAttribute(console, info.wAttributes, size, home, &written);
+	SetConsoleCursorPosition(console, home);
+}
+
+static void print_rate(const char *label, uint64_t then_packets, uint64_t now_packets, uint64_t then_bytes, uint64_t now_bytes, double seconds)
+{
+	printf("%-16s %12.0f %14.0f %16" PRIu64 " %18" PRIu64 "\n",
+		label,
+		((now_packets - then_packets) / seconds),
+		((now_bytes - then_bytes) / seconds),
+		now_packets,
+		now_bytes);
+}
+
+static void print_view(const struct ipx_stats_block *then, const struct ipx_stats_block *now)
+{
+	const struct ipx_stats_counters *tc = &(then->counters);
+	const struct ipx_stats_counters *nc = &(now->counters);
+	
+	double seconds = (double)(now->updated_at - then->updated_at) / now->perf_freq;
+	if(seconds <= 0)
+	{
+		seconds = 1;
+	}
+	
+	double ticks_per_usec = now->perf_freq / 1000000.0;
+	
+	clear_console();
+	
+	printf("IPXWrapper statistics for process %u\n\n", (unsigned)(now->pid));
+	
+	printf("%-16s %12s %14s %16s %18s\n", "", "Packets/s", "Bytes/s", "Packets", "Bytes");
+	print_rate("IPX sent",     tc->send_packets,     nc->send_packets,     tc->send_bytes,     nc->send_bytes,     seconds);
+	print_rate("IPX received", tc->recv_packets,     nc->recv_packets,     tc->recv_bytes,     nc->recv_bytes,     seconds);
+	print_rate("UDP sent",     tc->send_packets_udp, nc->send_packets_udp, tc->send_bytes_udp, nc->send_bytes_udp, seconds);
+	print_rate("UDP received", tc->recv_packets_udp, nc->recv_packets_udp, tc->recv_bytes_udp, nc->recv_bytes_udp, seconds);
+	
+	uint64_t cache_lookups = nc->addr_cache_hits + nc->addr_cache_misses;
+	
+	printf("\nAddress cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate)\n",
+		nc->addr_cache_hits, nc->addr_cache_misses,
+		(cache_lookups > 0 ? (100.0 * nc->addr_cache_hits / cache_lookups) : 0.0));
+	
+	printf("Coalescing: %u destinations, %u active, %u waiting to send\n",
+		(unsigned)(nc->coalesce_dests), (unsigned)(nc->coalesce_active), (unsigned)(nc->coalesce_pending));
+	
+	printf("Coalescing table: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+		nc->coalesce_table_hits, nc->coalesce_table_misses, nc->coalesce_table_evictions);
+	
+	printf("Packet buffers: %u of %u bytes used\n",
+		(unsigned)(nc->slab_used), (unsigned)(nc->slab_reserved));
+	
+	printf("\n%-8s %-36s %-6s %12s %10s\n", "Socket", "Address", "Type", "Recv queue", "Send queue");
+	
+	for(unsigned int i = 0; i < now->n_sockets; ++i)
+	{
+		const struct ipx_stats_socket *s = &(now->sockets[i]);
+		
+		char addr[IPX_SADDR_SIZE] = "(unbound)";
+		if(s->flags & STATSMEM_SOCKET_BOUND)
+		{
+			ipx_to_string(addr, addr32_in(s->net), addr48_in(s->node), s->socket);
+		}
+		
+		char recv_queue[32] = "-";
+		if(s->recv_queue_depth > 0)
+		{
+			snprintf(recv_queue, sizeof(recv_queue), "%u/%u", (unsigned)(s->recv_queued), (unsigned)(s->recv_queue_depth));
+		}
+		
+		const char *type = "IPX";
+		if(s->flags & STATSMEM_SOCKET_LISTENING)
+		{
+			type = "SPX-L";
+		}
+		else if(s->flags & STATSMEM_SOCKET_CONNECTED)
+		{
+			type = (s->flags & STATSMEM_SOCKET_SPX) ? "SPX-C" : "IPX-C";
+		}
+		else if(s->flags & STATSMEM_SOCKET_SPX)
+		{
+			type = "SPX";
+		}
+		
+		printf("%-8u %-36s %-6s %12s %10u\n",
+			(unsigned)(s->fd), addr, type, recv_queue, (unsigned)(s->send_queued));
+	}
+	
+	if(now->n_funcs == 0)
+	{
+		printf("\nFunction timings are only available when profiling is enabled.\n");
+		return;
+	}
+	
+	printf("\n%-40s %10s %10s %10s %10s %10s\n", "Function", "Calls/s", "Avg us", "p50 us", "p99 us", "Max us");
+	
+	for(unsigned int i = 0; i < now->n_funcs; ++i)
+	{
+		const struct ipx_stats_func *f = &(now->funcs[i]);
+		
+		/* The functions are always published in the same order. */
+		const struct fprof_shard *base = i < then->n_funcs ? &(then->funcs[i].totals) : NULL;
+		
+		struct fprof_summary s;
+		fprof_summarise(&(f->totals), base, &s);
+		
+		if(s.n_calls == 0)
+		{
+			continue;
+		}
+		
+		char name[80];
+		snprintf(name, sizeof(name), "%s:%s", f->dll_name, f->func_name);
+		
+		printf("%-40s %10.0f %10.2f %10.2f %10.2f %10.2f\n",
+			name,
+			(s.n_calls / seconds),
+			(((double)(s.total_time) / s.n_calls) / ticks_per_usec),
+			(s.p50 / ticks_per_usec),
+			(s.p99 / ticks_per_usec),
+			(s.max_time / ticks_per_usec));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	setbuf(stdout, NULL);
+	setbuf(stderr, NULL);
+	
+	bool csv = false;
+	int interval = 1000;
+	int count = -1;
+	
+	int i = 1;
+	for(; i < argc && argv[i][0] == '-'; ++i)
+	{
+		if(strcmp(argv[i], "-c") == 0)
+		{
+			csv = true;
+		}
+		else if(strcmp(argv[i], "-i") == 0 && (i + 1) < argc)
+		{
+			interval = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-n") == 0 && (i + 1) < argc)
+		{
+			count = atoi(argv[++i]);
+		}
+		else{
+			usage(argv[0]);
+		}
+	}
+	
+	if((argc - i) != 1 || interval <= 0)
+	{
+		usage(argv[0]);
+	}
+	
+	const char *target = argv[i];
+	
+	char *endptr;
+	DWORD pid = strtoul(target, &endptr, 10);
+	
+	DWORD give_up_at = GetTickCount() + ATTACH_TIMEOUT;
+	
+	if(*endptr != '\0')
+	{
+		while((pid = find_process(target)) == 0)
+		{
+			if((int)(GetTickCount() - give_up_at) >= 0)
+			{
+				fprintf(stderr, "No process named %s is running\n", target);
+				return 1;
+			}
+			
+			Sleep(100);
+		}
+	}
+	
+	char name[64];
+	snprintf(name, sizeof(name), STATSMEM_NAME_FMT, (unsigned)(pid));
+	
+	HANDLE mapping;
+	while((mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name)) == NULL)
+	{
+		if((int)(GetTickCount() - give_up_at) >= 0)
+		{
+			fprintf(stderr, "Unable to open %s: %s\n", name, w32_error(GetLastError()));
+			fprintf(stderr, "Is \"stats export\" enabled for process %u?\n", (unsigned)(pid));
+			return 1;
+		}
+		
+		Sleep(100);
+	}
+	
+	const struct ipx_stats_block *block = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(block == NULL)
+	{
+		fprintf(stderr, "Unable to map %s: %s\n", name, w32_error(GetLastError()));
+		return 1;
+	}
+	
+	if(__atomic_load_n(&(block->magic), __ATOMIC_ACQUIRE) != STATSMEM_MAGIC
+		|| block->version != STATSMEM_VERSION
+		|| block->size != sizeof(struct ipx_stats_block))
+	{
+		fprintf(stderr, "Process %u is using an incompatible version of IPXWrapper\n", (unsigned)(pid));
+		return 1;
+	}
+	
+	/* Used to stop when the process exits, we can carry on without it. */
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	
+	read_block(block, &first);
+	samples[0] = first;
+	
+	if(csv)
+	{
+		print_csv_header();
+	}
+	
+	for(int n = 0, cur = 0; count < 0 || n < count; ++n)
+	{
+		if(n > 0)
+		{
+			if(process != NULL)
+			{
+				if(WaitForSingleObject(process, interval) == WAIT_OBJECT_0)
+				{
+					break;
+				}
+			}
+			else{
+				Sleep(interval);
+			}
+			
+			cur = !cur;
+			read_block(block, &(samples[cur]));
+		}
+		
+		if(csv)
+		{
+			print_csv(&first, &(samples[cur]));
+		}
+		else{
+			/* The first view has nothing to work out rates from. */
+			print_view(&(samples[n > 0 ? !cur : cur]), &(samples[cur]));
+		}
+	}
+	
+	if(process != NULL)
+	{
+		CloseHandle(process);
+	}
+	
+	UnmapViewOfFile(block);
+	CloseHandle(mapping);
+	
+	return 0;
+}
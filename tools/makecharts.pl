@@ -18,15 +18,68 @@
 use strict;
 use warnings;
 
-unless(@ARGV && ((scalar @ARGV) % 2) == 0)
+# With -s, charts how performance scales with the number of threads, sockets,
+# offered load or payload size, using the output of one or more runs of
+# ipx-bench -f csv appended together in each file.
+my %SCALING_AXES = (
+	threads             => "Sender threads",
+	sockets             => "Sockets per thread",
+	offered_packets_sec => "Offered load (packets/sec)",
+	payload_size        => "Payload size (bytes)",
+);
+
+my $scaling_axis;
+
+if(@ARGV && $ARGV[0] eq "-s")
+{
+	shift(@ARGV);
+	$scaling_axis = "threads";
+	
+	if(@ARGV >= 2 && $ARGV[0] eq "-x")
+	{
+		(undef, $scaling_axis) = splice(@ARGV, 0, 2);
+	}
+}
+
+unless(@ARGV && ((scalar @ARGV) % 2) == 0 && (!defined($scaling_axis) || defined($SCALING_AXES{$scaling_axis})))
 {
 	print STDERR "Usage: $0 <file> <title> <file> <title> ...\n";
+	print STDERR "       $0 -s [-x threads|sockets|offered_packets_sec|payload_size] <file> <title> ...\n";
 	exit(42); # EX_USAGE
 }
 
 open(my $gnuplot, "|-", "gnuplot")
 	or die "Can't exec gnuplot: $!";
 
+if(defined $scaling_axis)
+{
+	print {$gnuplot} <<EOF;
+set terminal png size 1024,1024 enhanced font "Helvetica,20"
+
+set xlabel "$SCALING_AXES{$scaling_axis}"
+
+set offset 0.1, 0.1, 0, 0
+set key above title "Legend" box 3
+EOF
+	
+	my @series;
+	
+	for(my $i = 0; $i < (scalar @ARGV) / 2; ++$i)
+	{
+		push(@series, [ $ARGV[$i * 2 + 1], read_csv($ARGV[$i * 2]) ]);
+	}
+	
+	do_scaling_chart("scaling-send.png",       "Send rate (packets/sec)",         "sent_packets_sec", 1,    @series);
+	do_scaling_chart("scaling-recv.png",       "Receive rate (packets/sec)",      "recv_packets_sec", 1,    @series);
+	do_scaling_chart("scaling-throughput.png", "Throughput (kB/s)",               "recv_bytes_sec",   1000, @series);
+	do_scaling_chart("scaling-loss.png",       "Packet loss (\%)",                "loss_percent",     1,    @series);
+	do_scaling_chart("scaling-rtt-p50.png",    "50th percentile round trip (ms)", "p50_rtt_us",       1000, @series);
+	do_scaling_chart("scaling-rtt-p99.png",    "99th percentile round trip (ms)", "p99_rtt_us",       1000, @series);
+	
+	close($gnuplot);
+	exit($?);
+}
+
 print {$gnuplot} <<EOF;
 set terminal png size 1024,1024 enhanced font "Helvetica,20"
 
@@ -43,6 +96,7 @@ do_chart("sendto.png",     "sendto() call duration (µs)", "9",             "2")
 do_chart("recv.png",       "recv() call duration (µs)",   "10",            "3");
 do_chart("loss.png",       "Packet loss (\%)",            "7");
 do_chart("throughput.png", "Throughput (kB/s)",           "(\$8 / 1000)");
+do_chart("rtt-p99.png",    "99th percentile round trip time (ms)", "(\$13 / 1000)");
 
 close($gnuplot);
 exit($?);
@@ -71,3 +125,67 @@ sub do_chart
 	
 	print {$gnuplot} "\n";
 }
+
+# Returns the records from a CSV file written by ipx-bench as a list of hashes.
+# A header line is written at the start of each run's output, so each one
+# found replaces the column names used for the lines after it.
+sub read_csv
+{
+	my ($file) = @_;
+	
+	open(my $fh, "<", $file)
+		or die "Can't open $file: $!";
+	
+	my @columns;
+	my @records;
+	
+	while(defined(my $line = <$fh>))
+	{
+		$line =~ s/\r?\n$//;
+		next if($line eq "");
+		
+		if($line =~ m/^[a-z_,0-9]+$/ && $line =~ m/[a-z]/)
+		{
+			@columns = split(m/,/, $line);
+			next;
+		}
+		
+		die "$file: data found before header line\n" unless(@columns);
+		
+		my %record;
+		@record{@columns} = split(m/,/, $line, -1);
+		
+		push(@records, \%record);
+	}
+	
+	return \@records;
+}
+
+sub do_scaling_chart
+{
+	my ($output, $ylabel, $column, $divisor, @series) = @_;
+	
+	print {$gnuplot} "set output '$output'\n";
+	print {$gnuplot} "set ylabel '$ylabel'\n";
+	print {$gnuplot} "plot ";
+	
+	for(my $i = 0; $i < (scalar @series); ++$i)
+	{
+		print {$gnuplot} ", " if($i > 0);
+		print {$gnuplot} "'-' using 1:2 title '$series[$i]->[0]' with linespoints linecolor $i";
+	}
+	
+	print {$gnuplot} "\n";
+	
+	# Inline data for each series follows the plot command, in the same
+	# order, each terminated by a line containing "e".
+	foreach my $s (@series)
+	{
+		my @points = sort { $a->[0] <=> $b->[0] }
+			map { [ $_->{$scaling_axis}, ($_->{$column} / $divisor) ] }
+			grep { ($_->{$scaling_axis} // "") ne "" && ($_->{$column} // "") ne "" } @{ $s->[1] };
+		
+		print {$gnuplot} "$_->[0] $_->[1]\n" foreach(@points);
+		print {$gnuplot} "e\n";
+	}
+}